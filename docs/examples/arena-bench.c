@@ -0,0 +1,111 @@
+/*
+Allocation benchmark: rendering pages with and without an arena.
+
+This renders the first few pages of a document twice; once as normal,
+and once with the interpreter taking its paths from an arena for each
+page (see fz_set_page_arenas). It uses a counting allocator to show
+how many calls are made to the allocator in each case, which is where
+the time goes when that allocator is a locked malloc shared by many
+threads.
+
+To build this example in a source tree and run it, run:
+make examples
+./build/debug/arena-bench document.pdf [pages]
+*/
+
+#include <mupdf/fitz.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct
+{
+	size_t mallocs;
+	size_t reallocs;
+	size_t frees;
+} counts;
+
+static void *
+count_malloc(void *user, size_t size)
+{
+	((counts *) user)->mallocs++;
+	return malloc(size);
+}
+
+static void *
+count_realloc(void *user, void *old, size_t size)
+{
+	((counts *) user)->reallocs++;
+	return realloc(old, size);
+}
+
+static void
+count_free(void *user, void *ptr)
+{
+	if (ptr)
+		((counts *) user)->frees++;
+	free(ptr);
+}
+
+static void
+render_pages(fz_context *ctx, fz_document *doc, int pages)
+{
+	int i;
+
+	for (i = 0; i < pages; i++)
+	{
+		fz_pixmap *pix = NULL;
+
+		fz_try(ctx)
+			pix = fz_new_pixmap_from_page_number(ctx, doc, i, fz_identity, fz_device_rgb(ctx), 0);
+		fz_always(ctx)
+			fz_drop_pixmap(ctx, pix);
+		fz_catch(ctx)
+			fprintf(stderr, "render failed: %s\n", fz_caught_message(ctx));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	char *filename = argc >= 2 ? argv[1] : "";
+	int pages = argc >= 3 ? atoi(argv[2]) : 10;
+	counts count = { 0 };
+	fz_alloc_context alloc = { &count, count_malloc, count_realloc, count_free };
+	fz_context *ctx;
+	fz_document *doc;
+	int pass;
+
+	ctx = fz_new_context(&alloc, NULL, FZ_STORE_DEFAULT);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create mupdf context\n");
+		return EXIT_FAILURE;
+	}
+
+	fz_register_document_handlers(ctx);
+	doc = fz_open_document(ctx, filename);
+
+	if (pages > fz_count_pages(ctx, doc))
+		pages = fz_count_pages(ctx, doc);
+
+	/* Render once untimed, so that fonts, images and the like are
+	 * already loaded and held in the store for both passes. */
+	render_pages(ctx, doc, pages);
+
+	for (pass = 0; pass < 2; pass++)
+	{
+		counts before = count;
+		fz_set_page_arenas(ctx, pass);
+		render_pages(ctx, doc, pages);
+		printf("%s: %zu mallocs, %zu reallocs, %zu frees for %d pages\n",
+			pass ? "with arena" : "without arena",
+			count.mallocs - before.mallocs,
+			count.reallocs - before.reallocs,
+			count.frees - before.frees,
+			pages);
+	}
+
+	fz_drop_document(ctx, doc);
+	fz_drop_context(ctx);
+
+	return EXIT_SUCCESS;
+}
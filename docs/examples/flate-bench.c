@@ -0,0 +1,109 @@
+/*
+Inflate benchmark: the streaming flate filter against fz_new_inflated_buffer.
+
+This deflates the contents of a file (or, with no file, some generated
+text) and then inflates it over and over again; once through
+fz_open_flated and fz_read_best, as a FlateDecode stream used to be
+loaded, and once with fz_new_inflated_buffer, as pdf_load_stream now
+loads a stream whose only filter is FlateDecode. The second includes
+copying the compressed data into a buffer first, as loading the raw
+stream does. It prints the time taken for each.
+
+To build this example in a source tree and run it, run:
+make examples
+./build/debug/flate-bench [file] [repeats]
+*/
+
+#include <mupdf/fitz.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static fz_buffer *
+generate(fz_context *ctx)
+{
+	static const char *words[] = {
+		"lorem", "ipsum", "dolor", "sit", "amet", "consectetur",
+		"adipiscing", "elit", "sed", "do", "eiusmod", "tempor",
+	};
+	fz_buffer *buf = fz_new_buffer(ctx, 16 << 20);
+	unsigned int seed = 1;
+	int i;
+
+	for (i = 0; i < 1000000; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		fz_append_printf(ctx, buf, "%s %d %d Td (%s) Tj\n",
+			(seed >> 20) & 1 ? "BT" : "ET", (seed >> 8) & 511, (seed >> 12) & 767,
+			words[(seed >> 16) % nelem(words)]);
+	}
+	return buf;
+}
+
+int main(int argc, char **argv)
+{
+	char *filename = argc >= 2 ? argv[1] : NULL;
+	int repeats = argc >= 3 ? atoi(argv[2]) : 20;
+	fz_buffer *input, *raw, *buf;
+	unsigned char *data;
+	size_t len, total;
+	fz_context *ctx;
+	fz_stream *mem, *stm;
+	double start;
+	int i;
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create mupdf context\n");
+		return EXIT_FAILURE;
+	}
+
+	if (filename)
+		input = fz_read_file(ctx, filename);
+	else
+		input = generate(ctx);
+	data = fz_new_deflated_data_from_buffer(ctx, &len, input, FZ_DEFLATE_DEFAULT);
+	printf("%zu bytes deflated to %zu bytes\n", input->len, len);
+
+	total = 0;
+	start = now();
+	for (i = 0; i < repeats; i++)
+	{
+		mem = fz_open_memory(ctx, data, len);
+		stm = fz_open_flated(ctx, mem, 15);
+		buf = fz_read_best(ctx, stm, len, NULL);
+		total += buf->len;
+		fz_drop_buffer(ctx, buf);
+		fz_drop_stream(ctx, stm);
+		fz_drop_stream(ctx, mem);
+	}
+	printf("fz_open_flated: %zu bytes in %.3fs\n", total / repeats, now() - start);
+
+	total = 0;
+	start = now();
+	for (i = 0; i < repeats; i++)
+	{
+		raw = fz_new_buffer_from_copied_data(ctx, data, len);
+		buf = fz_new_inflated_buffer(ctx, raw->data, raw->len, len, NULL);
+		total += buf->len;
+		fz_drop_buffer(ctx, buf);
+		fz_drop_buffer(ctx, raw);
+	}
+	printf("fz_new_inflated_buffer: %zu bytes in %.3fs\n", total / repeats, now() - start);
+
+	fz_free(ctx, data);
+	fz_drop_buffer(ctx, input);
+	fz_drop_context(ctx);
+
+	return EXIT_SUCCESS;
+}
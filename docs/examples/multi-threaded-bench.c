@@ -0,0 +1,221 @@
+/*
+Contention benchmark: many threads rendering the same display lists.
+
+This renders the first few pages of a document into display lists,
+and then has several threads render all of those display lists over
+and over again at the same time. As the threads share the fonts,
+images, colorspaces and paths held in the display lists, this is a
+good way to find out how much time is lost to threads waiting on
+each other (for instance, for reference counting or the store).
+
+First look at docs/examples/multi-threaded.c, which explains the
+locking and context cloning used here.
+
+To build this example in a source tree and run it, run:
+make examples
+./build/debug/multi-threaded-bench document.pdf [threads] [pages] [repeats]
+
+Run it with 1 thread to get the baseline; ideally the time taken
+should stay the same as threads are added (up to the number of CPU
+cores), while the number of pages rendered goes up accordingly.
+
+Each page is rendered as a separate task with a worker context taken
+from a pool (see fz_new_context_pool), as a server handling one request
+at a time per thread would.
+
+At the end it prints the statistics for the store and the glyph
+cache, which show how well they are working for the given store
+size.
+*/
+
+#include <mupdf/fitz.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+void
+fail(char *msg)
+{
+	fprintf(stderr, "%s\n", msg);
+	abort();
+}
+
+struct data {
+	fz_context_pool *pool;
+	int count;
+	fz_display_list **lists;
+	int repeats;
+	int rendered;
+};
+
+void *
+renderer(void *data_)
+{
+	struct data *data = (struct data *) data_;
+	int i, k;
+
+	for (k = 0; k < data->repeats; k++)
+	{
+		for (i = 0; i < data->count; i++)
+		{
+			fz_context *ctx = fz_acquire_worker_context(data->pool);
+			fz_pixmap *pix = NULL;
+
+			if (!ctx)
+				fail("fz_acquire_worker_context()");
+
+			fz_try(ctx)
+			{
+				pix = fz_new_pixmap_from_display_list(ctx, data->lists[i], fz_identity, fz_device_rgb(ctx), 0);
+				data->rendered++;
+			}
+			fz_always(ctx)
+				fz_drop_pixmap(ctx, pix);
+			fz_catch(ctx)
+				fprintf(stderr, "render failed: %s\n", fz_caught_message(ctx));
+
+			fz_release_worker_context(data->pool, ctx);
+		}
+	}
+
+	return data;
+}
+
+void lock_mutex(void *user, int lock)
+{
+	pthread_mutex_t *mutex = (pthread_mutex_t *) user;
+
+	if (pthread_mutex_lock(&mutex[lock]) != 0)
+		fail("pthread_mutex_lock()");
+}
+
+void unlock_mutex(void *user, int lock)
+{
+	pthread_mutex_t *mutex = (pthread_mutex_t *) user;
+
+	if (pthread_mutex_unlock(&mutex[lock]) != 0)
+		fail("pthread_mutex_unlock()");
+}
+
+static void
+print_stats(fz_context *ctx)
+{
+	fz_store_stats store;
+	fz_glyph_cache_stats glyphs;
+	int i;
+
+	fz_get_store_stats(ctx, &store);
+	printf("store: %d items, %zu bytes; %lu scavenges taking %.3fs\n",
+		store.items, store.size, (unsigned long)store.scavenges, store.scavenge_time / 1e6);
+	for (i = 0; i < store.num_types; i++)
+	{
+		fz_store_type_stats *t = &store.types[i];
+		printf("  %-20s %6d items %10zu bytes; %lu hits %lu misses %lu inserts %lu evictions\n",
+			t->name, t->items, t->size,
+			(unsigned long)t->hits, (unsigned long)t->misses,
+			(unsigned long)t->inserts, (unsigned long)t->evictions);
+	}
+
+	printf("pixmap pool: %zu of %zu bytes; %lu hits %lu misses\n",
+		store.pool_size, store.pool_max,
+		(unsigned long)store.pool_hits, (unsigned long)store.pool_misses);
+
+	fz_get_glyph_cache_stats(ctx, &glyphs);
+	printf("glyph cache: %d glyphs, %zu bytes; %lu hits %lu misses %lu evictions\n",
+		glyphs.items, glyphs.size,
+		(unsigned long)glyphs.hits, (unsigned long)glyphs.misses, (unsigned long)glyphs.evictions);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	char *filename = argc >= 2 ? argv[1] : "";
+	int threads = argc >= 3 ? atoi(argv[2]) : 4;
+	int pages = argc >= 4 ? atoi(argv[3]) : 4;
+	int repeats = argc >= 5 ? atoi(argv[4]) : 10;
+	pthread_t *thread;
+	struct data *data;
+	fz_display_list **lists;
+	fz_context_pool *pool;
+	fz_locks_context locks;
+	pthread_mutex_t mutex[FZ_LOCK_MAX];
+	fz_context *ctx;
+	fz_document *doc;
+	double start, elapsed;
+	int total = 0;
+	int i;
+
+	if (threads < 1 || pages < 1 || repeats < 1)
+		fail("usage: multi-threaded-bench document [threads] [pages] [repeats]");
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+	{
+		if (pthread_mutex_init(&mutex[i], NULL) != 0)
+			fail("pthread_mutex_init()");
+	}
+
+	locks.user = mutex;
+	locks.lock = lock_mutex;
+	locks.unlock = unlock_mutex;
+
+	ctx = fz_new_context(NULL, &locks, FZ_STORE_DEFAULT);
+	fz_register_document_handlers(ctx);
+	doc = fz_open_document(ctx, filename);
+
+	if (pages > fz_count_pages(ctx, doc))
+		pages = fz_count_pages(ctx, doc);
+
+	// Make the display lists up front, so that only rendering is timed.
+
+	lists = malloc(pages * sizeof (fz_display_list *));
+	for (i = 0; i < pages; i++)
+		lists[i] = fz_new_display_list_from_page_number(ctx, doc, i);
+
+	pool = fz_new_context_pool(ctx, threads);
+	thread = malloc(threads * sizeof (pthread_t));
+	data = malloc(threads * sizeof (struct data));
+
+	fprintf(stderr, "rendering %d pages %d times on each of %d threads...\n", pages, repeats, threads);
+
+	start = now();
+	for (i = 0; i < threads; i++)
+	{
+		data[i].pool = pool;
+		data[i].count = pages;
+		data[i].lists = lists;
+		data[i].repeats = repeats;
+		data[i].rendered = 0;
+		if (pthread_create(&thread[i], NULL, renderer, &data[i]) != 0)
+			fail("pthread_create()");
+	}
+	for (i = 0; i < threads; i++)
+	{
+		if (pthread_join(thread[i], NULL) != 0)
+			fail("pthread_join()");
+		total += data[i].rendered;
+	}
+	elapsed = now() - start;
+
+	printf("%d threads: %d pages in %.3fs (%.1f pages/s)\n", threads, total, elapsed, total / elapsed);
+	print_stats(ctx);
+
+	for (i = 0; i < pages; i++)
+		fz_drop_display_list(ctx, lists[i]);
+	free(lists);
+	free(thread);
+	free(data);
+	fz_drop_context_pool(ctx, pool);
+
+	fz_drop_document(ctx, doc);
+	fz_drop_context(ctx);
+
+	return 0;
+}
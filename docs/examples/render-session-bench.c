@@ -0,0 +1,130 @@
+/*
+Allocation benchmark: redrawing a page with and without a render session.
+
+This makes a display list for one page of a document, and then draws it
+into the same pixmap over and over again, as a viewer does when a page
+is redrawn at the same zoom. It does this once with a new draw device
+for every redraw, and once reusing a render session (see
+fz_new_render_session). It uses a counting allocator to show how many
+calls are made to the allocator for each redraw.
+
+To build this example in a source tree and run it, run:
+make examples
+./build/debug/render-session-bench document.pdf [page] [repeats]
+*/
+
+#include <mupdf/fitz.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct
+{
+	size_t mallocs;
+	size_t reallocs;
+	size_t frees;
+} counts;
+
+static void *
+count_malloc(void *user, size_t size)
+{
+	((counts *) user)->mallocs++;
+	return malloc(size);
+}
+
+static void *
+count_realloc(void *user, void *old, size_t size)
+{
+	((counts *) user)->reallocs++;
+	return realloc(old, size);
+}
+
+static void
+count_free(void *user, void *ptr)
+{
+	if (ptr)
+		((counts *) user)->frees++;
+	free(ptr);
+}
+
+static void
+redraw(fz_context *ctx, fz_display_list *list, fz_pixmap *pix, fz_render_session *session)
+{
+	fz_device *dev = NULL;
+
+	fz_var(dev);
+
+	fz_clear_pixmap_with_value(ctx, pix, 0xff);
+	fz_try(ctx)
+	{
+		if (session)
+			dev = fz_begin_render_session(ctx, session, fz_identity, pix, NULL);
+		else
+			dev = fz_new_draw_device(ctx, fz_identity, pix);
+		fz_run_display_list(ctx, list, dev, fz_identity, fz_infinite_rect, NULL);
+		if (!session)
+			fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+	{
+		if (session)
+			fz_end_render_session(ctx, session);
+		else
+			fz_drop_device(ctx, dev);
+	}
+	fz_catch(ctx)
+		fprintf(stderr, "render failed: %s\n", fz_caught_message(ctx));
+}
+
+int main(int argc, char **argv)
+{
+	char *filename = argc >= 2 ? argv[1] : "";
+	int page = argc >= 3 ? atoi(argv[2]) - 1 : 0;
+	int repeats = argc >= 4 ? atoi(argv[3]) : 100;
+	counts count = { 0 };
+	fz_alloc_context alloc = { &count, count_malloc, count_realloc, count_free };
+	fz_render_session *session;
+	fz_display_list *list;
+	fz_pixmap *pix;
+	fz_context *ctx;
+	fz_document *doc;
+	int pass, i;
+
+	ctx = fz_new_context(&alloc, NULL, FZ_STORE_DEFAULT);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create mupdf context\n");
+		return EXIT_FAILURE;
+	}
+
+	fz_register_document_handlers(ctx);
+	doc = fz_open_document(ctx, filename);
+	list = fz_new_display_list_from_page_number(ctx, doc, page);
+	pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), fz_round_rect(fz_bound_display_list(ctx, list)), NULL, 0);
+	session = fz_new_render_session(ctx);
+
+	for (pass = 0; pass < 2; pass++)
+	{
+		counts before;
+
+		/* Draw once untimed, so that images, glyphs and the session
+		 * itself are already set up. */
+		redraw(ctx, list, pix, pass ? session : NULL);
+
+		before = count;
+		for (i = 0; i < repeats; i++)
+			redraw(ctx, list, pix, pass ? session : NULL);
+		printf("%s: %.1f mallocs, %.1f reallocs, %.1f frees per redraw\n",
+			pass ? "with session" : "without session",
+			(double)(count.mallocs - before.mallocs) / repeats,
+			(double)(count.reallocs - before.reallocs) / repeats,
+			(double)(count.frees - before.frees) / repeats);
+	}
+
+	fz_drop_render_session(ctx, session);
+	fz_drop_pixmap(ctx, pix);
+	fz_drop_display_list(ctx, list);
+	fz_drop_document(ctx, doc);
+	fz_drop_context(ctx);
+
+	return EXIT_SUCCESS;
+}
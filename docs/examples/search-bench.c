@@ -0,0 +1,88 @@
+/*
+Search benchmark: fz_search_stext_page against a compiled fz_search.
+
+This extracts the text of the first few pages of a document, and then
+searches all of them for a needle over and over again; once with
+fz_search_stext_page, which works from the needle string every time,
+and once with a search compiled by fz_new_search and reused from page
+to page. Both are case insensitive. It prints the number of hits and
+the time taken for each.
+
+Only the searching is timed; the text is extracted up front.
+
+To build this example in a source tree and run it, run:
+make examples
+./build/debug/search-bench document.pdf needle [pages] [repeats]
+*/
+
+#include <mupdf/fitz.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	char *filename = argc >= 2 ? argv[1] : "";
+	char *needle = argc >= 3 ? argv[2] : "the";
+	int pages = argc >= 4 ? atoi(argv[3]) : 100;
+	int repeats = argc >= 5 ? atoi(argv[4]) : 10;
+	fz_stext_page **text;
+	fz_quad hits[500];
+	fz_search *search;
+	fz_context *ctx;
+	fz_document *doc;
+	double start, elapsed;
+	int count, i, k;
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create mupdf context\n");
+		return EXIT_FAILURE;
+	}
+
+	fz_register_document_handlers(ctx);
+	doc = fz_open_document(ctx, filename);
+
+	if (pages > fz_count_pages(ctx, doc))
+		pages = fz_count_pages(ctx, doc);
+
+	text = malloc(pages * sizeof (fz_stext_page *));
+	for (i = 0; i < pages; i++)
+		text[i] = fz_new_stext_page_from_page_number(ctx, doc, i, NULL);
+
+	count = 0;
+	start = now();
+	for (k = 0; k < repeats; k++)
+		for (i = 0; i < pages; i++)
+			count += fz_search_stext_page(ctx, text[i], needle, hits, nelem(hits));
+	elapsed = now() - start;
+	printf("fz_search_stext_page: %d hits in %.3fs\n", count / repeats, elapsed);
+
+	count = 0;
+	start = now();
+	search = fz_new_search(ctx, needle, FZ_SEARCH_IGNORE_CASE);
+	for (k = 0; k < repeats; k++)
+		for (i = 0; i < pages; i++)
+			count += fz_run_search(ctx, search, text[i], NULL, NULL);
+	fz_drop_search(ctx, search);
+	elapsed = now() - start;
+	printf("fz_run_search: %d hits in %.3fs\n", count / repeats, elapsed);
+
+	for (i = 0; i < pages; i++)
+		fz_drop_stext_page(ctx, text[i]);
+	free(text);
+
+	fz_drop_document(ctx, doc);
+	fz_drop_context(ctx);
+
+	return EXIT_SUCCESS;
+}
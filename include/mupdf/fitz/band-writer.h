@@ -66,6 +66,36 @@ void fz_write_header(fz_context *ctx, fz_band_writer *writer, int w, int h, int
 */
 void fz_write_band(fz_context *ctx, fz_band_writer *writer, int stride, int band_height, const unsigned char *samples);
 
+/**
+	Encode a band of data for an image, ready to be written later by
+	fz_write_encoded_band, without writing anything to the output.
+
+	Once the header has been written, this may be called for
+	different bands from different threads at the same time (each
+	with its own cloned context), so that the encoding work can be
+	shared out between them.
+
+	band_start: The first line of the band within the image.
+
+	Other arguments are as for fz_write_band.
+
+	Returns NULL if the band writer cannot encode bands separately,
+	in which case use fz_write_band as usual. Do not mix encoded and
+	unencoded bands within one image.
+*/
+fz_buffer *fz_encode_band(fz_context *ctx, fz_band_writer *writer, int stride, int band_start, int band_height, const unsigned char *samples);
+
+/**
+	Write the next band of data for an image, as previously encoded
+	by fz_encode_band. Bands must be written in order.
+
+	band_height: The number of lines in this band, as passed to
+	fz_encode_band.
+
+	buf: The encoded band.
+*/
+void fz_write_encoded_band(fz_context *ctx, fz_band_writer *writer, int band_height, fz_buffer *buf);
+
 /**
 	Drop the reference to the band writer, causing it to be
 	destroyed.
@@ -78,6 +108,8 @@ void fz_drop_band_writer(fz_context *ctx, fz_band_writer *writer);
 
 typedef void (fz_write_header_fn)(fz_context *ctx, fz_band_writer *writer, fz_colorspace *cs);
 typedef void (fz_write_band_fn)(fz_context *ctx, fz_band_writer *writer, int stride, int band_start, int band_height, const unsigned char *samples);
+typedef fz_buffer *(fz_encode_band_fn)(fz_context *ctx, fz_band_writer *writer, int stride, int band_start, int band_height, const unsigned char *samples);
+typedef void (fz_write_encoded_band_fn)(fz_context *ctx, fz_band_writer *writer, int band_start, int band_height, fz_buffer *buf);
 typedef void (fz_write_trailer_fn)(fz_context *ctx, fz_band_writer *writer);
 typedef void (fz_drop_band_writer_fn)(fz_context *ctx, fz_band_writer *writer);
 
@@ -87,6 +119,8 @@ struct fz_band_writer
 	fz_write_header_fn *header;
 	fz_write_band_fn *band;
 	fz_write_trailer_fn *trailer;
+	fz_encode_band_fn *encode_band;
+	fz_write_encoded_band_fn *write_encoded_band;
 	fz_output *out;
 	int w;
 	int h;
@@ -259,6 +259,9 @@ int fz_is_valid_blend_colorspace(fz_context *ctx, fz_colorspace *cs);
 
 	These return borrowed references that should not be dropped,
 	unless they are kept first.
+
+	Each is made on first use (parsing its ICC profile, if ICC is
+	enabled), and so may throw the first time it is asked for.
 */
 fz_colorspace *fz_device_gray(fz_context *ctx);
 fz_colorspace *fz_device_rgb(fz_context *ctx);
@@ -266,6 +269,16 @@ fz_colorspace *fz_device_bgr(fz_context *ctx);
 fz_colorspace *fz_device_cmyk(fz_context *ctx);
 fz_colorspace *fz_device_lab(fz_context *ctx);
 
+/**
+	Make all the device colorspaces now, rather than on first use.
+
+	Short lived processes are best left to make only those they
+	need. Long lived ones that clone many contexts can call this
+	once on the base context at startup, so that no worker pays for
+	it (or races another to do it) later.
+*/
+void fz_warm_colorspace_context(fz_context *ctx);
+
 /**
 	Assign a name for a given colorant in a colorspace.
 
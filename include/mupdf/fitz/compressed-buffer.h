@@ -117,6 +117,24 @@ fz_stream *fz_open_image_decomp_stream_from_buffer(fz_context *ctx, fz_compresse
 */
 fz_stream *fz_open_image_decomp_stream(fz_context *ctx, fz_stream *, fz_compression_params *, int *l2factor);
 
+/**
+	As fz_open_image_decomp_stream_from_buffer, but ask for just a
+	subarea of the image (in full resolution pixels).
+
+	Decoders that can restrict their work to the subarea (currently
+	JPEG) return a stream that delivers only those pixels, and set
+	*cropped to 1. Others return the whole image, and set *cropped
+	to 0, leaving the caller to do the cropping. subarea should be
+	aligned as by fz_adjust_image_subarea.
+*/
+fz_stream *fz_open_image_decomp_stream_from_buffer_subarea(fz_context *ctx, fz_compressed_buffer *, int *l2factor, const fz_irect *subarea, int *cropped);
+
+/**
+	As fz_open_image_decomp_stream, but ask for just a subarea of
+	the image. See fz_open_image_decomp_stream_from_buffer_subarea.
+*/
+fz_stream *fz_open_image_decomp_stream_subarea(fz_context *ctx, fz_stream *, fz_compression_params *, int *l2factor, const fz_irect *subarea, int *cropped);
+
 /**
 	Recognise image format strings in the first 8 bytes from image
 	data.
@@ -33,6 +33,7 @@ typedef struct fz_style_context fz_style_context;
 typedef struct fz_tuning_context fz_tuning_context;
 typedef struct fz_store fz_store;
 typedef struct fz_glyph_cache fz_glyph_cache;
+typedef struct fz_memory_budget fz_memory_budget;
 typedef struct fz_document_handler_context fz_document_handler_context;
 typedef struct fz_output fz_output;
 typedef struct fz_context fz_context;
@@ -80,6 +81,7 @@ enum
 	FZ_ERROR_TRYLATER = 5,
 	FZ_ERROR_ABORT = 6,
 	FZ_ERROR_REPAIRED = 7,
+	FZ_ERROR_LIMIT = 8,
 	FZ_ERROR_COUNT
 };
 
@@ -210,6 +212,59 @@ enum {
 */
 fz_context *fz_clone_context(fz_context *ctx);
 
+/**
+	Pools of worker contexts.
+
+	For applications that run many short tasks (such as a server
+	handling a request at a time) on a set of threads, cloning and
+	dropping a context per task means allocating it, and taking and
+	dropping a reference to every shared part of it, each time.
+
+	A pool keeps contexts that have finished a task and hands them
+	out again for the next, already holding their references to
+	the shared parts of the base context. A context is reset when
+	it is returned to the pool: its user pointer, anti-aliasing
+	and other per-context settings, error and warning callbacks and
+	memory budget are restored to what they were in the base
+	context when the pool was made. Its exception stack must be
+	empty.
+
+	The base context must have locking functions (as for
+	fz_clone_context). The pool keeps a private clone of it, made
+	when the pool is made, to clone and reset worker contexts from;
+	so the base context may go on being used by its own thread, but
+	changes to its settings after that are not seen by the pool.
+*/
+typedef struct fz_context_pool fz_context_pool;
+
+/**
+	Create a pool that keeps up to max idle contexts cloned from
+	ctx.
+*/
+fz_context_pool *fz_new_context_pool(fz_context *ctx, int max);
+
+/**
+	Drop a pool and the idle contexts in it. Contexts still in use
+	are not affected; drop them with fz_drop_context once done.
+*/
+void fz_drop_context_pool(fz_context *ctx, fz_context_pool *pool);
+
+/**
+	Take a context from the pool, cloning a new one if the pool is
+	empty. May be called from any thread.
+
+	May return NULL.
+*/
+fz_context *fz_acquire_worker_context(fz_context_pool *pool);
+
+/**
+	Reset a context taken from the pool and put it back, dropping it
+	instead if the pool is full.
+
+	Never throws exceptions.
+*/
+void fz_release_worker_context(fz_context_pool *pool, fz_context *worker);
+
 /**
 	Free a context and its global state.
 
@@ -335,6 +390,59 @@ void fz_tune_image_decode(fz_context *ctx, fz_tune_image_decode_fn *image_decode
 */
 void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, void *arg);
 
+/**
+	Set the number of threads a single image decode may use
+	internally. Currently only used for JPEG 2000 images, and only
+	when OpenJPEG has been built with thread support.
+
+	The default is 1. Callers that already render several pages in
+	parallel will usually want to leave it there; callers that render
+	one page at a time can set it to the number of cores.
+*/
+void fz_set_image_decode_threads(fz_context *ctx, int threads);
+
+/**
+	Get the number of threads a single image decode may use.
+*/
+int fz_image_decode_threads(fz_context *ctx);
+
+/**
+	Set whether decoded image tiles should be kept compressed while
+	they sit in the store.
+
+	Tiles are compressed as they are stored, and decompressed again
+	on each hit. Monochrome tiles are packed to 1 bit per pixel
+	first. This costs a little time on every hit, but lets a store
+	of a given size hold several times as many tiles.
+
+	The default is 0 (tiles are stored uncompressed).
+*/
+void fz_set_image_tile_compression(fz_context *ctx, int compress);
+
+/**
+	Get whether decoded image tiles are kept compressed in the store.
+*/
+int fz_image_tile_compression(fz_context *ctx);
+
+/**
+	Set whether interpreters should take the storage for the
+	short-lived objects they make for each operator from an arena
+	(see fz_new_arena) for each page they run, instead of from the
+	allocator. Currently this covers the paths built by the PDF
+	interpreter.
+
+	This saves many calls to the allocator, which matters most when
+	that is a locked malloc shared by several rendering threads.
+
+	The default is 0.
+*/
+void fz_set_page_arenas(fz_context *ctx, int use);
+
+/**
+	Get whether interpreters use an arena for each page they run.
+*/
+int fz_page_arenas(fz_context *ctx);
+
 /**
 	Get the number of bits of antialiasing we are
 	using (for graphics). Between 0 and 8.
@@ -541,6 +649,88 @@ char *fz_strdup(fz_context *ctx, const char *s);
 */
 void fz_memrnd(fz_context *ctx, uint8_t *block, int len);
 
+/**
+	Memory budgets.
+
+	The store limit given to fz_new_context only covers what is
+	cached. A budget additionally limits the large blocks of memory
+	used while interpreting and rendering a page: the samples of
+	every pixmap (render targets, transparency groups, masks,
+	shadings, decoded images) are charged to the budget in force
+	when they are made, and given back when they are freed.
+
+	When a charge would take the budget over its limit, pixmaps
+	held in the store that are charged to the same budget are
+	evicted to make room. If that is not enough,
+	FZ_ERROR_LIMIT is thrown; the PDF interpreter then abandons the
+	page and sets the abort flag of its cookie, if any. Before that
+	point, images are decoded at a lower resolution when the
+	budget cannot accommodate them at the resolution asked for.
+
+	The budget belongs to the context it is set on, and to contexts
+	cloned from it afterwards. For a budget per document, give each
+	document its own cloned context and set a budget on that.
+*/
+
+/**
+	Set the memory budget for this context (and subsequent clones
+	of it) to limit bytes. A limit of 0 removes the budget.
+
+	Memory already charged to a previous budget is given back to
+	that budget when freed.
+*/
+void fz_set_memory_budget(fz_context *ctx, size_t limit);
+
+/**
+	Statistics for the memory budget of a context.
+
+	limit: The limit, or 0 if there is no budget.
+	used: The number of bytes currently charged.
+	peak: The largest number of bytes charged at once.
+	failures: The number of charges refused with FZ_ERROR_LIMIT.
+*/
+typedef struct
+{
+	size_t limit;
+	size_t used;
+	size_t peak;
+	int failures;
+} fz_memory_budget_stats;
+
+void fz_get_memory_budget_stats(fz_context *ctx, fz_memory_budget_stats *stats);
+
+/**
+	Return the number of bytes that can still be charged to the
+	budget, after evicting its pixmaps from the store if fewer than
+	wanted bytes are left. Returns SIZE_MAX if there is no budget.
+
+	Used to decide how much to degrade output before trying (for
+	example, the resolution at which to decode images).
+*/
+size_t fz_memory_budget_available(fz_context *ctx, size_t wanted);
+
+/**
+	Charge size bytes to the budget of the context, returning a
+	reference to the budget that must be passed to
+	fz_release_memory_budget when the memory is freed; or NULL if
+	there is no budget.
+
+	Throws FZ_ERROR_LIMIT if the budget cannot accommodate the
+	charge.
+*/
+fz_memory_budget *fz_charge_memory_budget(fz_context *ctx, size_t size);
+
+/**
+	Give back size bytes charged by fz_charge_memory_budget, and
+	drop the reference to the budget.
+
+	Never throws exceptions.
+*/
+void fz_release_memory_budget(fz_context *ctx, fz_memory_budget *budget, size_t size);
+
+fz_memory_budget *fz_keep_memory_budget(fz_context *ctx, fz_memory_budget *budget);
+void fz_drop_memory_budget(fz_context *ctx, fz_memory_budget *budget);
+
 
 /* Implementation details: subject to change. */
 
@@ -586,6 +776,15 @@ typedef struct
 	float min_line_width;
 } fz_aa_context;
 
+/* Glyph metrics cache counters; see fz_get_glyph_metrics_stats. */
+typedef struct
+{
+	int advance_lookups;
+	int advance_ft_calls;
+	int bbox_lookups;
+	int bbox_ft_calls;
+} fz_glyph_metrics_stats;
+
 struct fz_context
 {
 	void *user;
@@ -601,6 +800,7 @@ struct fz_context
 	int icc_enabled;
 #endif
 	int throw_on_repair;
+	fz_glyph_metrics_stats glyph_metrics;
 
 	/* TODO: should these be unshared? */
 	fz_document_handler_context *handler;
@@ -613,6 +813,7 @@ struct fz_context
 	fz_colorspace_context *colorspace;
 	fz_store *store;
 	fz_glyph_cache *glyph_cache;
+	fz_memory_budget *budget;
 };
 
 fz_context *fz_new_context_imp(const fz_alloc_context *alloc, const fz_locks_context *locks, size_t max_store, const char *version);
@@ -637,6 +838,63 @@ fz_unlock(fz_context *ctx, int lock)
 	ctx->locks.unlock(ctx->locks.user, lock);
 }
 
+/*
+	Reference counts are updated with atomic operations where the
+	compiler provides them, so that keeping and dropping objects
+	does not serialise every thread on FZ_LOCK_ALLOC. Memento
+	builds (and builds with FZ_LOCKED_REFS defined) take the lock
+	instead, as do compilers we have no atomics for.
+
+	fz_load_refs, fz_inc_refs and fz_dec_refs may be used on any
+	reference count, whether or not fz_lock_refs is in effect, so
+	that code already holding FZ_LOCK_ALLOC (such as the store) can
+	safely update counts that other threads keep and drop lock-free.
+	fz_inc_refs and fz_dec_refs return the new count.
+
+	fz_load_ptr_acquire and fz_store_ptr_release publish a pointer
+	to an object that was fully set up before it was stored, so
+	that readers may pick it up without taking a lock. They are
+	only atomic when FZ_ATOMIC_REFS is set; otherwise readers must
+	hold the same lock as the writer.
+*/
+#if !defined(MEMENTO) && !defined(FZ_LOCKED_REFS) && (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))))
+#define FZ_ATOMIC_REFS 1
+#define fz_load_refs(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define fz_inc_refs(p) __atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+#define fz_dec_refs(p) __atomic_sub_fetch((p), 1, __ATOMIC_ACQ_REL)
+#define fz_load_ptr_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define fz_store_ptr_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#elif !defined(MEMENTO) && !defined(FZ_LOCKED_REFS) && defined(_MSC_VER) && (_MSC_VER >= 1700)
+#include <intrin.h>
+#define FZ_ATOMIC_REFS 1
+#define fz_load_refs(p) (*(p)) /* Aligned loads are atomic on all MSVC targets */
+#define fz_inc_refs(p) \
+	(sizeof(*(p)) == 1 ? (int8_t)(_InterlockedExchangeAdd8((volatile char *)(p), 1) + 1) : \
+	sizeof(*(p)) == 2 ? (int16_t)_InterlockedIncrement16((volatile short *)(p)) : \
+	(int)_InterlockedIncrement((volatile long *)(p)))
+#define fz_dec_refs(p) \
+	(sizeof(*(p)) == 1 ? (int8_t)(_InterlockedExchangeAdd8((volatile char *)(p), -1) - 1) : \
+	sizeof(*(p)) == 2 ? (int16_t)_InterlockedDecrement16((volatile short *)(p)) : \
+	(int)_InterlockedDecrement((volatile long *)(p)))
+#define fz_load_ptr_acquire(p) _InterlockedCompareExchangePointer((void * volatile *)(p), NULL, NULL)
+#define fz_store_ptr_release(p, v) ((void)_InterlockedExchangePointer((void * volatile *)(p), (v)))
+#else
+#define FZ_ATOMIC_REFS 0
+#define fz_load_refs(p) (*(p))
+#define fz_inc_refs(p) (++*(p))
+#define fz_dec_refs(p) (--*(p))
+#define fz_load_ptr_acquire(p) (*(p))
+#define fz_store_ptr_release(p, v) ((void)(*(p) = (v)))
+#endif
+
+#if FZ_ATOMIC_REFS
+#define fz_lock_refs(ctx) ((void)(ctx))
+#define fz_unlock_refs(ctx) ((void)(ctx))
+#else
+#define fz_lock_refs(ctx) fz_lock(ctx, FZ_LOCK_ALLOC)
+#define fz_unlock_refs(ctx) fz_unlock(ctx, FZ_LOCK_ALLOC)
+#endif
+
 /* Lock-safe reference counting functions */
 
 static inline void *
@@ -645,13 +903,13 @@ fz_keep_imp(fz_context *ctx, void *p, int *refs)
 	if (p)
 	{
 		(void)Memento_checkIntPointerOrNull(refs);
-		fz_lock(ctx, FZ_LOCK_ALLOC);
-		if (*refs > 0)
+		fz_lock_refs(ctx);
+		if (fz_load_refs(refs) > 0)
 		{
 			(void)Memento_takeRef(p);
-			++*refs;
+			(void)fz_inc_refs(refs);
 		}
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		fz_unlock_refs(ctx);
 	}
 	return p;
 }
@@ -662,10 +920,10 @@ fz_keep_imp_locked(fz_context *ctx FZ_UNUSED, void *p, int *refs)
 	if (p)
 	{
 		(void)Memento_checkIntPointerOrNull(refs);
-		if (*refs > 0)
+		if (fz_load_refs(refs) > 0)
 		{
 			(void)Memento_takeRef(p);
-			++*refs;
+			(void)fz_inc_refs(refs);
 		}
 	}
 	return p;
@@ -677,13 +935,13 @@ fz_keep_imp8(fz_context *ctx, void *p, int8_t *refs)
 	if (p)
 	{
 		(void)Memento_checkBytePointerOrNull(refs);
-		fz_lock(ctx, FZ_LOCK_ALLOC);
-		if (*refs > 0)
+		fz_lock_refs(ctx);
+		if (fz_load_refs(refs) > 0)
 		{
 			(void)Memento_takeRef(p);
-			++*refs;
+			(void)fz_inc_refs(refs);
 		}
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		fz_unlock_refs(ctx);
 	}
 	return p;
 }
@@ -694,13 +952,13 @@ fz_keep_imp16(fz_context *ctx, void *p, int16_t *refs)
 	if (p)
 	{
 		(void)Memento_checkShortPointerOrNull(refs);
-		fz_lock(ctx, FZ_LOCK_ALLOC);
-		if (*refs > 0)
+		fz_lock_refs(ctx);
+		if (fz_load_refs(refs) > 0)
 		{
 			(void)Memento_takeRef(p);
-			++*refs;
+			(void)fz_inc_refs(refs);
 		}
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		fz_unlock_refs(ctx);
 	}
 	return p;
 }
@@ -712,15 +970,15 @@ fz_drop_imp(fz_context *ctx, void *p, int *refs)
 	{
 		int drop;
 		(void)Memento_checkIntPointerOrNull(refs);
-		fz_lock(ctx, FZ_LOCK_ALLOC);
-		if (*refs > 0)
+		fz_lock_refs(ctx);
+		if (fz_load_refs(refs) > 0)
 		{
 			(void)Memento_dropIntRef(p);
-			drop = --*refs == 0;
+			drop = fz_dec_refs(refs) == 0;
 		}
 		else
 			drop = 0;
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		fz_unlock_refs(ctx);
 		return drop;
 	}
 	return 0;
@@ -733,15 +991,15 @@ fz_drop_imp8(fz_context *ctx, void *p, int8_t *refs)
 	{
 		int drop;
 		(void)Memento_checkBytePointerOrNull(refs);
-		fz_lock(ctx, FZ_LOCK_ALLOC);
-		if (*refs > 0)
+		fz_lock_refs(ctx);
+		if (fz_load_refs(refs) > 0)
 		{
 			(void)Memento_dropByteRef(p);
-			drop = --*refs == 0;
+			drop = fz_dec_refs(refs) == 0;
 		}
 		else
 			drop = 0;
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		fz_unlock_refs(ctx);
 		return drop;
 	}
 	return 0;
@@ -754,15 +1012,15 @@ fz_drop_imp16(fz_context *ctx, void *p, int16_t *refs)
 	{
 		int drop;
 		(void)Memento_checkShortPointerOrNull(refs);
-		fz_lock(ctx, FZ_LOCK_ALLOC);
-		if (*refs > 0)
+		fz_lock_refs(ctx);
+		if (fz_load_refs(refs) > 0)
 		{
 			(void)Memento_dropShortRef(p);
-			drop = --*refs == 0;
+			drop = fz_dec_refs(refs) == 0;
 		}
 		else
 			drop = 0;
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		fz_unlock_refs(ctx);
 		return drop;
 	}
 	return 0;
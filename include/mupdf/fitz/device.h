@@ -449,6 +449,58 @@ fz_device *fz_new_draw_device_with_bbox_proof(fz_context *ctx, fz_matrix transfo
 
 fz_device *fz_new_draw_device_type3(fz_context *ctx, fz_matrix transform, fz_pixmap *dest);
 
+/**
+	A render session keeps a draw device, together with its
+	rasterizer (and the edge lists it has grown), image scale
+	caches and stack, alive from one render to the next.
+
+	Rendering the same display list again and again through the
+	same session (for instance, when a viewer redraws a page as
+	it scrolls) then reaches a steady state where the only
+	allocations left are the small headers of group and mask
+	pixmaps; their samples are recycled through the store's
+	pixmap pool (see fz_set_pixmap_pool_size), and glyphs come
+	from the glyph cache.
+
+	A session may only be used by one thread at a time.
+*/
+typedef struct fz_render_session fz_render_session;
+
+/**
+	Create a new, empty, render session.
+*/
+fz_render_session *fz_new_render_session(fz_context *ctx);
+
+/**
+	Drop a render session, and the draw device it holds.
+
+	Never throws exceptions.
+*/
+void fz_drop_render_session(fz_context *ctx, fz_render_session *session);
+
+/**
+	Start a render with a session. Returns a draw device, as from
+	fz_new_draw_device_with_bbox, which draws onto dest.
+
+	The device belongs to the session; run display lists (or pages)
+	to it, and then call fz_end_render_session rather than closing
+	or dropping it.
+
+	clip: Bounding box to restrict any marking operations of the
+	draw device (or NULL).
+*/
+fz_device *fz_begin_render_session(fz_context *ctx, fz_render_session *session, fz_matrix transform, fz_pixmap *dest, const fz_irect *clip);
+
+/**
+	Finish a render started with fz_begin_render_session, closing
+	the device, and leaving the session ready to be used again.
+
+	This should be called even if the render threw an exception, so
+	that any pixmaps left on the device's stack are released; in
+	that case what has been drawn to dest so far is left as it is.
+*/
+void fz_end_render_session(fz_context *ctx, fz_render_session *session);
+
 /**
 	struct fz_draw_options: Options for creating a pixmap and draw
 	device.
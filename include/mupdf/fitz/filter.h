@@ -112,6 +112,15 @@ fz_stream *fz_open_rld(fz_context *ctx, fz_stream *chain);
 */
 fz_stream *fz_open_dctd(fz_context *ctx, fz_stream *chain, int color_transform, int l2factor, fz_stream *jpegtables);
 
+/**
+	As fz_open_dctd, but only return the given subarea of the image
+	(given in full resolution pixels, and delivered at the
+	subsampled resolution). When built against libjpeg-turbo, rows
+	above the subarea are skipped without being fully decoded and
+	columns outside it are not decoded at all.
+*/
+fz_stream *fz_open_dctd_subarea(fz_context *ctx, fz_stream *chain, int color_transform, int l2factor, fz_stream *jpegtables, const fz_irect *subarea);
+
 /**
 	faxd filter performs FAX decoding of data read from
 	the chained filter.
@@ -148,6 +157,21 @@ fz_stream *fz_open_faxd(fz_context *ctx, fz_stream *chain,
 */
 fz_stream *fz_open_flated(fz_context *ctx, fz_stream *chain, int window_bits);
 
+/**
+	Inflate a complete zlib stream held in memory into a new
+	buffer. This avoids the overhead of the streaming filter (which
+	works in small chunks and copies data through its own buffer)
+	when the whole compressed data is available up front.
+
+	initial: The expected size of the decompressed data, or 0 if
+	unknown. As for fz_read_best, this is also used for compression
+	bomb detection.
+
+	truncated: If non-NULL, errors in the data do not throw; instead
+	*truncated is set to 1, and the data decoded so far is returned.
+*/
+fz_buffer *fz_new_inflated_buffer(fz_context *ctx, const unsigned char *data, size_t len, size_t initial, int *truncated);
+
 /**
 	lzwd filter performs LZW decoding of data read from the chained
 	filter.
@@ -180,6 +204,13 @@ fz_stream *fz_open_lzwd(fz_context *ctx, fz_stream *chain, int early_change, int
 */
 fz_stream *fz_open_predict(fz_context *ctx, fz_stream *chain, int predictor, int columns, int colors, int bpc);
 
+/**
+	Equivalent to fz_open_predict on top of fz_open_flated, but
+	done in a single filter, avoiding the intermediate buffers
+	and copies of the separate filters.
+*/
+fz_stream *fz_open_flated_predict(fz_context *ctx, fz_stream *chain, int window_bits, int predictor, int columns, int colors, int bpc);
+
 /**
 	Open a filter that performs jbig2 decompression on the chained
 	stream, using the optional globals record.
@@ -549,6 +549,17 @@ void fz_run_t3_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, str
 */
 float fz_advance_glyph(fz_context *ctx, fz_font *font, int glyph, int wmode);
 
+/**
+	Retrieve the glyph metrics cache counters for a context.
+
+	The lookup counts record how often fz_advance_glyph and
+	fz_bound_glyph were called with this context; the ft_calls
+	counts record how often FreeType actually had to be consulted
+	to answer them. Each context (including clones) keeps its own
+	counts, starting from zero.
+*/
+void fz_get_glyph_metrics_stats(fz_context *ctx, fz_glyph_metrics_stats *stats);
+
 /**
 	Find the glyph id for a given unicode
 	character within a font.
@@ -713,8 +724,11 @@ struct fz_font
 	short width_default; /* in 1000 units */
 	short *width_table; /* in 1000 units */
 
-	/* cached glyph metrics */
-	float *advance_cache;
+	/* cached glyph metrics, in pages of 256 glyphs; bounds are only
+	 * paged for fonts too big for bbox_table */
+	float *advance_cache[2][256];
+	struct fz_bbox_cache_page *bbox_cache[256];
+	int bbox_paged;
 
 	/* cached encoding lookup */
 	uint16_t *encoding_cache[256];
@@ -73,6 +73,44 @@ void fz_prepare_t3_glyph(fz_context *ctx, fz_font *font, int gid);
 */
 void fz_dump_glyph_cache_stats(fz_context *ctx, fz_output *out);
 
+/**
+	Statistics for the glyph cache (which holds rendered glyphs
+	from all but Type 3 fonts; those are kept in the store, as
+	"fz_t3_glyph" items).
+
+	max, size: The maximum size of the cache, and its current size,
+	in bytes.
+
+	items: The number of glyphs in the cache.
+
+	hits, misses: The number of lookups that found a glyph, and that
+	did not.
+
+	inserts: The number of glyphs that have been cached.
+
+	evictions, evicted: The number of glyphs that have been evicted
+	to make space, and the number of bytes that freed.
+*/
+typedef struct
+{
+	size_t max;
+	size_t size;
+	int items;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t inserts;
+	uint64_t evictions;
+	size_t evicted;
+} fz_glyph_cache_stats;
+
+/**
+	Take a snapshot of the statistics for the glyph cache. As with
+	fz_get_store_stats, this only holds the glyph cache lock for
+	long enough to copy the counters. The counters are shared by all
+	the contexts cloned from the same original.
+*/
+void fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats);
+
 /**
 	Perform subpixel quantisation and adjustment on a glyph matrix.
 
@@ -412,11 +412,46 @@ void fz_set_pixmap_image_tile(fz_context *ctx, fz_pixmap_image *cimg, fz_pixmap
 */
 fz_pixmap *fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *cs);
 
+/**
+	Exposed for PDF.
+
+	Create an image from JPEG 2000 data without decoding it. Only
+	the header is read; the image is decoded when needed, at the
+	resolution and for the area being drawn.
+
+	cs: The colorspace to use (overriding any in the data).
+
+	decode, mask: As for fz_new_image_from_compressed_buffer.
+
+	smask_in_data: As for the PDF SMaskInData entry.
+*/
+fz_image *fz_new_image_from_jpx(fz_context *ctx, fz_buffer *buffer, fz_colorspace *cs, float *decode, fz_image *mask, int smask_in_data);
+
 /**
 	Exposed for CBZ.
 */
 int fz_load_tiff_subimage_count(fz_context *ctx, const unsigned char *buf, size_t len);
 fz_pixmap *fz_load_tiff_subimage(fz_context *ctx, const unsigned char *buf, size_t len, int subimage);
+
+/**
+	Exposed for CBZ.
+
+	Index the subimages of a TIFF file read from a seekable stream.
+	Returns the number of subimages, and a pointer to an array of
+	their IFD offsets (to be freed by the caller) in *offsets.
+*/
+int fz_load_tiff_subimage_offsets(fz_context *ctx, fz_stream *stm, unsigned **offsets);
+
+/**
+	Exposed for CBZ.
+
+	Create an image for the subimage of a TIFF file read from a
+	seekable stream whose IFD is at the given offset. Only the data
+	for that subimage is read from the stream, and the image is
+	decoded on demand, decoding just the strips or tiles needed for
+	the area being drawn.
+*/
+fz_image *fz_new_image_from_tiff_subimage(fz_context *ctx, fz_stream *stm, unsigned ifd_offset);
 int fz_load_pnm_subimage_count(fz_context *ctx, const unsigned char *buf, size_t len);
 fz_pixmap *fz_load_pnm_subimage(fz_context *ctx, const unsigned char *buf, size_t len, int subimage);
 int fz_load_jbig2_subimage_count(fz_context *ctx, const unsigned char *buf, size_t len);
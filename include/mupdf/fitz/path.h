@@ -26,6 +26,7 @@
 #include "mupdf/fitz/system.h"
 #include "mupdf/fitz/context.h"
 #include "mupdf/fitz/geometry.h"
+#include "mupdf/fitz/pool.h"
 
 /**
  * Vector path buffer.
@@ -105,12 +106,28 @@ void fz_walk_path(fz_context *ctx, const fz_path *path, const fz_path_walker *wa
 */
 fz_path *fz_new_path(fz_context *ctx);
 
+/**
+	Create a new (empty) path structure, with its commands and
+	coordinates stored in the given arena.
+
+	This is for paths that are built, used and dropped again by a
+	single thread, such as those of an interpreter. If the path is
+	kept or trimmed, its storage first moves out of the arena to
+	the heap, so nothing else ever points into the arena; this may
+	throw on memory failure. Otherwise the path must be dropped
+	before the arena is.
+
+	If arena is NULL, this is the same as fz_new_path.
+*/
+fz_path *fz_new_path_in_arena(fz_context *ctx, fz_arena *arena);
+
 /**
 	Increment the reference count. Returns the same pointer.
 
 	All paths can be kept, regardless of their packing type.
 
-	Never throws exceptions.
+	Never throws exceptions, except for a path made with
+	fz_new_path_in_arena (see there).
 */
 fz_path *fz_keep_path(fz_context *ctx, const fz_path *path);
 
@@ -430,6 +430,9 @@ struct fz_pixmap
 	fz_colorspace *colorspace;
 	unsigned char *samples;
 	fz_pixmap *underlying;
+	fz_memory_budget *budget;
+	size_t budget_size;
+	size_t samples_size;
 };
 
 enum
@@ -438,6 +441,43 @@ enum
 	FZ_PIXMAP_FLAG_FREE_SAMPLES = 2
 };
 
+/**
+	Pixmap sample buffers.
+
+	The draw device makes and frees full size pixmaps for every
+	transparency group, soft mask and knockout group, and renderers
+	do the same for every band. Rather than return such large
+	buffers to the allocator (only to ask for them again moments
+	later), freed sample buffers are kept in a pool shared by all
+	the contexts sharing the store, and handed out again for
+	requests of about the same size.
+
+	The pool is bounded (by default to 32MB, or a quarter of a
+	limited store), and is the first thing to be trimmed when the
+	store is scavenged.
+*/
+
+/**
+	Set the most memory the pool of freed pixmap sample buffers may
+	hold. 0 disables the pool.
+*/
+void fz_set_pixmap_pool_size(fz_context *ctx, size_t max);
+
+/**
+	Allocate a buffer for at least size bytes of samples, from the
+	pool if possible. *allocated is set to the size actually
+	allocated, which must be given to fz_drop_pixmap_samples.
+*/
+void *fz_new_pixmap_samples(fz_context *ctx, size_t size, size_t *allocated);
+
+/**
+	Free (or return to the pool) a buffer from
+	fz_new_pixmap_samples.
+
+	Never throws exceptions.
+*/
+void fz_drop_pixmap_samples(fz_context *ctx, void *samples, size_t size);
+
 /* Create a new pixmap from a warped section of another.
  *
  * Colorspace, resolution etc are inherited from the original.
@@ -65,4 +65,53 @@ size_t fz_pool_size(fz_context *ctx, fz_pool *pool);
 */
 void fz_drop_pool(fz_context *ctx, fz_pool *pool);
 
+/**
+	Arena allocators.
+
+	An arena hands out blocks for short-lived storage that is made
+	and thrown away many times over, such as the paths built while
+	interpreting a page. Small blocks come from an fz_pool, rounded
+	up to one of a few size classes. A freed block goes on the free
+	list for its class, and is handed out again by the next
+	allocation of that class, so an arena only grows as large as
+	the most storage in use at once. Larger blocks come from the
+	heap.
+
+	An arena is not thread safe; use one per thread (for example,
+	one per page being interpreted).
+*/
+typedef struct fz_arena fz_arena;
+
+/**
+	Create a new arena to allocate from.
+*/
+fz_arena *fz_new_arena(fz_context *ctx);
+
+/**
+	Allocate an uninitialised block of size bytes from the arena.
+
+	Returns NULL for size = 0. Throws exception in the event of
+	failure to allocate.
+*/
+void *fz_arena_malloc(fz_context *ctx, fz_arena *arena, size_t size);
+
+/**
+	Reallocate a block from the arena to the given size, as for
+	fz_realloc.
+*/
+void *fz_arena_realloc(fz_context *ctx, fz_arena *arena, void *p, size_t size);
+
+/**
+	Return a block to the arena, to be reused by later allocations.
+
+	fz_arena_free(ctx, arena, NULL) does nothing.
+*/
+void fz_arena_free(fz_context *ctx, fz_arena *arena, void *p);
+
+/**
+	Drop an arena, freeing and invalidating all storage returned
+	from it, whether or not it has been freed.
+*/
+void fz_drop_arena(fz_context *ctx, fz_arena *arena);
+
 #endif
@@ -163,6 +163,15 @@ void fz_drop_key_storable_key(fz_context *, const fz_key_storable *);
 	maps from a void * to a fz_store_hash structure. If
 	make_hash_key function returns 0, then the key is determined not
 	to be hashable, and the value is not stored in the hash table.
+	Lookups for such keys have to compare against every item in the
+	store in turn, so store types should make every key they can
+	hashable; keys with no convenient fixed size representation can
+	be reduced to a digest (see the 'pd' member below).
+
+	The hash is made once, when the item is stored, and is kept
+	alongside it to remove it from the hash table again; so the
+	parts of a key that go into the hash must not change while it
+	is in the store.
 
 	Some objects can be used both as values within the store, and as
 	a component of keys within the store. We refer to these objects
@@ -237,6 +246,18 @@ typedef struct
 			unsigned int copy_spots:1;
 			unsigned int bgr:1;
 		} link; /* 36 bytes */
+		struct
+		{
+			const void *font;
+			const void *model;
+			int m[4];
+			unsigned char gid, e, f, aa;
+		} gl; /* 28 or 36 bytes */
+		struct
+		{
+			const void *ptr;
+			unsigned char digest[16];
+		} pd; /* 20 or 24 bytes */
 	} u;
 } fz_store_hash; /* 40 or 44 bytes */
 
@@ -301,6 +322,22 @@ void fz_drop_store_context(fz_context *ctx);
 */
 void *fz_store_item(fz_context *ctx, void *key, void *val, size_t itemsize, const fz_store_type *type);
 
+/**
+	As fz_store_item, but with a hint as to how expensive the item
+	would be to recreate if it were evicted.
+
+	cost: The (relative) cost of recreating the item, in units of
+	the cost of producing one byte of a plain decoded pixmap. So
+	an item that takes as long to recreate as it would take to
+	fill in its own size in pixmap data has cost == itemsize; an
+	item that takes 4 times as long has cost == 4 * itemsize.
+	0 means unknown, and is treated as cost == itemsize (as are
+	all items stored with fz_store_item).
+
+	The cost is only used by the FZ_STORE_GDSF eviction policy.
+*/
+void *fz_store_item_with_cost(fz_context *ctx, void *key, void *val, size_t itemsize, float cost, const fz_store_type *type);
+
 /**
 	Find an item within the store.
 
@@ -362,6 +399,31 @@ int fz_store_scavenge(fz_context *ctx, size_t size, int *phase);
 */
 int fz_store_scavenge_external(fz_context *ctx, size_t size, int *phase);
 
+/**
+	Callback function called by fz_store_evict to choose which items
+	it may evict. Called with FZ_LOCK_ALLOC held, so it must not
+	lock, allocate or throw.
+
+	Return 1 if the item with the given value may be evicted.
+*/
+typedef int (fz_store_evict_fn)(fz_context *ctx, void *arg, fz_storable *val);
+
+/**
+	Evict at least size bytes worth of those items from the store
+	for which fn returns 1 (least wanted first, according to the
+	eviction policy), however full the store is. Used to make room
+	in a memory budget.
+
+	Unlike fz_store_scavenge, this does not give up when another
+	thread is scavenging, as that thread may not evict the items
+	we are after.
+
+	Called with FZ_LOCK_ALLOC held, as for fz_store_scavenge.
+
+	Returns non zero if anything was evicted.
+*/
+int fz_store_evict(fz_context *ctx, size_t size, fz_store_evict_fn *fn, void *arg);
+
 /**
 	Evict items from the store until the total size of
 	the objects in the store is reduced to a given percentage of its
@@ -374,6 +436,45 @@ int fz_store_scavenge_external(fz_context *ctx, size_t size, int *phase);
 */
 int fz_shrink_store(fz_context *ctx, unsigned int percent);
 
+/**
+	Eviction policies for the store.
+
+	FZ_STORE_LRU: Evict the least recently used items first. This
+	is the default.
+
+	FZ_STORE_GDSF: Greedy Dual Size Frequency. Evict the items with
+	the lowest (uses * cost / size) first, where cost is the hint
+	given to fz_store_item_with_cost. Large items that are rarely
+	reused are evicted ahead of small or expensive to recreate
+	ones. Items that stop being used age out over time. To keep
+	eviction cheap, only the few least recently used evictable
+	items are considered each time, so this is an approximation.
+*/
+enum
+{
+	FZ_STORE_LRU,
+	FZ_STORE_GDSF
+};
+
+/**
+	Set the eviction policy for the store (FZ_STORE_LRU or
+	FZ_STORE_GDSF).
+*/
+void fz_set_store_policy(fz_context *ctx, int policy);
+
+/**
+	Limit the number of bytes that items of a given store type
+	(identified by the name in its fz_store_type, for example
+	"fz_image" or "pdf_obj") may take up in the store. Items of
+	that type are evicted (according to the store policy) to stay
+	within the budget, in addition to the limit on the store as a
+	whole.
+
+	budget: The number of bytes, or FZ_STORE_UNLIMITED for no limit
+	(the default).
+*/
+void fz_set_store_budget(fz_context *ctx, const char *type_name, size_t budget);
+
 /**
 	Callback function called by fz_filter_store on every item within
 	the store.
@@ -392,10 +493,112 @@ void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const f
 
 /**
 	Output debugging information for the current state of the store
-	to the given output channel.
+	to the given output channel. This includes the number of hits,
+	misses and evictions for each type of item.
 */
 void fz_debug_store(fz_context *ctx, fz_output *out);
 
+/**
+	The maximum number of store types for which separate statistics
+	are kept. Any beyond this are counted together, as "other".
+*/
+#define FZ_STORE_MAX_TYPES 32
+
+/**
+	Statistics for one type of item in the store (see
+	fz_store_type). The type is identified by name; for example
+	"fz_image" (decoded images), "fz_icc_link" (the colour link
+	cache), "fz_t3_glyph" (rendered Type 3 glyphs), or "pdf_obj"
+	(fonts, colorspaces, functions and other resources loaded from
+	PDF objects).
+
+	items, size: The number of items of this type in the store, and
+	the number of bytes they account for.
+
+	budget: The budget set by fz_set_store_budget, or
+	FZ_STORE_UNLIMITED.
+
+	hits, misses: The number of lookups that found an item, and that
+	did not.
+
+	inserts: The number of items that have been stored.
+
+	evictions: The number of items that have been evicted to make
+	space (including those counted in scavenged).
+
+	scavenged: The number of items that have been evicted by
+	scavenging; that is, to free memory for a failed allocation, or
+	to bring the store back under its limit when items held outside
+	of it are dropped.
+*/
+typedef struct
+{
+	char name[40];
+	int items;
+	size_t size;
+	size_t budget;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t inserts;
+	uint64_t evictions;
+	uint64_t scavenged;
+} fz_store_type_stats;
+
+/**
+	Statistics for the store as a whole.
+
+	max, size: The maximum size of the store, and its current size.
+
+	items: The number of items in the store.
+
+	scavenges: The number of times the store has been scavenged.
+
+	scavenge_time: The total time spent scavenging, in
+	microseconds.
+
+	pool_max, pool_size: The most memory the pool of recycled
+	pixmap sample buffers may hold, and how much it holds now.
+
+	pool_hits, pool_misses: How many pixmap sample buffers were
+	(and were not) taken from that pool.
+
+	types: The statistics for each type of item that has been
+	stored or looked for, num_types of them.
+*/
+typedef struct
+{
+	size_t max;
+	size_t size;
+	int items;
+	uint64_t scavenges;
+	uint64_t scavenge_time;
+	size_t pool_max;
+	size_t pool_size;
+	uint64_t pool_hits;
+	uint64_t pool_misses;
+	int num_types;
+	fz_store_type_stats types[FZ_STORE_MAX_TYPES];
+} fz_store_stats;
+
+/**
+	Take a snapshot of the statistics for the store. The store is
+	only locked for as long as it takes to copy the counters, so
+	this is cheap enough to call periodically from a monitoring
+	thread (using its own cloned context).
+
+	All the counters count from the creation of the store.
+*/
+void fz_get_store_stats(fz_context *ctx, fz_store_stats *stats);
+
+/**
+	Take a snapshot of the statistics for one type of item in the
+	store, identified by name (see fz_store_type_stats).
+
+	Returns 1 if any items of that type have been stored or looked
+	for, 0 otherwise (in which case stats is all zero).
+*/
+int fz_get_store_type_stats(fz_context *ctx, const char *type_name, fz_store_type_stats *stats);
+
 /**
 	Increment the defer reap count.
 
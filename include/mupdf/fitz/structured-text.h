@@ -246,6 +246,70 @@ void fz_print_stext_page_as_text(fz_context *ctx, fz_output *out, fz_stext_page
 */
 int fz_search_stext_page(fz_context *ctx, fz_stext_page *text, const char *needle, fz_quad *quads, int max_quads);
 
+/**
+	Options for fz_new_search.
+
+	FZ_SEARCH_IGNORE_CASE: Match regardless of case, using simple
+	(one character to one character) case folding for Latin, Greek,
+	Cyrillic and Armenian.
+
+	FZ_SEARCH_IGNORE_DIACRITICS: Match regardless of accents and
+	other combining marks, so that "e" also finds "\u00e9".
+
+	FZ_SEARCH_REGEXP: The needle is a regular expression. The
+	supported syntax is ". [...] [^...] \d \w \s \D \W \S \b \B ^ $
+	| (...) (?:...) * + ? {m,n}" with lazy variants of the
+	repeats. '^' and '$' match at the start and end of a block, '.'
+	does not match across blocks.
+
+	FZ_SEARCH_KEEP_HYPHENS: Do not join words that are hyphenated
+	across a line break.
+
+	Whitespace is collapsed before matching, and line breaks within
+	a block match a single space. Whitespace in the needle does not
+	match the break between blocks; only \s in a regular expression
+	does.
+*/
+enum
+{
+	FZ_SEARCH_EXACT = 0,
+	FZ_SEARCH_IGNORE_CASE = 1,
+	FZ_SEARCH_IGNORE_DIACRITICS = 2,
+	FZ_SEARCH_REGEXP = 4,
+	FZ_SEARCH_KEEP_HYPHENS = 8,
+};
+
+/**
+	A compiled search needle, with working buffers that are reused
+	from page to page. A search may not be used by more than one
+	thread at a time.
+*/
+typedef struct fz_search fz_search;
+
+/**
+	Compile a needle for searching. Throws on invalid regular
+	expressions.
+*/
+fz_search *fz_new_search(fz_context *ctx, const char *needle, int options);
+
+void fz_drop_search(fz_context *ctx, fz_search *search);
+
+/**
+	Called once for every hit, with the quads that cover it. The
+	quads are only valid for the duration of the call.
+
+	Return non-zero to stop the search.
+*/
+typedef int (fz_search_hit_fn)(fz_context *ctx, void *arg, int num_quads, const fz_quad *quads);
+
+/**
+	Search a structured text page, calling fn for every
+	(non-overlapping, leftmost first) hit.
+
+	Returns the number of hits reported.
+*/
+int fz_run_search(fz_context *ctx, fz_search *search, fz_stext_page *page, fz_search_hit_fn *fn, void *arg);
+
 /**
 	Return a list of quads to highlight lines inside the selection
 	points.
@@ -310,6 +374,60 @@ fz_stext_options *fz_parse_stext_options(fz_context *ctx, fz_stext_options *opts
 */
 fz_device *fz_new_stext_device(fz_context *ctx, fz_stext_page *page, const fz_stext_options *options);
 
+/**
+	Function types used by the streaming text extraction device.
+
+	fz_stext_block_fn is called with each block once it is complete.
+	The block, and all the lines and chars within it, are freed as soon
+	as the call returns.
+
+	fz_stext_close_fn is called when the device is closed, after the
+	last block has been passed on.
+
+	fz_stext_drop_fn is called to destroy the state when the device is
+	dropped.
+*/
+typedef void (fz_stext_block_fn)(fz_context *ctx, void *state, fz_stext_block *block);
+typedef void (fz_stext_close_fn)(fz_context *ctx, void *state);
+typedef void (fz_stext_drop_fn)(fz_context *ctx, void *state);
+
+/**
+	Create a device to extract the text on a page, passing each block
+	on to a callback as soon as it is complete rather than gathering
+	the whole page.
+
+	The text device only ever adds text to the last block, so a block
+	is complete once the next one is started. Memory use is therefore
+	bounded by the largest block rather than by the text on the page.
+	Blocks are delivered in the same order, and with the same
+	contents, as fz_new_stext_device would store them.
+
+	mediabox: The page mediabox, used for FZ_STEXT_MEDIABOX_CLIP.
+
+	state, block, close, drop: The callbacks and the state passed to
+	them. close and drop may be NULL. If creation fails, drop is
+	called before the exception is rethrown.
+*/
+fz_device *fz_new_stext_block_device(fz_context *ctx, fz_rect mediabox, const fz_stext_options *options,
+	void *state, fz_stext_block_fn *block, fz_stext_close_fn *close, fz_stext_drop_fn *drop);
+
+/**
+	Create a device that writes the text of a page to an output as
+	it is extracted, block by block, using the same markup as the
+	fz_print_stext_page_as_* functions.
+
+	format: "text", "html", "xhtml", "stext" (or "stext.xml") or
+	"stext.json".
+
+	id: The page number to use in html, xhtml and xml output.
+
+	The page markup is finished when the device is closed, or when
+	it is dropped without being closed (for instance because the
+	page could not be interpreted), so the output is always well
+	formed.
+*/
+fz_device *fz_new_stext_output_device(fz_context *ctx, fz_output *out, const char *format, fz_rect mediabox, int id, const fz_stext_options *options);
+
 /**
 	Create a device to OCR the text on the page.
 
@@ -247,6 +247,45 @@ fz_buffer *fz_new_buffer_from_image_as_png(fz_context *ctx, fz_image *image, fz_
 */
 fz_buffer *fz_new_buffer_from_pixmap_as_png(fz_context *ctx, fz_pixmap *pixmap, fz_color_params color_params);
 
+/**
+	JPEG output
+*/
+typedef struct
+{
+	int quality;
+	int subsample;
+} fz_jpeg_options;
+
+/**
+	Parse JPEG options.
+
+	Currently defined options and values are as follows:
+
+		quality=n: Compression quality, 1 to 100 (default 90)
+		subsample=yes: Halve the chroma resolution (default)
+		subsample=no: Keep the chroma at full resolution
+*/
+fz_jpeg_options *fz_parse_jpeg_options(fz_context *ctx, fz_jpeg_options *opts, const char *args);
+
+/**
+	Create a new jpeg band writer (greyscale or RGB, without
+	alpha). Bands are compressed as they are written, so the
+	whole image need never be held in memory.
+
+	options: NULL for the defaults.
+*/
+fz_band_writer *fz_new_jpeg_band_writer(fz_context *ctx, fz_output *out, const fz_jpeg_options *options);
+
+/**
+	Write a (Greyscale or RGB) pixmap as a jpeg.
+*/
+void fz_write_pixmap_as_jpeg(fz_context *ctx, fz_output *out, const fz_pixmap *pixmap, const fz_jpeg_options *options);
+
+/**
+	Save a (Greyscale or RGB) pixmap as a jpeg.
+*/
+void fz_save_pixmap_as_jpeg(fz_context *ctx, fz_pixmap *pixmap, const char *filename, const fz_jpeg_options *options);
+
 /**
 	Save a pixmap as a pnm (greyscale or rgb, no alpha).
 */
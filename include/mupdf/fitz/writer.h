@@ -104,7 +104,7 @@ size_t fz_copy_option(fz_context *ctx, const char *val, char *dest, size_t maxle
 	path: The document name to write (or NULL for default)
 
 	format: Which format to write (currently cbz, html, pdf, pam,
-	pbm, pgm, pkm, png, ppm, pnm, svg, text, xhtml, docx, odt)
+	pbm, pgm, pkm, png, jpeg, ppm, pnm, svg, text, xhtml, docx, odt)
 
 	options: NULL, or pointer to comma separated string to control
 	file generation.
@@ -155,6 +155,7 @@ fz_document_writer *fz_new_pdfocr_writer_with_output(fz_context *ctx, fz_output
 void fz_pdfocr_writer_set_progress(fz_context *ctx, fz_document_writer *writer, int (*progress)(fz_context *, void *, int), void *);
 
 fz_document_writer *fz_new_png_pixmap_writer(fz_context *ctx, const char *path, const char *options);
+fz_document_writer *fz_new_jpeg_pixmap_writer(fz_context *ctx, const char *path, const char *options);
 fz_document_writer *fz_new_pam_pixmap_writer(fz_context *ctx, const char *path, const char *options);
 fz_document_writer *fz_new_pnm_pixmap_writer(fz_context *ctx, const char *path, const char *options);
 fz_document_writer *fz_new_pgm_pixmap_writer(fz_context *ctx, const char *path, const char *options);
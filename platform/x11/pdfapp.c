@@ -1162,9 +1162,22 @@ void pdfapp_inverthit(pdfapp_t *app)
 	}
 }
 
+static int pdfapp_collect_hit(fz_context *ctx, void *arg, int num_quads, const fz_quad *quads)
+{
+	pdfapp_t *app = arg;
+	int i;
+
+	for (i = 0; i < num_quads && app->hit_count < (int)nelem(app->hit_bbox); i++)
+		app->hit_bbox[app->hit_count++] = quads[i];
+
+	return app->hit_count == (int)nelem(app->hit_bbox);
+}
+
 static void pdfapp_search_in_direction(pdfapp_t *app, enum panning *panto, int dir)
 {
+	fz_search *search = NULL;
 	int firstpage, page;
+	int found = 0;
 
 	/* abort if no search string */
 	if (app->search[0] == 0)
@@ -1184,30 +1197,55 @@ static void pdfapp_search_in_direction(pdfapp_t *app, enum panning *panto, int d
 	if (page < 1) page = app->pagecount;
 	if (page > app->pagecount) page = 1;
 
-	do
+	/* Compile the needle once, and reuse it for every page. */
+	fz_var(search);
+	fz_var(page);
+	fz_var(found);
+	fz_try(app->ctx)
 	{
-		if (page != app->pageno)
-		{
-			app->pageno = page;
-			pdfapp_showpage(app, 1, 0, 0, 0, 1);
-		}
+		search = fz_new_search(app->ctx, app->search, FZ_SEARCH_IGNORE_CASE);
 
-		app->hit_count = fz_search_stext_page(app->ctx, app->page_text, app->search, app->hit_bbox, nelem(app->hit_bbox));
-		if (app->hit_count > 0)
+		do
 		{
-			*panto = dir == 1 ? PAN_TO_TOP : PAN_TO_BOTTOM;
-			app->searchpage = app->pageno;
-			wincursor(app, HAND);
-			winrepaint(app);
-			return;
-		}
+			if (page != app->pageno)
+			{
+				app->pageno = page;
+				pdfapp_showpage(app, 1, 0, 0, 0, 1);
+			}
 
-		page += dir;
-		if (page < 1) page = app->pagecount;
-		if (page > app->pagecount) page = 1;
-	} while (page != firstpage);
+			app->hit_count = 0;
+			if (app->page_text)
+				fz_run_search(app->ctx, search, app->page_text, pdfapp_collect_hit, app);
+			if (app->hit_count > 0)
+			{
+				found = 1;
+				break;
+			}
+
+			page += dir;
+			if (page < 1) page = app->pagecount;
+			if (page > app->pagecount) page = 1;
+		} while (page != firstpage);
+	}
+	fz_always(app->ctx)
+		fz_drop_search(app->ctx, search);
+	fz_catch(app->ctx)
+	{
+		pdfapp_warn(app, "Cannot search for '%s': %s", app->search, fz_caught_message(app->ctx));
+		found = -1;
+	}
+
+	if (found > 0)
+	{
+		*panto = dir == 1 ? PAN_TO_TOP : PAN_TO_BOTTOM;
+		app->searchpage = app->pageno;
+		wincursor(app, HAND);
+		winrepaint(app);
+		return;
+	}
 
-	pdfapp_warn(app, "String '%s' not found.", app->search);
+	if (found == 0)
+		pdfapp_warn(app, "String '%s' not found.", app->search);
 
 	app->pageno = firstpage;
 	pdfapp_showpage(app, 1, 0, 0, 0, 0);
@@ -36,6 +36,8 @@ typedef struct
 {
 	fz_document super;
 	fz_buffer *buffer;
+	fz_stream *file;
+	unsigned *tiff_ifds;
 	const char *format;
 	int page_count;
 	fz_pixmap *(*load_subimage)(fz_context *ctx, const unsigned char *p, size_t total, int subimage);
@@ -46,6 +48,8 @@ img_drop_document(fz_context *ctx, fz_document *doc_)
 {
 	img_document *doc = (img_document*)doc_;
 	fz_drop_buffer(ctx, doc->buffer);
+	fz_drop_stream(ctx, doc->file);
+	fz_free(ctx, doc->tiff_ifds);
 }
 
 static int
@@ -129,7 +133,11 @@ img_load_page(fz_context *ctx, fz_document *doc_, int chapter, int number)
 
 	fz_try(ctx)
 	{
-		if (doc->load_subimage)
+		if (doc->tiff_ifds)
+		{
+			image = fz_new_image_from_tiff_subimage(ctx, doc->file, doc->tiff_ifds[number]);
+		}
+		else if (doc->load_subimage)
 		{
 			size_t len;
 			unsigned char *data;
@@ -188,42 +196,61 @@ img_open_document_with_stream(fz_context *ctx, fz_stream *file)
 		int fmt;
 		size_t len;
 		unsigned char *data;
+		unsigned char head[8];
 
-		doc->buffer = fz_read_all(ctx, file, 0);
-		len = fz_buffer_storage(ctx, doc->buffer, &data);
-
+		/* Multi-page TIFF files can be large; when we can seek the
+		 * stream, read them a page at a time rather than all at once. */
 		fmt = FZ_IMAGE_UNKNOWN;
-		if (len >= 8)
-			fmt = fz_recognize_image_format(ctx, data);
-		if (fmt == FZ_IMAGE_TIFF)
-		{
-			doc->page_count = fz_load_tiff_subimage_count(ctx, data, len);
-			doc->load_subimage = fz_load_tiff_subimage;
-			doc->format = "TIFF";
-		}
-		else if (fmt == FZ_IMAGE_PNM)
+		if (file->seek)
 		{
-			doc->page_count = fz_load_pnm_subimage_count(ctx, data, len);
-			doc->load_subimage = fz_load_pnm_subimage;
-			doc->format = "PNM";
+			if (fz_read(ctx, file, head, 8) == 8)
+				fmt = fz_recognize_image_format(ctx, head);
+			fz_seek(ctx, file, 0, SEEK_SET);
 		}
-		else if (fmt == FZ_IMAGE_JBIG2)
-		{
-			doc->page_count = fz_load_jbig2_subimage_count(ctx, data, len);
-			if (doc->page_count > 1)
-				doc->load_subimage = fz_load_jbig2_subimage;
-			doc->format = "JBIG2";
-		}
-		else if (fmt == FZ_IMAGE_BMP)
+		if (fmt == FZ_IMAGE_TIFF)
 		{
-			doc->page_count = fz_load_bmp_subimage_count(ctx, data, len);
-			doc->load_subimage = fz_load_bmp_subimage;
-			doc->format = "BMP";
+			doc->file = fz_keep_stream(ctx, file);
+			doc->page_count = fz_load_tiff_subimage_offsets(ctx, file, &doc->tiff_ifds);
+			doc->format = "TIFF";
 		}
 		else
 		{
-			doc->page_count = 1;
-			doc->format = "Image";
+			doc->buffer = fz_read_all(ctx, file, 0);
+			len = fz_buffer_storage(ctx, doc->buffer, &data);
+
+			fmt = FZ_IMAGE_UNKNOWN;
+			if (len >= 8)
+				fmt = fz_recognize_image_format(ctx, data);
+			if (fmt == FZ_IMAGE_TIFF)
+			{
+				doc->page_count = fz_load_tiff_subimage_count(ctx, data, len);
+				doc->load_subimage = fz_load_tiff_subimage;
+				doc->format = "TIFF";
+			}
+			else if (fmt == FZ_IMAGE_PNM)
+			{
+				doc->page_count = fz_load_pnm_subimage_count(ctx, data, len);
+				doc->load_subimage = fz_load_pnm_subimage;
+				doc->format = "PNM";
+			}
+			else if (fmt == FZ_IMAGE_JBIG2)
+			{
+				doc->page_count = fz_load_jbig2_subimage_count(ctx, data, len);
+				if (doc->page_count > 1)
+					doc->load_subimage = fz_load_jbig2_subimage;
+				doc->format = "JBIG2";
+			}
+			else if (fmt == FZ_IMAGE_BMP)
+			{
+				doc->page_count = fz_load_bmp_subimage_count(ctx, data, len);
+				doc->load_subimage = fz_load_bmp_subimage;
+				doc->format = "BMP";
+			}
+			else
+			{
+				doc->page_count = 1;
+				doc->format = "Image";
+			}
 		}
 	}
 	fz_catch(ctx)
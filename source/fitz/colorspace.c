@@ -39,16 +39,6 @@ void fz_new_colorspace_context(fz_context *ctx)
 {
 	fz_colorspace_context *cct;
 
-	fz_buffer *gray = NULL;
-	fz_buffer *rgb = NULL;
-	fz_buffer *cmyk = NULL;
-	fz_buffer *lab = NULL;
-
-	fz_var(gray);
-	fz_var(rgb);
-	fz_var(cmyk);
-	fz_var(lab);
-
 	cct = ctx->colorspace = fz_malloc_struct(ctx, fz_colorspace_context);
 	cct->ctx_refs = 1;
 
@@ -56,29 +46,49 @@ void fz_new_colorspace_context(fz_context *ctx)
 
 	ctx->icc_enabled = 1;
 
-	fz_try(ctx)
+	/* The device colorspaces are made on first use (see
+	 * device_colorspace), as parsing their ICC profiles is most of
+	 * the cost of making a context. */
+}
+
+static fz_colorspace *
+new_device_colorspace(fz_context *ctx, enum fz_colorspace_type type)
+{
+	const unsigned char *data;
+	size_t len;
+	const char *name;
+	fz_buffer *buf;
+	fz_colorspace *cs = NULL;
+
+	switch (type)
 	{
-		gray = fz_new_buffer_from_shared_data(ctx, resources_icc_gray_icc, resources_icc_gray_icc_len);
-		rgb = fz_new_buffer_from_shared_data(ctx, resources_icc_rgb_icc, resources_icc_rgb_icc_len);
-		cmyk = fz_new_buffer_from_shared_data(ctx, resources_icc_cmyk_icc, resources_icc_cmyk_icc_len);
-		lab = fz_new_buffer_from_shared_data(ctx, resources_icc_lab_icc, resources_icc_lab_icc_len);
-		cct->gray = fz_new_icc_colorspace(ctx, FZ_COLORSPACE_GRAY, FZ_COLORSPACE_IS_DEVICE, "DeviceGray", gray);
-		cct->rgb = fz_new_icc_colorspace(ctx, FZ_COLORSPACE_RGB, FZ_COLORSPACE_IS_DEVICE, "DeviceRGB", rgb);
-		cct->bgr = fz_new_icc_colorspace(ctx, FZ_COLORSPACE_BGR, FZ_COLORSPACE_IS_DEVICE, "DeviceBGR", rgb);
-		cct->cmyk = fz_new_icc_colorspace(ctx, FZ_COLORSPACE_CMYK, FZ_COLORSPACE_IS_DEVICE, "DeviceCMYK", cmyk);
-		cct->lab = fz_new_icc_colorspace(ctx, FZ_COLORSPACE_LAB, FZ_COLORSPACE_IS_DEVICE, "Lab", lab);
+	default:
+	case FZ_COLORSPACE_GRAY:
+		data = resources_icc_gray_icc, len = resources_icc_gray_icc_len, name = "DeviceGray";
+		break;
+	case FZ_COLORSPACE_RGB:
+		data = resources_icc_rgb_icc, len = resources_icc_rgb_icc_len, name = "DeviceRGB";
+		break;
+	case FZ_COLORSPACE_BGR:
+		data = resources_icc_rgb_icc, len = resources_icc_rgb_icc_len, name = "DeviceBGR";
+		break;
+	case FZ_COLORSPACE_CMYK:
+		data = resources_icc_cmyk_icc, len = resources_icc_cmyk_icc_len, name = "DeviceCMYK";
+		break;
+	case FZ_COLORSPACE_LAB:
+		data = resources_icc_lab_icc, len = resources_icc_lab_icc_len, name = "Lab";
+		break;
 	}
+
+	buf = fz_new_buffer_from_shared_data(ctx, data, len);
+	fz_try(ctx)
+		cs = fz_new_icc_colorspace(ctx, type, FZ_COLORSPACE_IS_DEVICE, name, buf);
 	fz_always(ctx)
-	{
-		fz_drop_buffer(ctx, gray);
-		fz_drop_buffer(ctx, rgb);
-		fz_drop_buffer(ctx, cmyk);
-		fz_drop_buffer(ctx, lab);
-	}
+		fz_drop_buffer(ctx, buf);
 	fz_catch(ctx)
-	{
 		fz_rethrow(ctx);
-	}
+
+	return cs;
 }
 
 void fz_enable_icc(fz_context *ctx)
@@ -100,11 +110,25 @@ void fz_new_colorspace_context(fz_context *ctx)
 	cct = ctx->colorspace = fz_malloc_struct(ctx, fz_colorspace_context);
 	cct->ctx_refs = 1;
 
-	cct->gray = fz_new_colorspace(ctx, FZ_COLORSPACE_GRAY, FZ_COLORSPACE_IS_DEVICE, 1, "DeviceGray");
-	cct->rgb = fz_new_colorspace(ctx, FZ_COLORSPACE_RGB, FZ_COLORSPACE_IS_DEVICE, 3, "DeviceRGB");
-	cct->bgr = fz_new_colorspace(ctx, FZ_COLORSPACE_BGR, FZ_COLORSPACE_IS_DEVICE, 3, "DeviceBGR");
-	cct->cmyk = fz_new_colorspace(ctx, FZ_COLORSPACE_CMYK, FZ_COLORSPACE_IS_DEVICE, 4, "DeviceCMYK");
-	cct->lab = fz_new_colorspace(ctx, FZ_COLORSPACE_LAB, FZ_COLORSPACE_IS_DEVICE, 3, "Lab");
+}
+
+static fz_colorspace *
+new_device_colorspace(fz_context *ctx, enum fz_colorspace_type type)
+{
+	switch (type)
+	{
+	default:
+	case FZ_COLORSPACE_GRAY:
+		return fz_new_colorspace(ctx, FZ_COLORSPACE_GRAY, FZ_COLORSPACE_IS_DEVICE, 1, "DeviceGray");
+	case FZ_COLORSPACE_RGB:
+		return fz_new_colorspace(ctx, FZ_COLORSPACE_RGB, FZ_COLORSPACE_IS_DEVICE, 3, "DeviceRGB");
+	case FZ_COLORSPACE_BGR:
+		return fz_new_colorspace(ctx, FZ_COLORSPACE_BGR, FZ_COLORSPACE_IS_DEVICE, 3, "DeviceBGR");
+	case FZ_COLORSPACE_CMYK:
+		return fz_new_colorspace(ctx, FZ_COLORSPACE_CMYK, FZ_COLORSPACE_IS_DEVICE, 4, "DeviceCMYK");
+	case FZ_COLORSPACE_LAB:
+		return fz_new_colorspace(ctx, FZ_COLORSPACE_LAB, FZ_COLORSPACE_IS_DEVICE, 3, "Lab");
+	}
 }
 
 void fz_enable_icc(fz_context *ctx)
@@ -141,29 +165,72 @@ void fz_drop_colorspace_context(fz_context *ctx)
 	}
 }
 
+/* Return the device colorspace held in slot, making it on first use.
+ * Contexts sharing the colorspace context may race to make it; the
+ * first to finish wins, and the others drop theirs. */
+static fz_colorspace *
+device_colorspace(fz_context *ctx, fz_colorspace **slot, enum fz_colorspace_type type)
+{
+	fz_colorspace *cs, *made;
+
+#if FZ_ATOMIC_REFS
+	cs = fz_load_ptr_acquire(slot);
+#else
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	cs = *slot;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+#endif
+	if (cs)
+		return cs;
+
+	made = new_device_colorspace(ctx, type);
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	cs = *slot;
+	if (!cs)
+	{
+		fz_store_ptr_release(slot, made);
+		cs = made;
+		made = NULL;
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	fz_drop_colorspace(ctx, made);
+	return cs;
+}
+
 fz_colorspace *fz_device_gray(fz_context *ctx)
 {
-	return ctx->colorspace->gray;
+	return device_colorspace(ctx, &ctx->colorspace->gray, FZ_COLORSPACE_GRAY);
 }
 
 fz_colorspace *fz_device_rgb(fz_context *ctx)
 {
-	return ctx->colorspace->rgb;
+	return device_colorspace(ctx, &ctx->colorspace->rgb, FZ_COLORSPACE_RGB);
 }
 
 fz_colorspace *fz_device_bgr(fz_context *ctx)
 {
-	return ctx->colorspace->bgr;
+	return device_colorspace(ctx, &ctx->colorspace->bgr, FZ_COLORSPACE_BGR);
 }
 
 fz_colorspace *fz_device_cmyk(fz_context *ctx)
 {
-	return ctx->colorspace->cmyk;
+	return device_colorspace(ctx, &ctx->colorspace->cmyk, FZ_COLORSPACE_CMYK);
 }
 
 fz_colorspace *fz_device_lab(fz_context *ctx)
 {
-	return ctx->colorspace->lab;
+	return device_colorspace(ctx, &ctx->colorspace->lab, FZ_COLORSPACE_LAB);
+}
+
+void fz_warm_colorspace_context(fz_context *ctx)
+{
+	(void)fz_device_gray(ctx);
+	(void)fz_device_rgb(ctx);
+	(void)fz_device_bgr(ctx);
+	(void)fz_device_cmyk(ctx);
+	(void)fz_device_lab(ctx);
 }
 
 /* Same order as needed by LCMS */
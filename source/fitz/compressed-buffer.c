@@ -39,12 +39,18 @@ fz_drop_compressed_buffer(fz_context *ctx, fz_compressed_buffer *buf)
 
 fz_stream *
 fz_open_image_decomp_stream_from_buffer(fz_context *ctx, fz_compressed_buffer *buffer, int *l2factor)
+{
+	return fz_open_image_decomp_stream_from_buffer_subarea(ctx, buffer, l2factor, NULL, NULL);
+}
+
+fz_stream *
+fz_open_image_decomp_stream_from_buffer_subarea(fz_context *ctx, fz_compressed_buffer *buffer, int *l2factor, const fz_irect *subarea, int *cropped)
 {
 	fz_stream *head, *tail;
 
 	tail = fz_open_buffer(ctx, buffer->buffer);
 	fz_try(ctx)
-		head = fz_open_image_decomp_stream(ctx, tail, &buffer->params, l2factor);
+		head = fz_open_image_decomp_stream_subarea(ctx, tail, &buffer->params, l2factor, subarea, cropped);
 	fz_always(ctx)
 		fz_drop_stream(ctx, tail);
 	fz_catch(ctx)
@@ -54,12 +60,21 @@ fz_open_image_decomp_stream_from_buffer(fz_context *ctx, fz_compressed_buffer *b
 
 fz_stream *
 fz_open_image_decomp_stream(fz_context *ctx, fz_stream *tail, fz_compression_params *params, int *l2factor)
+{
+	return fz_open_image_decomp_stream_subarea(ctx, tail, params, l2factor, NULL, NULL);
+}
+
+fz_stream *
+fz_open_image_decomp_stream_subarea(fz_context *ctx, fz_stream *tail, fz_compression_params *params, int *l2factor, const fz_irect *subarea, int *cropped)
 {
 	fz_stream *head = NULL, *body = NULL;
 	int our_l2factor = 0;
 
 	fz_var(body);
 
+	if (cropped)
+		*cropped = 0;
+
 	fz_try(ctx)
 	{
 		switch (params->type)
@@ -87,7 +102,9 @@ fz_open_image_decomp_stream(fz_context *ctx, fz_stream *tail, fz_compression_par
 					our_l2factor = 3;
 				*l2factor -= our_l2factor;
 			}
-			head = fz_open_dctd(ctx, tail, params->u.jpeg.color_transform, our_l2factor, NULL);
+			head = fz_open_dctd_subarea(ctx, tail, params->u.jpeg.color_transform, our_l2factor, NULL, subarea);
+			if (subarea && cropped)
+				*cropped = 1;
 			break;
 
 		case FZ_IMAGE_JBIG2:
@@ -99,16 +116,14 @@ fz_open_image_decomp_stream(fz_context *ctx, fz_stream *tail, fz_compression_par
 			break;
 
 		case FZ_IMAGE_FLATE:
-			head = fz_open_flated(ctx, tail, 15);
 			if (params->u.flate.predictor > 1)
-			{
-				body = head;
-				head = fz_open_predict(ctx, body,
+				head = fz_open_flated_predict(ctx, tail, 15,
 						params->u.flate.predictor,
 						params->u.flate.columns,
 						params->u.flate.colors,
 						params->u.flate.bpc);
-			}
+			else
+				head = fz_open_flated(ctx, tail, 15);
 			break;
 
 		case FZ_IMAGE_LZW:
@@ -94,6 +94,7 @@ static void fz_new_tuning_context(fz_context *ctx)
 		ctx->tuning->refs = 1;
 		ctx->tuning->image_decode = fz_default_image_decode;
 		ctx->tuning->image_scale = fz_default_image_scale;
+		ctx->tuning->image_decode_threads = 1;
 	}
 }
 
@@ -126,6 +127,36 @@ void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, v
 	ctx->tuning->image_scale_arg = arg;
 }
 
+void fz_set_image_decode_threads(fz_context *ctx, int threads)
+{
+	ctx->tuning->image_decode_threads = fz_maxi(threads, 1);
+}
+
+int fz_image_decode_threads(fz_context *ctx)
+{
+	return ctx->tuning->image_decode_threads;
+}
+
+void fz_set_image_tile_compression(fz_context *ctx, int compress)
+{
+	ctx->tuning->image_tile_compression = !!compress;
+}
+
+int fz_image_tile_compression(fz_context *ctx)
+{
+	return ctx->tuning->image_tile_compression;
+}
+
+void fz_set_page_arenas(fz_context *ctx, int use)
+{
+	ctx->tuning->page_arenas = !!use;
+}
+
+int fz_page_arenas(fz_context *ctx)
+{
+	return ctx->tuning->page_arenas;
+}
+
 static void fz_init_random_context(fz_context *ctx)
 {
 	if (!ctx)
@@ -149,6 +180,7 @@ fz_drop_context(fz_context *ctx)
 		return;
 
 	/* Other finalisation calls go here (in reverse order) */
+	fz_drop_memory_budget(ctx, ctx->budget);
 	fz_drop_document_handler_context(ctx);
 	fz_drop_glyph_cache_context(ctx);
 	fz_drop_store_context(ctx);
@@ -232,6 +264,18 @@ fz_new_context_imp(const fz_alloc_context *alloc, const fz_locks_context *locks,
 	return ctx;
 }
 
+/* Copy everything but the exception stack (which is large, and reset
+ * here anyway) from one context to another. */
+static void
+copy_context_state(fz_context *dst, const fz_context *src)
+{
+	memcpy(dst, src, offsetof(fz_context, error));
+	dst->error.print_user = src->error.print_user;
+	dst->error.print = src->error.print;
+	memcpy(&dst->warn, &src->warn, sizeof(fz_context) - offsetof(fz_context, warn));
+	fz_init_error_context(dst);
+}
+
 fz_context *
 fz_clone_context(fz_context *ctx)
 {
@@ -246,11 +290,12 @@ fz_clone_context(fz_context *ctx)
 	if (!new_ctx)
 		return NULL;
 
-	/* First copy old context, including pointers to shared contexts */
-	memcpy(new_ctx, ctx, sizeof (fz_context));
+	/* First copy old context, including pointers to shared contexts,
+	 * with the error context reset to its initial state. */
+	copy_context_state(new_ctx, ctx);
 
-	/* Reset error context to initial state. */
-	fz_init_error_context(new_ctx);
+	/* Statistics are counted per context. */
+	memset(&new_ctx->glyph_metrics, 0, sizeof new_ctx->glyph_metrics);
 
 	/* Then keep lock checking happy by keeping shared contexts with new context */
 	fz_keep_document_handler_context(new_ctx);
@@ -260,10 +305,128 @@ fz_clone_context(fz_context *ctx)
 	fz_keep_colorspace_context(new_ctx);
 	fz_keep_store_context(new_ctx);
 	fz_keep_glyph_cache(new_ctx);
+	fz_keep_memory_budget(new_ctx, new_ctx->budget);
 
 	return new_ctx;
 }
 
+/* Workers are cloned from, and reset to, a private clone of the base
+ * context rather than the base context itself. The base may be in use
+ * by its own thread at the same time, and we don't want to copy its
+ * pending warnings either. */
+struct fz_context_pool
+{
+	fz_context *model;
+	int len, max;
+	fz_context **workers;
+};
+
+fz_context_pool *
+fz_new_context_pool(fz_context *ctx, int max)
+{
+	fz_context_pool *pool;
+
+	if (ctx->locks.lock == fz_locks_default.lock && ctx->locks.unlock == fz_locks_default.unlock)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot pool contexts without locking functions");
+
+	pool = fz_malloc_struct(ctx, fz_context_pool);
+	fz_try(ctx)
+	{
+		pool->workers = fz_malloc_array(ctx, fz_maxi(max, 1), fz_context *);
+		pool->model = fz_clone_context(ctx);
+		if (!pool->model)
+			fz_throw(ctx, FZ_ERROR_MEMORY, "cannot clone context for pool");
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, pool->workers);
+		fz_free(ctx, pool);
+		fz_rethrow(ctx);
+	}
+	pool->model->warn.count = 0;
+	pool->model->warn.message[0] = 0;
+	pool->max = max;
+
+	return pool;
+}
+
+void
+fz_drop_context_pool(fz_context *ctx, fz_context_pool *pool)
+{
+	int i;
+
+	if (!pool)
+		return;
+
+	for (i = 0; i < pool->len; i++)
+		fz_drop_context(pool->workers[i]);
+	fz_drop_context(pool->model);
+	fz_free(ctx, pool->workers);
+	fz_free(ctx, pool);
+}
+
+/* The pool is used from many threads at once, each without a context of
+ * its own yet, so we call the lock functions directly rather than through
+ * fz_lock (whose debugging checks track the holder by context). */
+static void
+lock_pool(fz_context_pool *pool)
+{
+	pool->model->locks.lock(pool->model->locks.user, FZ_LOCK_ALLOC);
+}
+
+static void
+unlock_pool(fz_context_pool *pool)
+{
+	pool->model->locks.unlock(pool->model->locks.user, FZ_LOCK_ALLOC);
+}
+
+fz_context *
+fz_acquire_worker_context(fz_context_pool *pool)
+{
+	fz_context *worker = NULL;
+
+	lock_pool(pool);
+	if (pool->len > 0)
+		worker = pool->workers[--pool->len];
+	unlock_pool(pool);
+
+	if (!worker)
+		worker = fz_clone_context(pool->model);
+
+	return worker;
+}
+
+void
+fz_release_worker_context(fz_context_pool *pool, fz_context *worker)
+{
+	fz_context *model = pool->model;
+
+	if (!worker)
+		return;
+
+	assert(worker->error.top == worker->error.stack);
+
+	/* Undo anything the task changed on its own context, so that the
+	 * next one starts out just as a fresh clone would. */
+	fz_flush_warnings(worker);
+	if (worker->budget != model->budget)
+	{
+		fz_drop_memory_budget(worker, worker->budget);
+		fz_keep_memory_budget(worker, model->budget);
+	}
+	copy_context_state(worker, model);
+
+	lock_pool(pool);
+	if (pool->len < pool->max)
+	{
+		pool->workers[pool->len++] = worker;
+		worker = NULL;
+	}
+	unlock_pool(pool);
+
+	fz_drop_context(worker);
+}
+
 void fz_set_user_context(fz_context *ctx, void *user)
 {
 	if (ctx != NULL)
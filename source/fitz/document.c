@@ -678,16 +678,32 @@ fz_keep_page_locked(fz_context *ctx, fz_page *page)
 void
 fz_drop_page(fz_context *ctx, fz_page *page)
 {
-	if (fz_drop_imp(ctx, page, &page->refs))
+	int drop = 0;
+
+	if (page == NULL)
+		return;
+
+	/* Other threads can find (and keep) pages in the list of open
+	 * pages under the alloc lock, so drop the reference and take
+	 * the page off the list while holding it too. */
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (fz_load_refs(&page->refs) > 0)
+	{
+		(void)Memento_dropIntRef(page);
+		drop = fz_dec_refs(&page->refs) == 0;
+	}
+	if (drop)
 	{
 		/* Remove page from the list of open pages */
-		fz_lock(ctx, FZ_LOCK_ALLOC);
 		if (page->next != NULL)
 			page->next->prev = page->prev;
 		if (page->prev != NULL)
 			*page->prev = page->next;
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
 
+	if (drop)
+	{
 		if (page->drop_page)
 			page->drop_page(ctx, page);
 
@@ -2927,14 +2927,8 @@ fz_draw_close_device(fz_context *ctx, fz_device *devp)
 }
 
 static void
-fz_draw_drop_device(fz_context *ctx, fz_device *devp)
+unwind_draw_stack(fz_context *ctx, fz_draw_device *dev)
 {
-	fz_draw_device *dev = (fz_draw_device*)devp;
-	fz_rasterizer *rast = dev->rast;
-
-	fz_drop_default_colorspaces(ctx, dev->default_cs);
-	fz_drop_colorspace(ctx, dev->proof_cs);
-
 	/* pop and free the stacks */
 	for (; dev->top > 0; dev->top--)
 	{
@@ -2953,6 +2947,18 @@ fz_draw_drop_device(fz_context *ctx, fz_device *devp)
 	 * 1) dest is passed in and ownership remains with the caller.
 	 * 2) shape and mask are NULL at level 0.
 	 */
+}
+
+static void
+fz_draw_drop_device(fz_context *ctx, fz_device *devp)
+{
+	fz_draw_device *dev = (fz_draw_device*)devp;
+	fz_rasterizer *rast = dev->rast;
+
+	fz_drop_default_colorspaces(ctx, dev->default_cs);
+	fz_drop_colorspace(ctx, dev->proof_cs);
+
+	unwind_draw_stack(ctx, dev);
 
 	if (dev->stack != &dev->init_stack[0])
 		fz_free(ctx, dev->stack);
@@ -2962,11 +2968,9 @@ fz_draw_drop_device(fz_context *ctx, fz_device *devp)
 	fz_drop_shade_color_cache(ctx, dev->shade_cache);
 }
 
-static fz_device *
-new_draw_device(fz_context *ctx, fz_matrix transform, fz_pixmap *dest, const fz_aa_context *aa, const fz_irect *clip, fz_colorspace *proof_cs)
+static void
+init_draw_device_procs(fz_draw_device *dev)
 {
-	fz_draw_device *dev = fz_new_derived_device(ctx, fz_draw_device);
-
 	dev->super.drop_device = fz_draw_drop_device;
 	dev->super.close_device = fz_draw_close_device;
 
@@ -2998,14 +3002,17 @@ new_draw_device(fz_context *ctx, fz_matrix transform, fz_pixmap *dest, const fz_
 
 	dev->super.render_flags = fz_draw_render_flags;
 	dev->super.set_default_colorspaces = fz_draw_set_default_colorspaces;
+}
 
-	dev->proof_cs = fz_keep_colorspace(ctx, proof_cs);
+/* Set up the bottom of the stack to draw onto dest, leaving the
+ * stack itself (which may have grown) in place. */
+static void
+init_draw_device_state(fz_context *ctx, fz_draw_device *dev, fz_matrix transform, fz_pixmap *dest, const fz_irect *clip)
+{
 	dev->transform = transform;
 	dev->flags = 0;
 	dev->resolve_spots = 0;
 	dev->top = 0;
-	dev->stack = &dev->init_stack[0];
-	dev->stack_cap = STACK_SIZE;
 	dev->stack[0].dest = dest;
 	dev->stack[0].shape = NULL;
 	dev->stack[0].group_alpha = NULL;
@@ -3051,6 +3058,19 @@ new_draw_device(fz_context *ctx, fz_matrix transform, fz_pixmap *dest, const fz_
 #else
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Spot rendering (and overprint/overprint simulation) not available in this build");
 #endif
+}
+
+static fz_device *
+new_draw_device(fz_context *ctx, fz_matrix transform, fz_pixmap *dest, const fz_aa_context *aa, const fz_irect *clip, fz_colorspace *proof_cs)
+{
+	fz_draw_device *dev = fz_new_derived_device(ctx, fz_draw_device);
+
+	init_draw_device_procs(dev);
+
+	dev->proof_cs = fz_keep_colorspace(ctx, proof_cs);
+	dev->stack = &dev->init_stack[0];
+	dev->stack_cap = STACK_SIZE;
+	init_draw_device_state(ctx, dev, transform, dest, clip);
 
 	fz_try(ctx)
 	{
@@ -3099,6 +3119,94 @@ fz_new_draw_device_type3(fz_context *ctx, fz_matrix transform, fz_pixmap *dest)
 	return (fz_device*)dev;
 }
 
+struct fz_render_session
+{
+	fz_draw_device *dev;
+	int active;
+};
+
+fz_render_session *
+fz_new_render_session(fz_context *ctx)
+{
+	return fz_malloc_struct(ctx, fz_render_session);
+}
+
+void
+fz_drop_render_session(fz_context *ctx, fz_render_session *session)
+{
+	if (!session)
+		return;
+	if (session->dev)
+		fz_drop_device(ctx, &session->dev->super);
+	fz_free(ctx, session);
+}
+
+fz_device *
+fz_begin_render_session(fz_context *ctx, fz_render_session *session, fz_matrix transform, fz_pixmap *dest, const fz_irect *clip)
+{
+	fz_draw_device *dev = session->dev;
+
+	if (session->active)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "render session already in use");
+
+	if (!dev)
+	{
+		session->dev = (fz_draw_device *)new_draw_device(ctx, transform, dest, NULL, clip, NULL);
+		session->active = 1;
+		return &session->dev->super;
+	}
+
+#ifndef AA_BITS
+	/* The rasterizer (and the edge lists it has grown) can be kept
+	 * unless the antialiasing level now calls for a different kind. */
+	if (dev->rast->aa.bits != ctx->aa.bits && (dev->rast->aa.bits >= 9 || ctx->aa.bits >= 9))
+	{
+		fz_rasterizer *rast = fz_new_rasterizer(ctx, NULL);
+		fz_drop_rasterizer(ctx, dev->rast);
+		dev->rast = rast;
+	}
+	else
+		dev->rast->aa = ctx->aa;
+#endif
+
+	/* Closing the device disabled it; put it back as new, but keep
+	 * the rasterizer, scale caches, shade cache and grown stack. */
+	fz_drop_default_colorspaces(ctx, dev->default_cs);
+	dev->default_cs = NULL;
+	init_draw_device_procs(dev);
+	dev->super.hints = 0;
+	dev->super.flags = 0;
+	dev->super.container_len = 0;
+	init_draw_device_state(ctx, dev, transform, dest, clip);
+
+	session->active = 1;
+	return &dev->super;
+}
+
+void
+fz_end_render_session(fz_context *ctx, fz_render_session *session)
+{
+	fz_draw_device *dev = session->dev;
+
+	if (!session->active)
+		return;
+
+	/* A render that was abandoned part way through leaves items on
+	 * the stack; just throw them away rather than complaining. */
+	if (dev->top > dev->resolve_spots)
+		dev->super.close_device = NULL;
+
+	fz_try(ctx)
+		fz_close_device(ctx, &dev->super);
+	fz_always(ctx)
+	{
+		unwind_draw_stack(ctx, dev);
+		session->active = 0;
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
 fz_irect *
 fz_bound_path_accurate(fz_context *ctx, fz_irect *bbox, fz_irect scissor, const fz_path *path, const fz_stroke_state *stroke, fz_matrix ctm, float flatness, float linewidth)
 {
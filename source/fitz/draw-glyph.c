@@ -31,6 +31,9 @@
 #define MAX_GLYPH_SIZE 256
 #define MAX_CACHE_SIZE (1024*1024)
 
+/* Type3 glyphs up to this size (in pixels) are kept in the store. */
+#define MAX_T3_GLYPH_SIZE 1024
+
 #define GLYPH_HASH_LEN 509
 
 typedef struct
@@ -58,10 +61,12 @@ struct fz_glyph_cache
 {
 	int refs;
 	size_t total;
-#ifndef NDEBUG
-	int num_evictions;
-	ptrdiff_t evicted;
-#endif
+	int items;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t inserts;
+	uint64_t num_evictions;
+	size_t evicted;
 	fz_glyph_cache_entry *entry[GLYPH_HASH_LEN];
 	fz_glyph_cache_entry *lru_head;
 	fz_glyph_cache_entry *lru_tail;
@@ -101,6 +106,7 @@ drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_entry *entry)
 	else
 		cache->lru_head = entry->lru_next;
 	cache->total -= fz_glyph_size(ctx, entry->val);
+	cache->items--;
 	if (entry->bucket_next)
 		entry->bucket_next->bucket_prev = entry->bucket_prev;
 	if (entry->bucket_prev)
@@ -126,6 +132,93 @@ do_purge(fz_context *ctx)
 	}
 
 	cache->total = 0;
+	cache->items = 0;
+}
+
+/*
+	Rendered Type3 glyphs live in the store rather than the glyph
+	cache. They are expensive to make (the charproc has to be run
+	through the draw device), can be coloured, and can be large, so we
+	want them bounded by the overall store limit and evicted along with
+	everything else.
+*/
+typedef struct
+{
+	int refs;
+	fz_font *font;
+	fz_colorspace *model;
+	int a, b, c, d;
+	unsigned char gid, e, f, aa;
+} fz_t3_glyph_key;
+
+static int
+fz_make_hash_t3_glyph_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	fz_t3_glyph_key *key = (fz_t3_glyph_key *)key_;
+	hash->u.gl.font = key->font;
+	hash->u.gl.model = key->model;
+	hash->u.gl.m[0] = key->a;
+	hash->u.gl.m[1] = key->b;
+	hash->u.gl.m[2] = key->c;
+	hash->u.gl.m[3] = key->d;
+	hash->u.gl.gid = key->gid;
+	hash->u.gl.e = key->e;
+	hash->u.gl.f = key->f;
+	hash->u.gl.aa = key->aa;
+	return 1;
+}
+
+static void *
+fz_keep_t3_glyph_key(fz_context *ctx, void *key_)
+{
+	fz_t3_glyph_key *key = (fz_t3_glyph_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+fz_drop_t3_glyph_key(fz_context *ctx, void *key_)
+{
+	fz_t3_glyph_key *key = (fz_t3_glyph_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+	{
+		fz_drop_font(ctx, key->font);
+		fz_drop_colorspace(ctx, key->model);
+		fz_free(ctx, key);
+	}
+}
+
+static int
+fz_cmp_t3_glyph_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	fz_t3_glyph_key *k0 = (fz_t3_glyph_key *)k0_;
+	fz_t3_glyph_key *k1 = (fz_t3_glyph_key *)k1_;
+	return k0->font == k1->font && k0->model == k1->model && k0->gid == k1->gid &&
+		k0->a == k1->a && k0->b == k1->b && k0->c == k1->c && k0->d == k1->d &&
+		k0->e == k1->e && k0->f == k1->f && k0->aa == k1->aa;
+}
+
+static void
+fz_format_t3_glyph_key(fz_context *ctx, char *s, size_t n, void *key_)
+{
+	fz_t3_glyph_key *key = (fz_t3_glyph_key *)key_;
+	fz_snprintf(s, n, "(t3 glyph %s %d%s)", fz_font_name(ctx, key->font), key->gid, key->model ? " color" : "");
+}
+
+static const fz_store_type fz_t3_glyph_store_type =
+{
+	"fz_t3_glyph",
+	fz_make_hash_t3_glyph_key,
+	fz_keep_t3_glyph_key,
+	fz_drop_t3_glyph_key,
+	fz_cmp_t3_glyph_key,
+	fz_format_t3_glyph_key,
+	NULL
+};
+
+static int
+drop_any_t3_glyph(fz_context *ctx, void *arg, void *key)
+{
+	return 1;
 }
 
 void
@@ -134,6 +227,8 @@ fz_purge_glyph_cache(fz_context *ctx)
 	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
 	do_purge(ctx);
 	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+
+	fz_filter_store(ctx, drop_any_t3_glyph, NULL, &fz_t3_glyph_store_type);
 }
 
 void
@@ -256,6 +351,83 @@ move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
 	entry->lru_prev = NULL;
 }
 
+static fz_glyph *
+render_t3_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colorspace *model, const fz_irect *scissor, int aa)
+{
+	fz_t3_glyph_key key;
+	fz_t3_glyph_key *keyp = NULL;
+	fz_matrix subpix_ctm;
+	fz_irect subpix_scissor;
+	fz_irect bbox;
+	fz_glyph *val, *existing;
+
+	if (gid < 0 || gid > 255)
+		return NULL;
+
+	memset(&key, 0, sizeof key);
+	fz_subpixel_adjust(ctx, ctm, &subpix_ctm, &key.e, &key.f);
+
+	/* Glyphs that are too big to keep are rendered clipped to the
+	 * scissor, and not cached. */
+	bbox = fz_irect_from_rect(fz_expand_rect(fz_bound_glyph(ctx, font, gid, subpix_ctm), 1));
+	if (fz_is_empty_irect(bbox) || bbox.x1 - bbox.x0 > MAX_T3_GLYPH_SIZE || bbox.y1 - bbox.y0 > MAX_T3_GLYPH_SIZE)
+	{
+		subpix_scissor.x0 = scissor->x0 - floorf(ctm->e);
+		subpix_scissor.y0 = scissor->y0 - floorf(ctm->f);
+		subpix_scissor.x1 = scissor->x1 - floorf(ctm->e);
+		subpix_scissor.y1 = scissor->y1 - floorf(ctm->f);
+		return fz_render_t3_glyph(ctx, font, gid, subpix_ctm, model, &subpix_scissor, aa);
+	}
+
+	/* Masked glyphs are the same whatever the colorspace they end up
+	 * painted into, so only key coloured glyphs on the model. */
+	if (!(font->t3flags[gid] & FZ_DEVFLAG_COLOR) || (font->t3flags[gid] & FZ_DEVFLAG_MASK))
+		model = NULL;
+
+	key.refs = 1;
+	key.font = font;
+	key.model = model;
+	key.gid = gid;
+	key.a = subpix_ctm.a * 65536;
+	key.b = subpix_ctm.b * 65536;
+	key.c = subpix_ctm.c * 65536;
+	key.d = subpix_ctm.d * 65536;
+	key.aa = aa;
+
+	val = fz_find_item(ctx, fz_drop_glyph_imp, &key, &fz_t3_glyph_store_type);
+	if (val)
+		return val;
+
+	val = fz_render_t3_glyph(ctx, font, gid, subpix_ctm, model, &fz_infinite_irect, aa);
+	if (!val)
+		return NULL;
+
+	fz_var(keyp);
+
+	fz_try(ctx)
+	{
+		keyp = fz_malloc_struct(ctx, fz_t3_glyph_key);
+		*keyp = key;
+		keyp->font = fz_keep_font(ctx, font);
+		keyp->model = fz_keep_colorspace(ctx, model);
+
+		existing = fz_store_item(ctx, keyp, val, fz_glyph_size(ctx, val), &fz_t3_glyph_store_type);
+		if (existing)
+		{
+			/* Another thread rendered the same glyph while we
+			 * were running the charproc; use theirs. */
+			fz_drop_glyph(ctx, val);
+			val = existing;
+		}
+	}
+	fz_always(ctx)
+		fz_drop_t3_glyph_key(ctx, keyp);
+	fz_catch(ctx)
+		fz_warn(ctx, "cannot encache glyph; continuing");
+
+	return val;
+}
+
 fz_glyph *
 fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colorspace *model, const fz_irect *scissor, int alpha, int aa)
 {
@@ -274,6 +446,9 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	fz_var(caching);
 	fz_var(val);
 
+	if (!is_ft_font && fz_font_t3_procs(ctx, font))
+		return render_t3_glyph(ctx, font, gid, ctm, model, scissor, aa);
+
 	memset(&key, 0, sizeof key);
 	size = fz_subpixel_adjust(ctx, ctm, &subpix_ctm, &key.e, &key.f);
 	if (size <= MAX_GLYPH_SIZE)
@@ -311,12 +486,14 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 		if (memcmp(&entry->key, &key, sizeof(key)) == 0)
 		{
 			move_to_front(cache, entry);
+			cache->hits++;
 			val = fz_keep_glyph(ctx, entry->val);
 			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
 			return val;
 		}
 		entry = entry->bucket_next;
 	}
+	cache->misses++;
 
 	locked = 1;
 	caching = 0;
@@ -328,23 +505,6 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 		{
 			val = fz_render_ft_glyph(ctx, font, gid, subpix_ctm, aa);
 		}
-		else if (fz_font_t3_procs(ctx, font))
-		{
-			/* We drop the glyphcache here, and execute the t3
-			 * glyph code. The danger here is that some other
-			 * thread will come along, and want the same glyph
-			 * too. If it does, we may both end up rendering
-			 * pixmaps. We cope with this later on, by ensuring
-			 * that only one gets inserted into the cache. If
-			 * we insert ours to find one already there, we
-			 * abandon ours, and use the one there already.
-			 */
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
-			locked = 0;
-			val = fz_render_t3_glyph(ctx, font, gid, subpix_ctm, model, scissor, aa);
-			fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-			locked = 1;
-		}
 		else
 		{
 			fz_warn(ctx, "assert: uninitialized font structure");
@@ -356,23 +516,6 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				/* If we throw an exception whilst caching,
 				 * just ignore the exception and carry on. */
 				caching = 1;
-				if (!is_ft_font)
-				{
-					/* We had to unlock. Someone else might
-					 * have rendered in the meantime */
-					entry = cache->entry[hash];
-					while (entry)
-					{
-						if (memcmp(&entry->key, &key, sizeof(key)) == 0)
-						{
-							fz_drop_glyph(ctx, val);
-							move_to_front(cache, entry);
-							val = fz_keep_glyph(ctx, entry->val);
-							goto unlock_and_return_val;
-						}
-						entry = entry->bucket_next;
-					}
-				}
 
 				entry = fz_malloc_struct(ctx, fz_glyph_cache_entry);
 				entry->key = key;
@@ -392,19 +535,16 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				cache->lru_head = entry;
 
 				cache->total += fz_glyph_size(ctx, val);
+				cache->items++;
+				cache->inserts++;
 				while (cache->total > MAX_CACHE_SIZE)
 				{
-#ifndef NDEBUG
 					cache->num_evictions++;
 					cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
-#endif
 					drop_glyph_cache_entry(ctx, cache->lru_tail);
 				}
 			}
 		}
-unlock_and_return_val:
-		{
-		}
 	}
 	fz_always(ctx)
 	{
@@ -459,11 +599,32 @@ fz_render_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm,
 }
 
 void
-fz_dump_glyph_cache_stats(fz_context *ctx, fz_output *out)
+fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats)
 {
 	fz_glyph_cache *cache = ctx->glyph_cache;
-	fz_write_printf(ctx, out, "Glyph Cache Size: %zu\n", cache->total);
-#ifndef NDEBUG
-	fz_write_printf(ctx, out, "Glyph Cache Evictions: %d (%zu bytes)\n", cache->num_evictions, cache->evicted);
-#endif
+
+	memset(stats, 0, sizeof(*stats));
+	if (cache == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	stats->max = MAX_CACHE_SIZE;
+	stats->size = cache->total;
+	stats->items = cache->items;
+	stats->hits = cache->hits;
+	stats->misses = cache->misses;
+	stats->inserts = cache->inserts;
+	stats->evictions = cache->num_evictions;
+	stats->evicted = cache->evicted;
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+}
+
+void
+fz_dump_glyph_cache_stats(fz_context *ctx, fz_output *out)
+{
+	fz_glyph_cache_stats stats;
+	fz_get_glyph_cache_stats(ctx, &stats);
+	fz_write_printf(ctx, out, "Glyph Cache Size: %zu (%d glyphs)\n", stats.size, stats.items);
+	fz_write_printf(ctx, out, "Glyph Cache Hits: %lu Misses: %lu Inserts: %lu\n", stats.hits, stats.misses, stats.inserts);
+	fz_write_printf(ctx, out, "Glyph Cache Evictions: %lu (%zu bytes)\n", stats.evictions, stats.evicted);
 }
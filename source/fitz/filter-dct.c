@@ -40,6 +40,11 @@ typedef struct
 	int init;
 	int stride;
 	int l2factor;
+	int use_subarea;
+	fz_irect subarea;
+	int skip; /* bytes to drop from the start of each decoded scanline */
+	int direct; /* decoded scanlines are exactly what we deliver */
+	unsigned int lines; /* scanlines left to deliver */
 	unsigned char *scanline;
 	unsigned char *rp, *wp;
 	struct jpeg_decompress_struct cinfo;
@@ -171,6 +176,57 @@ static void skip_input_data_dct(j_decompress_ptr cinfo, long num_bytes)
 	}
 }
 
+/*
+	Restrict decoding to the subarea. The subarea is given in full
+	resolution pixels; the rows and columns we deliver are that area
+	at the output (possibly DCT scaled) resolution.
+
+	libjpeg-turbo can skip whole rows without running the IDCT and
+	colour conversion, and can restrict decoding to a range of iMCU
+	columns. The column range it picks can be wider than we asked
+	for, so we trim each scanline down to the exact width. With other
+	libraries we decode the leading rows and drop them.
+*/
+static void
+start_subarea(fz_context *ctx, fz_dctd *state)
+{
+	j_decompress_ptr cinfo = &state->cinfo;
+	int f = 1 << state->l2factor;
+	int comps = cinfo->output_components;
+	JDIMENSION x, y, w, h;
+
+	x = fz_mini(state->subarea.x0 >> state->l2factor, cinfo->output_width);
+	y = fz_mini(state->subarea.y0 >> state->l2factor, cinfo->output_height);
+	w = fz_mini((state->subarea.x1 - state->subarea.x0 + f - 1) >> state->l2factor, cinfo->output_width - x);
+	h = fz_mini((state->subarea.y1 - state->subarea.y0 + f - 1) >> state->l2factor, cinfo->output_height - y);
+
+#ifdef LIBJPEG_TURBO_VERSION
+	if (w > 0 && w < cinfo->output_width)
+	{
+		JDIMENSION xoff = x;
+		JDIMENSION cw = w;
+		jpeg_crop_scanline(cinfo, &xoff, &cw);
+		x -= xoff;
+	}
+#endif
+
+	state->scanline = Memento_label(fz_malloc(ctx, cinfo->output_width * (size_t)comps), "dct_scanline");
+
+#ifdef LIBJPEG_TURBO_VERSION
+	if (y > 0)
+		y -= jpeg_skip_scanlines(cinfo, y);
+#endif
+	while (y > 0 && cinfo->output_scanline < cinfo->output_height)
+	{
+		jpeg_read_scanlines(cinfo, &state->scanline, 1);
+		y--;
+	}
+
+	state->skip = x * comps;
+	state->stride = w * comps;
+	state->lines = h;
+}
+
 static int
 next_dctd(fz_context *ctx, fz_stream *stm, size_t max)
 {
@@ -254,7 +310,13 @@ next_dctd(fz_context *ctx, fz_stream *stm, size_t max)
 			jpeg_start_decompress(cinfo);
 
 			state->stride = cinfo->output_width * cinfo->output_components;
-			state->scanline = Memento_label(fz_malloc(ctx, state->stride), "dct_scanline");
+			state->lines = cinfo->output_height;
+			state->skip = 0;
+			if (state->use_subarea)
+				start_subarea(ctx, state);
+			else
+				state->scanline = Memento_label(fz_malloc(ctx, state->stride), "dct_scanline");
+			state->direct = (state->skip == 0 && state->stride == (int)(cinfo->output_width * cinfo->output_components));
 			state->rp = state->scanline;
 			state->wp = state->scanline;
 		}
@@ -264,10 +326,10 @@ next_dctd(fz_context *ctx, fz_stream *stm, size_t max)
 
 		while (p < ep)
 		{
-			if (cinfo->output_scanline == cinfo->output_height)
+			if (state->lines == 0 || cinfo->output_scanline == cinfo->output_height)
 				break;
 
-			if (p + state->stride <= ep)
+			if (state->direct && p + state->stride <= ep)
 			{
 				jpeg_read_scanlines(cinfo, &p, 1);
 				p += state->stride;
@@ -275,9 +337,10 @@ next_dctd(fz_context *ctx, fz_stream *stm, size_t max)
 			else
 			{
 				jpeg_read_scanlines(cinfo, &state->scanline, 1);
-				state->rp = state->scanline;
-				state->wp = state->scanline + state->stride;
+				state->rp = state->scanline + state->skip;
+				state->wp = state->rp + state->stride;
 			}
+			state->lines--;
 
 			while (state->rp < state->wp && p < ep)
 				*p++ = *state->rp++;
@@ -334,6 +397,12 @@ close_dctd(fz_context *ctx, void *state_)
 
 fz_stream *
 fz_open_dctd(fz_context *ctx, fz_stream *chain, int color_transform, int l2factor, fz_stream *jpegtables)
+{
+	return fz_open_dctd_subarea(ctx, chain, color_transform, l2factor, jpegtables, NULL);
+}
+
+fz_stream *
+fz_open_dctd_subarea(fz_context *ctx, fz_stream *chain, int color_transform, int l2factor, fz_stream *jpegtables, const fz_irect *subarea)
 {
 	fz_dctd *state = fz_malloc_struct(ctx, fz_dctd);
 	j_decompress_ptr cinfo = &state->cinfo;
@@ -351,6 +420,11 @@ fz_open_dctd(fz_context *ctx, fz_stream *chain, int color_transform, int l2facto
 	state->color_transform = color_transform;
 	state->init = 0;
 	state->l2factor = l2factor;
+	if (subarea)
+	{
+		state->use_subarea = 1;
+		state->subarea = *subarea;
+	}
 	state->chain = fz_keep_stream(ctx, chain);
 	state->jpegtables = fz_keep_stream(ctx, jpegtables);
 	state->curr_stm = state->chain;
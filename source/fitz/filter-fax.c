@@ -205,6 +205,28 @@ static const unsigned char clz[256] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
+/* Given that line[x] == a, and a is all white or all black, return
+ * the index of the last byte before W in the run of bytes equal to a
+ * that starts at x. Blank areas make up most of a typical fax page,
+ * so it pays to step over them a word at a time. */
+static inline int
+skip_run(const unsigned char *line, int x, int W, int a)
+{
+	uint32_t v = a ? 0xFFFFFFFF : 0;
+	uint32_t t;
+
+	while (x + 4 < W)
+	{
+		memcpy(&t, line + x + 1, 4);
+		if (t != v)
+			break;
+		x += 4;
+	}
+	while (x + 1 < W && line[x + 1] == a)
+		x++;
+	return x;
+}
+
 static inline int
 find_changing(const unsigned char *line, int x, int w)
 {
@@ -244,6 +266,8 @@ find_changing(const unsigned char *line, int x, int w)
 	}
 	while (b == 0)
 	{
+		if (a == 0 || a == 0xFF)
+			x = skip_run(line, x, W, a);
 		if (++x >= W)
 			goto nearend;
 		b = a & 1;
@@ -288,7 +312,7 @@ static const unsigned char rm[8] = {
 
 static inline void setbits(unsigned char *line, int x0, int x1)
 {
-	int a0, a1, b0, b1, a;
+	int a0, a1, b0, b1;
 
 	if (x1 <= x0)
 		return;
@@ -307,8 +331,8 @@ static inline void setbits(unsigned char *line, int x0, int x1)
 	else
 	{
 		line[a0] |= lm[b0];
-		for (a = a0 + 1; a < a1; a++)
-			line[a] = 0xFF;
+		if (a1 > a0 + 1)
+			memset(line + a0 + 1, 0xFF, a1 - a0 - 1);
 		if (b1)
 			line[a1] |= rm[b1];
 	}
@@ -397,7 +421,7 @@ get_code(fz_context *ctx, fz_faxd *fax, const cfd_node *table, int initialbits)
 }
 
 /* decode one 1d code */
-static void
+static int
 dec1d(fz_context *ctx, fz_faxd *fax)
 {
 	int code;
@@ -411,13 +435,22 @@ dec1d(fz_context *ctx, fz_faxd *fax)
 		code = get_code(ctx, fax, cf_white_decode, cfd_white_initial_bits);
 
 	if (code == UNCOMPRESSED)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "uncompressed data in faxd");
+	{
+		fz_warn(ctx, "uncompressed data in faxd");
+		return -1;
+	}
 
 	if (code < 0)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "negative code in 1d faxd");
+	{
+		fz_warn(ctx, "negative code in 1d faxd");
+		return -1;
+	}
 
 	if (fax->a + code > fax->columns)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "overflow in 1d faxd");
+	{
+		fz_warn(ctx, "overflow in 1d faxd");
+		return -1;
+	}
 
 	if (fax->c)
 		setbits(fax->dst, fax->a, fax->a + code);
@@ -431,10 +464,12 @@ dec1d(fz_context *ctx, fz_faxd *fax)
 	}
 	else
 		fax->stage = STATE_MAKEUP;
+
+	return 0;
 }
 
 /* decode one 2d code */
-static void
+static int
 dec2d(fz_context *ctx, fz_faxd *fax)
 {
 	int code, b1, b2;
@@ -450,13 +485,22 @@ dec2d(fz_context *ctx, fz_faxd *fax)
 			code = get_code(ctx, fax, cf_white_decode, cfd_white_initial_bits);
 
 		if (code == UNCOMPRESSED)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "uncompressed data in faxd");
+		{
+			fz_warn(ctx, "uncompressed data in faxd");
+			return -1;
+		}
 
 		if (code < 0)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "negative code in 2d faxd");
+		{
+			fz_warn(ctx, "negative code in 2d faxd");
+			return -1;
+		}
 
 		if (fax->a + code > fax->columns)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "overflow in 2d faxd");
+		{
+			fz_warn(ctx, "overflow in 2d faxd");
+			return -1;
+		}
 
 		if (fax->c)
 			setbits(fax->dst, fax->a, fax->a + code);
@@ -472,7 +516,7 @@ dec2d(fz_context *ctx, fz_faxd *fax)
 				fax->stage = STATE_NORMAL;
 		}
 
-		return;
+		return 0;
 	}
 
 	code = get_code(ctx, fax, cf_2d_decode, cfd_2d_initial_bits);
@@ -549,14 +593,36 @@ dec2d(fz_context *ctx, fz_faxd *fax)
 		break;
 
 	case UNCOMPRESSED:
-		fz_throw(ctx, FZ_ERROR_GENERIC, "uncompressed data in faxd");
+		fz_warn(ctx, "uncompressed data in faxd");
+		return -1;
 
 	case ERROR:
-		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid code in 2d faxd");
+		fz_warn(ctx, "invalid code in 2d faxd");
+		return -1;
 
 	default:
-		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid code in 2d faxd (%d)", code);
+		fz_warn(ctx, "invalid code in 2d faxd (%d)", code);
+		return -1;
 	}
+
+	return 0;
+}
+
+/* Copy as much of the decoded row as will fit to the output. */
+static unsigned char *
+copy_row(fz_faxd *fax, unsigned char *p, unsigned char *ep)
+{
+	size_t i, n = fax->wp - fax->rp;
+
+	if (n > (size_t)(ep - p))
+		n = ep - p;
+	if (fax->black_is_1)
+		memcpy(p, fax->rp, n);
+	else
+		for (i = 0; i < n; i++)
+			p[i] = fax->rp[i] ^ 0xff;
+	fax->rp += n;
+	return p + n;
 }
 
 static int
@@ -638,26 +704,14 @@ loop:
 	else if (fax->dim == 1)
 	{
 		fax->eolc = 0;
-		fz_try(ctx)
-		{
-			dec1d(ctx, fax);
-		}
-		fz_catch(ctx)
-		{
+		if (dec1d(ctx, fax))
 			goto error;
-		}
 	}
 	else if (fax->dim == 2)
 	{
 		fax->eolc = 0;
-		fz_try(ctx)
-		{
-			dec2d(ctx, fax);
-		}
-		fz_catch(ctx)
-		{
+		if (dec2d(ctx, fax))
 			goto error;
-		}
 	}
 
 	/* no eol check after makeup codes nor in the middle of an H code */
@@ -678,16 +732,7 @@ loop:
 eol:
 	fax->stage = STATE_EOL;
 
-	if (fax->black_is_1)
-	{
-		while (fax->rp < fax->wp && p < ep)
-			*p++ = *fax->rp++;
-	}
-	else
-	{
-		while (fax->rp < fax->wp && p < ep)
-			*p++ = *fax->rp++ ^ 0xff;
-	}
+	p = copy_row(fax, p, ep);
 
 	if (fax->rp < fax->wp)
 	{
@@ -748,16 +793,7 @@ eol:
 
 error:
 	/* decode the remaining pixels up to where the error occurred */
-	if (fax->black_is_1)
-	{
-		while (fax->rp < fax->wp && p < ep)
-			*p++ = *fax->rp++;
-	}
-	else
-	{
-		while (fax->rp < fax->wp && p < ep)
-			*p++ = *fax->rp++ ^ 0xff;
-	}
+	p = copy_row(fax, p, ep);
 	/* fallthrough */
 
 rtc:
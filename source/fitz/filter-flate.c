@@ -24,8 +24,11 @@
 
 #include <zlib.h>
 
+#include <limits.h>
 #include <string.h>
 
+#define MIN_BOMB (100 << 20)
+
 typedef struct
 {
 	fz_stream *chain;
@@ -143,3 +146,101 @@ fz_open_flated(fz_context *ctx, fz_stream *chain, int window_bits)
 
 	return fz_new_stream(ctx, state, next_flated, close_flated);
 }
+
+fz_buffer *
+fz_new_inflated_buffer(fz_context *ctx, const unsigned char *data, size_t len, size_t initial, int *truncated)
+{
+	fz_buffer *buf = NULL;
+	int check_bomb = (initial > 0);
+	z_stream z;
+	size_t avail;
+	int code;
+
+	fz_var(buf);
+
+	if (truncated)
+		*truncated = 0;
+
+	memset(&z, 0, sizeof z);
+	z.zalloc = fz_zlib_alloc;
+	z.zfree = fz_zlib_free;
+	z.opaque = ctx;
+
+	code = inflateInit(&z);
+	if (code != Z_OK)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "zlib error: inflateInit failed");
+
+	fz_try(ctx)
+	{
+		if (initial < 1024)
+			initial = 1024;
+
+		buf = fz_new_buffer(ctx, initial);
+		z.next_in = (Bytef *)data;
+
+		while (1)
+		{
+			if (z.avail_in == 0)
+			{
+				z.avail_in = len > UINT_MAX ? UINT_MAX : (uInt)len;
+				len -= z.avail_in;
+			}
+			if (buf->len == buf->cap)
+			{
+				if (check_bomb && buf->len >= MIN_BOMB && buf->len / 200 > initial)
+					fz_throw(ctx, FZ_ERROR_GENERIC, "compression bomb detected");
+				fz_grow_buffer(ctx, buf);
+			}
+
+			avail = buf->cap - buf->len;
+			z.next_out = buf->data + buf->len;
+			z.avail_out = avail > UINT_MAX ? UINT_MAX : (uInt)avail;
+
+			code = inflate(&z, Z_NO_FLUSH);
+
+			buf->len = z.next_out - buf->data;
+
+			if (code == Z_STREAM_END)
+			{
+				break;
+			}
+			else if (code == Z_OK || code == Z_BUF_ERROR)
+			{
+				/* No more input, yet room left for more output. */
+				if (z.avail_in == 0 && len == 0 && z.avail_out > 0)
+				{
+					fz_warn(ctx, "premature end of data in flate filter");
+					break;
+				}
+			}
+			else if (code == Z_DATA_ERROR && z.avail_in == 0 && len == 0)
+			{
+				fz_warn(ctx, "ignoring zlib error: %s", z.msg);
+				break;
+			}
+			else if (code == Z_DATA_ERROR && !strcmp(z.msg, "incorrect data check"))
+			{
+				fz_warn(ctx, "ignoring zlib error: %s", z.msg);
+				break;
+			}
+			else
+			{
+				fz_throw(ctx, FZ_ERROR_GENERIC, "zlib error: %s", z.msg);
+			}
+		}
+	}
+	fz_always(ctx)
+		inflateEnd(&z);
+	fz_catch(ctx)
+	{
+		if (truncated && buf)
+			*truncated = 1;
+		else
+		{
+			fz_drop_buffer(ctx, buf);
+			fz_rethrow(ctx);
+		}
+	}
+
+	return buf;
+}
@@ -45,8 +45,6 @@ typedef struct
 	fz_jbig2_allocators alloc;
 	fz_jbig2_globals *gctx;
 	Jbig2Image *page;
-	int idx;
-	unsigned char buffer[4096];
 } fz_jbig2d;
 
 fz_jbig2_globals *
@@ -73,54 +71,46 @@ close_jbig2d(fz_context *ctx, void *state_)
 	fz_free(ctx, state);
 }
 
+/*
+	The whole page is decoded on the first call. The page bitmap
+	belongs to us until we release it, so rather than copying it out
+	through a buffer in small pieces, we invert it in place and hand
+	it out in one go.
+*/
 static int
 next_jbig2d(fz_context *ctx, fz_stream *stm, size_t len)
 {
 	fz_jbig2d *state = stm->state;
-	unsigned char tmp[4096];
-	unsigned char *buf = state->buffer;
-	unsigned char *p = buf;
-	unsigned char *ep;
-	unsigned char *s;
-	int x, w;
+	unsigned char *s, *e;
 	size_t n;
 
-	if (len > sizeof(state->buffer))
-		len = sizeof(state->buffer);
-	ep = buf + len;
+	if (state->page)
+		return EOF;
 
-	if (!state->page)
+	/* Feed the data to jbig2dec straight from the chained stream's buffer. */
+	while ((n = fz_available(ctx, state->chain, 1)) > 0)
 	{
-		while (1)
-		{
-			n = fz_read(ctx, state->chain, tmp, sizeof tmp);
-			if (n == 0)
-				break;
-
-			if (jbig2_data_in(state->ctx, tmp, n) < 0)
-				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot decode jbig2 image");
-		}
-
-		if (jbig2_complete_page(state->ctx) < 0)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot complete jbig2 image");
-
-		state->page = jbig2_page_out(state->ctx);
-		if (!state->page)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "no jbig2 image decoded");
+		if (jbig2_data_in(state->ctx, state->chain->rp, n) < 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot decode jbig2 image");
+		state->chain->rp += n;
 	}
 
+	if (jbig2_complete_page(state->ctx) < 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot complete jbig2 image");
+
+	state->page = jbig2_page_out(state->ctx);
+	if (!state->page)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "no jbig2 image decoded");
+
 	s = state->page->data;
-	w = state->page->height * state->page->stride;
-	x = state->idx;
-	while (p < ep && x < w)
-		*p++ = s[x++] ^ 0xff;
-	state->idx = x;
-
-	stm->rp = buf;
-	stm->wp = p;
-	if (p == buf)
+	e = s + (size_t)state->page->height * state->page->stride;
+	for (stm->rp = s; s < e; s++)
+		*s ^= 0xff;
+
+	stm->wp = e;
+	if (stm->rp == stm->wp)
 		return EOF;
-	stm->pos += p - buf;
+	stm->pos += stm->wp - stm->rp;
 	return *stm->rp++;
 }
 
@@ -161,7 +151,7 @@ static void *fz_jbig2_realloc(Jbig2Allocator *allocator, void *p, size_t size)
 		return NULL;
 	}
 	if (p == NULL)
-		return Memento_label(fz_malloc(ctx, size), "jbig2_realloc");
+		return Memento_label(fz_malloc_no_throw(ctx, size), "jbig2_realloc");
 	return Memento_label(fz_realloc_no_throw(ctx, p, size), "jbig2_realloc");
 }
 
@@ -236,7 +226,6 @@ fz_open_jbig2d(fz_context *ctx, fz_stream *chain, fz_jbig2_globals *globals, int
 	}
 
 	state->page = NULL;
-	state->idx = 0;
 	state->chain = fz_keep_stream(ctx, chain);
 
 	return fz_new_stream(ctx, state, next_jbig2d, close_jbig2d);
@@ -22,6 +22,8 @@
 
 #include "mupdf/fitz.h"
 
+#include "z-imp.h"
+
 #include <string.h>
 #include <limits.h>
 
@@ -82,47 +84,45 @@ static inline int paeth(int a, int b, int c)
 }
 
 static void
-fz_predict_tiff(fz_predict *state, unsigned char *out, unsigned char *in)
+fz_predict_tiff(int columns, int colors, int bpc, int stride, unsigned char *out, unsigned char *in)
 {
 	int left[FZ_MAX_COLORS];
 	int i, k;
-	const int mask = (1 << state->bpc)-1;
+	const int mask = (1 << bpc)-1;
 
-	for (k = 0; k < state->colors; k++)
+	for (k = 0; k < colors; k++)
 		left[k] = 0;
 
 	/* special fast case */
-	if (state->bpc == 8)
+	if (bpc == 8)
 	{
-		for (i = 0; i < state->columns; i++)
-			for (k = 0; k < state->colors; k++)
+		for (i = 0; i < columns; i++)
+			for (k = 0; k < colors; k++)
 				*out++ = left[k] = (*in++ + left[k]) & 0xFF;
 		return;
 	}
 
 	/* putcomponent assumes zeroed memory for bpc < 8 */
-	if (state->bpc < 8)
-		memset(out, 0, state->stride);
+	if (bpc < 8)
+		memset(out, 0, stride);
 
-	for (i = 0; i < state->columns; i++)
+	for (i = 0; i < columns; i++)
 	{
-		for (k = 0; k < state->colors; k++)
+		for (k = 0; k < colors; k++)
 		{
-			int a = getcomponent(in, i * state->colors + k, state->bpc);
+			int a = getcomponent(in, i * colors + k, bpc);
 			int b = a + left[k];
 			int c = b & mask;
-			putcomponent(out, i * state->colors + k, state->bpc, c);
+			putcomponent(out, i * colors + k, bpc, c);
 			left[k] = c;
 		}
 	}
 }
 
 static void
-fz_predict_png(fz_context *ctx, fz_predict *state, unsigned char *out, unsigned char *in, size_t len, int predictor)
+fz_predict_png(fz_context *ctx, int bpp, unsigned char *ref, unsigned char *out, unsigned char *in, size_t len, int predictor)
 {
-	int bpp = state->bpp;
 	size_t i;
-	unsigned char *ref = state->ref;
 
 	if ((size_t)bpp > len)
 		bpp = (int)len;
@@ -208,10 +208,10 @@ next_predict(fz_context *ctx, fz_stream *stm, size_t len)
 		if (state->predictor == 1)
 			memcpy(state->out, state->in, n);
 		else if (state->predictor == 2)
-			fz_predict_tiff(state, state->out, state->in);
+			fz_predict_tiff(state->columns, state->colors, state->bpc, state->stride, state->out, state->in);
 		else
 		{
-			fz_predict_png(ctx, state, state->out, state->in + 1, n - 1, state->in[0]);
+			fz_predict_png(ctx, state->bpp, state->ref, state->out, state->in + 1, n - 1, state->in[0]);
 			memcpy(state->ref, state->out, state->stride);
 		}
 
@@ -242,35 +242,41 @@ close_predict(fz_context *ctx, void *state_)
 	fz_free(ctx, state);
 }
 
+static void
+check_predict_params(fz_context *ctx, int *predictor, int *columns, int *colors, int *bpc)
+{
+	if (*predictor < 1)
+		*predictor = 1;
+	if (*columns < 1)
+		*columns = 1;
+	if (*colors < 1)
+		*colors = 1;
+	if (*bpc < 1)
+		*bpc = 8;
+
+	if (*bpc != 1 && *bpc != 2 && *bpc != 4 && *bpc != 8 && *bpc != 16)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid number of bits per component: %d", *bpc);
+	if (*colors > FZ_MAX_COLORS)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "too many color components (%d > %d)", *colors, FZ_MAX_COLORS);
+	if (*columns >= INT_MAX / (*bpc * *colors))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "too many columns lead to an integer overflow (%d)", *columns);
+
+	if (*predictor != 1 && *predictor != 2 &&
+			*predictor != 10 && *predictor != 11 &&
+			*predictor != 12 && *predictor != 13 &&
+			*predictor != 14 && *predictor != 15)
+	{
+		fz_warn(ctx, "invalid predictor: %d", *predictor);
+		*predictor = 1;
+	}
+}
+
 fz_stream *
 fz_open_predict(fz_context *ctx, fz_stream *chain, int predictor, int columns, int colors, int bpc)
 {
 	fz_predict *state;
 
-	if (predictor < 1)
-		predictor = 1;
-	if (columns < 1)
-		columns = 1;
-	if (colors < 1)
-		colors = 1;
-	if (bpc < 1)
-		bpc = 8;
-
-	if (bpc != 1 && bpc != 2 && bpc != 4 && bpc != 8 && bpc != 16)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid number of bits per component: %d", bpc);
-	if (colors > FZ_MAX_COLORS)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "too many color components (%d > %d)", colors, FZ_MAX_COLORS);
-	if (columns >= INT_MAX / (bpc * colors))
-		fz_throw(ctx, FZ_ERROR_GENERIC, "too many columns lead to an integer overflow (%d)", columns);
-
-	if (predictor != 1 && predictor != 2 &&
-			predictor != 10 && predictor != 11 &&
-			predictor != 12 && predictor != 13 &&
-			predictor != 14 && predictor != 15)
-	{
-		fz_warn(ctx, "invalid predictor: %d", predictor);
-		predictor = 1;
-	}
+	check_predict_params(ctx, &predictor, &columns, &colors, &bpc);
 
 	state = fz_malloc_struct(ctx, fz_predict);
 	fz_try(ctx)
@@ -303,3 +309,197 @@ fz_open_predict(fz_context *ctx, fz_stream *chain, int predictor, int columns, i
 
 	return fz_new_stream(ctx, state, next_predict, close_predict);
 }
+
+/*
+	Flate decoding and prediction fused into a single filter.
+
+	Each encoded row is inflated straight into a row buffer, and the
+	predictor writes the decoded row directly into the output block
+	that the stream hands back to its reader. This saves both the
+	intermediate buffer of a separate flate filter and the copy from
+	the predictor's row buffer into its output buffer. The row before
+	the first one in the output block is kept just in front of it, so
+	the PNG predictors can use the previous output row as their
+	reference without copying it for every row.
+*/
+
+typedef struct
+{
+	fz_stream *chain;
+	z_stream z;
+	int eod;
+
+	int predictor;
+	int columns;
+	int colors;
+	int bpc;
+
+	int stride;
+	int bpp;
+	int rows;
+	unsigned char *in;
+	unsigned char *out;
+} fz_flate_predict;
+
+/* Inflate up to len bytes into buf; returns the number of bytes produced. */
+static size_t
+inflate_row(fz_context *ctx, fz_flate_predict *state, unsigned char *buf, size_t len)
+{
+	fz_stream *chain = state->chain;
+	z_streamp zp = &state->z;
+	int code;
+
+	zp->next_out = buf;
+	zp->avail_out = (uInt)len;
+
+	while (zp->avail_out > 0 && !state->eod)
+	{
+		zp->avail_in = (uInt)fz_available(ctx, chain, 1);
+		zp->next_in = chain->rp;
+
+		code = inflate(zp, Z_SYNC_FLUSH);
+
+		chain->rp = chain->wp - zp->avail_in;
+
+		if (code == Z_STREAM_END)
+		{
+			state->eod = 1;
+		}
+		else if (code == Z_BUF_ERROR)
+		{
+			fz_warn(ctx, "premature end of data in flate filter");
+			state->eod = 1;
+		}
+		else if (code == Z_DATA_ERROR && zp->avail_in == 0)
+		{
+			fz_warn(ctx, "ignoring zlib error: %s", zp->msg);
+			state->eod = 1;
+		}
+		else if (code == Z_DATA_ERROR && !strcmp(zp->msg, "incorrect data check"))
+		{
+			fz_warn(ctx, "ignoring zlib error: %s", zp->msg);
+			chain->rp = chain->wp;
+			state->eod = 1;
+		}
+		else if (code != Z_OK)
+		{
+			fz_throw(ctx, FZ_ERROR_GENERIC, "zlib error: %s", zp->msg);
+		}
+	}
+
+	return len - zp->avail_out;
+}
+
+static int
+next_flated_predict(fz_context *ctx, fz_stream *stm, size_t max)
+{
+	fz_flate_predict *state = stm->state;
+	int ispng = state->predictor >= 10;
+	int stride = state->stride;
+	unsigned char *start = state->out + stride;
+	unsigned char *p = start;
+	size_t n;
+	int r;
+
+	if (stm->eof)
+		return EOF;
+
+	for (r = 0; r < state->rows; r++)
+	{
+		n = inflate_row(ctx, state, state->in, stride + ispng);
+		if (n <= (size_t)ispng)
+			break;
+
+		if (state->predictor == 1)
+			memcpy(p, state->in, n);
+		else if (state->predictor == 2)
+		{
+			if (n < (size_t)stride)
+				memset(state->in + n, 0, stride - n);
+			fz_predict_tiff(state->columns, state->colors, state->bpc, stride, p, state->in);
+		}
+		else
+			fz_predict_png(ctx, state->bpp, p - stride, p, state->in + 1, n - 1, state->in[0]);
+
+		p += n - ispng;
+		if (n < (size_t)(stride + ispng))
+			break;
+	}
+
+	/* Keep the last complete row as the reference for the next block. */
+	if (r > 0 && p == start + (size_t)r * stride)
+		memcpy(state->out, p - stride, stride);
+
+	stm->rp = start;
+	stm->wp = p;
+	stm->pos += p - start;
+	if (stm->rp == stm->wp)
+	{
+		stm->eof = 1;
+		return EOF;
+	}
+	return *stm->rp++;
+}
+
+static void
+close_flated_predict(fz_context *ctx, void *state_)
+{
+	fz_flate_predict *state = (fz_flate_predict *)state_;
+	int code;
+
+	code = inflateEnd(&state->z);
+	if (code != Z_OK)
+		fz_warn(ctx, "zlib error: inflateEnd: %s", state->z.msg);
+
+	fz_drop_stream(ctx, state->chain);
+	fz_free(ctx, state->in);
+	fz_free(ctx, state->out);
+	fz_free(ctx, state);
+}
+
+fz_stream *
+fz_open_flated_predict(fz_context *ctx, fz_stream *chain, int window_bits, int predictor, int columns, int colors, int bpc)
+{
+	fz_flate_predict *state;
+	int code;
+
+	check_predict_params(ctx, &predictor, &columns, &colors, &bpc);
+
+	state = fz_malloc_struct(ctx, fz_flate_predict);
+	fz_try(ctx)
+	{
+		state->predictor = predictor;
+		state->columns = columns;
+		state->colors = colors;
+		state->bpc = bpc;
+
+		state->stride = (bpc * colors * columns + 7) / 8;
+		state->bpp = (bpc * colors + 7) / 8;
+		state->rows = fz_maxi(1, 4096 / state->stride);
+
+		state->in = Memento_label(fz_malloc(ctx, state->stride + 1), "flate_predict_in");
+		/* Room for the reference row, followed by the output rows. */
+		state->out = Memento_label(fz_calloc(ctx, state->rows + 1, state->stride), "flate_predict_out");
+
+		state->z.zalloc = fz_zlib_alloc;
+		state->z.zfree = fz_zlib_free;
+		state->z.opaque = ctx;
+		state->z.next_in = NULL;
+		state->z.avail_in = 0;
+
+		code = inflateInit2(&state->z, window_bits);
+		if (code != Z_OK)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "zlib error: inflateInit2 failed");
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, state->in);
+		fz_free(ctx, state->out);
+		fz_free(ctx, state);
+		fz_rethrow(ctx);
+	}
+
+	state->chain = fz_keep_stream(ctx, chain);
+
+	return fz_new_stream(ctx, state, next_flated_predict, close_flated_predict);
+}
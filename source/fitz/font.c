@@ -41,7 +41,16 @@
 #include FT_TRUETYPE_TAGS_H
 
 #define MAX_BBOX_TABLE_SIZE 4096
-#define MAX_ADVANCE_CACHE 4096
+#define MAX_ADVANCE_CACHE 65536
+
+/* A page of cached glyph bounds, for fonts too big for a bbox_table.
+ * Each bound is filled in when first asked for, and then published
+ * through known[] so that it can be read without a lock. */
+struct fz_bbox_cache_page
+{
+	fz_rect *known[256];
+	fz_rect bbox[256];
+};
 
 #ifndef FT_SFNT_OS2
 #define FT_SFNT_OS2 ft_sfnt_os2
@@ -128,6 +137,7 @@ fz_new_font(fz_context *ctx, const char *name, int use_glyph_bbox, int glyph_cou
 
 	font->glyph_count = glyph_count;
 
+	font->bbox_paged = use_glyph_bbox && glyph_count > MAX_BBOX_TABLE_SIZE;
 	if (use_glyph_bbox && glyph_count <= MAX_BBOX_TABLE_SIZE)
 	{
 		fz_try(ctx)
@@ -239,7 +249,12 @@ fz_drop_font(fz_context *ctx, fz_font *font)
 	fz_drop_buffer(ctx, font->buffer);
 	fz_free(ctx, font->bbox_table);
 	fz_free(ctx, font->width_table);
-	fz_free(ctx, font->advance_cache);
+	for (i = 0; i < 256; ++i)
+	{
+		fz_free(ctx, font->advance_cache[0][i]);
+		fz_free(ctx, font->advance_cache[1][i]);
+		fz_free(ctx, font->bbox_cache[i]);
+	}
 	if (font->shaper_data.destroy && font->shaper_data.shaper_handle)
 	{
 		font->shaper_data.destroy(ctx, font->shaper_data.shaper_handle);
@@ -1198,15 +1213,14 @@ fz_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix tr
 	return result;
 }
 
-static fz_rect *
-fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
+static void
+fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_rect *bounds)
 {
 	FT_Face face = font->ft_face;
 	FT_Error fterr;
 	FT_BBox cbox;
 	FT_Matrix m;
 	FT_Vector v;
-	fz_rect *bounds = &font->bbox_table[gid];
 
 	// TODO: refactor loading into fz_load_ft_glyph
 	// TODO: cache results
@@ -1237,6 +1251,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 		fz_warn(ctx, "FT_Set_Char_Size(%s,%d,72): %s", font->name, scale, ft_error_string(fterr));
 	FT_Set_Transform(face, &m, &v);
 
+	ctx->glyph_metrics.bbox_ft_calls++;
 	fterr = FT_Load_Glyph(face, gid, FT_LOAD_NO_BITMAP | FT_LOAD_NO_HINTING);
 	if (fterr)
 	{
@@ -1244,7 +1259,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 		fz_unlock(ctx, FZ_LOCK_FREETYPE);
 		bounds->x0 = bounds->x1 = trm.e;
 		bounds->y0 = bounds->y1 = trm.f;
-		return bounds;
+		return;
 	}
 
 	if (font->flags.fake_bold)
@@ -1265,8 +1280,6 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 		bounds->x0 = bounds->x1 = trm.e;
 		bounds->y0 = bounds->y1 = trm.f;
 	}
-
-	return bounds;
 }
 
 /* Turn FT_Outline into a fz_path */
@@ -1666,10 +1679,82 @@ fz_render_t3_glyph_direct(fz_context *ctx, fz_device *dev, fz_font *font, int gi
 		fz_rethrow(ctx);
 }
 
+/*
+	Fonts with too many glyphs for a bbox_table have their glyph
+	bounds cached in pages of 256 instead. Only the glyph asked for
+	is bounded, as for bbox_table. Bounding a glyph takes the
+	freetype lock itself, so it is done without holding it; if two
+	threads bound the same glyph at once, the first to finish
+	publishes its bound.
+*/
+static fz_rect
+fz_bound_ft_glyph_cached(fz_context *ctx, fz_font *font, int gid)
+{
+	struct fz_bbox_cache_page *page, *made;
+	fz_rect *known;
+	fz_rect bbox;
+	int pg = gid >> 8;
+	int i = gid & 255;
+
+#if FZ_ATOMIC_REFS
+	page = fz_load_ptr_acquire(&font->bbox_cache[pg]);
+	known = page ? fz_load_ptr_acquire(&page->known[i]) : NULL;
+	if (known)
+		return *known;
+#else
+	fz_lock(ctx, FZ_LOCK_FREETYPE);
+	page = font->bbox_cache[pg];
+	known = page ? page->known[i] : NULL;
+	if (known)
+		bbox = *known;
+	fz_unlock(ctx, FZ_LOCK_FREETYPE);
+	if (known)
+		return bbox;
+#endif
+
+	if (!page)
+	{
+		made = Memento_label(fz_malloc_struct(ctx, struct fz_bbox_cache_page), "font_bbox_cache");
+		fz_lock(ctx, FZ_LOCK_FREETYPE);
+		page = font->bbox_cache[pg];
+		if (!page)
+		{
+			fz_store_ptr_release(&font->bbox_cache[pg], made);
+			page = made;
+			made = NULL;
+		}
+		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+		fz_free(ctx, made);
+	}
+
+	fz_bound_ft_glyph(ctx, font, gid, &bbox);
+	/* As for bbox_table, remember empty glyphs as tiny ones. */
+	if (fz_is_empty_rect(bbox))
+	{
+		bbox.x0 = 0;
+		bbox.y0 = 0;
+		bbox.x1 = 0.0000001f;
+		bbox.y1 = 0.0000001f;
+	}
+
+	fz_lock(ctx, FZ_LOCK_FREETYPE);
+	if (page->known[i])
+		bbox = *page->known[i];
+	else
+	{
+		page->bbox[i] = bbox;
+		fz_store_ptr_release(&page->known[i], &page->bbox[i]);
+	}
+	fz_unlock(ctx, FZ_LOCK_FREETYPE);
+
+	return bbox;
+}
+
 fz_rect
 fz_bound_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm)
 {
 	fz_rect rect;
+	ctx->glyph_metrics.bbox_lookups++;
 	if (font->bbox_table && gid < font->glyph_count && gid >= 0)
 	{
 		/* If the bbox is infinite or empty, distrust it */
@@ -1677,7 +1762,7 @@ fz_bound_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm)
 		{
 			/* Get the real size from the glyph */
 			if (font->ft_face)
-				fz_bound_ft_glyph(ctx, font, gid);
+				fz_bound_ft_glyph(ctx, font, gid, &font->bbox_table[gid]);
 			else if (font->t3lists)
 				fz_bound_t3_glyph(ctx, font, gid);
 			else
@@ -1697,6 +1782,10 @@ fz_bound_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm)
 		}
 		rect = font->bbox_table[gid];
 	}
+	else if (font->bbox_paged && font->ft_face && gid < font->glyph_count && gid < MAX_ADVANCE_CACHE && gid >= 0)
+	{
+		rect = fz_bound_ft_glyph_cached(ctx, font, gid);
+	}
 	else
 	{
 		/* fall back to font bbox */
@@ -1743,6 +1832,7 @@ fz_advance_ft_glyph_aux(fz_context *ctx, fz_font *font, int gid, int wmode, int
 		mask |= FT_LOAD_VERTICAL_LAYOUT;
 	if (!locked)
 		fz_lock(ctx, FZ_LOCK_FREETYPE);
+	ctx->glyph_metrics.advance_ft_calls++;
 	fterr = FT_Get_Advance(font->ft_face, gid, mask, &adv);
 	if (!locked)
 		fz_unlock(ctx, FZ_LOCK_FREETYPE);
@@ -1794,42 +1884,70 @@ fz_get_glyph_name(fz_context *ctx, fz_font *font, int glyph, char *buf, int size
 	}
 }
 
-float
-fz_advance_glyph(fz_context *ctx, fz_font *font, int gid, int wmode)
+/*
+	The advance cache is split into pages of 256 glyphs. A page is
+	filled in one go under the freetype lock the first time any glyph
+	in it is asked for, and is only published once complete, so later
+	lookups can read it without taking the lock.
+*/
+static float
+fz_advance_ft_glyph_cached(fz_context *ctx, fz_font *font, int gid, int wmode)
 {
-	if (font->ft_face)
+	int pg = gid >> 8;
+	float *page;
+
+#if FZ_ATOMIC_REFS
+	page = fz_load_ptr_acquire(&font->advance_cache[wmode][pg]);
+	if (page)
+		return page[gid & 255];
+#endif
+
+	fz_lock(ctx, FZ_LOCK_FREETYPE);
+	page = font->advance_cache[wmode][pg];
+	if (!page)
 	{
-		if (wmode)
-			return fz_advance_ft_glyph(ctx, font, gid, 1);
-		if (gid >= 0 && gid < font->glyph_count && gid < MAX_ADVANCE_CACHE)
+		int i, n;
+		fz_try(ctx)
+			page = Memento_label(fz_malloc_array(ctx, 256, float), "font_advance_cache");
+		fz_catch(ctx)
 		{
-			float f;
-			fz_lock(ctx, FZ_LOCK_FREETYPE);
-			if (!font->advance_cache)
-			{
-				int i;
-				fz_try(ctx)
-					font->advance_cache = Memento_label(fz_malloc_array(ctx, font->glyph_count, float), "font_advance_cache");
-				fz_catch(ctx)
-				{
-					fz_unlock(ctx, FZ_LOCK_FREETYPE);
-					fz_rethrow(ctx);
-				}
-				for (i = 0; i < font->glyph_count; ++i)
-					font->advance_cache[i] = fz_advance_ft_glyph_aux(ctx, font, i, 0, 1);
-			}
-			f = font->advance_cache[gid];
 			fz_unlock(ctx, FZ_LOCK_FREETYPE);
-			return f;
+			fz_rethrow(ctx);
 		}
+		n = fz_mini(256, font->glyph_count - (pg << 8));
+		for (i = 0; i < n; ++i)
+			page[i] = fz_advance_ft_glyph_aux(ctx, font, (pg << 8) + i, wmode, 1);
+		for (; i < 256; ++i)
+			page[i] = 0;
+		fz_store_ptr_release(&font->advance_cache[wmode][pg], page);
+	}
+	fz_unlock(ctx, FZ_LOCK_FREETYPE);
 
-		return fz_advance_ft_glyph(ctx, font, gid, 0);
+	return page[gid & 255];
+}
+
+float
+fz_advance_glyph(fz_context *ctx, fz_font *font, int gid, int wmode)
+{
+	ctx->glyph_metrics.advance_lookups++;
+	if (font->ft_face)
+	{
+		wmode = !!wmode;
+		if (gid >= 0 && gid < font->glyph_count && gid < MAX_ADVANCE_CACHE)
+			return fz_advance_ft_glyph_cached(ctx, font, gid, wmode);
+		return fz_advance_ft_glyph(ctx, font, gid, wmode);
 	}
 	if (font->t3procs)
 		return fz_advance_t3_glyph(ctx, font, gid);
 	return 0;
 }
 
+void
+fz_get_glyph_metrics_stats(fz_context *ctx, fz_glyph_metrics_stats *stats)
+{
+	*stats = ctx->glyph_metrics;
+}
+
 int
 fz_encode_character(fz_context *ctx, fz_font *font, int ucs)
 {
@@ -61,6 +61,12 @@ struct fz_glyph
 	unsigned char data[1];
 };
 
+/*
+	Free a glyph once its last reference has gone. Glyphs in
+	the store are identified by this function.
+*/
+void fz_drop_glyph_imp(fz_context *ctx, fz_storable *glyph);
+
 /*
 	Create a new glyph from a pixmap
 
@@ -41,7 +41,7 @@ fz_drop_glyph(fz_context *ctx, fz_glyph *glyph)
 	fz_drop_storable(ctx, &glyph->storable);
 }
 
-static void
+void
 fz_drop_glyph_imp(fz_context *ctx, fz_storable *glyph_)
 {
 	fz_glyph *glyph = (fz_glyph *)glyph_;
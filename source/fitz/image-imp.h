@@ -32,6 +32,18 @@ fz_pixmap *fz_load_bmp(fz_context *ctx, const unsigned char *data, size_t size);
 fz_pixmap *fz_load_pnm(fz_context *ctx, const unsigned char *data, size_t size);
 fz_pixmap *fz_load_jbig2(fz_context *ctx, const unsigned char *data, size_t size);
 
+/*
+	Decode a JPEG 2000 image, or part of one.
+
+	subarea: If non-NULL, the area of the image (in pixels) wanted;
+	updated to the area actually decoded.
+
+	l2factor: If non-NULL, the log2 subsampling factor wanted. As
+	much as possible is done by discarding resolution levels in the
+	decoder; on exit it holds the factor still to be applied.
+*/
+fz_pixmap *fz_load_jpx_subarea(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *cs, fz_irect *subarea, int *l2factor);
+
 void fz_load_jpeg_info(fz_context *ctx, const unsigned char *data, size_t size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace, uint8_t *orientation);
 void fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
 void fz_load_png_info(fz_context *ctx, const unsigned char *data, size_t size, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace);
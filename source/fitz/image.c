@@ -34,7 +34,7 @@
 static int
 fz_key_storable_needs_reaping(fz_context *ctx, const fz_key_storable *ks)
 {
-	return ks == NULL ? 0 : (ks->store_key_refs == ks->storable.refs);
+	return ks == NULL ? 0 : (ks->store_key_refs == fz_load_refs(&ks->storable.refs));
 }
 
 #define SANE_DPI 72.0f
@@ -517,12 +517,140 @@ subsample_stream(fz_context *ctx, fz_stream *src, int w, int h, int n, int l2ext
 	return fz_new_stream(ctx, state, subsample_next, subsample_drop);
 }
 
+/* Subsampling 1 bit per pixel greyscale data straight from the packed
+ * bits, rather than unpacking to 8 bits per pixel and then subsampling.
+ * Gives the same results as fz_unpack_stream followed by
+ * subsample_stream. */
+typedef struct
+{
+	fz_stream *src;
+	int w; /* Width in source pixels. */
+	int h; /* Height (remaining) in scanlines. */
+	int l2; /* The amount of subsampling we're doing. */
+	size_t stride; /* Packed bytes per source scanline. */
+	int *sum; /* Set pixels so far for each destination pixel. */
+	unsigned char *out; /* One destination scanline. */
+	unsigned char *line; /* One packed source scanline. */
+	unsigned char data[1];
+} l2sub_mono_state;
+
+static const unsigned char popcount8[256] =
+{
+#define B2(n) n, n+1, n+1, n+2
+#define B4(n) B2(n), B2(n+1), B2(n+1), B2(n+2)
+#define B6(n) B4(n), B4(n+1), B4(n+1), B4(n+2)
+	B6(0), B6(1), B6(1), B6(2)
+#undef B2
+#undef B4
+#undef B6
+};
+
+static int
+subsample_mono_next(fz_context *ctx, fz_stream *stm, size_t len)
+{
+	l2sub_mono_state *state = (l2sub_mono_state *)stm->state;
+	int f = 1<<state->l2;
+	int dw = (state->w + f - 1)>>state->l2;
+	int rows, x, n;
+	unsigned char *d;
+
+	stm->rp = stm->wp = state->out;
+	if (state->h == 0)
+		return EOF;
+
+	memset(state->sum, 0, dw * sizeof(int));
+
+	for (rows = 0; rows < f && state->h > 0; rows++, state->h--)
+	{
+		unsigned char *s = state->line;
+		int *sum = state->sum;
+
+		if (fz_read(ctx, state->src, s, state->stride) < state->stride)
+		{
+			if (rows == 0)
+				return EOF;
+			state->h = 0;
+			break;
+		}
+
+		/* Ignore the padding bits at the end of the line. */
+		if (state->w & 7)
+			s[state->stride - 1] &= 0xFF00 >> (state->w & 7);
+
+		if (f >= 8)
+		{
+			int bytes = f>>3;
+			for (x = 0; x < dw; x++)
+			{
+				int k = bytes;
+				if (k > (int)(state->line + state->stride - s))
+					k = (int)(state->line + state->stride - s);
+				for (n = 0; n < k; n++)
+					sum[x] += popcount8[s[n]];
+				s += k;
+			}
+		}
+		else
+		{
+			int per = 8>>state->l2;
+			int shift = 8 - f;
+			int mask = (1<<f) - 1;
+			for (x = 0; x < dw; x += per, s++)
+			{
+				int v = *s;
+				for (n = 0; n < per && x + n < dw; n++)
+					sum[x + n] += popcount8[(v >> (shift - n * f)) & mask];
+			}
+		}
+	}
+
+	/* Average, as fz_subsample_pixblock would. */
+	d = state->out;
+	for (x = 0; x < dw; x++)
+	{
+		int cols = state->w - (x<<state->l2);
+		if (cols > f)
+			cols = f;
+		if (cols == f && rows == f)
+			d[x] = (state->sum[x] * 255) >> (2 * state->l2);
+		else
+			d[x] = (state->sum[x] * 255) / (cols * rows);
+	}
+
+	stm->pos += dw;
+	stm->rp = state->out;
+	stm->wp = state->out + dw;
+
+	return *stm->rp++;
+}
+
+static fz_stream *
+subsample_mono_stream(fz_context *ctx, fz_stream *src, int w, int h, int l2extra)
+{
+	int dw = (w + (1<<l2extra) - 1)>>l2extra;
+	size_t stride = ((size_t)w + 7)>>3;
+	l2sub_mono_state *state = fz_malloc(ctx, sizeof(l2sub_mono_state) + dw + stride + dw * sizeof(int));
+
+	state->src = src;
+	state->w = w;
+	state->h = h;
+	state->l2 = l2extra;
+	state->stride = stride;
+	state->sum = (int *)(void *)&state->data[0];
+	state->out = &state->data[dw * sizeof(int)];
+	state->line = state->out + dw;
+
+	return fz_new_stream(ctx, state, subsample_mono_next, subsample_drop);
+}
+
 /* l2factor is the amount of subsampling that the decoder is going to be
  * doing for us already. (So for JPEG 0,1,2,3 corresponding to 1, 2, 4,
  * 8. For other formats, probably 0.). l2extra is the additional amount
  * of subsampling we should perform here. */
-fz_pixmap *
-fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image *cimg, fz_irect *subarea, int indexed, int l2factor, int *l2extra)
+/* If cropped is set, the stream has already been restricted to the
+ * subarea by the decoder. */
+static fz_pixmap *
+decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image *cimg, fz_irect *subarea, int cropped, int indexed, int l2factor, int *l2extra)
 {
 	fz_image *image = &cimg->super;
 	fz_pixmap *tile = NULL;
@@ -574,9 +702,17 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image
 		if (image->use_colorkey)
 			alpha = 1;
 
-		if (subarea)
+		if (subarea && !cropped)
 			read_stream = sstream = subarea_stream(ctx, stm, image, subarea, l2factor);
-		if (image->bpc != 8 || image->use_colorkey)
+		if (image->bpc == 1 && image->n == 1 && !image->use_colorkey && !indexed && l2extra && *l2extra)
+		{
+			/* Subsample 1 bit images without expanding them first. */
+			read_stream = l2stream = subsample_mono_stream(ctx, read_stream, w, h, *l2extra);
+			w = (w + (1<<*l2extra) - 1)>>*l2extra;
+			h = (h + (1<<*l2extra) - 1)>>*l2extra;
+			*l2extra = 0;
+		}
+		else if (image->bpc != 8 || image->use_colorkey)
 			read_stream = unpstream = fz_unpack_stream(ctx, read_stream, image->bpc, w, h, image->n, indexed, image->use_colorkey, 0);
 		if (l2extra && *l2extra && !indexed)
 		{
@@ -650,6 +786,12 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image
 	return tile;
 }
 
+fz_pixmap *
+fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image *cimg, fz_irect *subarea, int indexed, int l2factor, int *l2extra)
+{
+	return decomp_image_from_stream(ctx, stm, cimg, subarea, 0, indexed, l2factor, l2extra);
+}
+
 void
 fz_drop_image_base(fz_context *ctx, fz_image *image)
 {
@@ -692,6 +834,7 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 	int indexed;
 	fz_pixmap *tile;
 	int can_sub = 0;
+	int cropped = 0;
 	int local_l2factor;
 
 	/* If we are using matte, then the decode code requires both image and tile sizes
@@ -726,7 +869,23 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 		tile = fz_load_jxr(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
 		break;
 	case FZ_IMAGE_JPX:
-		tile = fz_load_jpx(ctx, image->buffer->buffer->data, image->buffer->buffer->len, NULL);
+		/* OpenJPEG can decode subareas at reduced resolution itself. */
+		tile = fz_load_jpx_subarea(ctx, image->buffer->buffer->data, image->buffer->buffer->len, image->super.colorspace, subarea, l2factor);
+		can_sub = 1;
+		fz_try(ctx)
+		{
+			if (image->super.interpolate & FZ_PIXMAP_FLAG_INTERPOLATE)
+				tile->flags |= FZ_PIXMAP_FLAG_INTERPOLATE;
+			else
+				tile->flags &= ~FZ_PIXMAP_FLAG_INTERPOLATE;
+			if (image->super.use_decode)
+				fz_decode_tile(ctx, tile, image->super.decode);
+		}
+		fz_catch(ctx)
+		{
+			fz_drop_pixmap(ctx, tile);
+			fz_rethrow(ctx);
+		}
 		break;
 	case FZ_IMAGE_JPEG:
 		/* Scan JPEG stream and patch missing height values in header */
@@ -749,14 +908,23 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 
 	default:
 		native_l2factor = l2factor ? *l2factor : 0;
-		stm = fz_open_image_decomp_stream_from_buffer(ctx, image->buffer, l2factor);
+		/* Let decoders that can do so decode only the subarea. Align it
+		 * for the coarsest subsampling we might get; it stays aligned
+		 * for any finer one the decoder actually gives us. */
+		if (subarea && (subarea->x0 != 0 || subarea->y0 != 0 || subarea->x1 != image->super.w || subarea->y1 != image->super.h))
+		{
+			fz_adjust_image_subarea(ctx, &image->super, subarea, native_l2factor);
+			stm = fz_open_image_decomp_stream_from_buffer_subarea(ctx, image->buffer, l2factor, subarea, &cropped);
+		}
+		else
+			stm = fz_open_image_decomp_stream_from_buffer(ctx, image->buffer, l2factor);
 		fz_try(ctx)
 		{
 			if (l2factor)
 				native_l2factor -= *l2factor;
 			indexed = fz_colorspace_is_indexed(ctx, image->super.colorspace);
 			can_sub = 1;
-			tile = fz_decomp_image_from_stream(ctx, stm, image, subarea, indexed, native_l2factor, l2factor);
+			tile = decomp_image_from_stream(ctx, stm, image, subarea, cropped, indexed, native_l2factor, l2factor);
 		}
 		fz_always(ctx)
 			fz_drop_stream(ctx, stm);
@@ -842,6 +1010,365 @@ void fz_default_image_decode(void *arg, int w, int h, int l2factor, fz_irect *su
 	}
 }
 
+/*
+	Decoded tiles can optionally be kept compressed in the store (see
+	fz_set_image_tile_compression). We use a simple byte oriented LZ77
+	scheme in the style of LZ4, which compresses and decompresses at
+	close to memory speed, and pack monochrome tiles to 1 bit per
+	pixel before that.
+
+	The compressed data is a series of sequences, each a token byte
+	holding a literal count (high nibble) and a match length less 4
+	(low nibble), extended by 255-continued bytes when the nibble is
+	15, then the literals, then a 2 byte little endian match offset.
+	The final sequence has literals only.
+*/
+
+typedef struct
+{
+	fz_storable storable;
+	int x, y, w, h;
+	unsigned char alpha;
+	unsigned char flags;
+	unsigned char mono;
+	unsigned char raw;
+	int xres, yres;
+	fz_colorspace *colorspace;
+	size_t len;
+	unsigned char data[1];
+} fz_packed_tile;
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_LAST_LITERALS 8
+
+static inline unsigned
+lz_hash(const unsigned char *p)
+{
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static unsigned char *
+lz_put_count(unsigned char *d, unsigned char *e, size_t n)
+{
+	while (n >= 255)
+	{
+		if (d == e)
+			return NULL;
+		*d++ = 255;
+		n -= 255;
+	}
+	if (d == e)
+		return NULL;
+	*d++ = (unsigned char)n;
+	return d;
+}
+
+static unsigned char *
+lz_put_sequence(unsigned char *d, unsigned char *e, const unsigned char *lit, size_t nlit, size_t off, size_t nmatch)
+{
+	size_t m = nmatch ? nmatch - LZ_MIN_MATCH : 0;
+
+	if (d == e)
+		return NULL;
+	*d++ = ((nlit < 15 ? nlit : 15) << 4) | (m < 15 ? m : 15);
+	if (nlit >= 15 && (d = lz_put_count(d, e, nlit - 15)) == NULL)
+		return NULL;
+	if (nlit > (size_t)(e - d))
+		return NULL;
+	memcpy(d, lit, nlit);
+	d += nlit;
+	if (nmatch == 0)
+		return d;
+	if (e - d < 2)
+		return NULL;
+	*d++ = off & 255;
+	*d++ = off >> 8;
+	if (m >= 15 && (d = lz_put_count(d, e, m - 15)) == NULL)
+		return NULL;
+	return d;
+}
+
+/* Compress len bytes from src into at most cap bytes at dst. Returns
+ * the compressed length, or 0 if it didn't fit. */
+static size_t
+lz_compress(unsigned char *dst, size_t cap, const unsigned char *src, size_t len)
+{
+	unsigned table[1 << LZ_HASH_BITS];
+	const unsigned char *ip = src;
+	const unsigned char *anchor = src;
+	const unsigned char *end = src + len;
+	const unsigned char *limit = len > LZ_LAST_LITERALS + LZ_MIN_MATCH ? end - LZ_LAST_LITERALS - LZ_MIN_MATCH : src;
+	unsigned char *op = dst;
+	unsigned char *oe = dst + cap;
+
+	/* Entries hold offset + 1, so 0 means empty. */
+	memset(table, 0, sizeof table);
+
+	while (ip < limit)
+	{
+		unsigned h = lz_hash(ip);
+		unsigned r = table[h];
+		const unsigned char *ref = src + r - 1;
+		const unsigned char *m;
+
+		table[h] = (unsigned)(ip - src) + 1;
+		if (r == 0 || ip - ref > LZ_MAX_OFFSET || memcmp(ref, ip, LZ_MIN_MATCH))
+		{
+			/* Step faster through data that doesn't compress. */
+			ip += 1 + ((ip - anchor) >> 6);
+			continue;
+		}
+
+		/* Extend the match as far as we can, keeping back the last few
+		 * bytes as literals. */
+		m = ip + LZ_MIN_MATCH;
+		ref += LZ_MIN_MATCH;
+		while (m < end - LZ_LAST_LITERALS && *m == *ref)
+			m++, ref++;
+
+		op = lz_put_sequence(op, oe, anchor, ip - anchor, m - ref, m - ip);
+		if (op == NULL)
+			return 0;
+		ip = anchor = m;
+	}
+
+	op = lz_put_sequence(op, oe, anchor, end - anchor, 0, 0);
+	if (op == NULL)
+		return 0;
+	return op - dst;
+}
+
+static const unsigned char *
+lz_get_count(const unsigned char *s, const unsigned char *e, size_t *n)
+{
+	unsigned char c;
+	do
+	{
+		if (s == e)
+			return NULL;
+		c = *s++;
+		*n += c;
+	}
+	while (c == 255);
+	return s;
+}
+
+/* Decompress exactly len bytes into dst. Returns 0 on success. */
+static int
+lz_decompress(unsigned char *dst, size_t len, const unsigned char *src, size_t slen)
+{
+	const unsigned char *ip = src;
+	const unsigned char *ie = src + slen;
+	unsigned char *op = dst;
+	unsigned char *oe = dst + len;
+
+	while (ip < ie)
+	{
+		unsigned char token = *ip++;
+		const unsigned char *ref;
+		size_t n, off;
+
+		n = token >> 4;
+		if (n == 15 && (ip = lz_get_count(ip, ie, &n)) == NULL)
+			return -1;
+		if (n > (size_t)(ie - ip) || n > (size_t)(oe - op))
+			return -1;
+		memcpy(op, ip, n);
+		op += n;
+		ip += n;
+		if (ip == ie)
+			break;
+
+		if (ie - ip < 2)
+			return -1;
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+		n = token & 15;
+		if (n == 15 && (ip = lz_get_count(ip, ie, &n)) == NULL)
+			return -1;
+		n += LZ_MIN_MATCH;
+		if (off == 0 || off > (size_t)(op - dst) || n > (size_t)(oe - op))
+			return -1;
+
+		ref = op - off;
+		if (off >= n)
+			memcpy(op, ref, n);
+		else
+		{
+			size_t i;
+			for (i = 0; i < n; i++)
+				op[i] = ref[i];
+		}
+		op += n;
+	}
+
+	return op == oe ? 0 : -1;
+}
+
+static void
+drop_packed_tile(fz_context *ctx, fz_storable *tile_)
+{
+	fz_packed_tile *tile = (fz_packed_tile *)tile_;
+
+	fz_drop_colorspace(ctx, tile->colorspace);
+	fz_free(ctx, tile);
+}
+
+static size_t
+packed_tile_size(fz_packed_tile *tile)
+{
+	return offsetof(fz_packed_tile, data) + tile->len;
+}
+
+/* Compress a tile for the store. Returns NULL if the tile can't be
+ * compressed, or if compressing it doesn't save enough to be worth
+ * the cost of decompressing it again on every hit. */
+static fz_packed_tile *
+pack_tile(fz_context *ctx, fz_pixmap *pix)
+{
+	fz_packed_tile *tile = NULL;
+	unsigned char *bits = NULL;
+	const unsigned char *src;
+	size_t row, len, cap, n;
+	int mono, x, y;
+
+	if (pix->seps || pix->samples == NULL || pix->w <= 0 || pix->h <= 0)
+		return NULL;
+
+	mono = fz_is_pixmap_monochrome(ctx, pix);
+	row = mono ? ((size_t)pix->w + 7) >> 3 : (size_t)pix->w * pix->n;
+	len = row * pix->h;
+	if (!mono && pix->stride != (ptrdiff_t)row)
+		return NULL;
+
+	/* Monochrome tiles are worth storing packed even if they don't
+	 * compress further. Otherwise insist on saving a quarter. */
+	cap = mono ? len : len - len / 4;
+
+	fz_var(tile);
+	fz_var(bits);
+
+	fz_try(ctx)
+	{
+		if (mono)
+		{
+			unsigned char *d = bits = fz_malloc(ctx, len);
+			const unsigned char *s = pix->samples;
+			memset(bits, 0, len);
+			for (y = 0; y < pix->h; y++)
+			{
+				for (x = 0; x < pix->w; x++)
+					if (s[x])
+						d[x >> 3] |= 0x80 >> (x & 7);
+				s += pix->stride;
+				d += row;
+			}
+			src = bits;
+		}
+		else
+			src = pix->samples;
+
+		tile = fz_malloc(ctx, offsetof(fz_packed_tile, data) + cap);
+		n = lz_compress(tile->data, cap, src, len);
+		tile->raw = (n == 0);
+		if (n == 0 && mono)
+		{
+			memcpy(tile->data, bits, len);
+			n = len;
+		}
+		if (n == 0)
+		{
+			fz_free(ctx, tile);
+			tile = NULL;
+		}
+		else
+		{
+			tile = fz_realloc(ctx, tile, offsetof(fz_packed_tile, data) + n);
+			FZ_INIT_STORABLE(tile, 1, drop_packed_tile);
+			tile->x = pix->x;
+			tile->y = pix->y;
+			tile->w = pix->w;
+			tile->h = pix->h;
+			tile->alpha = pix->alpha;
+			tile->flags = pix->flags & FZ_PIXMAP_FLAG_INTERPOLATE;
+			tile->mono = mono;
+			tile->xres = pix->xres;
+			tile->yres = pix->yres;
+			tile->colorspace = fz_keep_colorspace(ctx, pix->colorspace);
+			tile->len = n;
+		}
+	}
+	fz_always(ctx)
+		fz_free(ctx, bits);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, tile);
+		return NULL;
+	}
+
+	return tile;
+}
+
+static fz_pixmap *
+unpack_tile(fz_context *ctx, fz_packed_tile *tile)
+{
+	fz_pixmap *pix;
+	unsigned char *bits = NULL;
+	size_t row;
+	int x, y;
+
+	pix = fz_new_pixmap(ctx, tile->colorspace, tile->w, tile->h, NULL, tile->alpha);
+	pix->x = tile->x;
+	pix->y = tile->y;
+	pix->xres = tile->xres;
+	pix->yres = tile->yres;
+	pix->flags |= tile->flags;
+
+	fz_var(bits);
+
+	fz_try(ctx)
+	{
+		if (tile->mono)
+		{
+			unsigned char *d = pix->samples;
+			const unsigned char *s;
+			row = ((size_t)tile->w + 7) >> 3;
+			if (tile->raw)
+				s = tile->data;
+			else
+			{
+				s = bits = fz_malloc(ctx, row * tile->h);
+				if (lz_decompress(bits, row * tile->h, tile->data, tile->len))
+					fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt compressed tile");
+			}
+			for (y = 0; y < tile->h; y++)
+			{
+				for (x = 0; x < tile->w; x++)
+					d[x] = (s[x >> 3] & (0x80 >> (x & 7))) ? 255 : 0;
+				s += row;
+				d += pix->stride;
+			}
+		}
+		else
+		{
+			if (lz_decompress(pix->samples, (size_t)pix->stride * pix->h, tile->data, tile->len))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt compressed tile");
+		}
+	}
+	fz_always(ctx)
+		fz_free(ctx, bits);
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_rethrow(ctx);
+	}
+
+	return pix;
+}
+
 static fz_pixmap *
 fz_find_image_tile(fz_context *ctx, fz_image *image, fz_image_key *key, fz_matrix *ctm)
 {
@@ -849,6 +1376,19 @@ fz_find_image_tile(fz_context *ctx, fz_image *image, fz_image_key *key, fz_matri
 	do
 	{
 		tile = fz_find_item(ctx, fz_drop_pixmap_imp, key, &fz_image_store_type);
+		if (!tile && fz_image_tile_compression(ctx))
+		{
+			fz_packed_tile *packed = fz_find_item(ctx, drop_packed_tile, key, &fz_image_store_type);
+			if (packed)
+			{
+				fz_try(ctx)
+					tile = unpack_tile(ctx, packed);
+				fz_always(ctx)
+					fz_drop_storable(ctx, &packed->storable);
+				fz_catch(ctx)
+					fz_rethrow(ctx);
+			}
+		}
 		if (tile)
 		{
 			update_ctm_for_subarea(ctm, &key->rect, image->w, image->h);
@@ -860,17 +1400,99 @@ fz_find_image_tile(fz_context *ctx, fz_image *image, fz_image_key *key, fz_matri
 	return NULL;
 }
 
+/* Estimate the cost of decoding a tile again (for the store's eviction
+ * policy), in units of the cost of producing a byte of plain pixmap
+ * data. Tiles are decoded from (up to) 1<<l2factor times as many source
+ * pixels in each direction, and some formats are much slower to decode
+ * than others. */
+static float
+image_tile_cost(fz_context *ctx, fz_image *image, fz_pixmap *tile, int l2factor)
+{
+	fz_compressed_buffer *buffer = fz_compressed_image_buffer(ctx, image);
+	float cost = (float)fz_pixmap_size(ctx, tile) * (1 << (2 * l2factor));
+
+	switch (buffer ? buffer->params.type : FZ_IMAGE_UNKNOWN)
+	{
+	case FZ_IMAGE_JPX:
+		return cost * 8;
+	case FZ_IMAGE_JBIG2:
+		return cost * 4;
+	case FZ_IMAGE_FAX:
+	case FZ_IMAGE_JPEG:
+		return cost * 2;
+	default:
+		return cost;
+	}
+}
+
+/* Look through the store for a tile for subarea (if given), or else
+ * for the entire image, at l2factor or better. */
+static fz_pixmap *
+find_cached_tile(fz_context *ctx, fz_image *image, fz_matrix *ctm, fz_image_key *key, const fz_irect *subarea, int l2factor, int *w, int *h, int *dw, int *dh)
+{
+	fz_pixmap *tile;
+
+	if (subarea)
+	{
+		fz_compute_image_key(ctx, image, ctm, key, subarea, l2factor, w, h, dw, dh);
+		tile = fz_find_image_tile(ctx, image, key, ctm);
+		if (tile)
+			return tile;
+	}
+
+	/* No subarea given, or no tile for subarea found; try entire image */
+	fz_compute_image_key(ctx, image, ctm, key, NULL, l2factor, w, h, dw, dh);
+	return fz_find_image_tile(ctx, image, key, ctm);
+}
+
+/* If a memory budget is in force, and the image (or subarea) would not
+ * fit within it at the given factor, find a larger one that does
+ * (if any), so that we degrade to a lower resolution rather than fail. */
+static int
+fit_image_to_budget(fz_context *ctx, fz_image *image, const fz_irect *subarea, int l2factor)
+{
+	size_t w = image->w;
+	size_t h = image->h;
+	size_t n = (size_t)image->n + 1;
+	int wanted = l2factor;
+
+	if (!ctx->budget)
+		return l2factor;
+
+	if (subarea && subarea->x1 > subarea->x0 && subarea->y1 > subarea->y0)
+	{
+		w = fz_mini(subarea->x1 - subarea->x0, image->w);
+		h = fz_mini(subarea->y1 - subarea->y0, image->h);
+	}
+
+	while (l2factor < 6)
+	{
+		size_t f = (size_t)1 << l2factor;
+		size_t size = ((w + f - 1) >> l2factor) * ((h + f - 1) >> l2factor) * n;
+		if (size <= fz_memory_budget_available(ctx, size))
+			break;
+		l2factor++;
+	}
+
+	if (l2factor != wanted)
+		fz_warn(ctx, "decoding image at 1/%d resolution to fit memory budget", 1 << l2factor);
+
+	return l2factor;
+}
+
 fz_pixmap *
 fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subarea, fz_matrix *ctm, int *dw, int *dh)
 {
 	fz_pixmap *tile;
-	int l2factor, l2factor_remaining;
+	int l2factor, l2factor_remaining, wanted;
 	fz_image_key key;
 	fz_image_key *keyp = NULL;
+	fz_packed_tile *packed = NULL;
 	int w;
 	int h;
 
 	fz_var(keyp);
+	fz_var(packed);
 
 	if (!image)
 		return NULL;
@@ -925,25 +1547,26 @@ fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subar
 		while (image->w>>(l2factor+1) >= w+2 && image->h>>(l2factor+1) >= h+2 && l2factor < 6)
 			l2factor++;
 	}
+	/* First, look through the store for existing tiles. Do this before
+	 * consulting the memory budget, as a tile we already have costs
+	 * nothing more. */
+	tile = find_cached_tile(ctx, image, ctm, &key, subarea, l2factor, &w, &h, dw, dh);
+	if (tile)
+		return tile;
 
-	/* First, look through the store for existing tiles */
-	if (subarea)
+	/* We'll have to decode; if that would not fit in the memory budget,
+	 * we may already have a tile at the resolution we fall back to. */
+	wanted = l2factor;
+	l2factor = fit_image_to_budget(ctx, image, subarea, l2factor);
+	if (l2factor != wanted)
 	{
-		fz_compute_image_key(ctx, image, ctm, &key, subarea, l2factor, &w, &h, dw, dh);
-		tile = fz_find_image_tile(ctx, image, &key, ctm);
+		tile = find_cached_tile(ctx, image, ctm, &key, subarea, l2factor, &w, &h, dw, dh);
 		if (tile)
 			return tile;
 	}
 
-	/* No subarea given, or no tile for subarea found; try entire image */
-	fz_compute_image_key(ctx, image, ctm, &key, NULL, l2factor, &w, &h, dw, dh);
-	tile = fz_find_image_tile(ctx, image, &key, ctm);
-	if (tile)
-		return tile;
-
 	/* Neither subarea nor full image tile found; prepare the subarea key again */
-	if (subarea)
-		fz_compute_image_key(ctx, image, ctm, &key, subarea, l2factor, &w, &h, dw, dh);
+	fz_compute_image_key(ctx, image, ctm, &key, subarea, l2factor, &w, &h, dw, dh);
 
 	/* We'll have to decode the image; request the correct amount of downscaling. */
 	l2factor_remaining = l2factor;
@@ -977,18 +1600,32 @@ fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subar
 		keyp->l2factor = l2factor;
 		keyp->rect = key.rect;
 
-		existing_tile = fz_store_item(ctx, keyp, tile, fz_pixmap_size(ctx, tile), &fz_image_store_type);
-		if (existing_tile)
+		if (fz_image_tile_compression(ctx))
+			packed = pack_tile(ctx, tile);
+		if (packed)
 		{
-			/* We already have a tile. This must have been produced by a
-			 * racing thread. We'll throw away ours and use that one. */
-			fz_drop_pixmap(ctx, tile);
-			tile = existing_tile;
+			/* Store the compressed tile, and return the one we have. */
+			void *existing = fz_store_item_with_cost(ctx, keyp, packed, packed_tile_size(packed), image_tile_cost(ctx, image, tile, l2factor), &fz_image_store_type);
+			if (existing)
+				fz_drop_storable(ctx, existing);
+		}
+		else
+		{
+			existing_tile = fz_store_item_with_cost(ctx, keyp, tile, fz_pixmap_size(ctx, tile), image_tile_cost(ctx, image, tile, l2factor), &fz_image_store_type);
+			if (existing_tile)
+			{
+				/* We already have a tile. This must have been produced by a
+				 * racing thread. We'll throw away ours and use that one. */
+				fz_drop_pixmap(ctx, tile);
+				tile = existing_tile;
+			}
 		}
 	}
 	fz_always(ctx)
 	{
 		fz_drop_image_key(ctx, keyp);
+		if (packed)
+			fz_drop_storable(ctx, &packed->storable);
 	}
 	fz_catch(ctx)
 	{
@@ -1908,9 +1908,19 @@ visible:
 		}
 		fz_catch(ctx)
 		{
-			/* Swallow the error */
+			/* Swallow the error, unless we are out of memory budget;
+			 * carrying on would only fail again. */
 			if (cookie)
 				cookie->errors++;
+			if (fz_caught(ctx) == FZ_ERROR_LIMIT)
+			{
+				if (cookie)
+					cookie->abort = 1;
+				fz_drop_colorspace(ctx, colorspace);
+				fz_drop_stroke_state(ctx, stroke);
+				fz_drop_path(ctx, path);
+				fz_rethrow(ctx);
+			}
 			if (fz_caught(ctx) == FZ_ERROR_ABORT)
 				break;
 			fz_warn(ctx, "Ignoring error during interpretation");
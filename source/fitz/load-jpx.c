@@ -23,6 +23,7 @@
 #include "mupdf/fitz.h"
 
 #include "pixmap-imp.h"
+#include "image-imp.h"
 
 #include <assert.h>
 #include <string.h>
@@ -84,10 +85,20 @@ typedef struct
  *
  * In order to ensure that allocations throughout mupdf
  * are done consistently, we implement opj_malloc etc as
- * functions that call down to fz_malloc etc. These
- * require context variables, so we lock and unlock around
- * calls to openjpeg. Any attempt to call through
- * without setting these will be detected.
+ * functions that call down to the allocator of the context
+ * that is decoding. We lock and unlock around calls to
+ * openjpeg so that only one context is decoding at a time.
+ * Any attempt to call through without setting these will
+ * be detected.
+ *
+ * When OpenJPEG decodes with worker threads, opj_malloc etc
+ * are called from several threads at once on behalf of that
+ * one context. So while those threads may be running, they
+ * must not use the context for anything but its (read only)
+ * allocator and lock functions: they call the allocator
+ * directly under FZ_LOCK_ALLOC, never scavenge the store,
+ * and never throw. Otherwise they go through fz_malloc etc
+ * as usual.
  *
  * It is therefore vital that any fz_lock/fz_unlock
  * handlers are shared between all the fz_contexts in
@@ -100,6 +111,7 @@ typedef struct
  */
 
 static fz_context *opj_secret = NULL;
+static int opj_threaded = 0;
 
 static void set_opj_context(fz_context *ctx)
 {
@@ -120,6 +132,7 @@ void opj_lock(fz_context *ctx)
 
 void opj_unlock(fz_context *ctx)
 {
+	opj_threaded = 0;
 	set_opj_context(NULL);
 
 	fz_unlock(ctx, FZ_LOCK_FREETYPE);
@@ -128,37 +141,80 @@ void opj_unlock(fz_context *ctx)
 void *opj_malloc(size_t size)
 {
 	fz_context *ctx = get_opj_context();
+	void *p;
 
 	assert(ctx != NULL);
 
-	return Memento_label(fz_malloc_no_throw(ctx, size), "opj_malloc");
+	if (!opj_threaded)
+		return Memento_label(fz_malloc_no_throw(ctx, size), "opj_malloc");
+
+	if (size == 0)
+		return NULL;
+	ctx->locks.lock(ctx->locks.user, FZ_LOCK_ALLOC);
+	p = ctx->alloc.malloc(ctx->alloc.user, size);
+	ctx->locks.unlock(ctx->locks.user, FZ_LOCK_ALLOC);
+
+	return Memento_label(p, "opj_malloc");
 }
 
 void *opj_calloc(size_t n, size_t size)
 {
 	fz_context *ctx = get_opj_context();
+	void *p;
 
 	assert(ctx != NULL);
 
-	return fz_calloc_no_throw(ctx, n, size);
+	if (!opj_threaded)
+		return fz_calloc_no_throw(ctx, n, size);
+
+	if (n == 0 || size == 0 || n > SIZE_MAX / size)
+		return NULL;
+	p = opj_malloc(n * size);
+	if (p)
+		memset(p, 0, n * size);
+
+	return p;
 }
 
-void *opj_realloc(void *ptr, size_t size)
+void opj_free(void *ptr)
 {
 	fz_context *ctx = get_opj_context();
 
 	assert(ctx != NULL);
 
-	return fz_realloc_no_throw(ctx, ptr, size);
+	if (!opj_threaded)
+	{
+		fz_free(ctx, ptr);
+		return;
+	}
+
+	if (ptr == NULL)
+		return;
+	ctx->locks.lock(ctx->locks.user, FZ_LOCK_ALLOC);
+	ctx->alloc.free(ctx->alloc.user, ptr);
+	ctx->locks.unlock(ctx->locks.user, FZ_LOCK_ALLOC);
 }
 
-void opj_free(void *ptr)
+void *opj_realloc(void *ptr, size_t size)
 {
 	fz_context *ctx = get_opj_context();
+	void *p;
 
 	assert(ctx != NULL);
 
-	fz_free(ctx, ptr);
+	if (!opj_threaded)
+		return fz_realloc_no_throw(ctx, ptr, size);
+
+	if (size == 0)
+	{
+		opj_free(ptr);
+		return NULL;
+	}
+	ctx->locks.lock(ctx->locks.user, FZ_LOCK_ALLOC);
+	p = ctx->alloc.realloc(ctx->alloc.user, ptr, size);
+	ctx->locks.unlock(ctx->locks.user, FZ_LOCK_ALLOC);
+
+	return p;
 }
 
 static void * opj_aligned_malloc_n(size_t alignment, size_t size)
@@ -370,7 +426,7 @@ template_copy_comp(unsigned char *dst0, int w, int h, int stride, const OPJ_INT3
 }
 
 static void
-copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
+copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx, int32_t x0, int32_t y0)
 {
 	unsigned char *dst;
 	int stride, comps;
@@ -389,8 +445,8 @@ copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
 		OPJ_UINT32 cdy = comp->dy;
 		OPJ_UINT32 cw = comp->w;
 		OPJ_UINT32 ch = comp->h;
-		int32_t oy = safe_mul32(ctx, comp->y0, cdy) - jpx->y0;
-		int32_t ox = safe_mul32(ctx, comp->x0, cdx) - jpx->x0;
+		int32_t oy = safe_mul32(ctx, comp->y0, cdy) - y0;
+		int32_t ox = safe_mul32(ctx, comp->x0, cdx) - x0;
 		unsigned char *dst0 = dst + oy * stride;
 
 		if (comp->data == NULL)
@@ -408,8 +464,56 @@ copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
 	}
 }
 
+/* The number of resolution levels available in every component. */
+static int
+jpx_resolutions(opj_codec_t *codec)
+{
+	opj_codestream_info_v2_t *info = opj_get_cstr_info(codec);
+	OPJ_UINT32 i;
+	int res = 1;
+
+	if (info && info->m_default_tile_info.tccp_info)
+	{
+		res = 33;
+		for (i = 0; i < info->nbcomps; i++)
+			if ((int)info->m_default_tile_info.tccp_info[i].numresolutions < res)
+				res = info->m_default_tile_info.tccp_info[i].numresolutions;
+	}
+	opj_destroy_cstr_info(&info);
+	return res;
+}
+
+/* The number of colour components according to the JP2 colr box, or
+ * 0 if that cannot be known without decoding (including when there
+ * are extra components, which may or may not be alpha). */
+static int
+jpx_header_components(opj_image_t *jpx)
+{
+	int n;
+	switch (jpx->color_space)
+	{
+	case OPJ_CLRSPC_GRAY: n = 1; break;
+	case OPJ_CLRSPC_SRGB: n = 3; break;
+	case OPJ_CLRSPC_SYCC: n = 3; break;
+	case OPJ_CLRSPC_EYCC: n = 3; break;
+	case OPJ_CLRSPC_CMYK: n = 4; break;
+	default: return 0;
+	}
+	if (jpx->numcomps != (OPJ_UINT32)n || jpx->icc_profile_buf)
+		return 0;
+	return n;
+}
+
+/*
+	area: If non-NULL, only decode this area (in image pixels) of
+	the image. Updated to the area actually decoded.
+
+	l2factor: If non-NULL, the log2 subsampling factor wanted. This
+	much is done by dropping resolution levels where the codestream
+	allows it; the remainder is passed back for the caller to do.
+*/
 static fz_pixmap *
-jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, int onlymeta)
+jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, int onlymeta, fz_irect *area, int *l2factor)
 {
 	fz_pixmap *img = NULL;
 	opj_dparameters_t params;
@@ -421,6 +525,10 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 	int w, h;
 	stream_block sb;
 	OPJ_UINT32 i;
+	int reduce = 0;
+	int header_n = 0;
+	int threads;
+	int32_t x0, y0;
 
 	fz_var(img);
 
@@ -447,6 +555,16 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		fz_throw(ctx, FZ_ERROR_GENERIC, "j2k decode failed");
 	}
 
+	/* This is only honoured if OpenJPEG was built with thread support. */
+	threads = fz_image_decode_threads(ctx);
+	if (!onlymeta && threads > 1 && opj_has_thread_support())
+	{
+		/* opj_malloc etc may now be called from the worker
+		 * threads, until opj_unlock. */
+		opj_threaded = 1;
+		opj_codec_set_threads(codec, threads);
+	}
+
 	stream = opj_stream_default_create(OPJ_TRUE);
 	sb.data = data;
 	sb.pos = 0;
@@ -466,12 +584,50 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to read JPX header");
 	}
 
-	if (!opj_decode(codec, stream, jpx))
+	/* When only the metadata is wanted, the header is enough if it
+	 * tells us the colorspace, and that agrees with any colorspace we
+	 * were given. Otherwise we have to decode to see how palettes and
+	 * channel definitions resolve, so that the colorspace matches what
+	 * a full decode will produce. */
+	if (onlymeta)
 	{
-		opj_stream_destroy(stream);
-		opj_destroy_codec(codec);
-		opj_image_destroy(jpx);
-		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to decode JPX image");
+		header_n = jpx_header_components(jpx);
+		if (defcs && header_n != defcs->n)
+			header_n = 0;
+	}
+
+	if (!header_n)
+	{
+		if (area && !onlymeta)
+		{
+			if (area->x0 == 0 && area->y0 == 0 && area->x1 == (int)(jpx->x1 - jpx->x0) && area->y1 == (int)(jpx->y1 - jpx->y0))
+			{
+				/* Whole image; nothing to set. */
+			}
+			else if (!opj_set_decode_area(codec, jpx, jpx->x0 + area->x0, jpx->y0 + area->y0, jpx->x0 + area->x1, jpx->y0 + area->y1))
+			{
+				fz_warn(ctx, "cannot decode JPX subarea; decoding entire image");
+				area->x0 = 0;
+				area->y0 = 0;
+				area->x1 = jpx->x1 - jpx->x0;
+				area->y1 = jpx->y1 - jpx->y0;
+			}
+		}
+
+		if (l2factor && *l2factor > 0 && !onlymeta)
+		{
+			reduce = fz_mini(*l2factor, jpx_resolutions(codec) - 1);
+			if (reduce > 0 && !opj_set_decoded_resolution_factor(codec, reduce))
+				reduce = 0;
+		}
+
+		if (!opj_decode(codec, stream, jpx))
+		{
+			opj_stream_destroy(stream);
+			opj_destroy_codec(codec);
+			opj_image_destroy(jpx);
+			fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to decode JPX image");
+		}
 	}
 
 	opj_stream_destroy(stream);
@@ -483,25 +639,37 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 
 	/* Count number of alpha and color channels */
 	n = a = 0;
-	for (i = 0; i < jpx->numcomps; ++i)
+	if (header_n)
 	{
-		if (jpx->comps[i].alpha)
-			++a;
-		else
-			++n;
+		n = header_n;
+		a = jpx->numcomps - n;
 	}
-
-	for (k = 1; k < n + a; k++)
+	else
 	{
-		if (!jpx->comps[k].data)
+		for (i = 0; i < jpx->numcomps; ++i)
 		{
-			opj_image_destroy(jpx);
-			fz_throw(ctx, FZ_ERROR_GENERIC, "image components are missing data");
+			if (jpx->comps[i].alpha)
+				++a;
+			else
+				++n;
+		}
+
+		for (k = 1; k < n + a; k++)
+		{
+			if (!jpx->comps[k].data)
+			{
+				opj_image_destroy(jpx);
+				fz_throw(ctx, FZ_ERROR_GENERIC, "image components are missing data");
+			}
 		}
 	}
 
-	w = state->width = jpx->x1 - jpx->x0;
-	h = state->height = jpx->y1 - jpx->y0;
+	/* After decoding, the image bounds are those of the decoded area,
+	 * and the components are at the reduced resolution. */
+	x0 = (jpx->x0 + (1 << reduce) - 1) >> reduce;
+	y0 = (jpx->y0 + (1 << reduce) - 1) >> reduce;
+	w = state->width = ((jpx->x1 + (1 << reduce) - 1) >> reduce) - x0;
+	h = state->height = ((jpx->y1 + (1 << reduce) - 1) >> reduce) - y0;
 	state->xres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 	state->yres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 
@@ -572,7 +740,7 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		a = !!a; /* ignore any superfluous alpha channels */
 		img = fz_new_pixmap(ctx, state->cs, w, h, NULL, a);
 		fz_clear_pixmap_with_value(ctx, img, 0);
-		copy_jpx_to_pixmap(ctx, img, jpx);
+		copy_jpx_to_pixmap(ctx, img, jpx, x0, y0);
 
 		if (jpx->color_space == OPJ_CLRSPC_SYCC && n == 3 && a == 0)
 			jpx_ycc_to_rgb(ctx, img, 1, 1);
@@ -590,11 +758,20 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		fz_rethrow(ctx);
 	}
 
+	if (l2factor)
+		*l2factor -= reduce;
+
 	return img;
 }
 
 fz_pixmap *
 fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs)
+{
+	return fz_load_jpx_subarea(ctx, data, size, defcs, NULL, NULL);
+}
+
+fz_pixmap *
+fz_load_jpx_subarea(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, fz_irect *subarea, int *l2factor)
 {
 	fz_jpxd state = { 0 };
 	fz_pixmap *pix = NULL;
@@ -602,7 +779,7 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		pix = jpx_read_image(ctx, &state, data, size, defcs, 0);
+		pix = jpx_read_image(ctx, &state, data, size, defcs, 0, subarea, l2factor);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
@@ -620,7 +797,7 @@ fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *w
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		jpx_read_image(ctx, &state, data, size, NULL, 1);
+		jpx_read_image(ctx, &state, data, size, NULL, 1, NULL, NULL);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
@@ -634,6 +811,44 @@ fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *w
 	*yresp = state.yres;
 }
 
+fz_image *
+fz_new_image_from_jpx(fz_context *ctx, fz_buffer *buffer, fz_colorspace *cs, float *decode, fz_image *mask, int smask_in_data)
+{
+	fz_jpxd state = { 0 };
+	fz_compressed_buffer *bc;
+	fz_image *image = NULL;
+	unsigned char *data;
+	size_t len;
+
+	len = fz_buffer_storage(ctx, buffer, &data);
+
+	fz_try(ctx)
+	{
+		opj_lock(ctx);
+		jpx_read_image(ctx, &state, data, len, cs, 1, NULL, NULL);
+	}
+	fz_always(ctx)
+		opj_unlock(ctx);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	fz_try(ctx)
+	{
+		bc = fz_malloc_struct(ctx, fz_compressed_buffer);
+		bc->buffer = fz_keep_buffer(ctx, buffer);
+		bc->params.type = FZ_IMAGE_JPX;
+		bc->params.u.jpx.smask_in_data = smask_in_data;
+		image = fz_new_image_from_compressed_buffer(ctx, state.width, state.height, 8, state.cs,
+			state.xres, state.yres, 0, 0, decode, NULL, bc, mask);
+	}
+	fz_always(ctx)
+		fz_drop_colorspace(ctx, state.cs);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return image;
+}
+
 #else /* FZ_ENABLE_JPX */
 
 fz_pixmap *
@@ -642,10 +857,22 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	fz_throw(ctx, FZ_ERROR_GENERIC, "JPX support disabled");
 }
 
+fz_pixmap *
+fz_load_jpx_subarea(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, fz_irect *subarea, int *l2factor)
+{
+	fz_throw(ctx, FZ_ERROR_GENERIC, "JPX support disabled");
+}
+
 void
 fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
 {
 	fz_throw(ctx, FZ_ERROR_GENERIC, "JPX support disabled");
 }
 
+fz_image *
+fz_new_image_from_jpx(fz_context *ctx, fz_buffer *buffer, fz_colorspace *cs, float *decode, fz_image *mask, int smask_in_data)
+{
+	fz_throw(ctx, FZ_ERROR_GENERIC, "JPX support disabled");
+}
+
 #endif
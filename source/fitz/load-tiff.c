@@ -41,6 +41,9 @@ struct tiff
 	/* "file" */
 	const unsigned char *bp, *rp, *ep;
 
+	/* file offset of bp; non-zero when only part of the file is in memory */
+	unsigned base;
+
 	/* byte order */
 	unsigned order;
 
@@ -603,6 +606,20 @@ tiff_paste_subsampled_tile(fz_context *ctx, struct tiff *tiff, unsigned char *ti
 	}
 }
 
+static const unsigned char *
+tiff_chunk(fz_context *ctx, struct tiff *tiff, unsigned offset, unsigned rlen, const char *what)
+{
+	const unsigned char *rp;
+
+	if (offset < tiff->base || offset - tiff->base > (unsigned)(tiff->ep - tiff->bp))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid %s offset %u", what, offset);
+	rp = tiff->bp + (offset - tiff->base);
+	if (rlen > (unsigned)(tiff->ep - rp))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid %s byte count %u", what, rlen);
+
+	return rp;
+}
+
 static void
 tiff_decode_tiles(fz_context *ctx, struct tiff *tiff)
 {
@@ -632,16 +649,10 @@ tiff_decode_tiles(fz_context *ctx, struct tiff *tiff)
 		{
 			for (y = 0; y < tiff->imagewidth; y += tiff->tilewidth)
 			{
-				unsigned int offset = tiff->tileoffsets[tile];
 				unsigned int rlen = tiff->tilebytecounts[tile];
-				const unsigned char *rp = tiff->bp + offset;
+				const unsigned char *rp = tiff_chunk(ctx, tiff, tiff->tileoffsets[tile], rlen, "tile");
 				unsigned decoded;
 
-				if (offset > (unsigned)(tiff->ep - tiff->bp))
-					fz_throw(ctx, FZ_ERROR_GENERIC, "invalid tile offset %u", offset);
-				if (rlen > (unsigned)(tiff->ep - rp))
-					fz_throw(ctx, FZ_ERROR_GENERIC, "invalid tile byte count %u", rlen);
-
 				decoded = tiff_decode_data(ctx, tiff, rp, rlen, data, wlen);
 				tiff_paste_subsampled_tile(ctx, tiff, data, decoded, tiff->tilewidth, tiff->tilelength, x, y);
 				tile++;
@@ -658,14 +669,8 @@ tiff_decode_tiles(fz_context *ctx, struct tiff *tiff)
 		{
 			for (y = 0; y < tiff->imagewidth; y += tiff->tilewidth)
 			{
-				unsigned int offset = tiff->tileoffsets[tile];
 				unsigned int rlen = tiff->tilebytecounts[tile];
-				const unsigned char *rp = tiff->bp + offset;
-
-				if (offset > (unsigned)(tiff->ep - tiff->bp))
-					fz_throw(ctx, FZ_ERROR_GENERIC, "invalid tile offset %u", offset);
-				if (rlen > (unsigned)(tiff->ep - rp))
-					fz_throw(ctx, FZ_ERROR_GENERIC, "invalid tile byte count %u", rlen);
+				const unsigned char *rp = tiff_chunk(ctx, tiff, tiff->tileoffsets[tile], rlen, "tile");
 
 				if (tiff_decode_data(ctx, tiff, rp, rlen, data, wlen) != wlen)
 					fz_throw(ctx, FZ_ERROR_GENERIC, "decoded tile is the wrong size");
@@ -709,16 +714,10 @@ tiff_decode_strips(fz_context *ctx, struct tiff *tiff)
 		strip = 0;
 		for (y = 0; y < tiff->imagelength; y += rowsperstrip)
 		{
-			unsigned offset = tiff->stripoffsets[strip];
 			unsigned rlen = tiff->stripbytecounts[strip];
-			const unsigned char *rp = tiff->bp + offset;
+			const unsigned char *rp = tiff_chunk(ctx, tiff, tiff->stripoffsets[strip], rlen, "strip");
 			int decoded;
 
-			if (offset > (unsigned)(tiff->ep - tiff->bp))
-				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid strip offset %u", offset);
-			if (rlen > (unsigned)(tiff->ep - rp))
-				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid strip byte count %u", rlen);
-
 			decoded = tiff_decode_data(ctx, tiff, rp, rlen, data, wlen);
 			tiff_paste_subsampled_tile(ctx, tiff, data, decoded, tiff->imagewidth, tiff->rowsperstrip, 0, y);
 			strip++;
@@ -729,15 +728,9 @@ tiff_decode_strips(fz_context *ctx, struct tiff *tiff)
 		strip = 0;
 		for (y = 0; y < tiff->imagelength; y += tiff->rowsperstrip)
 		{
-			unsigned offset = tiff->stripoffsets[strip];
 			unsigned rlen = tiff->stripbytecounts[strip];
 			unsigned wlen = tiff->stride * tiff->rowsperstrip;
-			const unsigned char *rp = tiff->bp + offset;
-
-			if (offset > (unsigned)(tiff->ep - tiff->bp))
-				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid strip offset %u", offset);
-			if (rlen > (unsigned)(tiff->ep - rp))
-				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid strip byte count %u", rlen);
+			const unsigned char *rp = tiff_chunk(ctx, tiff, tiff->stripoffsets[strip], rlen, "strip");
 
 			/* if imagelength is not a multiple of rowsperstrip, adjust the expectation of the size of the decoded data */
 			if (y + tiff->rowsperstrip >= tiff->imagelength)
@@ -782,12 +775,21 @@ static inline unsigned tiff_readlong(struct tiff *tiff)
 	return (a << 24) | (b << 16) | (c << 8) | d;
 }
 
+/* Position the read pointer at a file offset (or at the end, if that
+ * part of the file is not in memory). */
+static void
+tiff_seek(struct tiff *tiff, unsigned ofs)
+{
+	if (ofs < tiff->base || ofs - tiff->base > (unsigned)(tiff->ep - tiff->bp))
+		tiff->rp = tiff->ep;
+	else
+		tiff->rp = tiff->bp + (ofs - tiff->base);
+}
+
 static void
 tiff_read_bytes(unsigned char *p, struct tiff *tiff, unsigned ofs, unsigned n)
 {
-	if (ofs > (unsigned)(tiff->ep - tiff->bp))
-		ofs = (unsigned)(tiff->ep - tiff->bp);
-	tiff->rp = tiff->bp + ofs;
+	tiff_seek(tiff, ofs);
 
 	while (n--)
 		*p++ = tiff_readbyte(tiff);
@@ -798,9 +800,7 @@ tiff_read_tag_value(unsigned *p, struct tiff *tiff, unsigned type, unsigned ofs,
 {
 	unsigned den;
 
-	if (ofs > (unsigned)(tiff->ep - tiff->bp))
-		ofs = (unsigned)(tiff->ep - tiff->bp);
-	tiff->rp = tiff->bp + ofs;
+	tiff_seek(tiff, ofs);
 
 	while (n--)
 	{
@@ -840,7 +840,7 @@ tiff_read_tag(fz_context *ctx, struct tiff *tiff, unsigned offset)
 	if ((type == TBYTE && count <= 4) ||
 			(type == TSHORT && count <= 2) ||
 			(type == TLONG && count <= 1))
-		value = tiff->rp - tiff->bp;
+		value = tiff->base + (unsigned)(tiff->rp - tiff->bp);
 	else
 		value = tiff_readlong(tiff);
 
@@ -913,6 +913,9 @@ tiff_read_tag(fz_context *ctx, struct tiff *tiff, unsigned offset)
 
 	case JPEGTables:
 		/* Check both value and value + count to allow for overflow */
+		if (value < tiff->base)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "TIFF JPEG tables out of range");
+		value -= tiff->base;
 		if (value > (size_t)(tiff->ep - tiff->bp) || value + count > (size_t)(tiff->ep - tiff->bp))
 			fz_throw(ctx, FZ_ERROR_GENERIC, "TIFF JPEG tables out of range");
 		tiff->jpegtables = tiff->bp + value;
@@ -1004,15 +1007,8 @@ tiff_scale_lab_samples(fz_context *ctx, unsigned char *buf, int bps, int n)
 }
 
 static void
-tiff_read_header(fz_context *ctx, struct tiff *tiff, const unsigned char *buf, size_t len)
+tiff_set_defaults(struct tiff *tiff)
 {
-	unsigned version;
-
-	memset(tiff, 0, sizeof(struct tiff));
-	tiff->bp = buf;
-	tiff->rp = buf;
-	tiff->ep = buf + len;
-
 	/* tag defaults, where applicable */
 	tiff->bitspersample = 1;
 	tiff->compression = 1;
@@ -1025,6 +1021,19 @@ tiff_read_header(fz_context *ctx, struct tiff *tiff, const unsigned char *buf, s
 	tiff->predictor = 1;
 	tiff->ycbcrsubsamp[0] = 2;
 	tiff->ycbcrsubsamp[1] = 2;
+}
+
+static void
+tiff_read_header(fz_context *ctx, struct tiff *tiff, const unsigned char *buf, size_t len)
+{
+	unsigned version;
+
+	memset(tiff, 0, sizeof(struct tiff));
+	tiff->bp = buf;
+	tiff->rp = buf;
+	tiff->ep = buf + len;
+
+	tiff_set_defaults(tiff);
 
 	/*
 	 * Read IFH
@@ -1385,14 +1394,57 @@ tiff_decode_samples(fz_context *ctx, struct tiff *tiff)
 		tiff_scale_lab_samples(ctx, tiff->samples, tiff->bitspersample, tiff->imagewidth * tiff->imagelength);
 }
 
+static fz_pixmap *
+tiff_new_pixmap(fz_context *ctx, struct tiff *tiff)
+{
+	fz_pixmap *image;
+	int alpha;
+
+	/* Expand into fz_pixmap struct */
+	alpha = tiff->extrasamples != 0 || tiff->colorspace == NULL;
+	image = fz_new_pixmap(ctx, tiff->colorspace, tiff->imagewidth, tiff->imagelength, NULL, alpha);
+	image->xres = tiff->xresolution;
+	image->yres = tiff->yresolution;
+
+	fz_try(ctx)
+	{
+		fz_unpack_tile(ctx, image, tiff->samples, tiff->samplesperpixel, tiff->bitspersample, tiff->stride, 0);
+
+		/* We should only do this on non-pre-multiplied images, but files in the wild are bad */
+		/* TODO: check if any samples are non-premul to detect bad files */
+		if (tiff->extrasamples /* == 2 */)
+			fz_premultiply_pixmap(ctx, image);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, image);
+		fz_rethrow(ctx);
+	}
+
+	return image;
+}
+
+static void
+tiff_drop(fz_context *ctx, struct tiff *tiff)
+{
+	/* Clean up scratch memory */
+	fz_drop_colorspace(ctx, tiff->colorspace);
+	fz_free(ctx, tiff->colormap);
+	fz_free(ctx, tiff->stripoffsets);
+	fz_free(ctx, tiff->stripbytecounts);
+	fz_free(ctx, tiff->tileoffsets);
+	fz_free(ctx, tiff->tilebytecounts);
+	fz_free(ctx, tiff->data);
+	fz_free(ctx, tiff->samples);
+	fz_free(ctx, tiff->profile);
+	fz_free(ctx, tiff->ifd_offsets);
+}
+
 fz_pixmap *
 fz_load_tiff_subimage(fz_context *ctx, const unsigned char *buf, size_t len, int subimage)
 {
 	fz_pixmap *image = NULL;
 	struct tiff tiff = { 0 };
-	int alpha;
-
-	fz_var(image);
 
 	fz_try(ctx)
 	{
@@ -1404,38 +1456,12 @@ fz_load_tiff_subimage(fz_context *ctx, const unsigned char *buf, size_t len, int
 		tiff_decode_ifd(ctx, &tiff);
 		tiff_decode_samples(ctx, &tiff);
 
-		/* Expand into fz_pixmap struct */
-		alpha = tiff.extrasamples != 0 || tiff.colorspace == NULL;
-		image = fz_new_pixmap(ctx, tiff.colorspace, tiff.imagewidth, tiff.imagelength, NULL, alpha);
-		image->xres = tiff.xresolution;
-		image->yres = tiff.yresolution;
-
-		fz_unpack_tile(ctx, image, tiff.samples, tiff.samplesperpixel, tiff.bitspersample, tiff.stride, 0);
-
-		/* We should only do this on non-pre-multiplied images, but files in the wild are bad */
-		/* TODO: check if any samples are non-premul to detect bad files */
-		if (tiff.extrasamples /* == 2 */)
-			fz_premultiply_pixmap(ctx, image);
+		image = tiff_new_pixmap(ctx, &tiff);
 	}
 	fz_always(ctx)
-	{
-		/* Clean up scratch memory */
-		fz_drop_colorspace(ctx, tiff.colorspace);
-		fz_free(ctx, tiff.colormap);
-		fz_free(ctx, tiff.stripoffsets);
-		fz_free(ctx, tiff.stripbytecounts);
-		fz_free(ctx, tiff.tileoffsets);
-		fz_free(ctx, tiff.tilebytecounts);
-		fz_free(ctx, tiff.data);
-		fz_free(ctx, tiff.samples);
-		fz_free(ctx, tiff.profile);
-		fz_free(ctx, tiff.ifd_offsets);
-	}
+		tiff_drop(ctx, &tiff);
 	fz_catch(ctx)
-	{
-		fz_drop_pixmap(ctx, image);
 		fz_rethrow(ctx);
-	}
 
 	return image;
 }
@@ -1471,23 +1497,9 @@ fz_load_tiff_info_subimage(fz_context *ctx, const unsigned char *buf, size_t len
 		*cspacep = fz_keep_colorspace(ctx, tiff.colorspace);
 	}
 	fz_always(ctx)
-	{
-		/* Clean up scratch memory */
-		fz_drop_colorspace(ctx, tiff.colorspace);
-		fz_free(ctx, tiff.colormap);
-		fz_free(ctx, tiff.stripoffsets);
-		fz_free(ctx, tiff.stripbytecounts);
-		fz_free(ctx, tiff.tileoffsets);
-		fz_free(ctx, tiff.tilebytecounts);
-		fz_free(ctx, tiff.data);
-		fz_free(ctx, tiff.samples);
-		fz_free(ctx, tiff.profile);
-		fz_free(ctx, tiff.ifd_offsets);
-	}
+		tiff_drop(ctx, &tiff);
 	fz_catch(ctx)
-	{
 		fz_rethrow(ctx);
-	}
 }
 
 void
@@ -1521,3 +1533,404 @@ fz_load_tiff_subimage_count(fz_context *ctx, const unsigned char *buf, size_t le
 
 	return subimage_count;
 }
+
+/*
+	Multi-page TIFF documents.
+
+	Rather than holding the whole file in memory and walking the IFD
+	chain from the start for every page, we index the chain once, and
+	for each page read just its IFD (and the tag data it refers to)
+	and its strips or tiles from the file. The page image decodes
+	lazily from those, and only decodes the strips or tiles needed
+	for the rows it is asked for.
+*/
+
+typedef struct
+{
+	fz_image super;
+	unsigned order;
+	unsigned ifd_offset;
+	fz_buffer *ifd; /* the IFD and the tag data it refers to */
+	unsigned ifd_base;
+	fz_buffer *data; /* the strips or tiles */
+	unsigned data_base;
+} fz_tiff_image;
+
+/* Read the bytes from lo up to hi. The range is clamped to the end of
+ * the file, so that bogus offsets cannot make us allocate more than the
+ * file holds; the buffer may therefore be shorter than asked for. */
+static fz_buffer *
+tiff_read_window(fz_context *ctx, fz_stream *stm, unsigned lo, unsigned hi)
+{
+	fz_buffer *buf;
+	int64_t end;
+
+	if (hi < lo)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid TIFF data range %u to %u", lo, hi);
+
+	fz_seek(ctx, stm, 0, SEEK_END);
+	end = fz_tell(ctx, stm);
+	if (lo > end)
+		lo = (unsigned)end;
+	if (hi > end)
+		hi = (unsigned)end;
+
+	buf = fz_new_buffer(ctx, hi > lo ? hi - lo : 1);
+
+	fz_try(ctx)
+	{
+		fz_seek(ctx, stm, lo, SEEK_SET);
+		buf->len = fz_read(ctx, stm, buf->data, hi - lo);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+
+	return buf;
+}
+
+static int
+tiff_tag_is_used(unsigned tag)
+{
+	switch (tag)
+	{
+	case XResolution: case YResolution: case YCbCrSubSampling:
+	case ICCProfile: case JPEGTables: case ColorMap:
+	case StripOffsets: case StripByteCounts:
+	case TileOffsets: case TileByteCounts:
+		return 1;
+	}
+	/* Single valued tags are never stored out of line in practice,
+	 * but allow for it. */
+	return tag == NewSubfileType || (tag >= ImageWidth && tag <= ExtraSamples);
+}
+
+/* Restrict decoding to the strips or tiles covering the rows of
+ * subarea, and update subarea to the area that will be decoded. */
+static void
+tiff_crop_rows(fz_context *ctx, struct tiff *tiff, fz_irect *subarea)
+{
+	int tiled = tiff->tilelength && tiff->tilewidth && tiff->tileoffsets && tiff->tilebytecounts;
+	unsigned band, first, skip, y0, y1;
+
+	band = tiled ? tiff->tilelength : tiff->rowsperstrip;
+	if (band > tiff->imagelength)
+		band = tiff->imagelength;
+
+	y0 = fz_clampi(subarea->y0, 0, tiff->imagelength);
+	y1 = fz_clampi(subarea->y1, 0, tiff->imagelength);
+
+	subarea->x0 = 0;
+	subarea->y0 = 0;
+	subarea->x1 = tiff->imagewidth;
+	subarea->y1 = tiff->imagelength;
+
+	if (band == 0 || y0 >= y1)
+		return;
+	if (!tiled && !(tiff->stripoffsets && tiff->stripbytecounts))
+		return;
+	/* Subsampled YCbCr strips may be decoded in taller bands than the strips. */
+	if (!tiled && tiff->photometric == 6 && tiff->compression != 6 && tiff->compression != 7 && tiff->rowsperstrip < tiff->ycbcrsubsamp[1])
+		return;
+
+	first = y0 / band;
+	y0 = first * band;
+	if (y1 + band > tiff->imagelength)
+		y1 = tiff->imagelength;
+	else
+		y1 = (y1 + band - 1) / band * band;
+	if (y0 == 0 && y1 == tiff->imagelength)
+		return;
+
+	if (tiled)
+	{
+		skip = first * ((tiff->imagewidth + tiff->tilewidth - 1) / tiff->tilewidth);
+		if (skip >= tiff->tileoffsetslen || skip >= tiff->tilebytecountslen)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "insufficient tile metadata");
+		tiff->tileoffsetslen -= skip;
+		tiff->tilebytecountslen -= skip;
+		memmove(tiff->tileoffsets, tiff->tileoffsets + skip, tiff->tileoffsetslen * sizeof(unsigned));
+		memmove(tiff->tilebytecounts, tiff->tilebytecounts + skip, tiff->tilebytecountslen * sizeof(unsigned));
+	}
+	else
+	{
+		skip = first;
+		if (skip >= tiff->stripoffsetslen || skip >= tiff->stripbytecountslen)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "insufficient strip metadata");
+		tiff->stripoffsetslen -= skip;
+		tiff->stripbytecountslen -= skip;
+		memmove(tiff->stripoffsets, tiff->stripoffsets + skip, tiff->stripoffsetslen * sizeof(unsigned));
+		memmove(tiff->stripbytecounts, tiff->stripbytecounts + skip, tiff->stripbytecountslen * sizeof(unsigned));
+	}
+
+	tiff->imagelength = y1 - y0;
+	subarea->y0 = y0;
+	subarea->y1 = y1;
+}
+
+static void
+tiff_read_ifd_window(fz_context *ctx, struct tiff *tiff, fz_tiff_image *image)
+{
+	memset(tiff, 0, sizeof(struct tiff));
+	tiff_set_defaults(tiff);
+	tiff->order = image->order;
+
+	tiff->bp = image->ifd->data;
+	tiff->ep = image->ifd->data + image->ifd->len;
+	tiff->base = image->ifd_base;
+	tiff_seek(tiff, image->ifd_offset);
+	if (tiff->rp == tiff->ep)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid IFD offset %u", image->ifd_offset);
+
+	tiff_read_ifd(ctx, tiff);
+	tiff_decode_ifd(ctx, tiff);
+}
+
+static fz_pixmap *
+tiff_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea, int w, int h, int *l2factor)
+{
+	fz_tiff_image *image = (fz_tiff_image *)image_;
+	fz_pixmap *pix = NULL;
+	struct tiff tiff = { 0 };
+
+	fz_try(ctx)
+	{
+		tiff_read_ifd_window(ctx, &tiff, image);
+		if (subarea)
+			tiff_crop_rows(ctx, &tiff, subarea);
+
+		tiff.bp = image->data->data;
+		tiff.rp = tiff.bp;
+		tiff.ep = image->data->data + image->data->len;
+		tiff.base = image->data_base;
+		tiff_decode_samples(ctx, &tiff);
+
+		pix = tiff_new_pixmap(ctx, &tiff);
+	}
+	fz_always(ctx)
+		tiff_drop(ctx, &tiff);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return pix;
+}
+
+static size_t
+tiff_image_get_size(fz_context *ctx, fz_image *image_)
+{
+	fz_tiff_image *image = (fz_tiff_image *)image_;
+
+	if (image == NULL)
+		return 0;
+	return sizeof(fz_tiff_image) + image->ifd->cap + image->data->cap;
+}
+
+static void
+drop_tiff_image(fz_context *ctx, fz_image *image_)
+{
+	fz_tiff_image *image = (fz_tiff_image *)image_;
+
+	fz_drop_buffer(ctx, image->ifd);
+	fz_drop_buffer(ctx, image->data);
+}
+
+static unsigned
+tiff_read_stream_header(fz_context *ctx, struct tiff *tiff, fz_stream *stm)
+{
+	unsigned char hdr[8];
+	size_t n;
+
+	fz_seek(ctx, stm, 0, SEEK_SET);
+	n = fz_read(ctx, stm, hdr, sizeof hdr);
+	tiff_read_header(ctx, tiff, hdr, n);
+	tiff->bp = tiff->rp = tiff->ep = NULL;
+
+	return tiff->ifd_offsets[0];
+}
+
+int
+fz_load_tiff_subimage_offsets(fz_context *ctx, fz_stream *stm, unsigned **offsetsp)
+{
+	struct tiff tiff = { 0 };
+	unsigned char buf[4];
+	unsigned *offsets = NULL;
+	unsigned offset, count;
+	int i, n = 0, cap = 0;
+
+	fz_var(offsets);
+
+	fz_try(ctx)
+	{
+		offset = tiff_read_stream_header(ctx, &tiff, stm);
+
+		do
+		{
+			for (i = 0; i < n; i++)
+				if (offsets[i] == offset)
+					fz_throw(ctx, FZ_ERROR_GENERIC, "cycle in IFDs detected");
+			if (n == cap)
+			{
+				cap = cap ? cap * 2 : 16;
+				offsets = fz_realloc_array(ctx, offsets, cap, unsigned);
+			}
+			offsets[n++] = offset;
+
+			fz_seek(ctx, stm, offset, SEEK_SET);
+			if (fz_read(ctx, stm, buf, 2) != 2)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid IFD offset %u", offset);
+			tiff.rp = buf;
+			tiff.ep = buf + 2;
+			count = readshort(&tiff);
+
+			fz_seek(ctx, stm, (int64_t)offset + 2 + count * 12, SEEK_SET);
+			if (fz_read(ctx, stm, buf, 4) != 4)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "overlarge IFD entry count %u", count);
+			tiff.rp = buf;
+			tiff.ep = buf + 4;
+			offset = tiff_readlong(&tiff);
+		}
+		while (offset != 0);
+	}
+	fz_always(ctx)
+		fz_free(ctx, tiff.ifd_offsets);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, offsets);
+		fz_rethrow(ctx);
+	}
+
+	*offsetsp = offsets;
+	return n;
+}
+
+fz_image *
+fz_new_image_from_tiff_subimage(fz_context *ctx, fz_stream *stm, unsigned ifd_offset)
+{
+	static const unsigned char typesize[] = { 1, 1, 1, 2, 4, 8 };
+	fz_tiff_image *image = NULL;
+	fz_image *result = NULL;
+	fz_buffer *entries = NULL;
+	fz_buffer *ifd = NULL;
+	fz_buffer *data = NULL;
+	fz_pixmap *pix = NULL;
+	struct tiff tiff = { 0 };
+	fz_tiff_image tmp = { 0 };
+	unsigned char buf[2];
+	unsigned i, count, lo, hi;
+	unsigned *offsets, *counts, len;
+
+	fz_var(image);
+	fz_var(entries);
+	fz_var(ifd);
+	fz_var(data);
+	fz_var(pix);
+
+	fz_try(ctx)
+	{
+		tiff_read_stream_header(ctx, &tiff, stm);
+		tmp.order = tiff.order;
+		tmp.ifd_offset = ifd_offset;
+
+		/* Find the extent of the IFD and the tag data it refers to. */
+		fz_seek(ctx, stm, ifd_offset, SEEK_SET);
+		if (fz_read(ctx, stm, buf, 2) != 2)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "invalid IFD offset %u", ifd_offset);
+		tiff.rp = buf;
+		tiff.ep = buf + 2;
+		count = readshort(&tiff);
+
+		if (ifd_offset > UINT_MAX - 2 - count * 12)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "invalid IFD offset %u", ifd_offset);
+		lo = ifd_offset;
+		hi = ifd_offset + 2 + count * 12;
+		entries = tiff_read_window(ctx, stm, ifd_offset + 2, hi);
+		if (entries->len < count * 12)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "overlarge IFD entry count %u", count);
+		tiff.rp = entries->data;
+		tiff.ep = entries->data + entries->len;
+		for (i = 0; i < count; i++)
+		{
+			unsigned tag = readshort(&tiff);
+			unsigned type = readshort(&tiff);
+			unsigned n = tiff_readlong(&tiff);
+			unsigned value = tiff_readlong(&tiff);
+			uint64_t size = (uint64_t)n * (type < nelem(typesize) ? typesize[type] : 1);
+			if (size > 4 && tiff_tag_is_used(tag) && value + size <= UINT_MAX)
+			{
+				if (value < lo)
+					lo = value;
+				if (value + size > hi)
+					hi = (unsigned)(value + size);
+			}
+		}
+
+		tmp.ifd = ifd = tiff_read_window(ctx, stm, lo, hi);
+		tmp.ifd_base = lo;
+		tiff_drop(ctx, &tiff);
+		tiff_read_ifd_window(ctx, &tiff, &tmp);
+
+		/* Find the extent of the strips or tiles. */
+		if (tiff.tilelength && tiff.tilewidth && tiff.tileoffsets && tiff.tilebytecounts)
+		{
+			offsets = tiff.tileoffsets;
+			counts = tiff.tilebytecounts;
+			len = (tiff.tileoffsetslen < tiff.tilebytecountslen ? tiff.tileoffsetslen : tiff.tilebytecountslen);
+		}
+		else
+		{
+			offsets = tiff.stripoffsets;
+			counts = tiff.stripbytecounts;
+			len = (tiff.stripoffsetslen < tiff.stripbytecountslen ? tiff.stripoffsetslen : tiff.stripbytecountslen);
+		}
+		lo = UINT_MAX;
+		hi = 0;
+		for (i = 0; i < len; i++)
+		{
+			if (offsets[i] > UINT_MAX - counts[i])
+				continue;
+			if (offsets[i] < lo)
+				lo = offsets[i];
+			if (offsets[i] + counts[i] > hi)
+				hi = offsets[i] + counts[i];
+		}
+		if (lo > hi)
+			lo = hi = 0;
+
+		tmp.data = data = tiff_read_window(ctx, stm, lo, hi);
+		tmp.data_base = lo;
+
+		if (tiff.colorspace == NULL)
+		{
+			/* Transparency masks don't fit the image model; decode them now. */
+			pix = tiff_image_get_pixmap(ctx, &tmp.super, NULL, 0, 0, NULL);
+			result = fz_new_image_from_pixmap(ctx, pix, NULL);
+		}
+		else
+		{
+			image = fz_new_derived_image(ctx, tiff.imagewidth, tiff.imagelength, 8, tiff.colorspace,
+				tiff.xresolution, tiff.yresolution, 0, 0, NULL, NULL, NULL,
+				fz_tiff_image, tiff_image_get_pixmap, tiff_image_get_size, drop_tiff_image);
+			image->order = tmp.order;
+			image->ifd_offset = ifd_offset;
+			image->ifd = fz_keep_buffer(ctx, ifd);
+			image->ifd_base = tmp.ifd_base;
+			image->data = fz_keep_buffer(ctx, data);
+			image->data_base = tmp.data_base;
+			result = &image->super;
+		}
+	}
+	fz_always(ctx)
+	{
+		tiff_drop(ctx, &tiff);
+		fz_drop_pixmap(ctx, pix);
+		fz_drop_buffer(ctx, entries);
+		fz_drop_buffer(ctx, ifd);
+		fz_drop_buffer(ctx, data);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return result;
+}
@@ -22,6 +22,8 @@
 
 #include "mupdf/fitz.h"
 
+#include "pixmap-imp.h"
+
 #include <limits.h>
 #include <string.h>
 #include <stdlib.h>
@@ -388,3 +390,138 @@ void fz_lock_debug_unlock(fz_context *ctx, int lock)
 }
 
 #endif
+
+struct fz_memory_budget
+{
+	int refs;
+	size_t limit;
+	size_t used;
+	size_t peak;
+	int failures;
+};
+
+void
+fz_set_memory_budget(fz_context *ctx, size_t limit)
+{
+	fz_memory_budget *budget = NULL;
+
+	if (limit > 0)
+	{
+		budget = fz_malloc_struct(ctx, fz_memory_budget);
+		budget->refs = 1;
+		budget->limit = limit;
+	}
+	fz_drop_memory_budget(ctx, ctx->budget);
+	ctx->budget = budget;
+}
+
+fz_memory_budget *
+fz_keep_memory_budget(fz_context *ctx, fz_memory_budget *budget)
+{
+	return fz_keep_imp(ctx, budget, &budget->refs);
+}
+
+void
+fz_drop_memory_budget(fz_context *ctx, fz_memory_budget *budget)
+{
+	if (fz_drop_imp(ctx, budget, &budget->refs))
+		fz_free(ctx, budget);
+}
+
+/* Is this store item a pixmap charged to the given budget? Items
+ * charged elsewhere (or not at all) would free nothing here. */
+static int
+charged_to_budget(fz_context *ctx, void *budget, fz_storable *val)
+{
+	return val->drop == fz_drop_pixmap_imp && ((fz_pixmap *)val)->budget == budget;
+}
+
+/* Evict pixmaps charged to the budget from the store until size more
+ * bytes fit within the budget, or there are none left to evict. This
+ * is the same as dropping the caches that the budget pays for to make
+ * room. Called with FZ_LOCK_ALLOC held. */
+static int
+make_room_in_budget(fz_context *ctx, fz_memory_budget *budget, size_t size)
+{
+	if (size > budget->limit)
+		return 0;
+	while (size > budget->limit - budget->used)
+	{
+		if (!fz_store_evict(ctx, size - (budget->limit - budget->used), charged_to_budget, budget))
+			return 0;
+	}
+	return 1;
+}
+
+size_t
+fz_memory_budget_available(fz_context *ctx, size_t wanted)
+{
+	fz_memory_budget *budget = ctx->budget;
+	size_t available;
+
+	if (!budget)
+		return SIZE_MAX;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	(void)make_room_in_budget(ctx, budget, wanted);
+	available = budget->limit - budget->used;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return available;
+}
+
+fz_memory_budget *
+fz_charge_memory_budget(fz_context *ctx, size_t size)
+{
+	fz_memory_budget *budget = ctx->budget;
+	size_t used, limit;
+
+	if (!budget)
+		return NULL;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (!make_room_in_budget(ctx, budget, size))
+	{
+		budget->failures++;
+		used = budget->used;
+		limit = budget->limit;
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		fz_throw(ctx, FZ_ERROR_LIMIT, "memory budget exceeded (%zu bytes wanted, %zu of %zu in use)", size, used, limit);
+	}
+	budget->used += size;
+	if (budget->used > budget->peak)
+		budget->peak = budget->used;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return fz_keep_memory_budget(ctx, budget);
+}
+
+void
+fz_release_memory_budget(fz_context *ctx, fz_memory_budget *budget, size_t size)
+{
+	if (!budget)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	budget->used -= size;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	fz_drop_memory_budget(ctx, budget);
+}
+
+void
+fz_get_memory_budget_stats(fz_context *ctx, fz_memory_budget_stats *stats)
+{
+	fz_memory_budget *budget = ctx->budget;
+
+	memset(stats, 0, sizeof *stats);
+	if (!budget)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	stats->limit = budget->limit;
+	stats->used = budget->used;
+	stats->peak = budget->peak;
+	stats->failures = budget->failures;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
@@ -0,0 +1,430 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+#include "mupdf/fitz.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <jpeglib.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#ifndef SHARE_JPEG
+typedef void * backing_store_ptr;
+#include "jmemcust.h"
+#endif
+
+#define JPEG_DEFAULT_QUALITY 90
+
+fz_jpeg_options *
+fz_parse_jpeg_options(fz_context *ctx, fz_jpeg_options *opts, const char *args)
+{
+	const char *val;
+
+	opts->quality = JPEG_DEFAULT_QUALITY;
+	opts->subsample = 1;
+
+	if (fz_has_option(ctx, args, "quality", &val))
+	{
+		int i = fz_atoi(val);
+		if (i < 1 || i > 100)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "Unsupported JPEG quality %d (1 to 100)", i);
+		opts->quality = i;
+	}
+	if (fz_has_option(ctx, args, "subsample", &val))
+	{
+		if (fz_option_eq(val, "no"))
+			opts->subsample = 0;
+		else if (fz_option_eq(val, "yes"))
+			opts->subsample = 1;
+		else
+			fz_throw(ctx, FZ_ERROR_GENERIC, "Expected 'yes' or 'no' for subsample value");
+	}
+
+	return opts;
+}
+
+typedef struct jpeg_band_writer_s
+{
+	fz_band_writer super;
+	fz_jpeg_options options;
+	fz_context *ctx;
+	int created;
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_destination_mgr dstmgr;
+	struct jpeg_error_mgr errmgr;
+
+	unsigned char buffer[4096];
+} jpeg_band_writer;
+
+#ifdef SHARE_JPEG
+
+#define JPEG_WRITER_FROM_CINFO(c) (jpeg_band_writer *)((c)->client_data)
+
+static void fz_jpeg_mem_init(struct jpeg_compress_struct *cinfo, jpeg_band_writer *writer)
+{
+	cinfo->client_data = writer;
+}
+
+#define fz_jpeg_mem_term(cinfo)
+
+#else /* SHARE_JPEG */
+
+#define JPEG_WRITER_FROM_CINFO(c) (jpeg_band_writer *)(GET_CUST_MEM_DATA(c)->priv)
+
+static void *
+fz_jpeg_mem_alloc(j_common_ptr cinfo, size_t size)
+{
+	jpeg_band_writer *writer = JPEG_WRITER_FROM_CINFO(cinfo);
+	return Memento_label(fz_malloc_no_throw(writer->ctx, size), "jpeg_write_alloc");
+}
+
+static void
+fz_jpeg_mem_free(j_common_ptr cinfo, void *object, size_t size)
+{
+	jpeg_band_writer *writer = JPEG_WRITER_FROM_CINFO(cinfo);
+	fz_free(writer->ctx, object);
+}
+
+static void
+fz_jpeg_mem_init(struct jpeg_compress_struct *cinfo, jpeg_band_writer *writer)
+{
+	jpeg_cust_mem_data *custmptr;
+	custmptr = fz_malloc_struct(writer->ctx, jpeg_cust_mem_data);
+	if (!jpeg_cust_mem_init(custmptr, (void *) writer, NULL, NULL, NULL,
+				fz_jpeg_mem_alloc, fz_jpeg_mem_free,
+				fz_jpeg_mem_alloc, fz_jpeg_mem_free, NULL))
+	{
+		fz_free(writer->ctx, custmptr);
+		fz_throw(writer->ctx, FZ_ERROR_GENERIC, "cannot initialize custom JPEG memory handler");
+	}
+	cinfo->client_data = custmptr;
+}
+
+static void
+fz_jpeg_mem_term(struct jpeg_compress_struct *cinfo)
+{
+	if (cinfo->client_data)
+	{
+		jpeg_band_writer *writer = JPEG_WRITER_FROM_CINFO(cinfo);
+		fz_free(writer->ctx, cinfo->client_data);
+		cinfo->client_data = NULL;
+	}
+}
+
+#endif /* SHARE_JPEG */
+
+static void error_exit_jpeg(j_common_ptr cinfo)
+{
+	char msg[JMSG_LENGTH_MAX];
+	jpeg_band_writer *writer = JPEG_WRITER_FROM_CINFO(cinfo);
+	cinfo->err->format_message(cinfo, msg);
+	fz_throw(writer->ctx, FZ_ERROR_GENERIC, "jpeg error: %s", msg);
+}
+
+static void init_destination_jpeg(j_compress_ptr cinfo)
+{
+	jpeg_band_writer *writer = JPEG_WRITER_FROM_CINFO(cinfo);
+	cinfo->dest->next_output_byte = writer->buffer;
+	cinfo->dest->free_in_buffer = sizeof(writer->buffer);
+}
+
+static boolean empty_output_buffer_jpeg(j_compress_ptr cinfo)
+{
+	jpeg_band_writer *writer = JPEG_WRITER_FROM_CINFO(cinfo);
+	fz_write_data(writer->ctx, writer->super.out, writer->buffer, sizeof(writer->buffer));
+	cinfo->dest->next_output_byte = writer->buffer;
+	cinfo->dest->free_in_buffer = sizeof(writer->buffer);
+	return TRUE;
+}
+
+static void term_destination_jpeg(j_compress_ptr cinfo)
+{
+	jpeg_band_writer *writer = JPEG_WRITER_FROM_CINFO(cinfo);
+	size_t len = sizeof(writer->buffer) - cinfo->dest->free_in_buffer;
+	fz_write_data(writer->ctx, writer->super.out, writer->buffer, len);
+}
+
+static void
+jpeg_write_icc(fz_context *ctx, jpeg_band_writer *writer, fz_colorspace *cs)
+{
+#if FZ_ENABLE_ICC
+	if (cs && !(cs->flags & FZ_COLORSPACE_IS_DEVICE) && (cs->flags & FZ_COLORSPACE_IS_ICC) && cs->u.icc.buffer)
+	{
+		/* The profile is split across as many APP2 markers as it
+		 * takes, each with a 14 byte identifying header. */
+		enum { MAX_CHUNK = 65533 - 14 };
+		unsigned char *data, *chunk = NULL;
+		size_t size, len;
+		int i, count;
+
+		size = fz_buffer_storage(ctx, cs->u.icc.buffer, &data);
+		count = (int)((size + MAX_CHUNK - 1) / MAX_CHUNK);
+		if (size == 0 || count > 255)
+			return;
+
+		fz_try(ctx)
+		{
+			chunk = fz_malloc(ctx, 14 + MAX_CHUNK);
+			memcpy(chunk, "ICC_PROFILE", 12);
+			for (i = 0; i < count; i++)
+			{
+				len = size - (size_t)i * MAX_CHUNK;
+				if (len > MAX_CHUNK)
+					len = MAX_CHUNK;
+				chunk[12] = i + 1;
+				chunk[13] = count;
+				memcpy(chunk + 14, data + (size_t)i * MAX_CHUNK, len);
+				jpeg_write_marker(&writer->cinfo, JPEG_APP0 + 2, chunk, (unsigned int)(14 + len));
+			}
+		}
+		fz_always(ctx)
+			fz_free(ctx, chunk);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+	}
+#endif
+}
+
+static void
+jpeg_write_header(fz_context *ctx, fz_band_writer *writer_, fz_colorspace *cs)
+{
+	jpeg_band_writer *writer = (jpeg_band_writer *)(void *)writer_;
+	struct jpeg_compress_struct *cinfo = &writer->cinfo;
+	int n = writer->super.n;
+
+	if (writer->super.s != 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "JPEGs cannot contain spot colors");
+	if (writer->super.alpha != 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "JPEGs cannot contain alpha");
+	if (n != 1 && n != 3)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "pixmap must be grayscale or rgb to write as jpeg");
+	if (writer->created)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "JPEG band writer can only write one image");
+
+	writer->ctx = ctx;
+
+	fz_jpeg_mem_init(cinfo, writer);
+	cinfo->err = jpeg_std_error(&writer->errmgr);
+	cinfo->err->error_exit = error_exit_jpeg;
+	jpeg_create_compress(cinfo);
+	writer->created = 1;
+
+	writer->dstmgr.init_destination = init_destination_jpeg;
+	writer->dstmgr.empty_output_buffer = empty_output_buffer_jpeg;
+	writer->dstmgr.term_destination = term_destination_jpeg;
+	cinfo->dest = &writer->dstmgr;
+
+	cinfo->image_width = writer->super.w;
+	cinfo->image_height = writer->super.h;
+	cinfo->input_components = n;
+	cinfo->in_color_space = (n == 1 ? JCS_GRAYSCALE : JCS_RGB);
+	jpeg_set_defaults(cinfo);
+	jpeg_set_quality(cinfo, writer->options.quality, TRUE);
+
+	/* jpeg_set_defaults halves the chroma resolution in both
+	 * directions; keep it at full resolution if asked to. */
+	if (n == 3 && !writer->options.subsample)
+	{
+		cinfo->comp_info[0].h_samp_factor = 1;
+		cinfo->comp_info[0].v_samp_factor = 1;
+	}
+
+	cinfo->density_unit = 1; /* dots per inch */
+	cinfo->X_density = writer->super.xres;
+	cinfo->Y_density = writer->super.yres;
+
+	jpeg_start_compress(cinfo, TRUE);
+
+	jpeg_write_icc(ctx, writer, cs);
+}
+
+static void
+jpeg_write_band(fz_context *ctx, fz_band_writer *writer_, int stride, int band_start, int band_height, const unsigned char *sp)
+{
+	jpeg_band_writer *writer = (jpeg_band_writer *)(void *)writer_;
+	JSAMPROW row;
+	int y;
+
+	if (!writer->super.out)
+		return;
+
+	writer->ctx = ctx;
+
+	/* Rows are handed straight to the compressor as they arrive;
+	 * nothing of the image is kept beyond libjpeg's own buffers. */
+	for (y = 0; y < band_height; y++)
+	{
+		row = (JSAMPROW)sp;
+		jpeg_write_scanlines(&writer->cinfo, &row, 1);
+		sp += stride;
+	}
+}
+
+static void
+jpeg_write_trailer(fz_context *ctx, fz_band_writer *writer_)
+{
+	jpeg_band_writer *writer = (jpeg_band_writer *)(void *)writer_;
+
+	if (!writer->super.out)
+		return;
+
+	writer->ctx = ctx;
+	jpeg_finish_compress(&writer->cinfo);
+}
+
+static void
+jpeg_drop_band_writer(fz_context *ctx, fz_band_writer *writer_)
+{
+	jpeg_band_writer *writer = (jpeg_band_writer *)(void *)writer_;
+
+	writer->ctx = ctx;
+	if (writer->created)
+		jpeg_destroy_compress(&writer->cinfo);
+	fz_jpeg_mem_term(&writer->cinfo);
+}
+
+fz_band_writer *fz_new_jpeg_band_writer(fz_context *ctx, fz_output *out, const fz_jpeg_options *options)
+{
+	jpeg_band_writer *writer = fz_new_band_writer(ctx, jpeg_band_writer, out);
+
+	writer->super.header = jpeg_write_header;
+	writer->super.band = jpeg_write_band;
+	writer->super.trailer = jpeg_write_trailer;
+	writer->super.drop = jpeg_drop_band_writer;
+
+	if (options)
+		writer->options = *options;
+	else
+		fz_parse_jpeg_options(ctx, &writer->options, NULL);
+
+	return &writer->super;
+}
+
+void
+fz_write_pixmap_as_jpeg(fz_context *ctx, fz_output *out, const fz_pixmap *pixmap, const fz_jpeg_options *options)
+{
+	fz_band_writer *writer;
+
+	if (!pixmap || !out)
+		return;
+
+	writer = fz_new_jpeg_band_writer(ctx, out, options);
+	fz_try(ctx)
+	{
+		fz_write_header(ctx, writer, pixmap->w, pixmap->h, pixmap->n, pixmap->alpha, pixmap->xres, pixmap->yres, 0, pixmap->colorspace, pixmap->seps);
+		fz_write_band(ctx, writer, pixmap->stride, pixmap->h, pixmap->samples);
+	}
+	fz_always(ctx)
+		fz_drop_band_writer(ctx, writer);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+void
+fz_save_pixmap_as_jpeg(fz_context *ctx, fz_pixmap *pixmap, const char *filename, const fz_jpeg_options *options)
+{
+	fz_output *out = fz_new_output_with_path(ctx, filename, 0);
+	fz_try(ctx)
+	{
+		fz_write_pixmap_as_jpeg(ctx, out, pixmap, options);
+		fz_close_output(ctx, out);
+	}
+	fz_always(ctx)
+		fz_drop_output(ctx, out);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* JPEG document writer: one file per page, as for the other image
+ * formats, but with the JPEG options parsed too. */
+
+typedef struct
+{
+	fz_document_writer super;
+	fz_draw_options draw;
+	fz_jpeg_options jpeg;
+	fz_pixmap *pixmap;
+	int count;
+	char *path;
+} fz_jpeg_writer;
+
+static fz_device *
+jpeg_begin_page(fz_context *ctx, fz_document_writer *wri_, fz_rect mediabox)
+{
+	fz_jpeg_writer *wri = (fz_jpeg_writer*)wri_;
+	return fz_new_draw_device_with_options(ctx, &wri->draw, mediabox, &wri->pixmap);
+}
+
+static void
+jpeg_end_page(fz_context *ctx, fz_document_writer *wri_, fz_device *dev)
+{
+	fz_jpeg_writer *wri = (fz_jpeg_writer*)wri_;
+	char path[PATH_MAX];
+
+	fz_try(ctx)
+	{
+		fz_close_device(ctx, dev);
+		wri->count += 1;
+		fz_format_output_path(ctx, path, sizeof path, wri->path, wri->count);
+		fz_save_pixmap_as_jpeg(ctx, wri->pixmap, path, &wri->jpeg);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_pixmap(ctx, wri->pixmap);
+		wri->pixmap = NULL;
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+jpeg_drop_writer(fz_context *ctx, fz_document_writer *wri_)
+{
+	fz_jpeg_writer *wri = (fz_jpeg_writer*)wri_;
+	fz_drop_pixmap(ctx, wri->pixmap);
+	fz_free(ctx, wri->path);
+}
+
+fz_document_writer *
+fz_new_jpeg_pixmap_writer(fz_context *ctx, const char *path, const char *options)
+{
+	fz_jpeg_writer *wri = fz_new_derived_document_writer(ctx, fz_jpeg_writer, jpeg_begin_page, jpeg_end_page, NULL, jpeg_drop_writer);
+
+	fz_try(ctx)
+	{
+		fz_parse_draw_options(ctx, &wri->draw, options);
+		fz_parse_jpeg_options(ctx, &wri->jpeg, options);
+		wri->path = fz_strdup(ctx, path ? path : "out-%04d.jpg");
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, wri);
+		fz_rethrow(ctx);
+	}
+
+	return (fz_document_writer*)wri;
+}
@@ -34,6 +34,28 @@ static inline void big32(unsigned char *buf, unsigned int v)
 	buf[3] = (v) & 0xff;
 }
 
+/* Write an IDAT chunk made of the given head, data and tail. */
+static void putidat(fz_context *ctx, fz_output *out, const unsigned char *head, size_t nhead, const unsigned char *data, size_t size, const unsigned char *tail, size_t ntail)
+{
+	unsigned int sum;
+	size_t total = nhead + size + ntail;
+
+	if ((uint32_t)total != total)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "PNG chunk too large");
+
+	fz_write_int32_be(ctx, out, (int)total);
+	fz_write_data(ctx, out, "IDAT", 4);
+	fz_write_data(ctx, out, head, nhead);
+	fz_write_data(ctx, out, data, size);
+	fz_write_data(ctx, out, tail, ntail);
+	sum = crc32(0, NULL, 0);
+	sum = crc32(sum, (const unsigned char*)"IDAT", 4);
+	sum = crc32(sum, head, (unsigned int)nhead);
+	sum = crc32(sum, data, (unsigned int)size);
+	sum = crc32(sum, tail, (unsigned int)ntail);
+	fz_write_int32_be(ctx, out, sum);
+}
+
 static void putchunk(fz_context *ctx, fz_output *out, char *tag, unsigned char *data, size_t size)
 {
 	unsigned int sum;
@@ -109,6 +131,7 @@ typedef struct png_band_writer_s
 	uLong usize, csize;
 	z_stream stream;
 	int stream_ended;
+	uLong adler; /* Running checksum of separately encoded bands. */
 } png_band_writer;
 
 static void
@@ -201,46 +224,14 @@ png_write_header(fz_context *ctx, fz_band_writer *writer_, fz_colorspace *cs)
 	png_write_icc(ctx, writer, cs);
 }
 
-static void
-png_write_band(fz_context *ctx, fz_band_writer *writer_, int stride, int band_start, int band_height, const unsigned char *sp)
+/* Filter (and unpremultiply) a band of data, ready for deflating. */
+static unsigned char *
+png_filter_band(png_band_writer *writer, unsigned char *dp, int stride, int band_height, const unsigned char *sp)
 {
-	png_band_writer *writer = (png_band_writer *)(void *)writer_;
-	fz_output *out = writer->super.out;
-	unsigned char *dp;
-	int y, x, k, err, finalband;
-	int w, h, n;
-
-	if (!out)
-		return;
-
-	w = writer->super.w;
-	h = writer->super.h;
-	n = writer->super.n;
-
-	finalband = (band_start+band_height >= h);
-	if (finalband)
-		band_height = h - band_start;
-
-	if (writer->udata == NULL)
-	{
-		writer->usize = ((uLong)w * n + 1) * band_height;
-		/* Sadly the bound returned by compressBound is just for a
-		 * single usize chunk; if you compress a sequence of them
-		 * the buffering can result in you suddenly getting a block
-		 * larger than compressBound outputted in one go, even if you
-		 * take all the data out each time. */
-		writer->csize = compressBound(writer->usize);
-		writer->udata = Memento_label(fz_malloc(ctx, writer->usize), "png_write_udata");
-		writer->cdata = Memento_label(fz_malloc(ctx, writer->csize), "png_write_cdata");
-		writer->stream.opaque = ctx;
-		writer->stream.zalloc = fz_zlib_alloc;
-		writer->stream.zfree = fz_zlib_free;
-		err = deflateInit(&writer->stream, Z_DEFAULT_COMPRESSION);
-		if (err != Z_OK)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "compression error %d", err);
-	}
+	int w = writer->super.w;
+	int n = writer->super.n;
+	int y, x, k;
 
-	dp = writer->udata;
 	stride -= w*n;
 	if (writer->super.alpha)
 	{
@@ -293,6 +284,50 @@ png_write_band(fz_context *ctx, fz_band_writer *writer_, int stride, int band_st
 		}
 	}
 
+	return dp;
+}
+
+static void
+png_write_band(fz_context *ctx, fz_band_writer *writer_, int stride, int band_start, int band_height, const unsigned char *sp)
+{
+	png_band_writer *writer = (png_band_writer *)(void *)writer_;
+	fz_output *out = writer->super.out;
+	unsigned char *dp;
+	int err, finalband;
+	int w, h, n;
+
+	if (!out)
+		return;
+
+	w = writer->super.w;
+	h = writer->super.h;
+	n = writer->super.n;
+
+	finalband = (band_start+band_height >= h);
+	if (finalband)
+		band_height = h - band_start;
+
+	if (writer->udata == NULL)
+	{
+		writer->usize = ((uLong)w * n + 1) * band_height;
+		/* Sadly the bound returned by compressBound is just for a
+		 * single usize chunk; if you compress a sequence of them
+		 * the buffering can result in you suddenly getting a block
+		 * larger than compressBound outputted in one go, even if you
+		 * take all the data out each time. */
+		writer->csize = compressBound(writer->usize);
+		writer->udata = Memento_label(fz_malloc(ctx, writer->usize), "png_write_udata");
+		writer->cdata = Memento_label(fz_malloc(ctx, writer->csize), "png_write_cdata");
+		writer->stream.opaque = ctx;
+		writer->stream.zalloc = fz_zlib_alloc;
+		writer->stream.zfree = fz_zlib_free;
+		err = deflateInit(&writer->stream, Z_DEFAULT_COMPRESSION);
+		if (err != Z_OK)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "compression error %d", err);
+	}
+
+	dp = png_filter_band(writer, writer->udata, stride, band_height, sp);
+
 	writer->stream.next_in = (Bytef*)writer->udata;
 	writer->stream.avail_in = (uInt)(dp - writer->udata);
 	do
@@ -327,6 +362,110 @@ png_write_band(fz_context *ctx, fz_band_writer *writer_, int stride, int band_st
 	while (writer->stream.avail_out == 0);
 }
 
+static fz_buffer *
+png_encode_band(fz_context *ctx, fz_band_writer *writer_, int stride, int band_start, int band_height, const unsigned char *sp)
+{
+	png_band_writer *writer = (png_band_writer *)(void *)writer_;
+	int finalband = (band_start + band_height >= writer->super.h);
+	uLong usize = ((uLong)writer->super.w * writer->super.n + 1) * band_height;
+	unsigned char *udata = NULL;
+	fz_buffer *buf = NULL;
+	z_stream stream = { 0 };
+	int started = 0;
+	int err;
+
+	if ((uint32_t)usize != usize)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "PNG band too large");
+
+	fz_var(udata);
+	fz_var(buf);
+	fz_var(started);
+
+	fz_try(ctx)
+	{
+		udata = Memento_label(fz_malloc(ctx, usize), "png_encode_udata");
+		png_filter_band(writer, udata, stride, band_height, sp);
+
+		/* Each band is deflated on its own into raw deflate blocks,
+		 * ending on a byte boundary (or, for the last band, with the
+		 * final block), so that the bands can simply be concatenated
+		 * by png_write_encoded_band. */
+		stream.opaque = ctx;
+		stream.zalloc = fz_zlib_alloc;
+		stream.zfree = fz_zlib_free;
+		err = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+		if (err != Z_OK)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "compression error %d", err);
+		started = 1;
+
+		buf = fz_new_buffer(ctx, deflateBound(&stream, usize) + 16);
+		stream.next_in = udata;
+		stream.avail_in = (uInt)usize;
+		for (;;)
+		{
+			stream.next_out = buf->data + buf->len;
+			stream.avail_out = (uInt)(buf->cap - buf->len);
+			err = deflate(&stream, finalband ? Z_FINISH : Z_SYNC_FLUSH);
+			buf->len = stream.next_out - buf->data;
+			if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "compression error %d", err);
+			if (err == Z_STREAM_END || (!finalband && stream.avail_out != 0))
+				break;
+			fz_grow_buffer(ctx, buf);
+		}
+
+		/* Follow the data with its checksum and length, for the
+		 * running checksum. */
+		fz_append_int32_be(ctx, buf, (int)adler32(adler32(0, NULL, 0), udata, (uInt)usize));
+		fz_append_int32_be(ctx, buf, (int)usize);
+	}
+	fz_always(ctx)
+	{
+		if (started)
+			deflateEnd(&stream);
+		fz_free(ctx, udata);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+
+	return buf;
+}
+
+static inline uLong get32(const unsigned char *p)
+{
+	return ((uLong)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void
+png_write_encoded_band(fz_context *ctx, fz_band_writer *writer_, int band_start, int band_height, fz_buffer *buf)
+{
+	png_band_writer *writer = (png_band_writer *)(void *)writer_;
+	fz_output *out = writer->super.out;
+	static const unsigned char zhead[2] = { 0x78, 0x9c };
+	unsigned char ztail[4];
+	int finalband = (band_start + band_height >= writer->super.h);
+	size_t len;
+
+	if (!out)
+		return;
+	if (buf == NULL || buf->len < 8)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "invalid encoded PNG band");
+
+	len = buf->len - 8;
+	if (band_start == 0)
+		writer->adler = adler32(0, NULL, 0);
+	writer->adler = adler32_combine(writer->adler, get32(buf->data + len), get32(buf->data + len + 4));
+	big32(ztail, writer->adler);
+
+	putidat(ctx, out,
+		zhead, band_start == 0 ? 2 : 0,
+		buf->data, len,
+		ztail, finalband ? 4 : 0);
+}
+
 static void
 png_write_trailer(fz_context *ctx, fz_band_writer *writer_)
 {
@@ -335,10 +474,14 @@ png_write_trailer(fz_context *ctx, fz_band_writer *writer_)
 	unsigned char block[1];
 	int err;
 
-	writer->stream_ended = 1;
-	err = deflateEnd(&writer->stream);
-	if (err != Z_OK)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "compression error %d", err);
+	/* Bands encoded separately don't use the shared stream. */
+	if (writer->udata)
+	{
+		writer->stream_ended = 1;
+		err = deflateEnd(&writer->stream);
+		if (err != Z_OK)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "compression error %d", err);
+	}
 
 	putchunk(ctx, out, "IEND", block, 0);
 }
@@ -348,7 +491,7 @@ png_drop_band_writer(fz_context *ctx, fz_band_writer *writer_)
 {
 	png_band_writer *writer = (png_band_writer *)(void *)writer_;
 
-	if (!writer->stream_ended)
+	if (writer->udata && !writer->stream_ended)
 	{
 		int err = deflateEnd(&writer->stream);
 		if (err != Z_OK)
@@ -366,6 +509,8 @@ fz_band_writer *fz_new_png_band_writer(fz_context *ctx, fz_output *out)
 	writer->super.header = png_write_header;
 	writer->super.band = png_write_band;
 	writer->super.trailer = png_write_trailer;
+	writer->super.encode_band = png_encode_band;
+	writer->super.write_encoded_band = png_write_encoded_band;
 	writer->super.drop = png_drop_band_writer;
 
 	return &writer->super;
@@ -698,6 +698,39 @@ void fz_write_band(fz_context *ctx, fz_band_writer *writer, int stride, int band
 	}
 }
 
+fz_buffer *fz_encode_band(fz_context *ctx, fz_band_writer *writer, int stride, int band_start, int band_height, const unsigned char *samples)
+{
+	if (writer == NULL || writer->encode_band == NULL)
+		return NULL;
+	if (band_start < 0 || band_start >= writer->h)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "Band outside image!");
+	if (band_start + band_height > writer->h)
+		band_height = writer->h - band_start;
+	if (band_height <= 0)
+		return NULL;
+	return writer->encode_band(ctx, writer, stride, band_start, band_height, samples);
+}
+
+void fz_write_encoded_band(fz_context *ctx, fz_band_writer *writer, int band_height, fz_buffer *buf)
+{
+	if (writer == NULL || writer->write_encoded_band == NULL)
+		return;
+	if (writer->line + band_height > writer->h)
+		band_height = writer->h - writer->line;
+	if (band_height < 0) {
+		fz_throw(ctx, FZ_ERROR_GENERIC, "Too much band data!");
+	}
+	if (band_height > 0) {
+		writer->write_encoded_band(ctx, writer, writer->line, band_height, buf);
+		writer->line += band_height;
+	}
+	if (writer->line == writer->h && writer->trailer) {
+		writer->trailer(ctx, writer);
+		/* Protect against more band_height == 0 calls */
+		writer->line++;
+	}
+}
+
 void fz_drop_band_writer(fz_context *ctx, fz_band_writer *writer)
 {
 	if (writer == NULL)
@@ -70,6 +70,7 @@ struct fz_path
 	float *coords;
 	fz_point current;
 	fz_point begin;
+	fz_arena *arena;
 };
 
 typedef struct
@@ -118,6 +119,25 @@ fz_new_path(fz_context *ctx)
 	return path;
 }
 
+fz_path *
+fz_new_path_in_arena(fz_context *ctx, fz_arena *arena)
+{
+	fz_path *path = fz_new_path(ctx);
+
+	path->arena = arena;
+
+	return path;
+}
+
+/* Grow or shrink the storage of an unpacked path. */
+static void *
+resize_path_data(fz_context *ctx, fz_path *path, void *p, size_t size)
+{
+	if (path->arena)
+		return fz_arena_realloc(ctx, path->arena, p, size);
+	return fz_realloc(ctx, p, size);
+}
+
 /*
 	Take an additional reference to
 	a path.
@@ -133,7 +153,7 @@ fz_keep_path(fz_context *ctx, const fz_path *pathc)
 
 	if (path == NULL)
 		return NULL;
-	if (path->refs == 1 && path->packed == FZ_PATH_UNPACKED)
+	if (fz_load_refs(&path->refs) == 1 && path->packed == FZ_PATH_UNPACKED)
 		fz_trim_path(ctx, path);
 	return fz_keep_imp8(ctx, path, &path->refs);
 }
@@ -145,7 +165,12 @@ fz_drop_path(fz_context *ctx, const fz_path *pathc)
 
 	if (fz_drop_imp8(ctx, path, &path->refs))
 	{
-		if (path->packed != FZ_PATH_PACKED_FLAT)
+		if (path->packed == FZ_PATH_UNPACKED && path->arena)
+		{
+			fz_arena_free(ctx, path->arena, path->cmds);
+			fz_arena_free(ctx, path->arena, path->coords);
+		}
+		else if (path->packed != FZ_PATH_PACKED_FLAT)
 		{
 			fz_free(ctx, path->cmds);
 			fz_free(ctx, path->coords);
@@ -224,6 +249,7 @@ fz_pack_path(fz_context *ctx, uint8_t *pack_, size_t max, const fz_path *path)
 			pack->coord_len = path->coord_len;
 			pack->cmd_cap = path->cmd_len;
 			pack->cmd_len = path->cmd_len;
+			pack->arena = NULL;
 			pack->coords = Memento_label(fz_malloc_array(ctx, path->coord_len, float), "path_packed_coords");
 			fz_try(ctx)
 			{
@@ -262,13 +288,13 @@ fz_pack_path(fz_context *ctx, uint8_t *pack_, size_t max, const fz_path *path)
 static void
 push_cmd(fz_context *ctx, fz_path *path, int cmd)
 {
-	if (path->refs != 1)
+	if (fz_load_refs(&path->refs) != 1)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot modify shared paths");
 
 	if (path->cmd_len + 1 >= path->cmd_cap)
 	{
 		int new_cmd_cap = fz_maxi(16, path->cmd_cap * 2);
-		path->cmds = fz_realloc_array(ctx, path->cmds, new_cmd_cap, unsigned char);
+		path->cmds = resize_path_data(ctx, path, path->cmds, new_cmd_cap * sizeof(unsigned char));
 		path->cmd_cap = new_cmd_cap;
 	}
 
@@ -281,7 +307,7 @@ push_coord(fz_context *ctx, fz_path *path, float x, float y)
 	if (path->coord_len + 2 >= path->coord_cap)
 	{
 		int new_coord_cap = fz_maxi(32, path->coord_cap * 2);
-		path->coords = fz_realloc_array(ctx, path->coords, new_coord_cap, float);
+		path->coords = resize_path_data(ctx, path, path->coords, new_coord_cap * sizeof(float));
 		path->coord_cap = new_coord_cap;
 	}
 
@@ -298,7 +324,7 @@ push_ord(fz_context *ctx, fz_path *path, float xy, int isx)
 	if (path->coord_len + 1 >= path->coord_cap)
 	{
 		int new_coord_cap = fz_maxi(32, path->coord_cap * 2);
-		path->coords = fz_realloc_array(ctx, path->coords, new_coord_cap, float);
+		path->coords = resize_path_data(ctx, path, path->coords, new_coord_cap * sizeof(float));
 		path->coord_cap = new_coord_cap;
 	}
 
@@ -1222,12 +1248,12 @@ fz_transform_path(fz_context *ctx, fz_path *path, fz_matrix ctm)
 		}
 		if (path->cmd_len + extra_cmd < path->cmd_cap)
 		{
-			path->cmds = fz_realloc_array(ctx, path->cmds, path->cmd_len + extra_cmd, unsigned char);
+			path->cmds = resize_path_data(ctx, path, path->cmds, (path->cmd_len + extra_cmd) * sizeof(unsigned char));
 			path->cmd_cap = path->cmd_len + extra_cmd;
 		}
 		if (path->coord_len + extra_coord < path->coord_cap)
 		{
-			path->coords = fz_realloc_array(ctx, path->coords, path->coord_len + extra_coord, float);
+			path->coords = resize_path_data(ctx, path, path->coords, (path->coord_len + extra_coord) * sizeof(float));
 			path->coord_cap = path->coord_len + extra_coord;
 		}
 		memmove(path->cmds + extra_cmd, path->cmds, path->cmd_len * sizeof(unsigned char));
@@ -1363,8 +1389,38 @@ fz_transform_path(fz_context *ctx, fz_path *path, fz_matrix ctm)
 
 void fz_trim_path(fz_context *ctx, fz_path *path)
 {
+	unsigned char *cmds;
+	float *coords;
+
 	if (path->packed)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Can't trim a packed path");
+
+	/* Move the storage of an arena path out to the heap, as it is
+	 * about to be shared (or kept for longer). */
+	if (path->arena)
+	{
+		cmds = Memento_label(fz_malloc_array(ctx, path->cmd_len, unsigned char), "path_cmds");
+		fz_try(ctx)
+			coords = Memento_label(fz_malloc_array(ctx, path->coord_len, float), "path_coords");
+		fz_catch(ctx)
+		{
+			fz_free(ctx, cmds);
+			fz_rethrow(ctx);
+		}
+		if (path->cmd_len)
+			memcpy(cmds, path->cmds, path->cmd_len * sizeof(unsigned char));
+		if (path->coord_len)
+			memcpy(coords, path->coords, path->coord_len * sizeof(float));
+		fz_arena_free(ctx, path->arena, path->cmds);
+		fz_arena_free(ctx, path->arena, path->coords);
+		path->cmds = cmds;
+		path->cmd_cap = path->cmd_len;
+		path->coords = coords;
+		path->coord_cap = path->coord_len;
+		path->arena = NULL;
+		return;
+	}
+
 	if (path->cmd_cap > path->cmd_len)
 	{
 		path->cmds = fz_realloc_array(ctx, path->cmds, path->cmd_len, unsigned char);
@@ -1457,7 +1513,7 @@ fz_unshare_stroke_state_with_dash_len(fz_context *ctx, fz_stroke_state *shared,
 	fz_stroke_state *unshared;
 
 	fz_lock(ctx, FZ_LOCK_ALLOC);
-	single = (shared->refs == 1);
+	single = (fz_load_refs(&shared->refs) == 1);
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 
 	shlen = shared->dash_len - nelem(shared->dash_list);
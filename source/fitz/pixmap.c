@@ -51,7 +51,8 @@ fz_drop_pixmap_imp(fz_context *ctx, fz_storable *pix_)
 	fz_drop_colorspace(ctx, pix->colorspace);
 	fz_drop_separations(ctx, pix->seps);
 	if (pix->flags & FZ_PIXMAP_FLAG_FREE_SAMPLES)
-		fz_free(ctx, pix->samples);
+		fz_drop_pixmap_samples(ctx, pix->samples, pix->samples_size);
+	fz_release_memory_budget(ctx, pix->budget, pix->budget_size);
 	fz_drop_pixmap(ctx, pix->underlying);
 	fz_free(ctx, pix);
 }
@@ -106,10 +107,13 @@ fz_new_pixmap_with_data(fz_context *ctx, fz_colorspace *colorspace, int w, int h
 		{
 			if (pix->stride > INT_MAX / pix->h)
 				fz_throw(ctx, FZ_ERROR_GENERIC, "Overly large image");
-			pix->samples = Memento_label(fz_malloc(ctx, pix->h * pix->stride), "pixmap_data");
+			pix->budget = fz_charge_memory_budget(ctx, (size_t)pix->h * pix->stride);
+			pix->budget_size = (size_t)pix->h * pix->stride;
+			pix->samples = fz_new_pixmap_samples(ctx, (size_t)pix->h * pix->stride, &pix->samples_size);
 		}
 		fz_catch(ctx)
 		{
+			fz_release_memory_budget(ctx, pix->budget, pix->budget_size);
 			fz_drop_separations(ctx, pix->seps);
 			fz_drop_colorspace(ctx, pix->colorspace);
 			fz_free(ctx, pix);
@@ -1557,6 +1561,7 @@ fz_subsample_pixmap(fz_context *ctx, fz_pixmap *tile, int factor)
 	if (tile->h > INT_MAX / (tile->w * tile->n))
 		fz_throw(ctx, FZ_ERROR_MEMORY, "pixmap too large");
 	tile->samples = fz_realloc(ctx, tile->samples, (size_t)tile->h * tile->w * tile->n);
+	tile->samples_size = (size_t)tile->h * tile->w * tile->n;
 }
 
 void
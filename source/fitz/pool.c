@@ -129,3 +129,183 @@ void fz_drop_pool(fz_context *ctx, fz_pool *pool)
 	}
 	fz_free(ctx, pool);
 }
+
+/* Arena blocks are 16, 32, ... ARENA_MAX bytes. */
+#define ARENA_MIN 16
+#define ARENA_CLASSES 7
+#define ARENA_MAX (ARENA_MIN << (ARENA_CLASSES - 1))
+#define ARENA_LARGE ARENA_CLASSES
+
+/* Every block is preceded by the size class it belongs to. Large
+ * blocks are also linked together, so that dropping the arena can
+ * free them. */
+typedef union
+{
+	int size_class;
+	void *align_p;
+	double align_d;
+} fz_arena_header;
+
+typedef struct fz_arena_large
+{
+	struct fz_arena_large *prev, *next;
+	fz_arena_header header;
+} fz_arena_large;
+
+struct fz_arena
+{
+	fz_pool *pool;
+	void *free[ARENA_CLASSES];
+	fz_arena_large *large;
+};
+
+#define ARENA_HEADER(p) (((fz_arena_header *)(p)) - 1)
+#define ARENA_LARGE_BLOCK(p) ((fz_arena_large *)(((char *)(p)) - sizeof(fz_arena_large)))
+
+fz_arena *fz_new_arena(fz_context *ctx)
+{
+	fz_arena *arena = fz_malloc_struct(ctx, fz_arena);
+
+	fz_try(ctx)
+		arena->pool = fz_new_pool(ctx);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, arena);
+		fz_rethrow(ctx);
+	}
+
+	return arena;
+}
+
+static void link_large(fz_arena *arena, fz_arena_large *large)
+{
+	large->prev = NULL;
+	large->next = arena->large;
+	if (large->next)
+		large->next->prev = large;
+	arena->large = large;
+}
+
+static void unlink_large(fz_arena *arena, fz_arena_large *large)
+{
+	if (large->prev)
+		large->prev->next = large->next;
+	else
+		arena->large = large->next;
+	if (large->next)
+		large->next->prev = large->prev;
+}
+
+void *fz_arena_malloc(fz_context *ctx, fz_arena *arena, size_t size)
+{
+	fz_arena_header *header;
+	fz_arena_large *large;
+	void *p;
+	int c;
+
+	if (size == 0)
+		return NULL;
+
+	if (size > ARENA_MAX)
+	{
+		if (size > SIZE_MAX - sizeof(fz_arena_large))
+			fz_throw(ctx, FZ_ERROR_MEMORY, "arena malloc (%zu bytes) failed (size_t overflow)", size);
+		large = Memento_label(fz_malloc(ctx, sizeof(fz_arena_large) + size), "fz_arena_large");
+		large->header.size_class = ARENA_LARGE;
+		link_large(arena, large);
+		return large + 1;
+	}
+
+	for (c = 0; (size_t)(ARENA_MIN << c) < size; c++)
+		;
+
+	p = arena->free[c];
+	if (p)
+	{
+		arena->free[c] = *(void **)p;
+		return p;
+	}
+
+	header = fz_pool_alloc(ctx, arena->pool, sizeof(fz_arena_header) + (ARENA_MIN << c));
+	header->size_class = c;
+	return header + 1;
+}
+
+void fz_arena_free(fz_context *ctx, fz_arena *arena, void *p)
+{
+	fz_arena_large *large;
+	int c;
+
+	if (p == NULL)
+		return;
+
+	c = ARENA_HEADER(p)->size_class;
+	if (c == ARENA_LARGE)
+	{
+		large = ARENA_LARGE_BLOCK(p);
+		unlink_large(arena, large);
+		fz_free(ctx, large);
+		return;
+	}
+
+	*(void **)p = arena->free[c];
+	arena->free[c] = p;
+}
+
+void *fz_arena_realloc(fz_context *ctx, fz_arena *arena, void *p, size_t size)
+{
+	fz_arena_large *large;
+	size_t cap;
+	void *q;
+	int c;
+
+	if (p == NULL)
+		return fz_arena_malloc(ctx, arena, size);
+	if (size == 0)
+	{
+		fz_arena_free(ctx, arena, p);
+		return NULL;
+	}
+
+	c = ARENA_HEADER(p)->size_class;
+	if (c == ARENA_LARGE)
+	{
+		if (size > SIZE_MAX - sizeof(fz_arena_large))
+			fz_throw(ctx, FZ_ERROR_MEMORY, "arena realloc (%zu bytes) failed (size_t overflow)", size);
+		large = ARENA_LARGE_BLOCK(p);
+		unlink_large(arena, large);
+		large = fz_realloc_no_throw(ctx, large, sizeof(fz_arena_large) + size);
+		if (large == NULL)
+		{
+			link_large(arena, ARENA_LARGE_BLOCK(p));
+			fz_throw(ctx, FZ_ERROR_MEMORY, "arena realloc (%zu bytes) failed", size);
+		}
+		link_large(arena, large);
+		return large + 1;
+	}
+
+	cap = ARENA_MIN << c;
+	if (size <= cap)
+		return p;
+	q = fz_arena_malloc(ctx, arena, size);
+	memcpy(q, p, cap);
+	fz_arena_free(ctx, arena, p);
+	return q;
+}
+
+void fz_drop_arena(fz_context *ctx, fz_arena *arena)
+{
+	fz_arena_large *large;
+
+	if (!arena)
+		return;
+
+	while (arena->large)
+	{
+		large = arena->large;
+		arena->large = large->next;
+		fz_free(ctx, large);
+	}
+	fz_drop_pool(ctx, arena->pool);
+	fz_free(ctx, arena);
+}
@@ -99,6 +99,12 @@ typedef struct
 	int flags;
 	int color;
 	const fz_text *lasttext;
+
+	/* streaming mode: completed blocks are passed on and freed */
+	void *state;
+	fz_stext_block_fn *block_fn;
+	fz_stext_close_fn *close_fn;
+	fz_stext_drop_fn *drop_fn;
 } fz_stext_device;
 
 const char *fz_stext_options_usage =
@@ -133,23 +139,29 @@ fz_new_stext_page(fz_context *ctx, fz_rect mediabox)
 	return page;
 }
 
+static void
+drop_block_contents(fz_context *ctx, fz_stext_page *page)
+{
+	fz_stext_block *block;
+	fz_stext_line *line;
+	fz_stext_char *ch;
+	for (block = page->first_block; block; block = block->next)
+	{
+		if (block->type == FZ_STEXT_BLOCK_IMAGE)
+			fz_drop_image(ctx, block->u.i.image);
+		else
+			for (line = block->u.t.first_line; line; line = line->next)
+				for (ch = line->first_char; ch; ch = ch->next)
+					fz_drop_font(ctx, ch->font);
+	}
+}
+
 void
 fz_drop_stext_page(fz_context *ctx, fz_stext_page *page)
 {
 	if (page)
 	{
-		fz_stext_block *block;
-		fz_stext_line *line;
-		fz_stext_char *ch;
-		for (block = page->first_block; block; block = block->next)
-		{
-			if (block->type == FZ_STEXT_BLOCK_IMAGE)
-				fz_drop_image(ctx, block->u.i.image);
-			else
-				for (line = block->u.t.first_line; line; line = line->next)
-					for (ch = line->first_char; ch; ch = ch->next)
-						fz_drop_font(ctx, ch->font);
-		}
+		drop_block_contents(ctx, page);
 		fz_drop_pool(ctx, page->pool);
 	}
 }
@@ -275,6 +287,57 @@ remove_last_char(fz_context *ctx, fz_stext_line *line)
 	}
 }
 
+static void
+bound_block(fz_stext_block *block)
+{
+	fz_stext_line *line;
+	fz_stext_char *ch;
+
+	if (block->type != FZ_STEXT_BLOCK_TEXT)
+		return;
+	for (line = block->u.t.first_line; line; line = line->next)
+	{
+		for (ch = line->first_char; ch; ch = ch->next)
+		{
+			fz_rect ch_box = fz_rect_from_quad(ch->quad);
+			if (ch == line->first_char)
+				line->bbox = ch_box;
+			else
+				line->bbox = fz_union_rect(line->bbox, ch_box);
+		}
+		block->bbox = fz_union_rect(block->bbox, line->bbox);
+	}
+}
+
+/*
+	In streaming mode, hand over any blocks we have so far and then
+	throw them away. This is called before a new block is started;
+	since text is only ever added to the last block, those we have
+	are complete.
+*/
+static void
+flush_blocks(fz_context *ctx, fz_stext_device *dev)
+{
+	fz_stext_page *page = dev->page;
+	fz_stext_block *block;
+	fz_pool *pool;
+
+	if (!dev->block_fn || !page->first_block)
+		return;
+
+	for (block = page->first_block; block; block = block->next)
+	{
+		bound_block(block);
+		dev->block_fn(ctx, dev->state, block);
+	}
+
+	pool = fz_new_pool(ctx);
+	drop_block_contents(ctx, page);
+	fz_drop_pool(ctx, page->pool);
+	page->pool = pool;
+	page->first_block = page->last_block = NULL;
+}
+
 static int
 direction_from_bidi_class(int bidiclass, int curdir)
 {
@@ -482,6 +545,7 @@ fz_add_stext_char_imp(fz_context *ctx, fz_stext_device *dev, fz_font *font, int
 	/* Start a new block (but only at the beginning of a text object) */
 	if (new_para || !cur_block)
 	{
+		flush_blocks(ctx, dev);
 		cur_block = add_text_block_to_page(ctx, page);
 		cur_line = cur_block->u.t.last_line;
 	}
@@ -719,6 +783,7 @@ fz_stext_fill_image(fz_context *ctx, fz_device *dev, fz_image *img, fz_matrix ct
 	if (alpha < 0.5f)
 		return;
 
+	flush_blocks(ctx, tdev);
 	add_image_block_to_page(ctx, tdev->page, ctm, img);
 }
 
@@ -786,27 +851,18 @@ fz_stext_close_device(fz_context *ctx, fz_device *dev)
 	fz_stext_device *tdev = (fz_stext_device*)dev;
 	fz_stext_page *page = tdev->page;
 	fz_stext_block *block;
-	fz_stext_line *line;
-	fz_stext_char *ch;
 
-	for (block = page->first_block; block; block = block->next)
+	if (tdev->block_fn)
 	{
-		if (block->type != FZ_STEXT_BLOCK_TEXT)
-			continue;
-		for (line = block->u.t.first_line; line; line = line->next)
-		{
-			for (ch = line->first_char; ch; ch = ch->next)
-			{
-				fz_rect ch_box = fz_rect_from_quad(ch->quad);
-				if (ch == line->first_char)
-					line->bbox = ch_box;
-				else
-					line->bbox = fz_union_rect(line->bbox, ch_box);
-			}
-			block->bbox = fz_union_rect(block->bbox, line->bbox);
-		}
+		flush_blocks(ctx, tdev);
+		if (tdev->close_fn)
+			tdev->close_fn(ctx, tdev->state);
+		return;
 	}
 
+	for (block = page->first_block; block; block = block->next)
+		bound_block(block);
+
 	/* TODO: smart sorting of blocks and lines in reading order */
 	/* TODO: unicode NFC normalization */
 }
@@ -816,6 +872,18 @@ fz_stext_drop_device(fz_context *ctx, fz_device *dev)
 {
 	fz_stext_device *tdev = (fz_stext_device*)dev;
 	fz_drop_text(ctx, tdev->lasttext);
+	if (tdev->block_fn)
+	{
+		/* In streaming mode the page is ours. */
+		if (tdev->page)
+		{
+			drop_block_contents(ctx, tdev->page);
+			fz_drop_pool(ctx, tdev->page->pool);
+			fz_free(ctx, tdev->page);
+		}
+		if (tdev->drop_fn)
+			tdev->drop_fn(ctx, tdev->state);
+	}
 }
 
 fz_stext_options *
@@ -878,3 +946,39 @@ fz_new_stext_device(fz_context *ctx, fz_stext_page *page, const fz_stext_options
 
 	return (fz_device*)dev;
 }
+
+fz_device *
+fz_new_stext_block_device(fz_context *ctx, fz_rect mediabox, const fz_stext_options *opts,
+	void *state, fz_stext_block_fn *block, fz_stext_close_fn *close, fz_stext_drop_fn *drop)
+{
+	fz_stext_page *page = NULL;
+	fz_stext_device *dev = NULL;
+
+	fz_var(page);
+
+	/* The page lives outside its pool, so the pool can be recycled as
+	 * blocks are flushed. */
+	fz_try(ctx)
+	{
+		page = fz_malloc_struct(ctx, fz_stext_page);
+		page->pool = fz_new_pool(ctx);
+		page->mediabox = mediabox;
+		dev = (fz_stext_device *)fz_new_stext_device(ctx, page, opts);
+	}
+	fz_catch(ctx)
+	{
+		if (page)
+			fz_drop_pool(ctx, page->pool);
+		fz_free(ctx, page);
+		if (drop)
+			drop(ctx, state);
+		fz_rethrow(ctx);
+	}
+
+	dev->state = state;
+	dev->block_fn = block;
+	dev->close_fn = close;
+	dev->drop_fn = drop;
+
+	return (fz_device*)dev;
+}
@@ -0,0 +1,1070 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+#include "mupdf/fitz.h"
+#include "mupdf/ucdn.h"
+
+#include <string.h>
+
+/*
+	Search engine for structured text.
+
+	The text of a page is flattened into a normalised array of
+	characters (whitespace collapsed, optionally case and diacritic
+	folded, hyphenated line breaks joined) that remembers which
+	fz_stext_char each entry came from. The needle is compiled into a
+	small NFA program, which is run over the array with a Pike VM;
+	literal needles are compiled the same way. Each match is turned back
+	into quads and handed to a callback.
+*/
+
+#define MAX_PROG 10000
+#define MAX_REPEAT 1000
+
+enum
+{
+	I_CHAR, I_ANY, I_CLASS, I_MATCH, I_JMP, I_SPLIT,
+	I_BOL, I_EOL, I_WORDB, I_NWORDB,
+};
+
+typedef struct
+{
+	int op;
+	int x, y;
+} rinst;
+
+/* Class items are ranges; negative 'lo' values are the builtin classes. */
+enum { CLASS_DIGIT = -1, CLASS_WORD = -2, CLASS_SPACE = -3 };
+
+typedef struct
+{
+	int lo, hi;
+	int neg; /* for builtin classes: \D, \W, \S */
+} rclass_item;
+
+typedef struct
+{
+	int neg;
+	int first, count;
+} rclass;
+
+struct fz_search
+{
+	int options;
+
+	rinst *prog;
+	int prog_len, prog_cap;
+	rclass *classes;
+	int class_len, class_cap;
+	rclass_item *items;
+	int item_len, item_cap;
+	int first_char;
+
+	/* normalised page text, reused from page to page */
+	int *text;
+	fz_stext_char **chars;
+	fz_stext_line **lines;
+	int text_len, text_cap;
+
+	/* Pike VM state */
+	int *clist, *cstart, *nlist, *nstart;
+	int *mark;
+	int *stack;
+
+	fz_quad *quads;
+	int quad_len, quad_cap;
+};
+
+/* Character normalisation */
+
+static int
+is_space(int c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == 0xA0 ||
+		c == 0x2028 || c == 0x2029 || c == 0x3000 || (c >= 0x2000 && c <= 0x200A);
+}
+
+static int
+is_hyphen(int c)
+{
+	return c == '-' || c == 0xAD || c == 0x2010 || c == 0x2011;
+}
+
+static int
+is_mark(int c)
+{
+	int cat = ucdn_get_general_category(c);
+	return cat == UCDN_GENERAL_CATEGORY_MN || cat == UCDN_GENERAL_CATEGORY_ME;
+}
+
+static int
+is_word(int c)
+{
+	int cat;
+	if (c < 128)
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+	cat = ucdn_get_general_category(c);
+	return (cat >= UCDN_GENERAL_CATEGORY_LL && cat <= UCDN_GENERAL_CATEGORY_NO);
+}
+
+/* Simple (one to one) case folding for the common alphabets. */
+static int
+fold_case(int c)
+{
+	if (c < 128)
+	{
+		if (c >= 'A' && c <= 'Z')
+			return c + 32;
+		return c;
+	}
+	if (c >= 0xC0 && c <= 0xDE && c != 0xD7)
+		return c + 32;
+	if (c < 0x100)
+		return c;
+	/* Dotted capital I folds to plain i; dotless i has no case pair
+	 * outside Turkish, so it is left alone. */
+	if (c == 0x130)
+		return 'i';
+	if (c == 0x131)
+		return c;
+	if ((c >= 0x100 && c <= 0x137) || (c >= 0x14A && c <= 0x177))
+		return c | 1;
+	if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E))
+		return (c & 1) ? c + 1 : c;
+	if (c == 0x178)
+		return 0xFF;
+	if (c >= 0x391 && c <= 0x3A9 && c != 0x3A2)
+		return c + 32;
+	if (c == 0x386)
+		return 0x3AC;
+	if (c >= 0x388 && c <= 0x38A)
+		return c + 37;
+	if (c == 0x38C)
+		return 0x3CC;
+	if (c == 0x38E || c == 0x38F)
+		return c + 63;
+	if (c == 0x3C2)
+		return 0x3C3;
+	if (c >= 0x400 && c <= 0x40F)
+		return c + 80;
+	if (c >= 0x410 && c <= 0x42F)
+		return c + 32;
+	if ((c >= 0x460 && c <= 0x481) || (c >= 0x48A && c <= 0x4BF) || (c >= 0x4D0 && c <= 0x52F))
+		return c | 1;
+	if (c >= 0x531 && c <= 0x556)
+		return c + 48;
+	if (c >= 0x1E00 && c <= 0x1EFF && (c < 0x1E96 || c > 0x1E9F))
+		return c | 1;
+	if (c >= 0xFF21 && c <= 0xFF3A)
+		return c + 32;
+	return c;
+}
+
+/* Strip accents by following canonical decompositions to the base character. */
+static int
+fold_diacritics(int c)
+{
+	uint32_t a, b;
+	if (c < 0xC0 || (c >= 0xAC00 && c <= 0xD7A3))
+		return c;
+	while (ucdn_decompose(c, &a, &b))
+	{
+		if (b != 0 && !is_mark(b))
+			break;
+		if ((int)a == c)
+			break;
+		c = a;
+	}
+	return c;
+}
+
+/* Returns -1 if the character should be dropped altogether. */
+static int
+normalize(fz_search *search, int c)
+{
+	if (is_space(c))
+		return ' ';
+	if (c == 0xAD && !(search->options & FZ_SEARCH_KEEP_HYPHENS))
+		return -1;
+	if (search->options & FZ_SEARCH_IGNORE_DIACRITICS)
+	{
+		if (is_mark(c))
+			return -1;
+		c = fold_diacritics(c);
+	}
+	if (search->options & FZ_SEARCH_IGNORE_CASE)
+		c = fold_case(c);
+	return c;
+}
+
+/* Needle compilation */
+
+typedef struct rnode
+{
+	int type;
+	int c;
+	int min, max, lazy;
+	struct rnode *x, *y;
+} rnode;
+
+enum
+{
+	R_EMPTY, R_CHAR, R_ANY, R_CLASS, R_BOL, R_EOL, R_WORDB, R_NWORDB,
+	R_CAT, R_ALT, R_REP,
+};
+
+typedef struct
+{
+	fz_search *search;
+	fz_pool *pool;
+	int *s, *end;
+	int depth;
+} rparser;
+
+static rnode *
+new_node(fz_context *ctx, rparser *p, int type, rnode *x, rnode *y)
+{
+	rnode *node = fz_pool_alloc(ctx, p->pool, sizeof *node);
+	node->type = type;
+	node->x = x;
+	node->y = y;
+	return node;
+}
+
+static int
+new_class(fz_context *ctx, fz_search *search, int neg)
+{
+	if (search->class_len == search->class_cap)
+	{
+		int cap = search->class_cap ? search->class_cap * 2 : 8;
+		search->classes = fz_realloc_array(ctx, search->classes, cap, rclass);
+		search->class_cap = cap;
+	}
+	search->classes[search->class_len].neg = neg;
+	search->classes[search->class_len].first = search->item_len;
+	search->classes[search->class_len].count = 0;
+	return search->class_len++;
+}
+
+static void
+add_class_item(fz_context *ctx, fz_search *search, int cls, int lo, int hi, int neg)
+{
+	if (search->item_len == search->item_cap)
+	{
+		int cap = search->item_cap ? search->item_cap * 2 : 32;
+		search->items = fz_realloc_array(ctx, search->items, cap, rclass_item);
+		search->item_cap = cap;
+	}
+	search->items[search->item_len].lo = lo;
+	search->items[search->item_len].hi = hi;
+	search->items[search->item_len].neg = neg;
+	search->item_len++;
+	search->classes[cls].count++;
+}
+
+static int
+builtin_class(int e, int *neg)
+{
+	*neg = (e == 'D' || e == 'W' || e == 'S');
+	switch (e)
+	{
+	case 'd': case 'D': return CLASS_DIGIT;
+	case 'w': case 'W': return CLASS_WORD;
+	case 's': case 'S': return CLASS_SPACE;
+	}
+	return 0;
+}
+
+static int
+parse_escape(fz_context *ctx, rparser *p)
+{
+	int e;
+	if (p->s == p->end)
+		fz_throw(ctx, FZ_ERROR_SYNTAX, "unterminated escape in regular expression");
+	e = *p->s++;
+	switch (e)
+	{
+	case 'n': return '\n';
+	case 't': return '\t';
+	case 'r': return '\r';
+	}
+	return e;
+}
+
+static rnode *parse_alt(fz_context *ctx, rparser *p);
+
+static rnode *
+parse_class(fz_context *ctx, rparser *p)
+{
+	fz_search *search = p->search;
+	rnode *node;
+	int cls, neg = 0;
+	int lo, hi;
+
+	if (p->s < p->end && *p->s == '^')
+	{
+		neg = 1;
+		p->s++;
+	}
+	cls = new_class(ctx, search, neg);
+
+	while (p->s < p->end && (*p->s != ']' || search->classes[cls].count == 0))
+	{
+		lo = *p->s++;
+		if (lo == '\\')
+		{
+			int bneg, b;
+			if (p->s < p->end && (b = builtin_class(*p->s, &bneg)) != 0)
+			{
+				p->s++;
+				add_class_item(ctx, search, cls, b, b, bneg);
+				continue;
+			}
+			lo = parse_escape(ctx, p);
+		}
+		hi = lo;
+		if (p->s + 1 < p->end && p->s[0] == '-' && p->s[1] != ']')
+		{
+			p->s++;
+			hi = *p->s++;
+			if (hi == '\\')
+				hi = parse_escape(ctx, p);
+			if (hi < lo)
+				fz_throw(ctx, FZ_ERROR_SYNTAX, "invalid range in regular expression");
+		}
+		/* Ranges are compared against normalised text. */
+		lo = normalize(search, lo);
+		hi = normalize(search, hi);
+		if (lo >= 0 && hi >= 0)
+			add_class_item(ctx, search, cls, lo, fz_maxi(lo, hi), 0);
+	}
+	if (p->s == p->end)
+		fz_throw(ctx, FZ_ERROR_SYNTAX, "unterminated character class in regular expression");
+	p->s++;
+
+	node = new_node(ctx, p, R_CLASS, NULL, NULL);
+	node->c = cls;
+	return node;
+}
+
+static rnode *
+parse_atom(fz_context *ctx, rparser *p)
+{
+	fz_search *search = p->search;
+	rnode *node;
+	int c = *p->s++;
+
+	switch (c)
+	{
+	case '(':
+		if (++p->depth > 100)
+			fz_throw(ctx, FZ_ERROR_SYNTAX, "regular expression nested too deeply");
+		if (p->end - p->s >= 2 && p->s[0] == '?' && p->s[1] == ':')
+			p->s += 2;
+		node = parse_alt(ctx, p);
+		if (p->s == p->end || *p->s != ')')
+			fz_throw(ctx, FZ_ERROR_SYNTAX, "unmatched '(' in regular expression");
+		p->s++;
+		p->depth--;
+		return node;
+	case '.':
+		return new_node(ctx, p, R_ANY, NULL, NULL);
+	case '^':
+		return new_node(ctx, p, R_BOL, NULL, NULL);
+	case '$':
+		return new_node(ctx, p, R_EOL, NULL, NULL);
+	case '[':
+		return parse_class(ctx, p);
+	case '*': case '+': case '?': case '{':
+		fz_throw(ctx, FZ_ERROR_SYNTAX, "nothing to repeat in regular expression");
+	case '\\':
+		if (p->s < p->end)
+		{
+			int neg, b = builtin_class(*p->s, &neg);
+			if (b)
+			{
+				int cls;
+				p->s++;
+				cls = new_class(ctx, search, 0);
+				add_class_item(ctx, search, cls, b, b, neg);
+				node = new_node(ctx, p, R_CLASS, NULL, NULL);
+				node->c = cls;
+				return node;
+			}
+			if (*p->s == 'b' || *p->s == 'B')
+				return new_node(ctx, p, *p->s++ == 'b' ? R_WORDB : R_NWORDB, NULL, NULL);
+		}
+		c = parse_escape(ctx, p);
+		break;
+	}
+
+	c = normalize(search, c);
+	if (c < 0)
+		return new_node(ctx, p, R_EMPTY, NULL, NULL);
+	node = new_node(ctx, p, R_CHAR, NULL, NULL);
+	node->c = c;
+	return node;
+}
+
+static int
+parse_int(rparser *p)
+{
+	int n = 0;
+	while (p->s < p->end && *p->s >= '0' && *p->s <= '9')
+		n = fz_mini(n * 10 + *p->s++ - '0', MAX_REPEAT + 1);
+	return n;
+}
+
+static rnode *
+parse_repeat(fz_context *ctx, rparser *p)
+{
+	rnode *atom = parse_atom(ctx, p);
+	rnode *node;
+	int min, max;
+
+	while (p->s < p->end)
+	{
+		switch (*p->s)
+		{
+		case '*': min = 0; max = -1; p->s++; break;
+		case '+': min = 1; max = -1; p->s++; break;
+		case '?': min = 0; max = 1; p->s++; break;
+		case '{':
+			p->s++;
+			min = max = parse_int(p);
+			if (p->s < p->end && *p->s == ',')
+			{
+				p->s++;
+				max = (p->s < p->end && *p->s == '}') ? -1 : parse_int(p);
+			}
+			if (p->s == p->end || *p->s != '}')
+				fz_throw(ctx, FZ_ERROR_SYNTAX, "invalid repeat in regular expression");
+			p->s++;
+			if (min > MAX_REPEAT || max > MAX_REPEAT || (max >= 0 && max < min))
+				fz_throw(ctx, FZ_ERROR_SYNTAX, "invalid repeat count in regular expression");
+			break;
+		default:
+			return atom;
+		}
+		node = new_node(ctx, p, R_REP, atom, NULL);
+		node->min = min;
+		node->max = max;
+		node->lazy = 0;
+		if (p->s < p->end && *p->s == '?')
+		{
+			node->lazy = 1;
+			p->s++;
+		}
+		atom = node;
+	}
+	return atom;
+}
+
+static rnode *
+parse_cat(fz_context *ctx, rparser *p)
+{
+	rnode *node = NULL;
+	while (p->s < p->end && *p->s != '|' && *p->s != ')')
+	{
+		rnode *x = parse_repeat(ctx, p);
+		node = node ? new_node(ctx, p, R_CAT, node, x) : x;
+	}
+	return node ? node : new_node(ctx, p, R_EMPTY, NULL, NULL);
+}
+
+static rnode *
+parse_alt(fz_context *ctx, rparser *p)
+{
+	rnode *node = parse_cat(ctx, p);
+	while (p->s < p->end && *p->s == '|')
+	{
+		p->s++;
+		node = new_node(ctx, p, R_ALT, node, parse_cat(ctx, p));
+	}
+	return node;
+}
+
+static rnode *
+parse_literal(fz_context *ctx, rparser *p)
+{
+	fz_search *search = p->search;
+	rnode *node = NULL;
+	rnode *x;
+	int c;
+
+	while (p->s < p->end)
+	{
+		c = normalize(search, *p->s++);
+		if (c < 0)
+			continue;
+		/* Any run of whitespace matches a single space in the text,
+		 * which has had its own whitespace collapsed; but not the
+		 * break between blocks. */
+		if (c == ' ')
+			while (p->s < p->end && is_space(*p->s))
+				p->s++;
+		x = new_node(ctx, p, R_CHAR, NULL, NULL);
+		x->c = c;
+		node = node ? new_node(ctx, p, R_CAT, node, x) : x;
+	}
+	return node ? node : new_node(ctx, p, R_EMPTY, NULL, NULL);
+}
+
+static int
+emit(fz_context *ctx, fz_search *search, int op, int x, int y)
+{
+	if (search->prog_len >= MAX_PROG)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "regular expression too complex");
+	if (search->prog_len == search->prog_cap)
+	{
+		int cap = search->prog_cap ? search->prog_cap * 2 : 64;
+		search->prog = fz_realloc_array(ctx, search->prog, cap, rinst);
+		search->prog_cap = cap;
+	}
+	search->prog[search->prog_len].op = op;
+	search->prog[search->prog_len].x = x;
+	search->prog[search->prog_len].y = y;
+	return search->prog_len++;
+}
+
+static void compile(fz_context *ctx, fz_search *search, rnode *node);
+
+/* The parser builds concatenations and alternations leaning to the left,
+ * so a long needle makes a chain as deep as it is long. Walk down the
+ * chain with a loop rather than recursion to spare the stack. */
+static void
+compile_chain(fz_context *ctx, fz_search *search, rnode *node)
+{
+	rnode **chain;
+	rnode *x;
+	int type = node->type;
+	int n = 0, i, base, jmp;
+
+	for (x = node; x->type == type; x = x->x)
+		n++;
+	chain = fz_malloc_array(ctx, n, rnode *);
+	fz_try(ctx)
+	{
+		/* chain[0] is the innermost node; its x is the leftmost operand. */
+		for (x = node, i = n; x->type == type; x = x->x)
+			chain[--i] = x;
+
+		if (type == R_CAT)
+		{
+			compile(ctx, search, chain[0]->x);
+			for (i = 0; i < n; i++)
+				compile(ctx, search, chain[i]->y);
+		}
+		else
+		{
+			/* One split per alternation, outermost first, each
+			 * falling through to the next. */
+			base = search->prog_len;
+			for (i = 0; i < n; i++)
+				emit(ctx, search, I_SPLIT, base + i + 1, 0);
+			compile(ctx, search, chain[0]->x);
+			for (i = 0; i < n; i++)
+			{
+				jmp = emit(ctx, search, I_JMP, 0, 0);
+				search->prog[base + n - 1 - i].y = search->prog_len;
+				compile(ctx, search, chain[i]->y);
+				search->prog[jmp].x = search->prog_len;
+			}
+		}
+	}
+	fz_always(ctx)
+		fz_free(ctx, chain);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+compile(fz_context *ctx, fz_search *search, rnode *node)
+{
+	int split, i;
+
+	switch (node->type)
+	{
+	case R_EMPTY:
+		break;
+	case R_CHAR:
+		emit(ctx, search, I_CHAR, node->c, 0);
+		break;
+	case R_ANY:
+		emit(ctx, search, I_ANY, 0, 0);
+		break;
+	case R_CLASS:
+		emit(ctx, search, I_CLASS, node->c, 0);
+		break;
+	case R_BOL:
+		emit(ctx, search, I_BOL, 0, 0);
+		break;
+	case R_EOL:
+		emit(ctx, search, I_EOL, 0, 0);
+		break;
+	case R_WORDB:
+		emit(ctx, search, I_WORDB, 0, 0);
+		break;
+	case R_NWORDB:
+		emit(ctx, search, I_NWORDB, 0, 0);
+		break;
+	case R_CAT:
+	case R_ALT:
+		compile_chain(ctx, search, node);
+		break;
+	case R_REP:
+		for (i = 0; i < node->min; i++)
+			compile(ctx, search, node->x);
+		if (node->max < 0)
+		{
+			split = emit(ctx, search, I_SPLIT, 0, 0);
+			compile(ctx, search, node->x);
+			emit(ctx, search, I_JMP, split, 0);
+			search->prog[split].x = split + 1;
+			search->prog[split].y = search->prog_len;
+			if (node->lazy)
+			{
+				search->prog[split].x = search->prog_len;
+				search->prog[split].y = split + 1;
+			}
+		}
+		else
+		{
+			int first = search->prog_len;
+			int n = node->max - node->min;
+			for (i = 0; i < n; i++)
+			{
+				emit(ctx, search, I_SPLIT, search->prog_len + 1, 0);
+				compile(ctx, search, node->x);
+			}
+			/* Point all the optional copies at the end. */
+			for (i = first; i < search->prog_len; i++)
+			{
+				if (search->prog[i].op == I_SPLIT && search->prog[i].y == 0 && search->prog[i].x == i + 1)
+				{
+					search->prog[i].y = search->prog_len;
+					if (node->lazy)
+					{
+						search->prog[i].y = i + 1;
+						search->prog[i].x = search->prog_len;
+					}
+				}
+			}
+		}
+		break;
+	}
+}
+
+fz_search *
+fz_new_search(fz_context *ctx, const char *needle, int options)
+{
+	fz_search *search;
+	rparser p = { 0 };
+	rnode *node;
+	int *runes = NULL;
+	int n = 0;
+	const char *s;
+
+	fz_var(runes);
+
+	search = fz_malloc_struct(ctx, fz_search);
+	search->options = options;
+	search->first_char = -1;
+
+	fz_var(p.pool);
+
+	fz_try(ctx)
+	{
+		runes = fz_malloc_array(ctx, strlen(needle) + 1, int);
+		for (s = needle; *s; n++)
+			s += fz_chartorune(&runes[n], s);
+		if (n > MAX_PROG)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "search string too long");
+
+		p.search = search;
+		p.pool = fz_new_pool(ctx);
+		p.s = runes;
+		p.end = runes + n;
+
+		if (options & FZ_SEARCH_REGEXP)
+		{
+			node = parse_alt(ctx, &p);
+			if (p.s != p.end)
+				fz_throw(ctx, FZ_ERROR_SYNTAX, "unmatched ')' in regular expression");
+		}
+		else
+			node = parse_literal(ctx, &p);
+
+		compile(ctx, search, node);
+		emit(ctx, search, I_MATCH, 0, 0);
+
+		if (search->prog[0].op == I_CHAR)
+			search->first_char = search->prog[0].x;
+
+		search->clist = fz_malloc_array(ctx, search->prog_len, int);
+		search->cstart = fz_malloc_array(ctx, search->prog_len, int);
+		search->nlist = fz_malloc_array(ctx, search->prog_len, int);
+		search->nstart = fz_malloc_array(ctx, search->prog_len, int);
+		search->mark = fz_malloc_array(ctx, search->prog_len, int);
+		search->stack = fz_malloc_array(ctx, search->prog_len * 2 + 1, int);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_pool(ctx, p.pool);
+		fz_free(ctx, runes);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_search(ctx, search);
+		fz_rethrow(ctx);
+	}
+
+	return search;
+}
+
+void
+fz_drop_search(fz_context *ctx, fz_search *search)
+{
+	if (!search)
+		return;
+	fz_free(ctx, search->prog);
+	fz_free(ctx, search->classes);
+	fz_free(ctx, search->items);
+	fz_free(ctx, search->text);
+	fz_free(ctx, search->chars);
+	fz_free(ctx, search->lines);
+	fz_free(ctx, search->clist);
+	fz_free(ctx, search->cstart);
+	fz_free(ctx, search->nlist);
+	fz_free(ctx, search->nstart);
+	fz_free(ctx, search->mark);
+	fz_free(ctx, search->stack);
+	fz_free(ctx, search->quads);
+	fz_free(ctx, search);
+}
+
+/* Normalised page text */
+
+static void
+add_text(fz_context *ctx, fz_search *search, int c, fz_stext_char *ch, fz_stext_line *line)
+{
+	int len = search->text_len;
+
+	if (c == ' ' || c == '\n')
+	{
+		/* Collapse runs of whitespace; paragraph breaks win. */
+		if (len == 0 || search->text[len-1] == '\n')
+			return;
+		if (search->text[len-1] == ' ')
+		{
+			if (c == '\n')
+				search->text[len-1] = '\n';
+			return;
+		}
+	}
+
+	if (len == search->text_cap)
+	{
+		int cap = search->text_cap ? search->text_cap * 2 : 1024;
+		search->text = fz_realloc_array(ctx, search->text, cap, int);
+		search->chars = fz_realloc_array(ctx, search->chars, cap, fz_stext_char *);
+		search->lines = fz_realloc_array(ctx, search->lines, cap, fz_stext_line *);
+		search->text_cap = cap;
+	}
+	search->text[len] = c;
+	search->chars[len] = ch;
+	search->lines[len] = line;
+	search->text_len = len + 1;
+}
+
+static void
+load_page_text(fz_context *ctx, fz_search *search, fz_stext_page *page)
+{
+	fz_stext_block *block;
+	fz_stext_line *line;
+	fz_stext_char *ch;
+	int c;
+
+	search->text_len = 0;
+
+	for (block = page->first_block; block; block = block->next)
+	{
+		if (block->type != FZ_STEXT_BLOCK_TEXT)
+			continue;
+		for (line = block->u.t.first_line; line; line = line->next)
+		{
+			for (ch = line->first_char; ch; ch = ch->next)
+			{
+				c = normalize(search, ch->c);
+				if (c >= 0)
+					add_text(ctx, search, c, ch, line);
+			}
+
+			/* Join words hyphenated across the end of a line. */
+			if (!(search->options & FZ_SEARCH_KEEP_HYPHENS) && line->next &&
+				line->last_char && is_hyphen(line->last_char->c) &&
+				search->text_len > 0 && search->chars[search->text_len-1] == line->last_char)
+			{
+				search->text_len--;
+				continue;
+			}
+
+			add_text(ctx, search, ' ', NULL, line);
+		}
+		add_text(ctx, search, '\n', NULL, NULL);
+	}
+}
+
+/* Pike VM */
+
+static int
+match_class(fz_search *search, int cls, int c)
+{
+	rclass *k = &search->classes[cls];
+	rclass_item *item = &search->items[k->first];
+	int i, m;
+
+	for (i = 0; i < k->count; i++, item++)
+	{
+		switch (item->lo)
+		{
+		case CLASS_DIGIT: m = (c >= '0' && c <= '9') || ucdn_get_general_category(c) == UCDN_GENERAL_CATEGORY_ND; break;
+		case CLASS_WORD: m = is_word(c); break;
+		case CLASS_SPACE: m = (c == ' ' || c == '\n'); break;
+		default: m = (c >= item->lo && c <= item->hi); break;
+		}
+		if (m != item->neg)
+			return !k->neg;
+	}
+	return k->neg;
+}
+
+static int
+at_word_boundary(fz_search *search, int i)
+{
+	int a = i > 0 && is_word(search->text[i-1]);
+	int b = i < search->text_len && is_word(search->text[i]);
+	return a != b;
+}
+
+/* Add the thread at 'pc' (following jumps, splits and assertions at text
+ * position 'i') to a run list, in priority order. */
+static int
+add_thread(fz_search *search, int *list, int *starts, int n, int pc, int start, int i, int gen)
+{
+	rinst *prog = search->prog;
+	int *stack = search->stack;
+	int sp = 0;
+	int ok;
+
+	stack[sp++] = pc;
+	while (sp > 0)
+	{
+		pc = stack[--sp];
+		if (search->mark[pc] == gen)
+			continue;
+		search->mark[pc] = gen;
+		switch (prog[pc].op)
+		{
+		case I_JMP:
+			stack[sp++] = prog[pc].x;
+			break;
+		case I_SPLIT:
+			stack[sp++] = prog[pc].y;
+			stack[sp++] = prog[pc].x;
+			break;
+		case I_BOL:
+		case I_EOL:
+		case I_WORDB:
+		case I_NWORDB:
+			if (prog[pc].op == I_BOL)
+				ok = (i == 0 || search->text[i-1] == '\n');
+			else if (prog[pc].op == I_EOL)
+				ok = (i == search->text_len || search->text[i] == '\n');
+			else
+				ok = (at_word_boundary(search, i) == (prog[pc].op == I_WORDB));
+			if (ok)
+				stack[sp++] = pc + 1;
+			break;
+		default:
+			list[n] = pc;
+			starts[n] = start;
+			n++;
+			break;
+		}
+	}
+	return n;
+}
+
+/* Find the leftmost match starting at or after 'pos'. */
+static int
+find_match(fz_search *search, int pos, int *mstart, int *mend)
+{
+	rinst *prog = search->prog;
+	int *text = search->text;
+	int len = search->text_len;
+	int *clist = search->clist, *cstart = search->cstart;
+	int *nlist = search->nlist, *nstart = search->nstart;
+	int *tmp;
+	int cn = 0, nn, i, t, c;
+	int matched = 0;
+
+	for (i = 0; i < search->prog_len; i++)
+		search->mark[i] = -1;
+
+	for (i = pos; ; i++)
+	{
+		if (!matched)
+		{
+			if (cn == 0 && search->first_char >= 0)
+			{
+				while (i < len && text[i] != search->first_char)
+					i++;
+				if (i == len)
+					break;
+			}
+			cn = add_thread(search, clist, cstart, cn, 0, i, i, i);
+		}
+		if (cn == 0)
+		{
+			if (matched || i >= len)
+				break;
+			continue;
+		}
+
+		c = i < len ? text[i] : -1;
+		nn = 0;
+		for (t = 0; t < cn; t++)
+		{
+			rinst *inst = &prog[clist[t]];
+			int ok = 0;
+			switch (inst->op)
+			{
+			case I_MATCH:
+				matched = 1;
+				*mstart = cstart[t];
+				*mend = i;
+				/* Lower priority threads lose. */
+				t = cn;
+				continue;
+			case I_CHAR:
+				ok = (c == inst->x);
+				break;
+			case I_ANY:
+				ok = (c >= 0 && c != '\n');
+				break;
+			case I_CLASS:
+				ok = (c >= 0 && match_class(search, inst->x, c));
+				break;
+			}
+			if (ok)
+				nn = add_thread(search, nlist, nstart, nn, clist[t] + 1, cstart[t], i + 1, i + 1);
+		}
+
+		tmp = clist; clist = nlist; nlist = tmp;
+		tmp = cstart; cstart = nstart; nstart = tmp;
+		cn = nn;
+
+		if (i >= len)
+			break;
+	}
+
+	return matched;
+}
+
+/* Turn a match back into quads */
+
+static float hdist(fz_point *dir, fz_point *a, fz_point *b)
+{
+	float dx = b->x - a->x;
+	float dy = b->y - a->y;
+	return fz_abs(dx * dir->x + dy * dir->y);
+}
+
+static float vdist(fz_point *dir, fz_point *a, fz_point *b)
+{
+	float dx = b->x - a->x;
+	float dy = b->y - a->y;
+	return fz_abs(dx * dir->y + dy * dir->x);
+}
+
+static void
+add_hit_char(fz_context *ctx, fz_search *search, fz_stext_line *line, fz_stext_char *ch)
+{
+	float vfuzz = ch->size * 0.1f;
+	float hfuzz = ch->size * 0.2f; /* merge kerns but not large gaps */
+
+	if (search->quad_len > 0)
+	{
+		fz_quad *end = &search->quads[search->quad_len-1];
+		if (hdist(&line->dir, &end->lr, &ch->quad.ll) < hfuzz
+			&& vdist(&line->dir, &end->lr, &ch->quad.ll) < vfuzz
+			&& hdist(&line->dir, &end->ur, &ch->quad.ul) < hfuzz
+			&& vdist(&line->dir, &end->ur, &ch->quad.ul) < vfuzz)
+		{
+			end->ur = ch->quad.ur;
+			end->lr = ch->quad.lr;
+			return;
+		}
+	}
+
+	if (search->quad_len == search->quad_cap)
+	{
+		int cap = search->quad_cap ? search->quad_cap * 2 : 16;
+		search->quads = fz_realloc_array(ctx, search->quads, cap, fz_quad);
+		search->quad_cap = cap;
+	}
+	search->quads[search->quad_len++] = ch->quad;
+}
+
+int
+fz_run_search(fz_context *ctx, fz_search *search, fz_stext_page *page, fz_search_hit_fn *fn, void *arg)
+{
+	int pos = 0;
+	int hits = 0;
+	int start, end, i;
+
+	load_page_text(ctx, search, page);
+
+	while (pos <= search->text_len && find_match(search, pos, &start, &end))
+	{
+		if (end == start)
+		{
+			pos = end + 1;
+			continue;
+		}
+		pos = end;
+
+		search->quad_len = 0;
+		for (i = start; i < end; i++)
+			if (search->chars[i])
+				add_hit_char(ctx, search, search->lines[i], search->chars[i]);
+		if (search->quad_len == 0)
+			continue;
+
+		hits++;
+		if (fn && fn(ctx, arg, search->quad_len, search->quads))
+			break;
+	}
+
+	return hits;
+}
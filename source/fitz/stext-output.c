@@ -167,23 +167,33 @@ fz_print_stext_block_as_html(fz_context *ctx, fz_output *out, fz_stext_block *bl
 	}
 }
 
+static void
+fz_print_stext_begin_page_as_html(fz_context *ctx, fz_output *out, fz_rect mediabox, int id)
+{
+	int w = mediabox.x1 - mediabox.x0;
+	int h = mediabox.y1 - mediabox.y0;
+
+	fz_write_printf(ctx, out, "<div id=\"page%d\" style=\"position:relative;width:%dpt;height:%dpt;background-color:white\">\n", id, w, h);
+}
+
+static void
+fz_print_stext_any_block_as_html(fz_context *ctx, fz_output *out, fz_stext_block *block)
+{
+	if (block->type == FZ_STEXT_BLOCK_IMAGE)
+		fz_print_stext_image_as_html(ctx, out, block);
+	else if (block->type == FZ_STEXT_BLOCK_TEXT)
+		fz_print_stext_block_as_html(ctx, out, block);
+}
+
 void
 fz_print_stext_page_as_html(fz_context *ctx, fz_output *out, fz_stext_page *page, int id)
 {
 	fz_stext_block *block;
 
-	int w = page->mediabox.x1 - page->mediabox.x0;
-	int h = page->mediabox.y1 - page->mediabox.y0;
-
-	fz_write_printf(ctx, out, "<div id=\"page%d\" style=\"position:relative;width:%dpt;height:%dpt;background-color:white\">\n", id, w, h);
+	fz_print_stext_begin_page_as_html(ctx, out, page->mediabox, id);
 
 	for (block = page->first_block; block; block = block->next)
-	{
-		if (block->type == FZ_STEXT_BLOCK_IMAGE)
-			fz_print_stext_image_as_html(ctx, out, block);
-		else if (block->type == FZ_STEXT_BLOCK_TEXT)
-			fz_print_stext_block_as_html(ctx, out, block);
-	}
+		fz_print_stext_any_block_as_html(ctx, out, block);
 
 	fz_write_string(ctx, out, "</div>\n");
 }
@@ -345,6 +355,15 @@ static void fz_print_stext_block_as_xhtml(fz_context *ctx, fz_output *out, fz_st
 	fz_write_printf(ctx, out, "</%s>\n", tag);
 }
 
+static void
+fz_print_stext_any_block_as_xhtml(fz_context *ctx, fz_output *out, fz_stext_block *block)
+{
+	if (block->type == FZ_STEXT_BLOCK_IMAGE)
+		fz_print_stext_image_as_xhtml(ctx, out, block);
+	else if (block->type == FZ_STEXT_BLOCK_TEXT)
+		fz_print_stext_block_as_xhtml(ctx, out, block);
+}
+
 void
 fz_print_stext_page_as_xhtml(fz_context *ctx, fz_output *out, fz_stext_page *page, int id)
 {
@@ -353,12 +372,7 @@ fz_print_stext_page_as_xhtml(fz_context *ctx, fz_output *out, fz_stext_page *pag
 	fz_write_printf(ctx, out, "<div id=\"page%d\">\n", id);
 
 	for (block = page->first_block; block; block = block->next)
-	{
-		if (block->type == FZ_STEXT_BLOCK_IMAGE)
-			fz_print_stext_image_as_xhtml(ctx, out, block);
-		else if (block->type == FZ_STEXT_BLOCK_TEXT)
-			fz_print_stext_block_as_xhtml(ctx, out, block);
-	}
+		fz_print_stext_any_block_as_xhtml(ctx, out, block);
 
 	fz_write_string(ctx, out, "</div>\n");
 }
@@ -388,204 +402,220 @@ fz_print_stext_trailer_as_xhtml(fz_context *ctx, fz_output *out)
 
 /* Detailed XML dump of the entire structured text data */
 
-void
-fz_print_stext_page_as_xml(fz_context *ctx, fz_output *out, fz_stext_page *page, int id)
+static void
+fz_print_stext_block_as_xml(fz_context *ctx, fz_output *out, fz_stext_block *block)
 {
-	fz_stext_block *block;
 	fz_stext_line *line;
 	fz_stext_char *ch;
 
-	fz_write_printf(ctx, out, "<page id=\"page%d\" width=\"%g\" height=\"%g\">\n", id,
-		page->mediabox.x1 - page->mediabox.x0,
-		page->mediabox.y1 - page->mediabox.y0);
-
-	for (block = page->first_block; block; block = block->next)
+	switch (block->type)
 	{
-		switch (block->type)
+	case FZ_STEXT_BLOCK_TEXT:
+		fz_write_printf(ctx, out, "<block bbox=\"%g %g %g %g\">\n",
+				block->bbox.x0, block->bbox.y0, block->bbox.x1, block->bbox.y1);
+		for (line = block->u.t.first_line; line; line = line->next)
 		{
-		case FZ_STEXT_BLOCK_TEXT:
-			fz_write_printf(ctx, out, "<block bbox=\"%g %g %g %g\">\n",
-					block->bbox.x0, block->bbox.y0, block->bbox.x1, block->bbox.y1);
-			for (line = block->u.t.first_line; line; line = line->next)
-			{
-				fz_font *font = NULL;
-				float size = 0;
-				const char *name = NULL;
+			fz_font *font = NULL;
+			float size = 0;
+			const char *name = NULL;
 
-				fz_write_printf(ctx, out, "<line bbox=\"%g %g %g %g\" wmode=\"%d\" dir=\"%g %g\">\n",
-						line->bbox.x0, line->bbox.y0, line->bbox.x1, line->bbox.y1,
-						line->wmode,
-						line->dir.x, line->dir.y);
+			fz_write_printf(ctx, out, "<line bbox=\"%g %g %g %g\" wmode=\"%d\" dir=\"%g %g\">\n",
+					line->bbox.x0, line->bbox.y0, line->bbox.x1, line->bbox.y1,
+					line->wmode,
+					line->dir.x, line->dir.y);
 
-				for (ch = line->first_char; ch; ch = ch->next)
+			for (ch = line->first_char; ch; ch = ch->next)
+			{
+				if (ch->font != font || ch->size != size)
 				{
-					if (ch->font != font || ch->size != size)
-					{
-						if (font)
-							fz_write_string(ctx, out, "</font>\n");
-						font = ch->font;
-						size = ch->size;
-						name = font_full_name(ctx, font);
-						fz_write_printf(ctx, out, "<font name=\"%s\" size=\"%g\">\n", name, size);
-					}
-					fz_write_printf(ctx, out, "<char quad=\"%g %g %g %g %g %g %g %g\" x=\"%g\" y=\"%g\" color=\"#%06x\" c=\"",
-							ch->quad.ul.x, ch->quad.ul.y,
-							ch->quad.ur.x, ch->quad.ur.y,
-							ch->quad.ll.x, ch->quad.ll.y,
-							ch->quad.lr.x, ch->quad.lr.y,
-							ch->origin.x, ch->origin.y,
-							ch->color);
-					switch (ch->c)
-					{
-					case '<': fz_write_string(ctx, out, "&lt;"); break;
-					case '>': fz_write_string(ctx, out, "&gt;"); break;
-					case '&': fz_write_string(ctx, out, "&amp;"); break;
-					case '"': fz_write_string(ctx, out, "&quot;"); break;
-					case '\'': fz_write_string(ctx, out, "&apos;"); break;
-					default:
-						   if (ch->c >= 32 && ch->c <= 127)
-							   fz_write_printf(ctx, out, "%c", ch->c);
-						   else
-							   fz_write_printf(ctx, out, "&#x%x;", ch->c);
-						   break;
-					}
-					fz_write_string(ctx, out, "\"/>\n");
+					if (font)
+						fz_write_string(ctx, out, "</font>\n");
+					font = ch->font;
+					size = ch->size;
+					name = font_full_name(ctx, font);
+					fz_write_printf(ctx, out, "<font name=\"%s\" size=\"%g\">\n", name, size);
 				}
-
-				if (font)
-					fz_write_string(ctx, out, "</font>\n");
-
-				fz_write_string(ctx, out, "</line>\n");
+				fz_write_printf(ctx, out, "<char quad=\"%g %g %g %g %g %g %g %g\" x=\"%g\" y=\"%g\" color=\"#%06x\" c=\"",
+						ch->quad.ul.x, ch->quad.ul.y,
+						ch->quad.ur.x, ch->quad.ur.y,
+						ch->quad.ll.x, ch->quad.ll.y,
+						ch->quad.lr.x, ch->quad.lr.y,
+						ch->origin.x, ch->origin.y,
+						ch->color);
+				switch (ch->c)
+				{
+				case '<': fz_write_string(ctx, out, "&lt;"); break;
+				case '>': fz_write_string(ctx, out, "&gt;"); break;
+				case '&': fz_write_string(ctx, out, "&amp;"); break;
+				case '"': fz_write_string(ctx, out, "&quot;"); break;
+				case '\'': fz_write_string(ctx, out, "&apos;"); break;
+				default:
+					   if (ch->c >= 32 && ch->c <= 127)
+						   fz_write_printf(ctx, out, "%c", ch->c);
+					   else
+						   fz_write_printf(ctx, out, "&#x%x;", ch->c);
+					   break;
+				}
+				fz_write_string(ctx, out, "\"/>\n");
 			}
-			fz_write_string(ctx, out, "</block>\n");
-			break;
 
-		case FZ_STEXT_BLOCK_IMAGE:
-			fz_write_printf(ctx, out, "<image bbox=\"%g %g %g %g\" />\n",
-					block->bbox.x0, block->bbox.y0, block->bbox.x1, block->bbox.y1);
-			break;
+			if (font)
+				fz_write_string(ctx, out, "</font>\n");
+
+			fz_write_string(ctx, out, "</line>\n");
 		}
+		fz_write_string(ctx, out, "</block>\n");
+		break;
+
+	case FZ_STEXT_BLOCK_IMAGE:
+		fz_write_printf(ctx, out, "<image bbox=\"%g %g %g %g\" />\n",
+				block->bbox.x0, block->bbox.y0, block->bbox.x1, block->bbox.y1);
+		break;
 	}
+}
+
+void
+fz_print_stext_page_as_xml(fz_context *ctx, fz_output *out, fz_stext_page *page, int id)
+{
+	fz_stext_block *block;
+
+	fz_write_printf(ctx, out, "<page id=\"page%d\" width=\"%g\" height=\"%g\">\n", id,
+		page->mediabox.x1 - page->mediabox.x0,
+		page->mediabox.y1 - page->mediabox.y0);
+
+	for (block = page->first_block; block; block = block->next)
+		fz_print_stext_block_as_xml(ctx, out, block);
+
 	fz_write_string(ctx, out, "</page>\n");
 }
 
 /* JSON dump */
 
-void
-fz_print_stext_page_as_json(fz_context *ctx, fz_output *out, fz_stext_page *page, float scale)
+static void
+fz_print_stext_block_as_json(fz_context *ctx, fz_output *out, fz_stext_block *block, float scale)
 {
-	fz_stext_block *block;
 	fz_stext_line *line;
 	fz_stext_char *ch;
 
-	fz_write_printf(ctx, out, "{%q:[", "blocks");
-
-	for (block = page->first_block; block; block = block->next)
+	switch (block->type)
 	{
-		if (block != page->first_block)
-			fz_write_string(ctx, out, ",");
-		switch (block->type)
+	case FZ_STEXT_BLOCK_TEXT:
+		fz_write_printf(ctx, out, "{%q:%q,", "type", "text");
+		fz_write_printf(ctx, out, "%q:{", "bbox");
+		fz_write_printf(ctx, out, "%q:%d,", "x", (int)(block->bbox.x0 * scale));
+		fz_write_printf(ctx, out, "%q:%d,", "y", (int)(block->bbox.y0 * scale));
+		fz_write_printf(ctx, out, "%q:%d,", "w", (int)((block->bbox.x1 - block->bbox.x0) * scale));
+		fz_write_printf(ctx, out, "%q:%d},", "h", (int)((block->bbox.y1 - block->bbox.y0) * scale));
+		fz_write_printf(ctx, out, "%q:[", "lines");
+
+		for (line = block->u.t.first_line; line; line = line->next)
 		{
-		case FZ_STEXT_BLOCK_TEXT:
-			fz_write_printf(ctx, out, "{%q:%q,", "type", "text");
+			if (line != block->u.t.first_line)
+				fz_write_string(ctx, out, ",");
+			fz_write_printf(ctx, out, "{%q:%d,", "wmode", line->wmode);
 			fz_write_printf(ctx, out, "%q:{", "bbox");
-			fz_write_printf(ctx, out, "%q:%d,", "x", (int)(block->bbox.x0 * scale));
-			fz_write_printf(ctx, out, "%q:%d,", "y", (int)(block->bbox.y0 * scale));
-			fz_write_printf(ctx, out, "%q:%d,", "w", (int)((block->bbox.x1 - block->bbox.x0) * scale));
-			fz_write_printf(ctx, out, "%q:%d},", "h", (int)((block->bbox.y1 - block->bbox.y0) * scale));
-			fz_write_printf(ctx, out, "%q:[", "lines");
+			fz_write_printf(ctx, out, "%q:%d,", "x", (int)(line->bbox.x0 * scale));
+			fz_write_printf(ctx, out, "%q:%d,", "y", (int)(line->bbox.y0 * scale));
+			fz_write_printf(ctx, out, "%q:%d,", "w", (int)((line->bbox.x1 - line->bbox.x0) * scale));
+			fz_write_printf(ctx, out, "%q:%d},", "h", (int)((line->bbox.y1 - line->bbox.y0) * scale));
 
-			for (line = block->u.t.first_line; line; line = line->next)
+			/* Since we force preserve-spans, the first char has the style for the entire line. */
+			if (line->first_char)
 			{
-				if (line != block->u.t.first_line)
-					fz_write_string(ctx, out, ",");
-				fz_write_printf(ctx, out, "{%q:%d,", "wmode", line->wmode);
-				fz_write_printf(ctx, out, "%q:{", "bbox");
-				fz_write_printf(ctx, out, "%q:%d,", "x", (int)(line->bbox.x0 * scale));
-				fz_write_printf(ctx, out, "%q:%d,", "y", (int)(line->bbox.y0 * scale));
-				fz_write_printf(ctx, out, "%q:%d,", "w", (int)((line->bbox.x1 - line->bbox.x0) * scale));
-				fz_write_printf(ctx, out, "%q:%d},", "h", (int)((line->bbox.y1 - line->bbox.y0) * scale));
-
-				/* Since we force preserve-spans, the first char has the style for the entire line. */
-				if (line->first_char)
-				{
-					fz_font *font = line->first_char->font;
-					char *font_family = "sans-serif";
-					char *font_weight = "normal";
-					char *font_style = "normal";
-					if (fz_font_is_monospaced(ctx, font)) font_family = "monospace";
-					else if (fz_font_is_serif(ctx, font)) font_family = "serif";
-					if (fz_font_is_bold(ctx, font)) font_weight = "bold";
-					if (fz_font_is_italic(ctx, font)) font_style = "italic";
-					fz_write_printf(ctx, out, "%q:{", "font");
-					fz_write_printf(ctx, out, "%q:%q,", "name", fz_font_name(ctx, font));
-					fz_write_printf(ctx, out, "%q:%q,", "family", font_family);
-					fz_write_printf(ctx, out, "%q:%q,", "weight", font_weight);
-					fz_write_printf(ctx, out, "%q:%q,", "style", font_style);
-					fz_write_printf(ctx, out, "%q:%d},", "size", (int)(line->first_char->size * scale));
-					fz_write_printf(ctx, out, "%q:%d,", "x", (int)(line->first_char->origin.x * scale));
-					fz_write_printf(ctx, out, "%q:%d,", "y", (int)(line->first_char->origin.y * scale));
-				}
-
-				fz_write_printf(ctx, out, "%q:\"", "text");
-				for (ch = line->first_char; ch; ch = ch->next)
-				{
-					if (ch->c == '"' || ch->c == '\\')
-						fz_write_printf(ctx, out, "\\%c", ch->c);
-					else if (ch->c < 32)
-						fz_write_printf(ctx, out, "\\u%04x", ch->c);
-					else
-						fz_write_printf(ctx, out, "%C", ch->c);
-				}
-				fz_write_printf(ctx, out, "\"}");
+				fz_font *font = line->first_char->font;
+				char *font_family = "sans-serif";
+				char *font_weight = "normal";
+				char *font_style = "normal";
+				if (fz_font_is_monospaced(ctx, font)) font_family = "monospace";
+				else if (fz_font_is_serif(ctx, font)) font_family = "serif";
+				if (fz_font_is_bold(ctx, font)) font_weight = "bold";
+				if (fz_font_is_italic(ctx, font)) font_style = "italic";
+				fz_write_printf(ctx, out, "%q:{", "font");
+				fz_write_printf(ctx, out, "%q:%q,", "name", fz_font_name(ctx, font));
+				fz_write_printf(ctx, out, "%q:%q,", "family", font_family);
+				fz_write_printf(ctx, out, "%q:%q,", "weight", font_weight);
+				fz_write_printf(ctx, out, "%q:%q,", "style", font_style);
+				fz_write_printf(ctx, out, "%q:%d},", "size", (int)(line->first_char->size * scale));
+				fz_write_printf(ctx, out, "%q:%d,", "x", (int)(line->first_char->origin.x * scale));
+				fz_write_printf(ctx, out, "%q:%d,", "y", (int)(line->first_char->origin.y * scale));
 			}
-			fz_write_string(ctx, out, "]}");
-			break;
 
-		case FZ_STEXT_BLOCK_IMAGE:
-			fz_write_printf(ctx, out, "{%q:%q,", "type", "image");
-			fz_write_printf(ctx, out, "%q:{", "bbox");
-			fz_write_printf(ctx, out, "%q:%d,", "x", (int)(block->bbox.x0 * scale));
-			fz_write_printf(ctx, out, "%q:%d,", "y", (int)(block->bbox.y0 * scale));
-			fz_write_printf(ctx, out, "%q:%d,", "w", (int)((block->bbox.x1 - block->bbox.x0) * scale));
-			fz_write_printf(ctx, out, "%q:%d}}", "h", (int)((block->bbox.y1 - block->bbox.y0) * scale));
-			break;
+			fz_write_printf(ctx, out, "%q:\"", "text");
+			for (ch = line->first_char; ch; ch = ch->next)
+			{
+				if (ch->c == '"' || ch->c == '\\')
+					fz_write_printf(ctx, out, "\\%c", ch->c);
+				else if (ch->c < 32)
+					fz_write_printf(ctx, out, "\\u%04x", ch->c);
+				else
+					fz_write_printf(ctx, out, "%C", ch->c);
+			}
+			fz_write_printf(ctx, out, "\"}");
 		}
+		fz_write_string(ctx, out, "]}");
+		break;
+
+	case FZ_STEXT_BLOCK_IMAGE:
+		fz_write_printf(ctx, out, "{%q:%q,", "type", "image");
+		fz_write_printf(ctx, out, "%q:{", "bbox");
+		fz_write_printf(ctx, out, "%q:%d,", "x", (int)(block->bbox.x0 * scale));
+		fz_write_printf(ctx, out, "%q:%d,", "y", (int)(block->bbox.y0 * scale));
+		fz_write_printf(ctx, out, "%q:%d,", "w", (int)((block->bbox.x1 - block->bbox.x0) * scale));
+		fz_write_printf(ctx, out, "%q:%d}}", "h", (int)((block->bbox.y1 - block->bbox.y0) * scale));
+		break;
+	}
+}
+
+void
+fz_print_stext_page_as_json(fz_context *ctx, fz_output *out, fz_stext_page *page, float scale)
+{
+	fz_stext_block *block;
+
+	fz_write_printf(ctx, out, "{%q:[", "blocks");
+
+	for (block = page->first_block; block; block = block->next)
+	{
+		if (block != page->first_block)
+			fz_write_string(ctx, out, ",");
+		fz_print_stext_block_as_json(ctx, out, block, scale);
 	}
 	fz_write_string(ctx, out, "]}");
 }
 
 /* Plain text */
 
-void
-fz_print_stext_page_as_text(fz_context *ctx, fz_output *out, fz_stext_page *page)
+static void
+fz_print_stext_block_as_text(fz_context *ctx, fz_output *out, fz_stext_block *block)
 {
-	fz_stext_block *block;
 	fz_stext_line *line;
 	fz_stext_char *ch;
 	char utf[10];
 	int i, n;
 
-	for (block = page->first_block; block; block = block->next)
+	if (block->type == FZ_STEXT_BLOCK_TEXT)
 	{
-		if (block->type == FZ_STEXT_BLOCK_TEXT)
+		for (line = block->u.t.first_line; line; line = line->next)
 		{
-			for (line = block->u.t.first_line; line; line = line->next)
+			for (ch = line->first_char; ch; ch = ch->next)
 			{
-				for (ch = line->first_char; ch; ch = ch->next)
-				{
-					n = fz_runetochar(utf, ch->c);
-					for (i = 0; i < n; i++)
-						fz_write_byte(ctx, out, utf[i]);
-				}
-				fz_write_string(ctx, out, "\n");
+				n = fz_runetochar(utf, ch->c);
+				for (i = 0; i < n; i++)
+					fz_write_byte(ctx, out, utf[i]);
 			}
 			fz_write_string(ctx, out, "\n");
 		}
+		fz_write_string(ctx, out, "\n");
 	}
 }
 
-/* Text output writer */
+void
+fz_print_stext_page_as_text(fz_context *ctx, fz_output *out, fz_stext_page *page)
+{
+	fz_stext_block *block;
+
+	for (block = page->first_block; block; block = block->next)
+		fz_print_stext_block_as_text(ctx, out, block);
+}
 
 enum {
 	FZ_FORMAT_TEXT,
@@ -595,69 +625,176 @@ enum {
 	FZ_FORMAT_STEXT_JSON,
 };
 
+static int
+stext_format_from_string(const char *format)
+{
+	if (!strcmp(format, "html"))
+		return FZ_FORMAT_HTML;
+	if (!strcmp(format, "xhtml"))
+		return FZ_FORMAT_XHTML;
+	if (!strcmp(format, "stext") || !strcmp(format, "stext.xml"))
+		return FZ_FORMAT_STEXT_XML;
+	if (!strcmp(format, "stext.json"))
+		return FZ_FORMAT_STEXT_JSON;
+	return FZ_FORMAT_TEXT;
+}
+
+/* Streaming output: blocks are written as the text device completes them */
+
 typedef struct
 {
-	fz_document_writer super;
-	int format;
-	int number;
-	fz_stext_options opts;
-	fz_stext_page *page;
 	fz_output *out;
-} fz_text_writer;
+	int format;
+	int count;
+	int open;
+} fz_stext_output_state;
 
-static fz_device *
-text_begin_page(fz_context *ctx, fz_document_writer *wri_, fz_rect mediabox)
+static void
+stext_output_block(fz_context *ctx, void *state_, fz_stext_block *block)
 {
-	fz_text_writer *wri = (fz_text_writer*)wri_;
+	fz_stext_output_state *state = state_;
+	fz_output *out = state->out;
 
-	if (wri->page)
+	switch (state->format)
 	{
-		fz_drop_stext_page(ctx, wri->page);
-		wri->page = NULL;
+	default:
+	case FZ_FORMAT_TEXT:
+		fz_print_stext_block_as_text(ctx, out, block);
+		break;
+	case FZ_FORMAT_HTML:
+		fz_print_stext_any_block_as_html(ctx, out, block);
+		break;
+	case FZ_FORMAT_XHTML:
+		fz_print_stext_any_block_as_xhtml(ctx, out, block);
+		break;
+	case FZ_FORMAT_STEXT_XML:
+		fz_print_stext_block_as_xml(ctx, out, block);
+		break;
+	case FZ_FORMAT_STEXT_JSON:
+		if (state->count > 0)
+			fz_write_string(ctx, out, ",");
+		fz_print_stext_block_as_json(ctx, out, block, 1);
+		break;
 	}
+	state->count++;
+}
 
-	wri->number++;
+static void
+stext_output_close(fz_context *ctx, void *state_)
+{
+	fz_stext_output_state *state = state_;
 
-	wri->page = fz_new_stext_page(ctx, mediabox);
-	return fz_new_stext_device(ctx, wri->page, &wri->opts);
+	state->open = 0;
+	switch (state->format)
+	{
+	case FZ_FORMAT_HTML:
+	case FZ_FORMAT_XHTML:
+		fz_write_string(ctx, state->out, "</div>\n");
+		break;
+	case FZ_FORMAT_STEXT_XML:
+		fz_write_string(ctx, state->out, "</page>\n");
+		break;
+	case FZ_FORMAT_STEXT_JSON:
+		fz_write_string(ctx, state->out, "]}");
+		break;
+	}
 }
 
 static void
-text_end_page(fz_context *ctx, fz_document_writer *wri_, fz_device *dev)
+stext_output_drop(fz_context *ctx, void *state_)
 {
-	fz_text_writer *wri = (fz_text_writer*)wri_;
+	fz_stext_output_state *state = state_;
+
+	/* If the page failed before the device could be closed, finish
+	 * the page markup anyway so that the output stays well formed. */
+	if (state->open)
+	{
+		fz_try(ctx)
+			stext_output_close(ctx, state);
+		fz_catch(ctx)
+			fz_warn(ctx, "cannot finish page markup: %s", fz_caught_message(ctx));
+	}
+	fz_free(ctx, state);
+}
+
+fz_device *
+fz_new_stext_output_device(fz_context *ctx, fz_output *out, const char *format, fz_rect mediabox, int id, const fz_stext_options *options)
+{
+	fz_stext_output_state *state = fz_malloc_struct(ctx, fz_stext_output_state);
+	fz_stext_options opts = { 0 };
+
+	state->out = out;
+	state->format = stext_format_from_string(format);
+
+	if (options)
+		opts = *options;
+	if (state->format == FZ_FORMAT_STEXT_JSON)
+		opts.flags |= FZ_STEXT_PRESERVE_SPANS;
 
 	fz_try(ctx)
 	{
-		fz_close_device(ctx, dev);
-		switch (wri->format)
+		switch (state->format)
 		{
-		default:
-		case FZ_FORMAT_TEXT:
-			fz_print_stext_page_as_text(ctx, wri->out, wri->page);
-			break;
 		case FZ_FORMAT_HTML:
-			fz_print_stext_page_as_html(ctx, wri->out, wri->page, wri->number);
+			fz_print_stext_begin_page_as_html(ctx, out, mediabox, id);
 			break;
 		case FZ_FORMAT_XHTML:
-			fz_print_stext_page_as_xhtml(ctx, wri->out, wri->page, wri->number);
+			fz_write_printf(ctx, out, "<div id=\"page%d\">\n", id);
 			break;
 		case FZ_FORMAT_STEXT_XML:
-			fz_print_stext_page_as_xml(ctx, wri->out, wri->page, wri->number);
+			fz_write_printf(ctx, out, "<page id=\"page%d\" width=\"%g\" height=\"%g\">\n", id,
+				mediabox.x1 - mediabox.x0,
+				mediabox.y1 - mediabox.y0);
 			break;
 		case FZ_FORMAT_STEXT_JSON:
-			if (wri->number > 1)
-				fz_write_string(ctx, wri->out, ",");
-			fz_print_stext_page_as_json(ctx, wri->out, wri->page, 1);
+			fz_write_printf(ctx, out, "{%q:[", "blocks");
 			break;
 		}
+		state->open = 1;
 	}
-	fz_always(ctx)
+	fz_catch(ctx)
 	{
-		fz_drop_device(ctx, dev);
-		fz_drop_stext_page(ctx, wri->page);
-		wri->page = NULL;
+		fz_free(ctx, state);
+		fz_rethrow(ctx);
 	}
+
+	return fz_new_stext_block_device(ctx, mediabox, &opts, state, stext_output_block, stext_output_close, stext_output_drop);
+}
+
+/* Text output writer */
+
+typedef struct
+{
+	fz_document_writer super;
+	const char *format_name;
+	int format;
+	int number;
+	fz_stext_options opts;
+	fz_output *out;
+} fz_text_writer;
+
+static fz_device *
+text_begin_page(fz_context *ctx, fz_document_writer *wri_, fz_rect mediabox)
+{
+	fz_text_writer *wri = (fz_text_writer*)wri_;
+
+	wri->number++;
+
+	if (wri->format == FZ_FORMAT_STEXT_JSON && wri->number > 1)
+		fz_write_string(ctx, wri->out, ",");
+
+	/* Write blocks out as they are completed, so that pages with huge
+	 * amounts of text do not need to be held in memory. */
+	return fz_new_stext_output_device(ctx, wri->out, wri->format_name, mediabox, wri->number, &wri->opts);
+}
+
+static void
+text_end_page(fz_context *ctx, fz_document_writer *wri_, fz_device *dev)
+{
+	fz_try(ctx)
+		fz_close_device(ctx, dev);
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
 	fz_catch(ctx)
 		fz_rethrow(ctx);
 }
@@ -688,7 +825,6 @@ static void
 text_drop_writer(fz_context *ctx, fz_document_writer *wri_)
 {
 	fz_text_writer *wri = (fz_text_writer*)wri_;
-	fz_drop_stext_page(ctx, wri->page);
 	fz_drop_output(ctx, wri->out);
 }
 
@@ -704,21 +840,15 @@ fz_new_text_writer_with_output(fz_context *ctx, const char *format, fz_output *o
 		wri = fz_new_derived_document_writer(ctx, fz_text_writer, text_begin_page, text_end_page, text_close_writer, text_drop_writer);
 		fz_parse_stext_options(ctx, &wri->opts, options);
 
-		wri->format = FZ_FORMAT_TEXT;
-		if (!strcmp(format, "text"))
-			wri->format = FZ_FORMAT_TEXT;
-		else if (!strcmp(format, "html"))
-			wri->format = FZ_FORMAT_HTML;
-		else if (!strcmp(format, "xhtml"))
-			wri->format = FZ_FORMAT_XHTML;
-		else if (!strcmp(format, "stext"))
-			wri->format = FZ_FORMAT_STEXT_XML;
-		else if (!strcmp(format, "stext.xml"))
-			wri->format = FZ_FORMAT_STEXT_XML;
-		else if (!strcmp(format, "stext.json"))
+		wri->format = stext_format_from_string(format);
+		switch (wri->format)
 		{
-			wri->format = FZ_FORMAT_STEXT_JSON;
-			wri->opts.flags |= FZ_STEXT_PRESERVE_SPANS;
+		default:
+		case FZ_FORMAT_TEXT: wri->format_name = "text"; break;
+		case FZ_FORMAT_HTML: wri->format_name = "html"; break;
+		case FZ_FORMAT_XHTML: wri->format_name = "xhtml"; break;
+		case FZ_FORMAT_STEXT_XML: wri->format_name = "stext"; break;
+		case FZ_FORMAT_STEXT_JSON: wri->format_name = "stext.json"; break;
 		}
 
 		wri->out = out;
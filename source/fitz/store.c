@@ -27,6 +27,30 @@
 #include <stdio.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+/* The number of different store types we keep separate accounts
+ * for. Any more than this share the last (catch all) record. */
+#define MAX_STORE_TYPES FZ_STORE_MAX_TYPES
+
+typedef struct
+{
+	const fz_store_type *type; /* NULL until the type is first used */
+	char name[40];
+	size_t budget;
+	size_t size;
+	int items;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t inserts;
+	uint64_t evictions;
+	uint64_t scavenged;
+} fz_store_usage;
+
 typedef struct fz_item
 {
 	void *key;
@@ -36,9 +60,26 @@ typedef struct fz_item
 	struct fz_item *prev;
 	fz_store *store;
 	const fz_store_type *type;
+	fz_store_hash hash; /* hash.drop == NULL if not in the hash table */
+	fz_store_usage *usage;
+	float cost;
+	unsigned int uses;
+	double priority;
 } fz_item;
 
 /* Every entry in fz_store is protected by the alloc lock */
+/* Pixmap sample buffers of at least this size are recycled, up to
+ * POOL_SLOTS of them at once. */
+#define POOL_MIN (64<<10)
+#define POOL_SLOTS 32
+#define POOL_DEFAULT (32<<20)
+
+typedef struct
+{
+	void *block;
+	size_t size;
+} fz_pool_block;
+
 struct fz_store
 {
 	int refs;
@@ -48,8 +89,8 @@ struct fz_store
 	fz_item *head;
 	fz_item *tail;
 
-	/* We have a hash table that allows to quickly find a subset of the
-	 * entries (those whose keys are indirect objects). */
+	/* We have a hash table that allows to quickly find the entries
+	 * whose keys are hashable (all of those of the built in types). */
 	fz_hash_table *hash;
 
 	/* We keep track of the size of the store, and keep it below max. */
@@ -59,8 +100,48 @@ struct fz_store
 	int defer_reap_count;
 	int needs_reaping;
 	int scavenging;
+
+	/* How we choose what to evict (FZ_STORE_LRU or FZ_STORE_GDSF),
+	 * and the GDSF 'inflation' value (the priority of the last item
+	 * evicted). */
+	int policy;
+	double inflation;
+
+	/* Sizes, budgets and statistics for each type of item. */
+	int num_usages;
+	fz_store_usage usage[MAX_STORE_TYPES];
+
+	/* How often, and for how long (in microseconds), we have had
+	 * to scavenge. */
+	uint64_t scavenges;
+	uint64_t scavenge_time;
+
+	/* Freed pixmap sample buffers waiting to be reused, oldest
+	 * first, and how much memory they hold (at most pool_max). */
+	int pool_len;
+	fz_pool_block pool[POOL_SLOTS];
+	size_t pool_size;
+	size_t pool_max;
+	uint64_t pool_hits;
+	uint64_t pool_misses;
 };
 
+/* A microsecond clock, for timing scavenges. */
+static uint64_t
+us_clock(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER count, freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (uint64_t)(count.QuadPart / (freq.QuadPart / 1000000.0));
+#else
+	struct timeval tp;
+	gettimeofday(&tp, NULL);
+	return (uint64_t)tp.tv_sec * 1000000 + tp.tv_usec;
+#endif
+}
+
 void
 fz_new_store_context(fz_context *ctx, size_t max)
 {
@@ -82,6 +163,14 @@ fz_new_store_context(fz_context *ctx, size_t max)
 	store->max = max;
 	store->defer_reap_count = 0;
 	store->needs_reaping = 0;
+	store->policy = FZ_STORE_LRU;
+	store->inflation = 0;
+	store->num_usages = 0;
+	fz_strlcpy(store->usage[MAX_STORE_TYPES-1].name, "other", sizeof store->usage[0].name);
+	store->usage[MAX_STORE_TYPES-1].budget = FZ_STORE_UNLIMITED;
+	store->pool_max = POOL_DEFAULT;
+	if (max != FZ_STORE_UNLIMITED && max / 4 < store->pool_max)
+		store->pool_max = max / 4;
 	ctx->store = store;
 }
 
@@ -100,6 +189,50 @@ void *fz_keep_key_storable(fz_context *ctx, const fz_key_storable *sc)
 	return fz_keep_storable(ctx, &sc->storable);
 }
 
+/*
+	Find the usage record for a type, making one if required.
+	Entered with FZ_LOCK_ALLOC held.
+*/
+static fz_store_usage *
+find_usage(fz_store *store, const fz_store_type *type)
+{
+	fz_store_usage *usage;
+	int i;
+
+	for (i = 0; i < store->num_usages; i++)
+		if (store->usage[i].type == type)
+			return &store->usage[i];
+
+	/* A budget may have been set by name before the type was first used. */
+	for (i = 0; i < store->num_usages; i++)
+	{
+		if (store->usage[i].type == NULL && !strncmp(store->usage[i].name, type->name, sizeof store->usage[i].name - 1))
+		{
+			store->usage[i].type = type;
+			return &store->usage[i];
+		}
+	}
+
+	if (store->num_usages == MAX_STORE_TYPES-1)
+		return &store->usage[MAX_STORE_TYPES-1];
+
+	usage = &store->usage[store->num_usages++];
+	memset(usage, 0, sizeof(*usage));
+	usage->type = type;
+	fz_strlcpy(usage->name, type->name, sizeof usage->name);
+	usage->budget = FZ_STORE_UNLIMITED;
+	return usage;
+}
+
+/* Remove an item's size from the store totals. */
+static void
+unaccount(fz_store *store, fz_item *item)
+{
+	store->size -= item->size;
+	item->usage->size -= item->size;
+	item->usage->items--;
+}
+
 /*
 	Entered with FZ_LOCK_ALLOC held.
 	Drops FZ_LOCK_ALLOC.
@@ -132,7 +265,7 @@ do_reap(fz_context *ctx)
 			continue;
 
 		/* We have to drop it */
-		store->size -= item->size;
+		unaccount(store, item);
 
 		/* Unlink from the linked list */
 		if (item->next)
@@ -145,18 +278,13 @@ do_reap(fz_context *ctx)
 			store->head = item->next;
 
 		/* Remove from the hash table */
-		if (item->type->make_hash_key)
-		{
-			fz_store_hash hash = { NULL };
-			hash.drop = item->val->drop;
-			if (item->type->make_hash_key(ctx, &hash, item->key))
-				fz_hash_remove(ctx, store->hash, &hash);
-		}
+		if (item->hash.drop)
+			fz_hash_remove(ctx, store->hash, &item->hash);
 
 		/* Store whether to drop this value or not in 'prev' */
-		if (item->val->refs > 0)
+		if (fz_load_refs(&item->val->refs) > 0)
 			(void)Memento_dropRef(item->val);
-		item->prev = (item->val->refs > 0 && --item->val->refs == 0) ? item : NULL;
+		item->prev = (fz_load_refs(&item->val->refs) > 0 && fz_dec_refs(&item->val->refs) == 0) ? item : NULL;
 
 		/* Store it in our removal chain - just singly linked */
 		item->next = remove;
@@ -192,12 +320,14 @@ void fz_drop_key_storable(fz_context *ctx, const fz_key_storable *sc)
 		return;
 
 	fz_lock(ctx, FZ_LOCK_ALLOC);
-	assert(s->storable.refs != 0);
-	if (s->storable.refs > 0)
+	assert(fz_load_refs(&s->storable.refs) != 0);
+	if (fz_load_refs(&s->storable.refs) > 0)
 	{
+		int num;
 		(void)Memento_dropRef(s);
-		drop = --s->storable.refs == 0;
-		if (!drop && s->storable.refs == s->store_key_refs)
+		num = fz_dec_refs(&s->storable.refs);
+		drop = num == 0;
+		if (!drop && num == s->store_key_refs)
 		{
 			if (ctx->store->defer_reap_count > 0)
 			{
@@ -235,10 +365,10 @@ void *fz_keep_key_storable_key(fz_context *ctx, const fz_key_storable *sc)
 		return NULL;
 
 	fz_lock(ctx, FZ_LOCK_ALLOC);
-	if (s->storable.refs > 0)
+	if (fz_load_refs(&s->storable.refs) > 0)
 	{
 		(void)Memento_takeRef(s);
-		++s->storable.refs;
+		(void)fz_inc_refs(&s->storable.refs);
 		++s->store_key_refs;
 	}
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
@@ -256,9 +386,9 @@ void fz_drop_key_storable_key(fz_context *ctx, const fz_key_storable *sc)
 		return;
 
 	fz_lock(ctx, FZ_LOCK_ALLOC);
-	assert(s->store_key_refs > 0 && s->storable.refs >= s->store_key_refs);
+	assert(s->store_key_refs > 0 && fz_load_refs(&s->storable.refs) >= s->store_key_refs);
 	(void)Memento_dropRef(s);
-	drop = --s->storable.refs == 0;
+	drop = fz_dec_refs(&s->storable.refs) == 0;
 	--s->store_key_refs;
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 	/*
@@ -278,7 +408,7 @@ evict(fz_context *ctx, fz_item *item)
 	fz_store *store = ctx->store;
 	int drop;
 
-	store->size -= item->size;
+	unaccount(store, item);
 	/* Unlink from the linked list */
 	if (item->next)
 		item->next->prev = item->prev;
@@ -290,18 +420,13 @@ evict(fz_context *ctx, fz_item *item)
 		store->head = item->next;
 
 	/* Drop a reference to the value (freeing if required) */
-	if (item->val->refs > 0)
+	if (fz_load_refs(&item->val->refs) > 0)
 		(void)Memento_dropRef(item->val);
-	drop = (item->val->refs > 0 && --item->val->refs == 0);
+	drop = (fz_load_refs(&item->val->refs) > 0 && fz_dec_refs(&item->val->refs) == 0);
 
 	/* Remove from the hash table */
-	if (item->type->make_hash_key)
-	{
-		fz_store_hash hash = { NULL };
-		hash.drop = item->val->drop;
-		if (item->type->make_hash_key(ctx, &hash, item->key))
-			fz_hash_remove(ctx, store->hash, &hash);
-	}
+	if (item->hash.drop)
+		fz_hash_remove(ctx, store->hash, &item->hash);
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 	if (drop)
 		item->val->drop(ctx, item->val);
@@ -312,77 +437,103 @@ evict(fz_context *ctx, fz_item *item)
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 }
 
-static size_t
-ensure_space(fz_context *ctx, size_t tofree)
+/*
+	Choose the next item to evict according to the store policy,
+	considering only those items of the given usage record (or all
+	items, if usage is NULL) for which fn (if given) returns 1. Only
+	items to which the store holds the only reference can be
+	evicted.
+
+	For LRU, this is the least recently used such item. For GDSF
+	(Greedy Dual Size Frequency), it is the one with the lowest
+	priority, where priority is uses * cost / size, plus the
+	'inflation' value at the time the item was last used. Setting
+	the inflation to the priority of each item as it is evicted
+	ages out items that are no longer being used.
+
+	Searching the whole store for the lowest priority for every
+	victim would make eviction quadratic, all under FZ_LOCK_ALLOC.
+	Instead we look at only the GDSF_SAMPLE least recently used
+	candidates. Items that have not been used for a while are the
+	likely victims anyway, and a valuable item among them survives
+	for as long as there are cheaper ones beside it.
+
+	The search starts at *from, and *from is moved on to the first
+	candidate found (or NULL if there are none), so that a caller
+	choosing several victims without dropping the lock does not step
+	over the same items again for each one.
+*/
+#define GDSF_SAMPLE 32
+
+static fz_item *
+pick_victim(fz_context *ctx, fz_item **from, fz_store_usage *usage, fz_store_evict_fn *fn, void *arg)
 {
-	fz_item *item, *prev;
-	size_t count;
 	fz_store *store = ctx->store;
-	fz_item *to_be_freed = NULL;
+	fz_item *item, *victim = NULL;
+	int candidates = 0;
 
-	fz_assert_lock_held(ctx, FZ_LOCK_ALLOC);
-
-	/* First check that we *can* free tofree; if not, we'd rather not
-	 * cache this. */
-	count = 0;
-	for (item = store->tail; item; item = item->prev)
-	{
-		if (item->val->refs == 1)
-		{
-			count += item->size;
-			if (count >= tofree)
-				break;
-		}
-	}
-
-	/* If we ran out of items to search, then we can never free enough */
-	if (item == NULL)
+	for (item = *from; item; item = item->prev)
 	{
-		return 0;
+		if (fz_load_refs(&item->val->refs) != 1)
+			continue;
+		if (usage && item->usage != usage)
+			continue;
+		if (fn && !fn(ctx, arg, item->val))
+			continue;
+		if (candidates++ == 0)
+			*from = item;
+		if (store->policy == FZ_STORE_LRU)
+			return item;
+		if (victim == NULL || item->priority < victim->priority)
+			victim = item;
+		if (candidates == GDSF_SAMPLE)
+			break;
 	}
 
-	/* Now move all the items to be freed onto 'to_be_freed' */
-	count = 0;
-	for (item = store->tail; item; item = prev)
-	{
-		prev = item->prev;
-		if (item->val->refs != 1)
-			continue;
+	if (victim == NULL)
+		*from = NULL;
+	return victim;
+}
 
-		store->size -= item->size;
+/*
+	Take an item out of the store's list and hash table, so that it
+	can no longer be found, ready to be freed by free_detached.
 
-		/* Unlink from the linked list */
-		if (item->next)
-			item->next->prev = item->prev;
-		else
-			store->tail = item->prev;
-		if (item->prev)
-			item->prev->next = item->next;
-		else
-			store->head = item->next;
+	Called with FZ_LOCK_ALLOC held.
+*/
+static void
+detach(fz_context *ctx, fz_item *item)
+{
+	fz_store *store = ctx->store;
 
-		/* Remove from the hash table */
-		if (item->type->make_hash_key)
-		{
-			fz_store_hash hash = { NULL };
-			hash.drop = item->val->drop;
-			if (item->type->make_hash_key(ctx, &hash, item->key))
-				fz_hash_remove(ctx, store->hash, &hash);
-		}
+	unaccount(store, item);
 
-		/* Link into to_be_freed */
-		item->next = to_be_freed;
-		to_be_freed = item;
+	/* Unlink from the linked list */
+	if (item->next)
+		item->next->prev = item->prev;
+	else
+		store->tail = item->prev;
+	if (item->prev)
+		item->prev->next = item->next;
+	else
+		store->head = item->next;
 
-		count += item->size;
-		if (count >= tofree)
-			break;
-	}
+	/* Remove from the hash table */
+	if (item->hash.drop)
+		fz_hash_remove(ctx, store->hash, &item->hash);
+}
 
-	/* Now we can safely drop the lock and free our pending items. These
-	 * have all been removed from both the store list, and the hash table,
-	 * so they can't be 'found' by anyone else in the meantime. */
+/*
+	Free a list (linked through next) of detached items.
 
+	Entered with FZ_LOCK_ALLOC held; drops and retakes it.
+*/
+static void
+free_detached(fz_context *ctx, fz_item *to_be_freed)
+{
+	/* These have all been removed from both the store list, and the
+	 * hash table, so they can't be 'found' by anyone else while we
+	 * drop the lock. */
 	while (to_be_freed)
 	{
 		fz_item *item = to_be_freed;
@@ -391,9 +542,9 @@ ensure_space(fz_context *ctx, size_t tofree)
 		to_be_freed = to_be_freed->next;
 
 		/* Drop a reference to the value (freeing if required) */
-		if (item->val->refs > 0)
+		if (fz_load_refs(&item->val->refs) > 0)
 			(void)Memento_dropRef(item->val);
-		drop = (item->val->refs > 0 && --item->val->refs == 0);
+		drop = (fz_load_refs(&item->val->refs) > 0 && fz_dec_refs(&item->val->refs) == 0);
 
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
 		if (drop)
@@ -404,13 +555,88 @@ ensure_space(fz_context *ctx, size_t tofree)
 		fz_free(ctx, item);
 		fz_lock(ctx, FZ_LOCK_ALLOC);
 	}
+}
+
+/*
+	Evict items according to the store policy (from just those of
+	the given usage record, if usage is non-NULL, and for which fn
+	returns 1, if fn is non-NULL) until at least tofree bytes have
+	been freed, or nothing else can be evicted. Returns the number
+	of bytes freed.
 
-	return count;
+	All the victims are chosen and detached before the lock is
+	dropped to free them, so the search for each carries on from
+	where the last left off rather than from the tail.
+
+	Entered with FZ_LOCK_ALLOC held; drops and retakes it.
+*/
+static size_t
+evict_by_policy(fz_context *ctx, fz_store_usage *usage, fz_store_evict_fn *fn, void *arg, size_t tofree)
+{
+	fz_store *store = ctx->store;
+	fz_item *from = store->tail;
+	fz_item *victim, *to_be_freed = NULL;
+	size_t freed = 0;
+
+	while (freed < tofree)
+	{
+		victim = pick_victim(ctx, &from, usage, fn, arg);
+		if (victim == NULL)
+			break;
+		if (store->policy == FZ_STORE_GDSF)
+			store->inflation = victim->priority;
+		victim->usage->evictions++;
+		freed += victim->size;
+		if (from == victim)
+			from = victim->prev;
+		detach(ctx, victim);
+		victim->next = to_be_freed;
+		to_be_freed = victim;
+	}
+
+	free_detached(ctx, to_be_freed);
+
+	return freed;
+}
+
+static size_t
+ensure_space(fz_context *ctx, size_t tofree)
+{
+	fz_item *item;
+	size_t count;
+	fz_store *store = ctx->store;
+
+	fz_assert_lock_held(ctx, FZ_LOCK_ALLOC);
+
+	/* First check that we *can* free tofree; if not, we'd rather not
+	 * cache this. */
+	count = 0;
+	for (item = store->tail; item; item = item->prev)
+	{
+		if (fz_load_refs(&item->val->refs) == 1)
+		{
+			count += item->size;
+			if (count >= tofree)
+				break;
+		}
+	}
+
+	/* If we ran out of items to search, then we can never free enough */
+	if (item == NULL)
+	{
+		return 0;
+	}
+
+	return evict_by_policy(ctx, NULL, NULL, NULL, tofree);
 }
 
 static void
 touch(fz_store *store, fz_item *item)
 {
+	/* Update the priority for GDSF */
+	item->uses++;
+	item->priority = store->inflation + (double)item->uses * item->cost / (item->size ? item->size : 1);
+
 	if (item->next != item)
 	{
 		/* Already in the list - unlink it */
@@ -434,7 +660,13 @@ touch(fz_store *store, fz_item *item)
 }
 
 void *
-fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_store_type *type)
+fz_store_item(fz_context *ctx, void *key, void *val, size_t itemsize, const fz_store_type *type)
+{
+	return fz_store_item_with_cost(ctx, key, val, itemsize, 0, type);
+}
+
+void *
+fz_store_item_with_cost(fz_context *ctx, void *key, void *val_, size_t itemsize, float cost, const fz_store_type *type)
 {
 	fz_item *item = NULL;
 	size_t size;
@@ -442,6 +674,7 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 	fz_store *store = ctx->store;
 	fz_store_hash hash = { NULL };
 	int use_hash = 0;
+	fz_store_usage *usage;
 
 	if (!store)
 		return NULL;
@@ -474,6 +707,12 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 	item->next = item;
 	item->prev = item;
 	item->type = type;
+	if (use_hash)
+		item->hash = hash;
+	item->usage = usage = find_usage(store, type);
+	/* With no better idea, assume items cost as much to recreate as
+	 * they take to store. */
+	item->cost = cost > 0 ? cost : (float)itemsize;
 
 	/* If we can index it fast, put it into the hash table. This serves
 	 * to check whether we have one there already. */
@@ -495,16 +734,26 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 			type->drop_key(ctx, key);
 			return NULL;
 		}
+		if (existing && type->cmp_key(ctx, existing->key, key))
+		{
+			/* A different key with the same digest. It cannot
+			 * go in the hash table, and it would never be found
+			 * outside it, so don't store it at all. */
+			fz_unlock(ctx, FZ_LOCK_ALLOC);
+			fz_free(ctx, item);
+			type->drop_key(ctx, key);
+			return NULL;
+		}
 		if (existing)
 		{
 			/* There was one there already! Take a new reference
 			 * to the existing one, and drop our current one. */
 			fz_warn(ctx, "found duplicate %s in the store", type->name);
 			touch(store, existing);
-			if (existing->val->refs > 0)
+			if (fz_load_refs(&existing->val->refs) > 0)
 			{
 				(void)Memento_takeRef(existing->val);
-				existing->val->refs++;
+				(void)fz_inc_refs(&existing->val->refs);
 			}
 			fz_unlock(ctx, FZ_LOCK_ALLOC);
 			fz_free(ctx, item);
@@ -514,10 +763,10 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 	}
 
 	/* Now bump the ref */
-	if (val->refs > 0)
+	if (fz_load_refs(&val->refs) > 0)
 	{
 		(void)Memento_takeRef(val);
-		val->refs++;
+		(void)fz_inc_refs(&val->refs);
 	}
 
 	/* If we haven't got an infinite store, check for space within it */
@@ -564,7 +813,19 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 			FZ_LOG_DUMP_STORE(ctx, "After eviction:\n");
 		}
 	}
+
+	/* Likewise, keep within any budget for this type of item. */
+	if (usage->budget != FZ_STORE_UNLIMITED && usage->size + itemsize > usage->budget)
+	{
+		FZ_LOG_STORE(ctx, "Store budget for %s exceeded: item=%zu, size=%zu, budget=%zu\n",
+			usage->name, itemsize, usage->size, usage->budget);
+		evict_by_policy(ctx, usage, NULL, NULL, usage->size + itemsize - usage->budget);
+	}
+
 	store->size += itemsize;
+	usage->size += itemsize;
+	usage->items++;
+	usage->inserts++;
 
 	/* Regardless of whether it's indexed, it goes into the linked list */
 	touch(store, item);
@@ -596,8 +857,12 @@ fz_find_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_store_
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 	if (use_hash)
 	{
-		/* We can find objects keyed on indirected objects quickly */
+		/* We can find objects with hashable keys quickly. Some
+		 * hash keys are digests of the key rather than the key
+		 * itself, so check that we have really found it. */
 		item = fz_hash_find(ctx, store->hash, &hash);
+		if (item && type->cmp_key(ctx, item->key, key))
+			item = NULL;
 	}
 	else
 	{
@@ -615,15 +880,17 @@ fz_find_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_store_
 		 * linked list does not get whipped out again due to the
 		 * store being full. */
 		touch(store, item);
+		item->usage->hits++;
 		/* And bump the refcount before returning */
-		if (item->val->refs > 0)
+		if (fz_load_refs(&item->val->refs) > 0)
 		{
 			(void)Memento_takeRef(item->val);
-			item->val->refs++;
+			(void)fz_inc_refs(&item->val->refs);
 		}
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
 		return (void *)item->val;
 	}
+	find_usage(store, type)->misses++;
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 
 	return NULL;
@@ -647,8 +914,11 @@ fz_remove_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_stor
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 	if (use_hash)
 	{
-		/* We can find objects keyed on indirect objects quickly */
+		/* We can find objects with hashable keys quickly, but
+		 * check it is the right one (see fz_find_item). */
 		item = fz_hash_find(ctx, store->hash, &hash);
+		if (item && type->cmp_key(ctx, item->key, key))
+			item = NULL;
 		if (item)
 			fz_hash_remove(ctx, store->hash, &hash);
 	}
@@ -666,6 +936,7 @@ fz_remove_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_stor
 		 * such items by setting item->next == item. */
 		if (item->next != item)
 		{
+			unaccount(store, item);
 			if (item->next)
 				item->next->prev = item->prev;
 			else
@@ -675,9 +946,9 @@ fz_remove_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_stor
 			else
 				store->head = item->next;
 		}
-		if (item->val->refs > 0)
+		if (fz_load_refs(&item->val->refs) > 0)
 			(void)Memento_dropRef(item->val);
-		dodrop = (item->val->refs > 0 && --item->val->refs == 0);
+		dodrop = (fz_load_refs(&item->val->refs) > 0 && fz_dec_refs(&item->val->refs) == 0);
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
 		if (dodrop)
 			item->val->drop(ctx, item->val);
@@ -688,6 +959,28 @@ fz_remove_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_stor
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
 }
 
+/* Free the oldest recycled pixmap buffers until at least tofree bytes
+ * have been freed, or the pool is empty. Called with FZ_LOCK_ALLOC held,
+ * so frees directly through the allocator, as fz_free would. */
+static size_t
+trim_pixmap_pool(fz_context *ctx, fz_store *store, size_t tofree)
+{
+	size_t freed = 0;
+	int i = 0;
+
+	while (i < store->pool_len && freed < tofree)
+	{
+		ctx->alloc.free(ctx->alloc.user, store->pool[i].block);
+		freed += store->pool[i].size;
+		i++;
+	}
+	store->pool_len -= i;
+	memmove(&store->pool[0], &store->pool[i], store->pool_len * sizeof(store->pool[0]));
+	store->pool_size -= freed;
+
+	return freed;
+}
+
 void
 fz_empty_store(fz_context *ctx)
 {
@@ -700,6 +993,7 @@ fz_empty_store(fz_context *ctx)
 	/* Run through all the items in the store */
 	while (store->head)
 		evict(ctx, store->head); /* Drops then retakes lock */
+	trim_pixmap_pool(ctx, store, SIZE_MAX);
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 }
 
@@ -739,7 +1033,7 @@ fz_debug_store_item(fz_context *ctx, void *state, void *key_, int keylen, void *
 	fz_write_printf(ctx, out, "STORE\thash[");
 	for (i=0; i < keylen; ++i)
 		fz_write_printf(ctx, out,"%02x", key[i]);
-	fz_write_printf(ctx, out, "][refs=%d][size=%d] key=%s val=%p\n", item->val->refs, (int)item->size, buf, (void *)item->val);
+	fz_write_printf(ctx, out, "][refs=%d][size=%d] key=%s val=%p\n", fz_load_refs(&item->val->refs), (int)item->size, buf, (void *)item->val);
 }
 
 static void
@@ -749,6 +1043,7 @@ fz_debug_store_locked(fz_context *ctx, fz_output *out)
 	char buf[256];
 	fz_store *store = ctx->store;
 	size_t list_total = 0;
+	int i;
 
 	fz_write_printf(ctx, out, "STORE\t-- resource store contents --\n");
 
@@ -758,18 +1053,18 @@ fz_debug_store_locked(fz_context *ctx, fz_output *out)
 		if (next)
 		{
 			(void)Memento_takeRef(next->val);
-			next->val->refs++;
+			(void)fz_inc_refs(&next->val->refs);
 		}
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
 		item->type->format_key(ctx, buf, sizeof buf, item->key);
 		fz_lock(ctx, FZ_LOCK_ALLOC);
 		fz_write_printf(ctx, out, "STORE\tstore[*][refs=%d][size=%d] key=%s val=%p\n",
-				item->val->refs, (int)item->size, buf, (void *)item->val);
+				fz_load_refs(&item->val->refs), (int)item->size, buf, (void *)item->val);
 		list_total += item->size;
 		if (next)
 		{
 			(void)Memento_dropRef(next->val);
-			next->val->refs--;
+			(void)fz_dec_refs(&next->val->refs);
 		}
 	}
 
@@ -778,6 +1073,21 @@ fz_debug_store_locked(fz_context *ctx, fz_output *out)
 	fz_write_printf(ctx, out, "STORE\t-- end --\n");
 
 	fz_write_printf(ctx, out, "STORE\tmax=%zu, size=%zu, actual size=%zu\n", store->max, store->size, list_total);
+
+	for (i = 0; i < MAX_STORE_TYPES; i++)
+	{
+		fz_store_usage *usage = &store->usage[i];
+		if (i >= store->num_usages && i != MAX_STORE_TYPES-1)
+			continue;
+		if (usage->type == NULL && usage->hits + usage->misses + usage->evictions == 0 && usage->budget == FZ_STORE_UNLIMITED)
+			continue;
+		fz_write_printf(ctx, out, "STORE\ttype=%s items=%d size=%zu", usage->name, usage->items, usage->size);
+		if (usage->budget != FZ_STORE_UNLIMITED)
+			fz_write_printf(ctx, out, " budget=%zu", usage->budget);
+		fz_write_printf(ctx, out, " hits=%lu misses=%lu inserts=%lu evictions=%lu scavenged=%lu\n",
+			usage->hits, usage->misses, usage->inserts, usage->evictions, usage->scavenged);
+	}
+	fz_write_printf(ctx, out, "STORE\tscavenges=%lu scavenge time=%luus\n", store->scavenges, store->scavenge_time);
 }
 
 void
@@ -817,29 +1127,46 @@ scavenge(fz_context *ctx, size_t tofree)
 	fz_store *store = ctx->store;
 	size_t freed = 0;
 	fz_item *item;
+	uint64_t start;
 
 	if (store->scavenging)
 		return 0;
 
 	store->scavenging = 1;
+	store->scavenges++;
+	start = us_clock();
 
-	do
+	/* Recycled pixmap buffers are the cheapest thing to give up. */
+	freed = trim_pixmap_pool(ctx, store, tofree);
+
+	while (freed < tofree)
 	{
 		/* Count through a suffix of objects in the store until
 		 * we find enough to give us what we need to evict. */
 		size_t suffix_size = 0;
 		fz_item *largest = NULL;
 
-		for (item = store->tail; item; item = item->prev)
+		if (store->policy == FZ_STORE_GDSF)
+		{
+			/* Just take the lowest priority block. */
+			item = store->tail;
+			largest = pick_victim(ctx, &item, NULL, NULL, NULL);
+			if (largest)
+				store->inflation = largest->priority;
+		}
+		else
 		{
-			if (item->val->refs == 1)
+			for (item = store->tail; item; item = item->prev)
 			{
-				/* This one is evictable */
-				suffix_size += item->size;
-				if (largest == NULL || item->size > largest->size)
-					largest = item;
-				if (suffix_size >= tofree - freed)
-					break;
+				if (fz_load_refs(&item->val->refs) == 1)
+				{
+					/* This one is evictable */
+					suffix_size += item->size;
+					if (largest == NULL || item->size > largest->size)
+						largest = item;
+					if (suffix_size >= tofree - freed)
+						break;
+				}
 			}
 		}
 
@@ -851,14 +1178,16 @@ scavenge(fz_context *ctx, size_t tofree)
 		if (freed == 0) {
 			FZ_LOG_DUMP_STORE(ctx, "Before scavenge:\n");
 		}
+		largest->usage->evictions++;
+		largest->usage->scavenged++;
 		freed += largest->size;
 		evict(ctx, largest); /* Drops then retakes lock */
 	}
-	while (freed < tofree);
 
 	if (freed != 0) {
 		FZ_LOG_DUMP_STORE(ctx, "After scavenge:\n");
 	}
+	store->scavenge_time += us_clock() - start;
 	store->scavenging = 0;
 	/* Success is managing to evict any blocks */
 	return freed != 0;
@@ -875,26 +1204,31 @@ fz_drop_storable(fz_context *ctx, const fz_storable *sc)
 	if (s == NULL)
 		return;
 
-	fz_lock(ctx, FZ_LOCK_ALLOC);
 	/* Drop the ref, and leave num as being the number of
 	 * refs left (-1 meaning, "statically allocated"). */
-	if (s->refs > 0)
+	fz_lock_refs(ctx);
+	if (fz_load_refs(&s->refs) > 0)
 	{
 		(void)Memento_dropIntRef(s);
-		num = --s->refs;
+		num = fz_dec_refs(&s->refs);
 	}
 	else
 		num = -1;
+	fz_unlock_refs(ctx);
 
 	/* If we have just 1 ref left, it's possible that
 	 * this ref is held by the store. If the store is
 	 * oversized, we ought to throw any such references
 	 * away to try to bring the store down to a "legal"
-	 * size. Run a scavenge to check for this case. */
-	if (ctx->store->max != FZ_STORE_UNLIMITED)
-		if (num == 1 && ctx->store->size > ctx->store->max)
+	 * size. Run a scavenge to check for this case. Only
+	 * this case needs the lock. */
+	if (num == 1 && ctx->store->max != FZ_STORE_UNLIMITED)
+	{
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+		if (ctx->store->size > ctx->store->max)
 			scavenge(ctx, ctx->store->size - ctx->store->max);
-	fz_unlock(ctx, FZ_LOCK_ALLOC);
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+	}
 
 	/* If we have no references to an object left, then
 	 * it cannot possibly be in the store (as the store always
@@ -917,6 +1251,16 @@ int fz_store_scavenge_external(fz_context *ctx, size_t size, int *phase)
 	return ret;
 }
 
+int fz_store_evict(fz_context *ctx, size_t size, fz_store_evict_fn *fn, void *arg)
+{
+	if (ctx->store == NULL)
+		return 0;
+
+	fz_assert_lock_held(ctx, FZ_LOCK_ALLOC);
+
+	return evict_by_policy(ctx, NULL, fn, arg, size) != 0;
+}
+
 int fz_store_scavenge(fz_context *ctx, size_t size, int *phase)
 {
 	fz_store *store;
@@ -931,6 +1275,10 @@ int fz_store_scavenge(fz_context *ctx, size_t size, int *phase)
 	fz_debug_store_locked(ctx, fz_stdout(ctx));
 	Memento_stats();
 #endif
+	/* Recycled pixmap buffers cost nothing to give up, so try them first. */
+	if (trim_pixmap_pool(ctx, store, size))
+		return 1;
+
 	do
 	{
 		size_t tofree;
@@ -1004,6 +1352,139 @@ fz_shrink_store(fz_context *ctx, unsigned int percent)
 	return success;
 }
 
+void
+fz_set_store_policy(fz_context *ctx, int policy)
+{
+	fz_store *store = ctx->store;
+	fz_item *item;
+
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (policy == FZ_STORE_GDSF && store->policy != FZ_STORE_GDSF)
+	{
+		/* Start everything off on an equal footing. */
+		store->inflation = 0;
+		for (item = store->head; item; item = item->next)
+			item->priority = (double)item->uses * item->cost / (item->size ? item->size : 1);
+	}
+	store->policy = policy;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+void
+fz_set_store_budget(fz_context *ctx, const char *type_name, size_t budget)
+{
+	fz_store *store = ctx->store;
+	fz_store_usage *usage = NULL;
+	int i;
+
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	for (i = 0; i < store->num_usages; i++)
+	{
+		if (!strncmp(store->usage[i].name, type_name, sizeof store->usage[i].name - 1))
+		{
+			usage = &store->usage[i];
+			break;
+		}
+	}
+	if (usage == NULL)
+	{
+		if (store->num_usages == MAX_STORE_TYPES-1)
+		{
+			fz_unlock(ctx, FZ_LOCK_ALLOC);
+			fz_warn(ctx, "too many store types to set a budget for %s", type_name);
+			return;
+		}
+		/* We don't know the type itself until it is first used. */
+		usage = &store->usage[store->num_usages++];
+		memset(usage, 0, sizeof(*usage));
+		fz_strlcpy(usage->name, type_name, sizeof usage->name);
+	}
+	usage->budget = budget;
+
+	if (budget != FZ_STORE_UNLIMITED && usage->size > budget)
+		evict_by_policy(ctx, usage, NULL, NULL, usage->size - budget);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+static void
+copy_usage_stats(fz_store_type_stats *stats, const fz_store_usage *usage)
+{
+	memcpy(stats->name, usage->name, sizeof stats->name);
+	stats->items = usage->items;
+	stats->size = usage->size;
+	stats->budget = usage->budget;
+	stats->hits = usage->hits;
+	stats->misses = usage->misses;
+	stats->inserts = usage->inserts;
+	stats->evictions = usage->evictions;
+	stats->scavenged = usage->scavenged;
+}
+
+void
+fz_get_store_stats(fz_context *ctx, fz_store_stats *stats)
+{
+	fz_store *store = ctx->store;
+	int i, n = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	stats->max = store->max;
+	stats->size = store->size;
+	stats->scavenges = store->scavenges;
+	stats->scavenge_time = store->scavenge_time;
+	stats->pool_max = store->pool_max;
+	stats->pool_size = store->pool_size;
+	stats->pool_hits = store->pool_hits;
+	stats->pool_misses = store->pool_misses;
+	for (i = 0; i < store->num_usages; i++)
+	{
+		stats->items += store->usage[i].items;
+		copy_usage_stats(&stats->types[n++], &store->usage[i]);
+	}
+	/* Only report the catch all record if anything has ended up in it. */
+	if (store->usage[MAX_STORE_TYPES-1].inserts + store->usage[MAX_STORE_TYPES-1].misses > 0)
+	{
+		stats->items += store->usage[MAX_STORE_TYPES-1].items;
+		copy_usage_stats(&stats->types[n++], &store->usage[MAX_STORE_TYPES-1]);
+	}
+	stats->num_types = n;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+int
+fz_get_store_type_stats(fz_context *ctx, const char *type_name, fz_store_type_stats *stats)
+{
+	fz_store *store = ctx->store;
+	int i, found = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	if (store == NULL)
+		return 0;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	for (i = 0; i < store->num_usages; i++)
+	{
+		if (!strncmp(store->usage[i].name, type_name, sizeof store->usage[i].name - 1))
+		{
+			copy_usage_stats(stats, &store->usage[i]);
+			found = 1;
+			break;
+		}
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return found;
+}
+
 void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const fz_store_type *type)
 {
 	fz_store *store;
@@ -1027,7 +1508,7 @@ void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const f
 			continue;
 
 		/* We have to drop it */
-		store->size -= item->size;
+		unaccount(store, item);
 
 		/* Unlink from the linked list */
 		if (item->next)
@@ -1040,18 +1521,13 @@ void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const f
 			store->head = item->next;
 
 		/* Remove from the hash table */
-		if (item->type->make_hash_key)
-		{
-			fz_store_hash hash = { NULL };
-			hash.drop = item->val->drop;
-			if (item->type->make_hash_key(ctx, &hash, item->key))
-				fz_hash_remove(ctx, store->hash, &hash);
-		}
+		if (item->hash.drop)
+			fz_hash_remove(ctx, store->hash, &item->hash);
 
 		/* Store whether to drop this value or not in 'prev' */
-		if (item->val->refs > 0)
+		if (fz_load_refs(&item->val->refs) > 0)
 			(void)Memento_dropRef(item->val);
-		item->prev = (item->val->refs > 0 && --item->val->refs == 0) ? item : NULL;
+		item->prev = (fz_load_refs(&item->val->refs) > 0 && fz_dec_refs(&item->val->refs) == 0) ? item : NULL;
 
 		/* Store it in our removal chain - just singly linked */
 		item->next = remove;
@@ -1117,3 +1593,99 @@ void fz_log_dump_store(fz_context *ctx, const char *fmt, ...)
 }
 
 #endif
+
+/* Round up to one of four steps per power of two, so that a buffer can
+ * be reused for requests of nearly (but not exactly) the same size,
+ * wasting no more than a quarter of it. */
+static size_t
+pool_bucket(size_t size)
+{
+	size_t step = POOL_MIN / 4;
+
+	while (step <= SIZE_MAX / 8 && step * 8 <= size)
+		step *= 2;
+	return (size + step - 1) & ~(step - 1);
+}
+
+void *
+fz_new_pixmap_samples(fz_context *ctx, size_t size, size_t *allocated)
+{
+	fz_store *store = ctx->store;
+	void *block = NULL;
+	size_t bucket;
+	int i;
+
+	if (store == NULL || store->pool_max == 0 || size < POOL_MIN)
+	{
+		*allocated = size;
+		return Memento_label(fz_malloc(ctx, size), "pixmap_data");
+	}
+
+	bucket = pool_bucket(size);
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	/* Take the most recently freed match; it is the most likely to be
+	 * still mapped in, and in the cache. */
+	for (i = store->pool_len - 1; i >= 0; i--)
+	{
+		if (store->pool[i].size == bucket)
+		{
+			block = store->pool[i].block;
+			store->pool_size -= bucket;
+			store->pool_len--;
+			memmove(&store->pool[i], &store->pool[i+1], (store->pool_len - i) * sizeof(store->pool[0]));
+			break;
+		}
+	}
+	if (block)
+		store->pool_hits++;
+	else
+		store->pool_misses++;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	*allocated = bucket;
+	if (block)
+		return block;
+	return Memento_label(fz_malloc(ctx, bucket), "pixmap_data");
+}
+
+void
+fz_drop_pixmap_samples(fz_context *ctx, void *samples, size_t size)
+{
+	fz_store *store = ctx->store;
+
+	if (samples == NULL)
+		return;
+
+	if (store == NULL || size < POOL_MIN || size > store->pool_max || pool_bucket(size) != size)
+	{
+		fz_free(ctx, samples);
+		return;
+	}
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (store->pool_len == POOL_SLOTS)
+		trim_pixmap_pool(ctx, store, 1);
+	if (store->pool_size + size > store->pool_max)
+		trim_pixmap_pool(ctx, store, store->pool_size + size - store->pool_max);
+	store->pool[store->pool_len].block = samples;
+	store->pool[store->pool_len].size = size;
+	store->pool_len++;
+	store->pool_size += size;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+void
+fz_set_pixmap_pool_size(fz_context *ctx, size_t max)
+{
+	fz_store *store = ctx->store;
+
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	store->pool_max = max;
+	if (store->pool_size > max)
+		trim_pixmap_pool(ctx, store, store->pool_size - max);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
@@ -186,6 +186,8 @@ fz_new_document_writer(fz_context *ctx, const char *path, const char *explicit_f
 
 		if (is_extension(format, "png"))
 			return fz_new_png_pixmap_writer(ctx, path, options);
+		if (is_extension(format, "jpg") || is_extension(format, "jpeg"))
+			return fz_new_jpeg_pixmap_writer(ctx, path, options);
 		if (is_extension(format, "pam"))
 			return fz_new_pam_pixmap_writer(ctx, path, options);
 		if (is_extension(format, "pnm"))
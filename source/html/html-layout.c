@@ -170,9 +170,15 @@ static int walk_string(string_walker *walker)
 	{
 		face = fz_font_ft_face(ctx, walker->font);
 		walker->scale = face->units_per_EM;
-		fterr = FT_Set_Char_Size(face, walker->scale, walker->scale, 72, 72);
-		if (fterr)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "freetype setting character size: %s", ft_error_string(fterr));
+
+		/* Quick shaping takes its advances from the font's metrics cache,
+		 * so only harfbuzz needs the face scaled. */
+		if (!quickshape)
+		{
+			fterr = FT_Set_Char_Size(face, walker->scale, walker->scale, 72, 72);
+			if (fterr)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "freetype setting character size: %s", ft_error_string(fterr));
+		}
 
 		hb_buffer_clear_contents(walker->hb_buf);
 		hb_buffer_set_direction(walker->hb_buf, walker->rtl ? HB_DIRECTION_RTL : HB_DIRECTION_LTR);
@@ -259,15 +259,24 @@ pdf_load_jpx(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int forcemask)
 	/* FIXME: We can't handle decode arrays for indexed images currently */
 	fz_try(ctx)
 	{
+		float decode[FZ_MAX_COLORS * 2];
 		unsigned char *data;
 		size_t len;
+		int lazy;
 
 		obj = pdf_dict_get(ctx, dict, PDF_NAME(ColorSpace));
 		if (obj)
 			colorspace = pdf_load_colorspace(ctx, obj);
 
+		/* When the colorspace is given we only need the header now, and
+		 * can leave decoding (at the resolution and area needed) until
+		 * the image is drawn. Masks and indexed images are converted
+		 * from the decoded pixmap, so decode those up front. */
+		lazy = colorspace && !fz_colorspace_is_indexed(ctx, colorspace) && !forcemask;
+
 		len = fz_buffer_storage(ctx, buf, &data);
-		pix = fz_load_jpx(ctx, data, len, colorspace);
+		if (!lazy)
+			pix = fz_load_jpx(ctx, data, len, colorspace);
 
 		obj = pdf_dict_geta(ctx, dict, PDF_NAME(SMask), PDF_NAME(Mask));
 		if (pdf_is_dict(ctx, obj))
@@ -281,16 +290,20 @@ pdf_load_jpx(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int forcemask)
 		obj = pdf_dict_geta(ctx, dict, PDF_NAME(Decode), PDF_NAME(D));
 		if (obj && !fz_colorspace_is_indexed(ctx, colorspace))
 		{
-			float decode[FZ_MAX_COLORS * 2];
-			int i;
+			int i, n = lazy ? fz_colorspace_n(ctx, colorspace) : pix->n;
 
-			for (i = 0; i < pix->n * 2; i++)
+			for (i = 0; i < n * 2; i++)
 				decode[i] = pdf_array_get_real(ctx, obj, i);
 
-			fz_decode_tile(ctx, pix, decode);
+			if (!lazy)
+				fz_decode_tile(ctx, pix, decode);
 		}
 
-		img = fz_new_image_from_pixmap(ctx, pix, mask);
+		if (lazy)
+			img = fz_new_image_from_jpx(ctx, buf, colorspace, obj ? decode : NULL, mask,
+				pdf_dict_get_int(ctx, dict, PDF_NAME(SMaskInData)));
+		else
+			img = fz_new_image_from_pixmap(ctx, pix, mask);
 	}
 	fz_always(ctx)
 	{
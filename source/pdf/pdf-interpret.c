@@ -995,6 +995,14 @@ pdf_process_stream(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_stream
 				{
 					fz_rethrow(ctx);
 				}
+				else if (caught == FZ_ERROR_LIMIT)
+				{
+					/* Out of memory budget; abandon the page, and tell
+					 * anyone else working on it with this cookie to stop too. */
+					cookie->errors++;
+					cookie->abort = 1;
+					fz_rethrow(ctx);
+				}
 				else if (caught == FZ_ERROR_MINOR)
 				{
 					cookie->errors++;
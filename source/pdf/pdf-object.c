@@ -3028,7 +3028,7 @@ int pdf_obj_refs(fz_context *ctx, pdf_obj *obj)
 {
 	if (obj < PDF_LIMIT)
 		return 0;
-	return obj->refs;
+	return fz_load_refs(&obj->refs);
 }
 
 /* Convenience functions */
@@ -96,6 +96,7 @@ struct pdf_run_processor
 
 	/* path object state */
 	fz_path *path;
+	fz_arena *arena; /* for path storage, if fz_page_arenas */
 	int clip;
 	int clip_even_odd;
 
@@ -611,7 +612,7 @@ pdf_show_path(fz_context *ctx, pdf_run_processor *pr, int doclose, int dofill, i
 	}
 
 	path = pr->path;
-	pr->path = fz_new_path(ctx);
+	pr->path = fz_new_path_in_arena(ctx, pr->arena);
 
 	fz_try(ctx)
 	{
@@ -2044,6 +2045,7 @@ pdf_drop_run_processor(fz_context *ctx, pdf_processor *proc)
 	}
 
 	fz_drop_path(ctx, pr->path);
+	fz_drop_arena(ctx, pr->arena);
 	fz_drop_text(ctx, pr->tos.text);
 
 	fz_drop_default_colorspaces(ctx, pr->default_cs);
@@ -2204,6 +2206,7 @@ pdf_new_run_processor(fz_context *ctx, fz_device *dev, fz_matrix ctm, const char
 	proc->default_cs = fz_keep_default_colorspaces(ctx, default_cs);
 
 	proc->path = NULL;
+	proc->arena = NULL;
 	proc->clip = 0;
 	proc->clip_even_odd = 0;
 
@@ -2216,7 +2219,9 @@ pdf_new_run_processor(fz_context *ctx, fz_device *dev, fz_matrix ctm, const char
 
 	fz_try(ctx)
 	{
-		proc->path = fz_new_path(ctx);
+		if (fz_page_arenas(ctx))
+			proc->arena = fz_new_arena(ctx);
+		proc->path = fz_new_path_in_arena(ctx, proc->arena);
 
 		proc->gcap = 64;
 		proc->gstate = fz_malloc_struct_array(ctx, proc->gcap, pdf_gstate);
@@ -24,16 +24,108 @@
 #include "mupdf/pdf.h"
 
 #include <assert.h>
+#include <string.h>
+
+/*
+	Feed a direct object into a digest, such that any two objects
+	that pdf_objcmp considers equal give the same digest. Indirect
+	references within it are not followed.
+*/
+static void
+pdf_digest_obj(fz_context *ctx, fz_md5 *md5, pdf_obj *obj)
+{
+	unsigned char kind;
+	int i, n;
+
+	if (pdf_is_indirect(ctx, obj))
+	{
+		int ref[2];
+		kind = 'R';
+		ref[0] = pdf_to_num(ctx, obj);
+		ref[1] = pdf_to_gen(ctx, obj);
+		fz_md5_update(md5, &kind, 1);
+		fz_md5_update(md5, (unsigned char *)ref, sizeof ref);
+	}
+	else if (pdf_is_int(ctx, obj))
+	{
+		int64_t v = pdf_to_int64(ctx, obj);
+		kind = 'i';
+		fz_md5_update(md5, &kind, 1);
+		fz_md5_update(md5, (unsigned char *)&v, sizeof v);
+	}
+	else if (pdf_is_real(ctx, obj))
+	{
+		float v = pdf_to_real(ctx, obj);
+		kind = 'f';
+		fz_md5_update(md5, &kind, 1);
+		fz_md5_update(md5, (unsigned char *)&v, sizeof v);
+	}
+	else if (pdf_is_name(ctx, obj))
+	{
+		const char *s = pdf_to_name(ctx, obj);
+		kind = '/';
+		fz_md5_update(md5, &kind, 1);
+		fz_md5_update(md5, (const unsigned char *)s, strlen(s) + 1);
+	}
+	else if (pdf_is_string(ctx, obj))
+	{
+		size_t len;
+		const char *s = pdf_to_string(ctx, obj, &len);
+		kind = '(';
+		fz_md5_update(md5, &kind, 1);
+		fz_md5_update(md5, (unsigned char *)&len, sizeof len);
+		fz_md5_update(md5, (const unsigned char *)s, len);
+	}
+	else if (pdf_is_array(ctx, obj))
+	{
+		n = pdf_array_len(ctx, obj);
+		kind = '[';
+		fz_md5_update(md5, &kind, 1);
+		fz_md5_update(md5, (unsigned char *)&n, sizeof n);
+		for (i = 0; i < n; i++)
+			pdf_digest_obj(ctx, md5, pdf_array_get(ctx, obj, i));
+	}
+	else if (pdf_is_dict(ctx, obj))
+	{
+		n = pdf_dict_len(ctx, obj);
+		kind = '<';
+		fz_md5_update(md5, &kind, 1);
+		fz_md5_update(md5, (unsigned char *)&n, sizeof n);
+		for (i = 0; i < n; i++)
+		{
+			pdf_digest_obj(ctx, md5, pdf_dict_get_key(ctx, obj, i));
+			pdf_digest_obj(ctx, md5, pdf_dict_get_val(ctx, obj, i));
+		}
+	}
+	else
+	{
+		/* null, true or false */
+		kind = pdf_is_null(ctx, obj) ? 'n' : pdf_to_bool(ctx, obj) ? 't' : 'F';
+		fz_md5_update(md5, &kind, 1);
+	}
+}
 
 static int
 pdf_make_hash_key(fz_context *ctx, fz_store_hash *hash, void *key_)
 {
 	pdf_obj *key = (pdf_obj *)key_;
+	fz_md5 md5;
+
+	if (pdf_is_indirect(ctx, key))
+	{
+		hash->u.pi.i = pdf_to_num(ctx, key);
+		hash->u.pi.ptr = pdf_get_indirect_document(ctx, key);
+		return 1;
+	}
 
-	if (!pdf_is_indirect(ctx, key))
-		return 0;
-	hash->u.pi.i = pdf_to_num(ctx, key);
-	hash->u.pi.ptr = pdf_get_indirect_document(ctx, key);
+	/* Direct objects (such as inline colorspace arrays, or function
+	 * and shading dictionaries) are hashed on a digest of their
+	 * contents, so that they can be found without a linear search
+	 * of the store. */
+	fz_md5_init(&md5);
+	pdf_digest_obj(ctx, &md5, key);
+	fz_md5_final(&md5, hash->u.pd.digest);
+	hash->u.pd.ptr = pdf_get_bound_document(ctx, key);
 	return 1;
 }
 
@@ -583,13 +583,34 @@ can_reuse_buffer(fz_context *ctx, pdf_xref_entry *entry, fz_compression_params *
 	return (params->type == FZ_IMAGE_RAW) ? 0 : 1;
 }
 
+/* Is the stream compressed with nothing more than a plain FlateDecode
+ * (no predictor)? If so, we can inflate it in one go from memory. */
+static int
+is_plain_flate(fz_context *ctx, pdf_obj *dict)
+{
+	pdf_obj *f = pdf_dict_geta(ctx, dict, PDF_NAME(Filter), PDF_NAME(F));
+	pdf_obj *p = pdf_dict_geta(ctx, dict, PDF_NAME(DecodeParms), PDF_NAME(DP));
+
+	if (pdf_is_array(ctx, f))
+	{
+		if (pdf_array_len(ctx, f) != 1)
+			return 0;
+		f = pdf_array_get(ctx, f, 0);
+		p = pdf_array_get(ctx, p, 0);
+	}
+	if (!pdf_name_eq(ctx, f, PDF_NAME(FlateDecode)) && !pdf_name_eq(ctx, f, PDF_NAME(Fl)))
+		return 0;
+	return pdf_dict_get_int(ctx, p, PDF_NAME(Predictor)) <= 1;
+}
+
 static fz_buffer *
 pdf_load_image_stream(fz_context *ctx, pdf_document *doc, int num, fz_compression_params *params, int *truncated)
 {
 	fz_stream *stm = NULL;
 	pdf_obj *dict, *obj;
 	int i, len, n;
-	fz_buffer *buf;
+	int flate = 0;
+	fz_buffer *buf, *raw;
 
 	fz_var(buf);
 
@@ -611,6 +632,7 @@ pdf_load_image_stream(fz_context *ctx, pdf_document *doc, int num, fz_compressio
 		n = pdf_array_len(ctx, obj);
 		for (i = 0; i < n; i++)
 			len = pdf_guess_filter_length(len, pdf_to_name(ctx, pdf_array_get(ctx, obj, i)));
+		flate = !params && is_plain_flate(ctx, dict);
 	}
 	fz_always(ctx)
 	{
@@ -621,6 +643,21 @@ pdf_load_image_stream(fz_context *ctx, pdf_document *doc, int num, fz_compressio
 		fz_rethrow(ctx);
 	}
 
+	/* The compressed length is known, so rather than trickle the data
+	 * through the streaming inflate filter, load it and inflate it in
+	 * one go. */
+	if (flate)
+	{
+		raw = pdf_load_raw_stream_number(ctx, doc, num);
+		fz_try(ctx)
+			buf = fz_new_inflated_buffer(ctx, raw->data, raw->len, len, truncated);
+		fz_always(ctx)
+			fz_drop_buffer(ctx, raw);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+		return buf;
+	}
+
 	stm = pdf_open_image_stream(ctx, doc, num, params);
 
 	fz_try(ctx)
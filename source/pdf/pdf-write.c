@@ -23,8 +23,6 @@
 #include "mupdf/fitz.h"
 #include "pdf-annot-imp.h"
 
-#include <zlib.h>
-
 #include <assert.h>
 #include <limits.h>
 #include <string.h>
@@ -95,6 +93,7 @@ typedef struct
 	int do_encrypt;
 	int dont_regenerate_id;
 	int do_snapshot;
+	int compression_effort;
 
 	int list_len;
 	int *use_list;
@@ -1753,27 +1752,33 @@ static void addhexfilter(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
 		fz_rethrow(ctx);
 }
 
-static fz_buffer *deflatebuf(fz_context *ctx, const unsigned char *p, size_t n)
+/* Map compression_effort (0 = default, 1 = fastest .. 100 = smallest)
+ * onto a zlib compression level. */
+static fz_deflate_level deflate_level(int effort)
+{
+	if (effort <= 0)
+		return FZ_DEFLATE_DEFAULT;
+	if (effort >= 100)
+		return FZ_DEFLATE_BEST;
+	return (fz_deflate_level)(FZ_DEFLATE_BEST_SPEED + (effort - 1) * (FZ_DEFLATE_BEST - FZ_DEFLATE_BEST_SPEED) / 99);
+}
+
+static fz_buffer *deflatebuf(fz_context *ctx, const unsigned char *p, size_t n, int effort)
 {
 	fz_buffer *buf;
-	uLongf csize;
-	int t;
-	uLong longN = (uLong)n;
 	unsigned char *data;
-	size_t cap;
-
-	if (n != (size_t)longN)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "Buffer too large to deflate");
+	size_t cap, csize;
 
-	cap = compressBound(longN);
+	cap = fz_deflate_bound(ctx, n);
 	data = Memento_label(fz_malloc(ctx, cap), "pdf_write_deflate");
 	buf = fz_new_buffer_from_data(ctx, data, cap);
-	csize = (uLongf)cap;
-	t = compress(data, &csize, p, longN);
-	if (t != Z_OK)
+	csize = cap;
+	fz_try(ctx)
+		fz_deflate(ctx, data, &csize, p, n, deflate_level(effort));
+	fz_catch(ctx)
 	{
 		fz_drop_buffer(ctx, buf);
-		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot deflate buffer");
+		fz_rethrow(ctx);
 	}
 	fz_resize_buffer(ctx, buf, csize);
 	return buf;
@@ -1892,7 +1897,7 @@ static void copystream(fz_context *ctx, pdf_document *doc, pdf_write_state *opts
 			}
 			else
 			{
-				tmp_comp = deflatebuf(ctx, data, len);
+				tmp_comp = deflatebuf(ctx, data, len, opts->compression_effort);
 				pdf_dict_put(ctx, obj, PDF_NAME(Filter), PDF_NAME(FlateDecode));
 			}
 			len = fz_buffer_storage(ctx, tmp_comp, &data);
@@ -1972,7 +1977,7 @@ static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_state *op
 			}
 			else
 			{
-				tmp_comp = deflatebuf(ctx, data, len);
+				tmp_comp = deflatebuf(ctx, data, len, opts->compression_effort);
 				pdf_dict_put(ctx, obj, PDF_NAME(Filter), PDF_NAME(FlateDecode));
 			}
 			len = fz_buffer_storage(ctx, tmp_comp, &data);
@@ -3077,6 +3082,7 @@ static void initialise_write_state(fz_context *ctx, pdf_document *doc, const pdf
 	opts->do_compress_images = in_opts->do_compress_images;
 	opts->do_compress_fonts = in_opts->do_compress_fonts;
 	opts->do_snapshot = in_opts->do_snapshot;
+	opts->compression_effort = in_opts->compression_effort;
 
 	opts->do_garbage = in_opts->do_garbage;
 	opts->do_linear = in_opts->do_linear;
@@ -3141,7 +3147,8 @@ const pdf_write_options pdf_default_write_options = {
 	~0, /* permissions */
 	"", /* opwd_utf8[128] */
 	"", /* upwd_utf8[128] */
-	0 /* do_snapshot */
+	0, /* do_snapshot */
+	0 /* compression_effort */
 };
 
 static const pdf_write_options pdf_snapshot_write_options = {
@@ -3162,7 +3169,8 @@ static const pdf_write_options pdf_snapshot_write_options = {
 	~0, /* permissions */
 	"", /* opwd_utf8[128] */
 	"", /* upwd_utf8[128] */
-	1 /* do_snapshot */
+	1, /* do_snapshot */
+	0 /* compression_effort */
 };
 
 const char *fz_pdf_write_options_usage =
@@ -3171,6 +3179,7 @@ const char *fz_pdf_write_options_usage =
 	"\tcompress: compress all streams\n"
 	"\tcompress-fonts: compress embedded fonts\n"
 	"\tcompress-images: compress images\n"
+	"\tcompression-effort=NUMBER: 1 (fastest) to 100 (smallest), 0 for default\n"
 	"\tascii: ASCII hex encode binary streams\n"
 	"\tpretty: pretty-print objects with indentation\n"
 	"\tlinearize: optimize for web browsers\n"
@@ -3204,6 +3213,8 @@ pdf_parse_write_options(fz_context *ctx, pdf_write_options *opts, const char *ar
 		opts->do_compress_fonts = fz_option_eq(val, "yes");
 	if (fz_has_option(ctx, args, "compress-images", &val))
 		opts->do_compress_images = fz_option_eq(val, "yes");
+	if (fz_has_option(ctx, args, "compression-effort", &val))
+		opts->compression_effort = fz_clampi(fz_atoi(val), 0, 100);
 	if (fz_has_option(ctx, args, "ascii", &val))
 		opts->do_ascii = fz_option_eq(val, "yes");
 	if (fz_has_option(ctx, args, "pretty", &val))
@@ -3871,6 +3882,12 @@ pdf_format_write_options(fz_context *ctx, char *buffer, size_t buffer_len, const
 		ADD_OPT("compress-fonts=yes");
 	if (opts->do_compress_images)
 		ADD_OPT("compress-images=yes");
+	if (opts->compression_effort)
+	{
+		char effort[32];
+		fz_snprintf(effort, sizeof effort, "compression-effort=%d", opts->compression_effort);
+		ADD_OPT(effort);
+	}
 	if (opts->do_ascii)
 		ADD_OPT("ascii=yes");
 	if (opts->do_pretty)
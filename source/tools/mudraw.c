@@ -70,6 +70,7 @@ int gettimeofday(struct timeval *tv, struct timezone *tz);
 enum {
 	OUT_BBOX,
 	OUT_HTML,
+	OUT_JPEG,
 	OUT_NONE,
 	OUT_OCR_HTML,
 	OUT_OCR_PDF,
@@ -130,6 +131,8 @@ static const suffix_t suffix_table[] =
 
 	/* And the 'single extension' ones go last. */
 	{ ".png", OUT_PNG, 0 },
+	{ ".jpg", OUT_JPEG, 0 },
+	{ ".jpeg", OUT_JPEG, 0 },
 	{ ".pgm", OUT_PGM, 0 },
 	{ ".ppm", OUT_PPM, 0 },
 	{ ".pnm", OUT_PNM, 0 },
@@ -191,6 +194,7 @@ typedef struct
 static const format_cs_table_t format_cs_table[] =
 {
 	{ OUT_PNG, CS_RGB, { CS_GRAY, CS_GRAY_ALPHA, CS_RGB, CS_RGB_ALPHA, CS_ICC } },
+	{ OUT_JPEG, CS_RGB, { CS_GRAY, CS_RGB, CS_ICC } },
 	{ OUT_PPM, CS_RGB, { CS_GRAY, CS_RGB } },
 	{ OUT_PNM, CS_GRAY, { CS_GRAY, CS_RGB } },
 	{ OUT_PAM, CS_RGB_ALPHA, { CS_GRAY, CS_GRAY_ALPHA, CS_RGB, CS_RGB_ALPHA, CS_CMYK, CS_CMYK_ALPHA } },
@@ -298,7 +302,12 @@ typedef struct worker_t {
 	fz_rect tbounds;
 	fz_pixmap *pix;
 	fz_bitmap *bit;
+	fz_buffer *encoded; /* band encoded for output by the worker, if the band writer can */
 	fz_cookie cookie;
+	fz_document *doc; /* per worker document for threaded text extraction */
+	int pagenum;
+	int time;
+	fz_stext_page *text;
 #ifndef DISABLE_MUTHREADS
 	mu_semaphore start;
 	mu_semaphore stop;
@@ -313,6 +322,7 @@ static int output_file_per_page = 0;
 
 static char *format = NULL;
 static int output_format = OUT_NONE;
+static char *jpeg_options = NULL;
 
 static float rotation = 0;
 static float resolution = 72;
@@ -367,6 +377,7 @@ static char *filename;
 static int files = 0;
 static int num_workers = 0;
 static worker_t *workers;
+static int threaded_text = 0;
 static fz_band_writer *bander = NULL;
 
 static const char *layer_config = NULL;
@@ -414,7 +425,7 @@ static int usage(void)
 		"\n"
 		"\t-o -\toutput file name (%%d for page number)\n"
 		"\t-F -\toutput format (default inferred from output file name)\n"
-		"\t\traster: png, pnm, pam, pbm, pkm, pwg, pcl, ps\n"
+		"\t\traster: png, jpeg, pnm, pam, pbm, pkm, pwg, pcl, ps\n"
 		"\t\tvector: svg, pdf, trace, ocr.trace\n"
 		"\t\ttext: txt, html, xhtml, stext, stext.json\n"
 #ifndef OCR_DISABLED
@@ -423,6 +434,7 @@ static int usage(void)
 		"\t\tocr'd text: ocr.txt, ocr.html, ocr.xhtml, ocr.stext, ocr.stext.json (disabled)\n"
 #endif
 		"\t\tbitmap-wrapped-as-pdf: pclm, ocr.pdf\n"
+		"\t-Q -\tjpeg options (e.g. quality=75,subsample=no)\n"
 		"\n"
 		"\t-q\tbe quiet (don't print progress messages)\n"
 		"\t-s -\tshow extra information:\n"
@@ -436,9 +448,10 @@ static int usage(void)
 		"\t-w -\twidth (in pixels) (maximum width if -r is specified)\n"
 		"\t-h -\theight (in pixels) (maximum height if -r is specified)\n"
 		"\t-f -\tfit width and/or height exactly; ignore original aspect ratio\n"
-		"\t-B -\tmaximum band_height (pXm, pcl, pclm, ocr.pdf, ps, psd and png output only)\n"
+		"\t-B -\tmaximum band_height (pXm, pcl, pclm, ocr.pdf, ps, psd, png and jpeg output only)\n"
 #ifndef DISABLE_MUTHREADS
 		"\t-T -\tnumber of threads to use for rendering (banded mode only)\n"
+		"\t\tor for text extraction (txt, html, xhtml, stext, stext.json)\n"
 #else
 		"\t-T -\tnumber of threads to use for rendering (disabled in this non-threading build)\n"
 #endif
@@ -582,6 +595,90 @@ file_level_trailers(fz_context *ctx)
 		fz_drop_band_writer(ctx, bander);
 }
 
+static void get_stext_options(fz_stext_options *stext_options)
+{
+	stext_options->flags = (output_format == OUT_HTML ||
+				output_format == OUT_XHTML ||
+				output_format == OUT_OCR_HTML ||
+				output_format == OUT_OCR_XHTML
+				) ? FZ_STEXT_PRESERVE_IMAGES : 0;
+	stext_options->flags |= FZ_STEXT_MEDIABOX_CLIP;
+	if (output_format == OUT_STEXT_JSON || output_format == OUT_OCR_STEXT_JSON)
+		stext_options->flags |= FZ_STEXT_PRESERVE_SPANS;
+}
+
+static void print_stext_page(fz_context *ctx, fz_stext_page *text, int pagenum)
+{
+	if (output_format == OUT_STEXT_XML || output_format == OUT_OCR_STEXT_XML)
+	{
+		fz_print_stext_page_as_xml(ctx, out, text, pagenum);
+	}
+	else if (output_format == OUT_STEXT_JSON || output_format == OUT_OCR_STEXT_JSON)
+	{
+		static int first = 1;
+		if (first)
+			first = 0;
+		else
+			fz_write_string(ctx, out, ",");
+		fz_print_stext_page_as_json(ctx, out, text, 1);
+	}
+	else if (output_format == OUT_HTML || output_format == OUT_OCR_HTML)
+	{
+		fz_print_stext_page_as_html(ctx, out, text, pagenum);
+	}
+	else if (output_format == OUT_XHTML || output_format == OUT_OCR_XHTML)
+	{
+		fz_print_stext_page_as_xhtml(ctx, out, text, pagenum);
+	}
+	else if (output_format == OUT_TEXT || output_format == OUT_OCR_TEXT)
+	{
+		fz_print_stext_page_as_text(ctx, out, text);
+		fz_write_printf(ctx, out, "\f\n");
+	}
+}
+
+/* Run a page of a worker's own document straight into a structured
+ * text page; used for threaded text extraction. */
+static fz_stext_page *extracttext(fz_context *ctx, fz_document *doc, int pagenum, fz_cookie *cookie)
+{
+	fz_stext_page *text = NULL;
+	fz_device *dev = NULL;
+	fz_page *page;
+	fz_stext_options stext_options;
+	float zoom;
+	fz_matrix ctm;
+
+	fz_var(text);
+	fz_var(dev);
+
+	zoom = resolution / 72;
+	ctm = fz_pre_scale(fz_rotate(rotation), zoom, zoom);
+	get_stext_options(&stext_options);
+
+	page = fz_load_page(ctx, doc, pagenum - 1);
+	fz_try(ctx)
+	{
+		text = fz_new_stext_page(ctx, fz_bound_page(ctx, page));
+		dev = fz_new_stext_device(ctx, text, &stext_options);
+		if (lowmemory)
+			fz_enable_device_hints(ctx, dev, FZ_NO_CACHE);
+		fz_run_page(ctx, page, dev, ctm, cookie);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_page(ctx, page);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_stext_page(ctx, text);
+		fz_rethrow(ctx);
+	}
+
+	return text;
+}
+
 static void drawband(fz_context *ctx, fz_page *page, fz_display_list *list, fz_matrix ctm, fz_rect tbounds, fz_cookie *cookie, int band_start, fz_pixmap *pix, fz_bitmap **bit)
 {
 	fz_device *dev = NULL;
@@ -754,14 +851,7 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 		{
 			fz_stext_options stext_options;
 
-			stext_options.flags = (output_format == OUT_HTML ||
-						output_format == OUT_XHTML ||
-						output_format == OUT_OCR_HTML ||
-						output_format == OUT_OCR_XHTML
-						) ? FZ_STEXT_PRESERVE_IMAGES : 0;
-			stext_options.flags |= FZ_STEXT_MEDIABOX_CLIP;
-			if (output_format == OUT_STEXT_JSON || output_format == OUT_OCR_STEXT_JSON)
-				stext_options.flags |= FZ_STEXT_PRESERVE_SPANS;
+			get_stext_options(&stext_options);
 			text = fz_new_stext_page(ctx, mediabox);
 			dev = fz_new_stext_device(ctx, text, &stext_options);
 			if (lowmemory)
@@ -786,32 +876,7 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 			fz_close_device(ctx, pre_ocr_dev);
 			fz_drop_device(ctx, pre_ocr_dev);
 			pre_ocr_dev = NULL;
-			if (output_format == OUT_STEXT_XML || output_format == OUT_OCR_STEXT_XML)
-			{
-				fz_print_stext_page_as_xml(ctx, out, text, pagenum);
-			}
-			else if (output_format == OUT_STEXT_JSON || output_format == OUT_OCR_STEXT_JSON)
-			{
-				static int first = 1;
-				if (first)
-					first = 0;
-				else
-					fz_write_string(ctx, out, ",");
-				fz_print_stext_page_as_json(ctx, out, text, 1);
-			}
-			else if (output_format == OUT_HTML || output_format == OUT_OCR_HTML)
-			{
-				fz_print_stext_page_as_html(ctx, out, text, pagenum);
-			}
-			else if (output_format == OUT_XHTML || output_format == OUT_OCR_XHTML)
-			{
-				fz_print_stext_page_as_xhtml(ctx, out, text, pagenum);
-			}
-			else if (output_format == OUT_TEXT || output_format == OUT_OCR_TEXT)
-			{
-				fz_print_stext_page_as_text(ctx, out, text);
-				fz_write_printf(ctx, out, "\f\n");
-			}
+			print_stext_page(ctx, text, pagenum);
 		}
 		fz_always(ctx)
 		{
@@ -917,10 +982,12 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 		fz_pixmap *pix = NULL;
 		int w, h;
 		fz_bitmap *bit = NULL;
+		fz_buffer *encoded = NULL;
 
 		fz_var(pix);
 		fz_var(bander);
 		fz_var(bit);
+		fz_var(encoded);
 
 		zoom = resolution / 72;
 		ctm = fz_pre_scale(fz_rotate(rotation), zoom, zoom);
@@ -1011,11 +1078,6 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 					workers[band].list = list;
 					workers[band].pix = fz_new_pixmap_with_bbox(ctx, colorspace, band_ibounds, seps, alpha);
 					fz_set_pixmap_resolution(ctx, workers[band].pix, resolution, resolution);
-					workers[band].running = 1;
-#ifndef DISABLE_MUTHREADS
-					DEBUG_THREADS(("Worker %d, Pre-triggering band %d\n", band, band));
-					mu_trigger_semaphore(&workers[band].start);
-#endif
 					ctm.f -= drawheight;
 				}
 				pix = workers[0].pix;
@@ -1035,6 +1097,12 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 					bander = fz_new_pam_band_writer(ctx, out);
 				else if (output_format == OUT_PNG)
 					bander = fz_new_png_band_writer(ctx, out);
+				else if (output_format == OUT_JPEG)
+				{
+					fz_jpeg_options opts;
+					fz_parse_jpeg_options(ctx, &opts, jpeg_options);
+					bander = fz_new_jpeg_band_writer(ctx, out, &opts);
+				}
 				else if (output_format == OUT_PBM)
 					bander = fz_new_pbm_band_writer(ctx, out);
 				else if (output_format == OUT_PKM)
@@ -1063,6 +1131,20 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 				}
 			}
 
+			/* Start the workers once the header is written, so that
+			 * they can encode their bands for output too. */
+			if (num_workers > 0)
+			{
+				for (band = 0; band < fz_mini(num_workers, bands); band++)
+				{
+					workers[band].running = 1;
+#ifndef DISABLE_MUTHREADS
+					DEBUG_THREADS(("Worker %d, Pre-triggering band %d\n", band, band));
+					mu_trigger_semaphore(&workers[band].start);
+#endif
+				}
+			}
+
 			for (band = 0; band < bands; band++)
 			{
 				if (num_workers > 0)
@@ -1077,6 +1159,8 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 					pix = w->pix;
 					bit = w->bit;
 					w->bit = NULL;
+					encoded = w->encoded;
+					w->encoded = NULL;
 
 					if (w->error)
 						fz_throw(ctx, FZ_ERROR_GENERIC, "worker %d failed to render band %d", w->num, band);
@@ -1086,10 +1170,14 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 
 				if (output)
 				{
-					if (bander && (pix || bit))
+					if (bander && encoded)
+						fz_write_encoded_band(ctx, bander, drawheight, encoded);
+					else if (bander && (pix || bit))
 						fz_write_band(ctx, bander, bit ? bit->stride : pix->stride, drawheight, bit ? bit->samples : pix->samples);
 					fz_drop_bitmap(ctx, bit);
 					bit = NULL;
+					fz_drop_buffer(ctx, encoded);
+					encoded = NULL;
 				}
 
 				if (num_workers > 0 && band + num_workers < bands)
@@ -1122,17 +1210,10 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 		}
 		fz_always(ctx)
 		{
-			if (output_format != OUT_PCLM && output_format != OUT_OCR_PDF)
-			{
-				fz_drop_band_writer(ctx, bander);
-				/* bander must be set to NULL to avoid use-after-frees. A use-after-free
-				 * would occur when a valid page was followed by a page with invalid
-				 * pixmap dimensions, causing bander -- a static -- to point to previously
-				 * freed memory instead of a new band_writer. */
-				bander = NULL;
-			}
 			fz_drop_bitmap(ctx, bit);
 			bit = NULL;
+			fz_drop_buffer(ctx, encoded);
+			encoded = NULL;
 			if (num_workers > 0)
 			{
 				int i;
@@ -1151,10 +1232,23 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 						DEBUG_THREADS(("Worker %d not processing anything\n", i));
 					fz_drop_pixmap(ctx, workers[i].pix);
 					workers[i].pix = NULL;
+					fz_drop_buffer(ctx, workers[i].encoded);
+					workers[i].encoded = NULL;
 				}
 			}
 			else
 				fz_drop_pixmap(ctx, pix);
+			/* Only drop the band writer once the workers have stopped
+			 * using it. */
+			if (output_format != OUT_PCLM && output_format != OUT_OCR_PDF)
+			{
+				fz_drop_band_writer(ctx, bander);
+				/* bander must be set to NULL to avoid use-after-frees. A use-after-free
+				 * would occur when a valid page was followed by a page with invalid
+				 * pixmap dimensions, causing bander -- a static -- to point to previously
+				 * freed memory instead of a new band_writer. */
+				bander = NULL;
+			}
 		}
 		fz_catch(ctx)
 		{
@@ -1456,6 +1550,154 @@ static void drawrange(fz_context *ctx, fz_document *doc, const char *range)
 	}
 }
 
+#ifndef DISABLE_MUTHREADS
+static void wait_for_text_workers(fz_context *ctx)
+{
+	int i;
+
+	for (i = 0; i < num_workers; i++)
+	{
+		if (workers[i].running)
+		{
+			DEBUG_THREADS(("Waiting on worker %d to finish processing\n", i));
+			mu_wait_semaphore(&workers[i].stop);
+			workers[i].running = 0;
+		}
+		fz_drop_stext_page(ctx, workers[i].text);
+		workers[i].text = NULL;
+	}
+}
+
+static void start_text_worker(worker_t *w, int pagenum)
+{
+	w->pagenum = pagenum;
+	w->band = 0;
+	w->error = 0;
+	w->running = 1;
+	memset(&w->cookie, 0, sizeof(w->cookie));
+	mu_trigger_semaphore(&w->start);
+}
+
+/* Extract the pages of a range in parallel. Worker n extracts every
+ * num_workers'th page from its own copy of the document, and the pages
+ * are printed in order as they complete, just like bands are. */
+static void drawrange_threaded_text(fz_context *ctx, fz_document *doc, const char *range)
+{
+	int *pages = NULL;
+	int count = 0;
+	int page, spage, epage, pagecount;
+	int i;
+
+	fz_var(pages);
+
+	pagecount = fz_count_pages(ctx, doc);
+
+	fz_try(ctx)
+	{
+		const char *r = range;
+		while ((r = fz_parse_page_range(ctx, r, &spage, &epage, pagecount)))
+			count += fz_absi(epage - spage) + 1;
+		pages = fz_malloc_array(ctx, count, int);
+		count = 0;
+		while ((range = fz_parse_page_range(ctx, range, &spage, &epage, pagecount)))
+		{
+			if (spage < epage)
+				for (page = spage; page <= epage; page++)
+					pages[count++] = page;
+			else
+				for (page = spage; page >= epage; page--)
+					pages[count++] = page;
+		}
+
+		for (i = 0; i < fz_mini(num_workers, count); i++)
+			start_text_worker(&workers[i], pages[i]);
+
+		for (i = 0; i < count; i++)
+		{
+			worker_t *w = &workers[i % num_workers];
+			fz_stext_page *text;
+			int error;
+
+			DEBUG_THREADS(("Waiting for worker %d to complete page %d\n", w->num, pages[i]));
+			mu_wait_semaphore(&w->stop);
+			w->running = 0;
+			text = w->text;
+			w->text = NULL;
+			error = w->error;
+			if (w->cookie.errors)
+				errored = 1;
+
+			if (!quiet || showtime)
+				fprintf(stderr, "page %s %d", filename, pages[i]);
+			if (showtime)
+			{
+				if (w->time < timing.min)
+				{
+					timing.min = w->time;
+					timing.minpage = pages[i];
+					timing.minfilename = filename;
+				}
+				if (w->time > timing.max)
+				{
+					timing.max = w->time;
+					timing.maxpage = pages[i];
+					timing.maxfilename = filename;
+				}
+				timing.count ++;
+				fprintf(stderr, " %dms", w->time);
+			}
+			if (!quiet || showtime)
+				fprintf(stderr, "\n");
+
+			if (i + num_workers < count)
+				start_text_worker(w, pages[i + num_workers]);
+
+			fz_try(ctx)
+			{
+				if (error)
+					fz_throw(ctx, FZ_ERROR_GENERIC, "cannot extract text from page %d in '%s'", pages[i], filename);
+				if (output_file_per_page)
+				{
+					char text_buffer[512];
+					if (out)
+					{
+						fz_close_output(ctx, out);
+						fz_drop_output(ctx, out);
+						out = NULL;
+					}
+					fz_format_output_path(ctx, text_buffer, sizeof text_buffer, output, pages[i]);
+					out = fz_new_output_with_path(ctx, text_buffer, 0);
+					file_level_headers(ctx);
+				}
+				print_stext_page(ctx, text, pages[i]);
+				if (output_file_per_page)
+					file_level_trailers(ctx);
+			}
+			fz_always(ctx)
+				fz_drop_stext_page(ctx, text);
+			fz_catch(ctx)
+			{
+				if (ignore_errors)
+					fz_warn(ctx, "ignoring error on page %d in '%s'", pages[i], filename);
+				else
+					fz_rethrow(ctx);
+			}
+
+			if (lowmemory)
+				fz_empty_store(ctx);
+			fz_flush_warnings(ctx);
+		}
+	}
+	fz_always(ctx)
+	{
+		wait_for_text_workers(ctx);
+		fz_free(ctx, pages);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+#endif
+
 static int
 parse_colorspace(const char *name)
 {
@@ -1597,11 +1839,28 @@ static void worker_thread(void *arg)
 		mu_wait_semaphore(&me->start);
 		band = me->band;
 		DEBUG_THREADS(("Worker %d woken for band %d\n", me->num, band));
-		if (band >= 0)
+		if (band >= 0 && me->doc)
+		{
+			int start = gettime();
+			fz_try(me->ctx)
+			{
+				me->text = extracttext(me->ctx, me->doc, me->pagenum, &me->cookie);
+				DEBUG_THREADS(("Worker %d completed page %d\n", me->num, me->pagenum));
+			}
+			fz_catch(me->ctx)
+			{
+				DEBUG_THREADS(("Worker %d failed on page %d\n", me->num, me->pagenum));
+				me->error = 1;
+			}
+			me->time = gettime() - start;
+		}
+		else if (band >= 0)
 		{
 			fz_try(me->ctx)
 			{
 				drawband(me->ctx, NULL, me->list, me->ctm, me->tbounds, &me->cookie, band * band_height, me->pix, &me->bit);
+				if (bander && !me->bit)
+					me->encoded = fz_encode_band(me->ctx, bander, me->pix->stride, band * band_height, band_height, me->pix->samples);
 				DEBUG_THREADS(("Worker %d completed band %d\n", me->num, band));
 			}
 			fz_catch(me->ctx)
@@ -1665,7 +1924,7 @@ static inline int iswhite(int ch)
 		ch == '\014' || ch == '\015' || ch == '\040';
 }
 
-static void apply_layer_config(fz_context *ctx, fz_document *doc, const char *lc)
+static void apply_layer_config(fz_context *ctx, fz_document *doc, const char *lc, int report)
 {
 #if FZ_ENABLE_PDF
 	pdf_document *pdoc = pdf_specifics(ctx, doc);
@@ -1675,7 +1934,8 @@ static void apply_layer_config(fz_context *ctx, fz_document *doc, const char *lc
 
 	if (!pdoc)
 	{
-		fz_warn(ctx, "Only PDF files have layers");
+		if (report)
+			fz_warn(ctx, "Only PDF files have layers");
 		return;
 	}
 
@@ -1684,7 +1944,12 @@ static void apply_layer_config(fz_context *ctx, fz_document *doc, const char *lc
 
 	if (*lc == 0 || *lc == 'l')
 	{
-		int num_configs = pdf_count_layer_configs(ctx, pdoc);
+		int num_configs;
+
+		if (!report)
+			return;
+
+		num_configs = pdf_count_layer_configs(ctx, pdoc);
 
 		fprintf(stderr, "Layer configs:\n");
 		for (config = 0; config < num_configs; config++)
@@ -1732,6 +1997,9 @@ static void apply_layer_config(fz_context *ctx, fz_document *doc, const char *lc
 		pdf_toggle_layer_config_ui(ctx, pdoc, item);
 	}
 
+	if (!report)
+		return;
+
 	/* Now list the final state of the config */
 	fprintf(stderr, "Layer Config %d:\n", config);
 	pdf_layer_config_info(ctx, pdoc, config, &info);
@@ -1765,6 +2033,47 @@ static void apply_layer_config(fz_context *ctx, fz_document *doc, const char *lc
 #endif
 }
 
+#ifndef DISABLE_MUTHREADS
+/* Give every worker its own handle on the current document, since
+ * documents must only be used from one thread at a time. */
+static void open_worker_documents(fz_context *ctx, const char *accel, const char *password)
+{
+	int i;
+
+	for (i = 0; i < num_workers; i++)
+	{
+		fz_context *wctx = workers[i].ctx;
+		fz_try(wctx)
+		{
+			workers[i].doc = fz_open_accelerated_document(wctx, filename, accel);
+			if (fz_needs_password(wctx, workers[i].doc))
+				if (!fz_authenticate_password(wctx, workers[i].doc, password))
+					fz_throw(wctx, FZ_ERROR_GENERIC, "cannot authenticate password: %s", filename);
+			fz_layout_document(wctx, workers[i].doc, layout_w, layout_h, layout_em);
+			if (layer_config)
+				apply_layer_config(wctx, workers[i].doc, layer_config, 0);
+		}
+		fz_catch(wctx)
+		{
+			fz_drop_document(wctx, workers[i].doc);
+			workers[i].doc = NULL;
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot open '%s' for worker %d", filename, i);
+		}
+	}
+}
+
+static void drop_worker_documents(void)
+{
+	int i;
+
+	for (i = 0; i < num_workers; i++)
+	{
+		fz_drop_document(workers[i].ctx, workers[i].doc);
+		workers[i].doc = NULL;
+	}
+}
+#endif
+
 static int convert_to_accel_path(fz_context *ctx, char outname[], char *absname, size_t len)
 {
 	char *tmpdir;
@@ -1835,7 +2144,7 @@ int mudraw_main(int argc, char **argv)
 
 	fz_var(doc);
 
-	while ((c = fz_getopt(argc, argv, "qp:o:F:R:r:w:h:fB:c:e:G:Is:A:DiW:H:S:T:t:U:XLvPl:y:NO:am:")) != -1)
+	while ((c = fz_getopt(argc, argv, "qp:o:F:Q:R:r:w:h:fB:c:e:G:Is:A:DiW:H:S:T:t:U:XLvPl:y:NO:am:")) != -1)
 	{
 		switch (c)
 		{
@@ -1847,6 +2156,7 @@ int mudraw_main(int argc, char **argv)
 
 		case 'o': output = fz_optarg; break;
 		case 'F': format = fz_optarg; break;
+		case 'Q': jpeg_options = fz_optarg; break;
 
 		case 'R': rotation = fz_atof(fz_optarg); break;
 		case 'r': resolution = fz_atof(fz_optarg); res_specified = 1; break;
@@ -1941,10 +2251,6 @@ int mudraw_main(int argc, char **argv)
 			exit(1);
 		}
 
-		if (band_height == 0)
-		{
-			fprintf(stderr, "Using multiple threads without banding is pointless\n");
-		}
 	}
 
 	if (bgprint.active)
@@ -2101,6 +2407,7 @@ int mudraw_main(int argc, char **argv)
 				output_format != OUT_PPM &&
 				output_format != OUT_PNM &&
 				output_format != OUT_PNG &&
+				output_format != OUT_JPEG &&
 				output_format != OUT_PBM &&
 				output_format != OUT_PKM &&
 				output_format != OUT_PCL &&
@@ -2109,7 +2416,7 @@ int mudraw_main(int argc, char **argv)
 				output_format != OUT_PSD &&
 				output_format != OUT_OCR_PDF)
 			{
-				fprintf(stderr, "Banded operation only possible with PxM, PCL, PCLM, PDFOCR, PS, PSD, and PNG outputs\n");
+				fprintf(stderr, "Banded operation only possible with PxM, PCL, PCLM, PDFOCR, PS, PSD, PNG, and JPEG outputs\n");
 				exit(1);
 			}
 			if (showmd5)
@@ -2119,6 +2426,23 @@ int mudraw_main(int argc, char **argv)
 			}
 		}
 
+		if (num_workers > 0 && band_height == 0)
+		{
+			if (output_format == OUT_TEXT ||
+				output_format == OUT_HTML ||
+				output_format == OUT_XHTML ||
+				output_format == OUT_STEXT_XML ||
+				output_format == OUT_STEXT_JSON)
+			{
+				if (bgprint.active)
+					fprintf(stderr, "Threaded text extraction not compatible with parallel interpretation\n");
+				else
+					threaded_text = 1;
+			}
+			else
+				fprintf(stderr, "Using multiple threads without banding is pointless\n");
+		}
+
 		{
 			int i, j;
 
@@ -2291,7 +2615,7 @@ int mudraw_main(int argc, char **argv)
 		timing.maxlayout = 0;
 		timing.minlayoutfilename = "";
 		timing.maxlayoutfilename = "";
-		if (showtime && bgprint.active)
+		if (showtime && (bgprint.active || threaded_text))
 			timing.total = gettime();
 
 		fz_try(ctx)
@@ -2380,12 +2704,25 @@ int mudraw_main(int argc, char **argv)
 					}
 
 					if (layer_config)
-						apply_layer_config(ctx, doc, layer_config);
+						apply_layer_config(ctx, doc, layer_config, 1);
 
-					if (fz_optind == argc || !fz_is_page_range(ctx, argv[fz_optind]))
-						drawrange(ctx, doc, "1-N");
-					if (fz_optind < argc && fz_is_page_range(ctx, argv[fz_optind]))
-						drawrange(ctx, doc, argv[fz_optind++]);
+#ifndef DISABLE_MUTHREADS
+					if (threaded_text)
+					{
+						open_worker_documents(ctx, accel, password);
+						if (fz_optind == argc || !fz_is_page_range(ctx, argv[fz_optind]))
+							drawrange_threaded_text(ctx, doc, "1-N");
+						if (fz_optind < argc && fz_is_page_range(ctx, argv[fz_optind]))
+							drawrange_threaded_text(ctx, doc, argv[fz_optind++]);
+					}
+					else
+#endif
+					{
+						if (fz_optind == argc || !fz_is_page_range(ctx, argv[fz_optind]))
+							drawrange(ctx, doc, "1-N");
+						if (fz_optind < argc && fz_is_page_range(ctx, argv[fz_optind]))
+							drawrange(ctx, doc, argv[fz_optind++]);
+					}
 
 					bgprint_flush();
 					if (bgprint.error)
@@ -2396,6 +2733,10 @@ int mudraw_main(int argc, char **argv)
 				}
 				fz_always(ctx)
 				{
+#ifndef DISABLE_MUTHREADS
+					if (threaded_text)
+						drop_worker_documents();
+#endif
 					fz_drop_document(ctx, doc);
 					doc = NULL;
 				}
@@ -2438,7 +2779,7 @@ int mudraw_main(int argc, char **argv)
 
 		if (showtime && timing.count > 0)
 		{
-			if (bgprint.active)
+			if (bgprint.active || threaded_text)
 				timing.total = gettime() - timing.total;
 
 			if (files == 1)
@@ -2467,6 +2808,8 @@ int mudraw_main(int argc, char **argv)
 				fprintf(stderr, "fastest page %d: %dms (%s)\n", timing.minpage, timing.min, timing.minfilename);
 				fprintf(stderr, "slowest page %d: %dms (%s)\n", timing.maxpage, timing.max, timing.maxfilename);
 			}
+			if (timing.total > 0)
+				fprintf(stderr, "throughput %.2f pages/s\n", timing.count * 1000.0f / timing.total);
 		}
 
 #ifndef DISABLE_MUTHREADS